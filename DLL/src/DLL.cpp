@@ -3,6 +3,519 @@
 * Oleg Gavrilchenko
 * reffum@bk.ru
 **/
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "Master.h"
+#include "Tcp.h"
+#include "Serial.h"
+#include "AsciiFdu.h"
+#include "Pdu.h"
+#include "mb_exceptions.h"
+#include "ModbusMaster.h"
 
 using namespace Modbus;
+using namespace std;
+
+struct mb_master
+{
+	unique_ptr<Master> master;
+
+	/**
+	 * Same object as master, if it is MODBUS/TCP.
+	 **/
+	TcpMaster* tcp;
+	string error;
+};
+
+/**
+ * v120 toolset has no thread_local, so error of mb_open_* is kept in
+ * fixed buffer of compiler thread storage.
+ **/
+#ifdef _MSC_VER
+#define MB_THREAD_LOCAL __declspec(thread)
+#else
+#define MB_THREAD_LOCAL __thread
+#endif
+
+static const size_t OpenErrorSize = 256;
+static MB_THREAD_LOCAL char openError[OpenErrorSize];
+
+/**
+ * Convert current exception to return code and keep its message.
+ **/
+static int exception_status(string& message)
+{
+	try
+	{
+		throw;
+	}
+	catch (const EException& e)
+	{
+		message = e.what();
+		return e.GetExceptionCode();
+	}
+	catch (const ETimeout& e)
+	{
+		message = e.what();
+		return MB_ERR_TIMEOUT;
+	}
+	catch (const EPDUFrameError& e)
+	{
+		message = e.what();
+		return MB_ERR_FRAME;
+	}
+	catch (const logic_error& e)
+	{
+		message = e.what();
+		return MB_ERR_ARGUMENT;
+	}
+	catch (const exception& e)
+	{
+		message = e.what();
+		return MB_ERR_TRANSPORT;
+	}
+	catch (...)
+	{
+		message = "Unknown error";
+		return MB_ERR_TRANSPORT;
+	}
+}
+
+/**
+ * Keep message of current exception as error of mb_open_*.
+ **/
+static void set_open_error()
+{
+	string message;
+	exception_status(message);
+
+	const size_t size = min(message.size(), OpenErrorSize - 1);
+	memcpy(openError, message.data(), size);
+	openError[size] = 0;
+}
+
+static SerialPort::Settings serial_settings(unsigned baudRate, int parity, unsigned stopBits)
+{
+	SerialPort::Settings settings;
+	settings.baudRate = baudRate;
+	settings.stopBits = stopBits;
+
+	switch (parity)
+	{
+	case MB_PARITY_NONE:
+		settings.parity = SerialPort::Parity::None;
+		break;
+	case MB_PARITY_EVEN:
+		settings.parity = SerialPort::Parity::Even;
+		break;
+	case MB_PARITY_ODD:
+		settings.parity = SerialPort::Parity::Odd;
+		break;
+	default:
+		throw invalid_argument("Invalid parity.");
+	}
+
+	return settings;
+}
+
+/**
+ * Batch requests are encoded and their responces are checked and decoded
+ * by PDU codec of Master.
+ **/
+static bool valid_request(const mb_request& request, size_t size)
+{
+	switch (request.function)
+	{
+	case 0x01:
+	case 0x02:
+	case 0x03:
+	case 0x04:
+	case 0x0F:
+	case 0x10:
+		break;
+	case 0x05:
+	case 0x06:
+		if (request.quantity != 1)
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	return request.unit != Master::IDBroadcast &&
+		request.offset <= size && request.quantity <= size - request.offset;
+}
+
+/**
+ * Exceptions:	invalid_argument if quantity is out of range.
+ **/
+static void encode_request(const mb_request& request, const uint16_t* values, vector<uint8_t>& pdu)
+{
+	uint8_t buffer[Master::PDU_MAX_SIZE];
+	size_t size;
+
+	switch (request.function)
+	{
+	case 0x05:
+		size = Pdu::EncodeWriteSingleCoil(buffer, request.address, values[0] != 0);
+		break;
+	case 0x06:
+		size = Pdu::EncodeWriteSingleRegister(buffer, request.address, values[0]);
+		break;
+	case 0x0F:
+		size = Pdu::EncodeWriteMultipleCoils(buffer, request.address, values, request.quantity);
+		break;
+	case 0x10:
+		size = Pdu::EncodeWriteMultipleRegisters(buffer, request.address, values, request.quantity);
+		break;
+	default:
+		size = Pdu::EncodeRead(buffer, (Master::FunctionCodes)request.function, request.address, request.quantity);
+		break;
+	}
+
+	pdu.assign(buffer, buffer + size);
+}
+
+/**
+ * Return:	return code of request. Read values are stored to values.
+ **/
+static int decode_responce(const mb_request& request, const vector<uint8_t>& pdu, const vector<uint8_t>& responce,
+	uint16_t* values, string& message)
+{
+	try
+	{
+		switch (request.function)
+		{
+		case 0x01:
+		case 0x02:
+			Pdu::DecodeBits(pdu.data(), pdu.size(), responce.data(), responce.size(), request.quantity, values);
+			break;
+		case 0x03:
+		case 0x04:
+			Pdu::DecodeRegisters(pdu.data(), pdu.size(), responce.data(), responce.size(), request.quantity, values);
+			break;
+		default:
+			Pdu::CheckResponce(pdu, responce);
+			break;
+		}
+	}
+	catch (...)
+	{
+		return exception_status(message);
+	}
+
+	return MB_OK;
+}
+
+extern "C"
+{
+	MB_API int MB_CALL mb_api_version(void)
+	{
+		return MB_API_VERSION;
+	}
+
+	MB_API mb_master* MB_CALL mb_open_tcp(const char* host, uint16_t port, unsigned timeout)
+	{
+		try
+		{
+			unique_ptr<mb_master> m(new mb_master());
+			TcpMaster* tcp = new TcpMaster(host, port, timeout);
+			m->master.reset(tcp);
+			m->tcp = tcp;
+			return m.release();
+		}
+		catch (...)
+		{
+			set_open_error();
+			return NULL;
+		}
+	}
+
+	MB_API mb_master* MB_CALL mb_open_rtu(const char* device, unsigned baudRate, int parity, unsigned stopBits,
+		unsigned timeout)
+	{
+		try
+		{
+			unique_ptr<mb_master> m(new mb_master());
+			RtuMaster* rtu = new RtuMaster(device, serial_settings(baudRate, parity, stopBits));
+			m->master.reset(rtu);
+			m->tcp = NULL;
+			rtu->SetTimeout(timeout);
+			return m.release();
+		}
+		catch (...)
+		{
+			set_open_error();
+			return NULL;
+		}
+	}
+
+	MB_API mb_master* MB_CALL mb_open_ascii(const char* device, unsigned baudRate, int parity, unsigned stopBits,
+		unsigned timeout)
+	{
+		try
+		{
+			unique_ptr<mb_master> m(new mb_master());
+			AsciiMaster* ascii = new AsciiMaster(device, serial_settings(baudRate, parity, stopBits));
+			m->master.reset(ascii);
+			m->tcp = NULL;
+			ascii->SetTimeout(timeout);
+			return m.release();
+		}
+		catch (...)
+		{
+			set_open_error();
+			return NULL;
+		}
+	}
+
+	MB_API void MB_CALL mb_close(mb_master* master)
+	{
+		delete master;
+	}
+
+	MB_API const char* MB_CALL mb_open_error(void)
+	{
+		return openError;
+	}
+
+	MB_API const char* MB_CALL mb_last_error(mb_master* master)
+	{
+		return master == NULL ? "" : master->error.c_str();
+	}
+
+	MB_API int MB_CALL mb_set_pipeline_depth(mb_master* master, unsigned depth)
+	{
+		if (master == NULL || depth == 0)
+			return MB_ERR_ARGUMENT;
+
+		if (master->tcp == NULL)
+			return depth == 1 ? MB_OK : MB_ERR_UNSUPPORTED;
+
+		master->tcp->SetPipelineDepth(depth);
+		return MB_OK;
+	}
+
+	MB_API int MB_CALL mb_read_coils(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+		uint8_t* values)
+	{
+		if (master == NULL || values == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			vector<bool> coils = master->master->ReadCoils(unit, address, quantity);
+			if (coils.size() < quantity)
+				return MB_ERR_FRAME;
+
+			for (unsigned i = 0; i < quantity; i++)
+				values[i] = coils[i] ? 1 : 0;
+
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_read_discrete_inputs(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+		uint8_t* values)
+	{
+		if (master == NULL || values == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			vector<bool> inputs = master->master->ReadDiscreteInputs(unit, address, quantity);
+			if (inputs.size() < quantity)
+				return MB_ERR_FRAME;
+
+			for (unsigned i = 0; i < quantity; i++)
+				values[i] = inputs[i] ? 1 : 0;
+
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_read_holding_registers(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+		uint16_t* values)
+	{
+		if (master == NULL || values == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			vector<uint16_t> registers = master->master->ReadHoldingRegisters(unit, address, quantity);
+			copy(registers.cbegin(), registers.cend(), values);
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_read_input_registers(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+		uint16_t* values)
+	{
+		if (master == NULL || values == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			vector<uint16_t> registers = master->master->ReadInputRegisters(unit, address, quantity);
+			copy(registers.cbegin(), registers.cend(), values);
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_write_single_coil(mb_master* master, uint8_t unit, uint16_t address, int value)
+	{
+		if (master == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			master->master->WriteSingleCoil(unit, address, value != 0);
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_write_single_register(mb_master* master, uint8_t unit, uint16_t address, uint16_t value)
+	{
+		if (master == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			master->master->WriteSingleRegister(unit, address, value);
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_write_multiple_coils(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+		const uint8_t* values)
+	{
+		if (master == NULL || values == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			vector<bool> coils(values, values + quantity);
+			master->master->WriteMultipleCoils(unit, address, coils);
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_write_multiple_registers(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+		const uint16_t* values)
+	{
+		if (master == NULL || values == NULL)
+			return MB_ERR_ARGUMENT;
+
+		try
+		{
+			vector<uint16_t> registers(values, values + quantity);
+			master->master->WriteMultipleRegisters(unit, address, registers);
+			return MB_OK;
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+	}
+
+	MB_API int MB_CALL mb_execute_batch(mb_master* master, const mb_request* requests, size_t count,
+		uint16_t* data, size_t size, int* status)
+	{
+		if (master == NULL || (count != 0 && (requests == NULL || status == NULL)) || (size != 0 && data == NULL))
+			return MB_ERR_ARGUMENT;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!valid_request(requests[i], size))
+			{
+				master->error = "Invalid request " + to_string(i);
+				return MB_ERR_ARGUMENT;
+			}
+		}
+
+		vector<Master::Transaction> transactions(count);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			transactions[i].id = requests[i].unit;
+
+			try
+			{
+				encode_request(requests[i], data + requests[i].offset, transactions[i].request);
+			}
+			catch (const exception& e)
+			{
+				master->error = "Invalid request " + to_string(i) + ": " + e.what();
+				return MB_ERR_ARGUMENT;
+			}
+		}
+
+		try
+		{
+			master->master->TransactMany(transactions);
+		}
+		catch (...)
+		{
+			return exception_status(master->error);
+		}
+
+		int failed = 0;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if (transactions[i].error)
+			{
+				try
+				{
+					rethrow_exception(transactions[i].error);
+				}
+				catch (...)
+				{
+					status[i] = exception_status(master->error);
+				}
+			}
+			else
+			{
+				status[i] = decode_responce(requests[i], transactions[i].request, transactions[i].responce,
+					data + requests[i].offset, master->error);
+			}
+
+			if (status[i] != MB_OK)
+				failed++;
+		}
+
+		return failed;
+	}
+}
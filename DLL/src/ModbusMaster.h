@@ -0,0 +1,132 @@
+/**
+ * Description: C interface of Modbus Master library. It is exported from
+ *				DLL(Windows) or shared object(Linux) and is intended for
+ *				use from C and managed runtimes(ctypes, P/Invoke).
+ *				Functions of one handle must not be called concurrently.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _MODBUS_MASTER_H_
+#define _MODBUS_MASTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifdef DLL_EXPORTS
+#define MB_API __declspec(dllexport)
+#else
+#define MB_API __declspec(dllimport)
+#endif
+#define MB_CALL __cdecl
+#else
+#define MB_API __attribute__((visibility("default")))
+#define MB_CALL
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Interface version. It is changed only when existing function or
+ * structure is changed.
+ **/
+#define MB_API_VERSION 1
+
+/**
+ * Return codes. Positive codes are MODBUS exception codes from device.
+ **/
+#define MB_OK				0
+#define MB_ERR_ARGUMENT		(-1)
+#define MB_ERR_TIMEOUT		(-2)
+#define MB_ERR_FRAME		(-3)
+#define MB_ERR_TRANSPORT	(-4)
+#define MB_ERR_UNSUPPORTED	(-5)
+
+/**
+ * Serial parity
+ **/
+#define MB_PARITY_NONE		0
+#define MB_PARITY_EVEN		1
+#define MB_PARITY_ODD		2
+
+typedef struct mb_master mb_master;
+
+/**
+ * Batch request. Function is one of 0x01-0x06, 0x0F, 0x10. Values of
+ * request are data[offset]..data[offset + quantity - 1] of batch data
+ * buffer: registers, or coils and inputs as 0/1. Read requests fill
+ * them, write requests take values from them. Quantity of 0x05 and 0x06
+ * is 1.
+ **/
+typedef struct mb_request
+{
+	uint8_t unit;
+	uint8_t function;
+	uint16_t address;
+	uint16_t quantity;
+	uint16_t reserved;
+	uint32_t offset;
+} mb_request;
+
+MB_API int MB_CALL mb_api_version(void);
+
+/**
+ * Open master. Return NULL on failure, mb_open_error() describes it.
+ * timeout:	responce timeout, ms
+ **/
+MB_API mb_master* MB_CALL mb_open_tcp(const char* host, uint16_t port, unsigned timeout);
+MB_API mb_master* MB_CALL mb_open_rtu(const char* device, unsigned baudRate, int parity, unsigned stopBits,
+	unsigned timeout);
+MB_API mb_master* MB_CALL mb_open_ascii(const char* device, unsigned baudRate, int parity, unsigned stopBits,
+	unsigned timeout);
+MB_API void MB_CALL mb_close(mb_master* master);
+
+/**
+ * Error message of last failed mb_open_* of calling thread, or of last
+ * failed call of master.
+ **/
+MB_API const char* MB_CALL mb_open_error(void);
+MB_API const char* MB_CALL mb_last_error(mb_master* master);
+
+/**
+ * Number of requests sent without waiting responce by mb_execute_batch.
+ * Only MODBUS/TCP supports depth more than 1.
+ **/
+MB_API int MB_CALL mb_set_pipeline_depth(mb_master* master, unsigned depth);
+
+/**
+ * Single requests. Coils and inputs are one byte(0/1) per bit.
+ **/
+MB_API int MB_CALL mb_read_coils(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+	uint8_t* values);
+MB_API int MB_CALL mb_read_discrete_inputs(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+	uint8_t* values);
+MB_API int MB_CALL mb_read_holding_registers(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+	uint16_t* values);
+MB_API int MB_CALL mb_read_input_registers(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+	uint16_t* values);
+MB_API int MB_CALL mb_write_single_coil(mb_master* master, uint8_t unit, uint16_t address, int value);
+MB_API int MB_CALL mb_write_single_register(mb_master* master, uint8_t unit, uint16_t address, uint16_t value);
+MB_API int MB_CALL mb_write_multiple_coils(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+	const uint8_t* values);
+MB_API int MB_CALL mb_write_multiple_registers(mb_master* master, uint8_t unit, uint16_t address, uint16_t quantity,
+	const uint16_t* values);
+
+/**
+ * Execute batch of requests in one call. Requests are pipelined where
+ * transport supports it.
+ * data:		values buffer of size elements
+ * status:		return code of each request
+ * Return:		number of failed requests, or MB_ERR_ARGUMENT if any request
+ *				is invalid or does not fit into data(nothing is sent).
+ **/
+MB_API int MB_CALL mb_execute_batch(mb_master* master, const mb_request* requests, size_t count,
+	uint16_t* data, size_t size, int* status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _MODBUS_MASTER_H_ */
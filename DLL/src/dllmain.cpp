@@ -1,4 +1,5 @@
 // dllmain.cpp : Defines the entry point for the DLL application.
+#ifdef _WIN32
 #include <Windows.h>
 
 BOOL APIENTRY DllMain( HMODULE hModule,
@@ -16,3 +17,4 @@ BOOL APIENTRY DllMain( HMODULE hModule,
 	}
 	return TRUE;
 }
+#endif
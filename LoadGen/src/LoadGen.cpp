@@ -0,0 +1,489 @@
+/**
+* MODBUS load generator. Drive N connections or serial lines at target
+* request rate or at maximum throughput and report achieved transactions
+* per second and latency percentiles.
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AsciiFdu.h"
+#include "Master.h"
+#include "mb_exceptions.h"
+#include "Serial.h"
+#include "Slave.h"
+#include "Tcp.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace Modbus;
+
+/**
+ * One kind of request in load mix.
+ **/
+struct MixEntry
+{
+	unsigned funcCode;
+	unsigned quantity;
+	unsigned weight;
+};
+
+/**
+ * Load generator options
+ **/
+struct Options
+{
+	vector<string> tcpTargets;
+	vector<string> rtuTargets;
+	vector<string> asciiTargets;
+	bool simulated;
+	unsigned simulatedLatency;
+	unsigned connections;
+	double rate;
+	double duration;
+	uint8_t unit;
+	uint16_t address;
+	unsigned timeout;
+	vector<MixEntry> mix;
+
+	Options() : simulated(false), simulatedLatency(0), connections(1), rate(0),
+		duration(10), unit(1), address(0), timeout(1000)
+	{
+	}
+};
+
+/**
+ * Per worker statistic
+ **/
+struct WorkerStat
+{
+	vector<uint32_t> latencies;
+	uint64_t timeouts;
+	uint64_t exceptions;
+	uint64_t errors;
+
+	WorkerStat() : timeouts(0), exceptions(0), errors(0)
+	{
+	}
+};
+
+typedef function<unique_ptr<Master>()> MasterFactory;
+
+static void usage()
+{
+	cerr <<
+		"Usage: LoadGen [options]\n"
+		"Targets(one or more):\n"
+		"  --tcp HOST[:PORT]              MODBUS/TCP slave or gateway\n"
+		"  --rtu DEVICE[:BAUD[:PARITY]]   RTU serial line, may be repeated. PARITY is N, E or O\n"
+		"  --ascii DEVICE[:BAUD[:PARITY]] ASCII serial line, may be repeated\n"
+		"  --sim [LATENCY_US]             in-process simulated slave\n"
+		"Options:\n"
+		"  -c N     connections per TCP target or simulated slave(default 1)\n"
+		"  -r N     total target rate, requests/s(default 0 - maximum throughput)\n"
+		"  -d S     test duration, s(default 10)\n"
+		"  -u ID    unit ID(default 1)\n"
+		"  -a ADDR  start address(default 0)\n"
+		"  -t MS    responce timeout, ms(default 1000)\n"
+		"  -m MIX   request mix FC:QUANTITY[:WEIGHT],...(default 3:125)\n"
+		"           supported functions: 1, 2, 3, 4, 5, 6, 15, 16\n";
+}
+
+static vector<string> split(const string& s, char delim)
+{
+	vector<string> parts;
+	stringstream ss(s);
+	string item;
+
+	while (getline(ss, item, delim))
+		parts.push_back(item);
+
+	return parts;
+}
+
+/**
+ * Parse request mix specification.
+ **/
+static vector<MixEntry> parse_mix(const string& spec)
+{
+	vector<MixEntry> mix;
+
+	for (const string& item : split(spec, ','))
+	{
+		vector<string> fields = split(item, ':');
+		if (fields.size() < 2 || fields.size() > 3)
+			throw invalid_argument("Invalid mix entry " + item);
+
+		MixEntry e;
+		e.funcCode = stoul(fields[0]);
+		e.quantity = stoul(fields[1]);
+		e.weight = fields.size() == 3 ? stoul(fields[2]) : 1;
+
+		switch (e.funcCode)
+		{
+		case 1: case 2: case 3: case 4: case 5: case 6: case 15: case 16:
+			break;
+		default:
+			throw invalid_argument("Unsupported function in mix: " + fields[0]);
+		}
+
+		mix.push_back(e);
+	}
+
+	return mix;
+}
+
+static Options parse_options(int argc, char* argv[])
+{
+	Options opt;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--tcp" && hasValue)
+			opt.tcpTargets.push_back(argv[++i]);
+		else if (arg == "--rtu" && hasValue)
+			opt.rtuTargets.push_back(argv[++i]);
+		else if (arg == "--ascii" && hasValue)
+			opt.asciiTargets.push_back(argv[++i]);
+		else if (arg == "--sim")
+		{
+			opt.simulated = true;
+			if (hasValue && argv[i + 1][0] != '-')
+				opt.simulatedLatency = stoul(argv[++i]);
+		}
+		else if (arg == "-c" && hasValue)
+			opt.connections = stoul(argv[++i]);
+		else if (arg == "-r" && hasValue)
+			opt.rate = stod(argv[++i]);
+		else if (arg == "-d" && hasValue)
+			opt.duration = stod(argv[++i]);
+		else if (arg == "-u" && hasValue)
+			opt.unit = (uint8_t)stoul(argv[++i]);
+		else if (arg == "-a" && hasValue)
+			opt.address = (uint16_t)stoul(argv[++i]);
+		else if (arg == "-t" && hasValue)
+			opt.timeout = stoul(argv[++i]);
+		else if (arg == "-m" && hasValue)
+			opt.mix = parse_mix(argv[++i]);
+		else
+			throw invalid_argument("Unknown option " + arg);
+	}
+
+	if (opt.mix.empty())
+		opt.mix = parse_mix("3:125");
+
+	if (opt.connections < 1)
+		throw invalid_argument("Connections number must be positive");
+
+	return opt;
+}
+
+/**
+ * Parse serial line specification DEVICE[:BAUD[:PARITY]].
+ **/
+static SerialPort::Settings parse_serial(const string& target, string& device)
+{
+	vector<string> fields = split(target, ':');
+	SerialPort::Settings settings;
+
+	device = fields[0];
+
+	if (fields.size() > 1)
+		settings.baudRate = stoul(fields[1]);
+
+	if (fields.size() > 2)
+	{
+		const char p = fields[2].empty() ? 'E' : (char)toupper(fields[2][0]);
+		settings.parity = p == 'N' ? SerialPort::Parity::None :
+			p == 'O' ? SerialPort::Parity::Odd : SerialPort::Parity::Even;
+		settings.stopBits = settings.parity == SerialPort::Parity::None ? 2 : 1;
+	}
+
+	return settings;
+}
+
+/**
+ * Create master factories, one for each worker.
+ **/
+static vector<MasterFactory> make_factories(const Options& opt, Slave& slave)
+{
+	vector<MasterFactory> factories;
+	const unsigned timeout = opt.timeout;
+
+	for (const string& target : opt.tcpTargets)
+	{
+		vector<string> fields = split(target, ':');
+		const string host = fields[0];
+		const uint16_t port = fields.size() > 1 ? (uint16_t)stoul(fields[1]) : TcpMaster::DefaultPort;
+
+		for (unsigned c = 0; c < opt.connections; c++)
+		{
+			factories.push_back([host, port, timeout]()
+			{
+				unique_ptr<TcpMaster> m(new TcpMaster(host, port));
+				m->SetTimeout(timeout);
+				return unique_ptr<Master>(move(m));
+			});
+		}
+	}
+
+	for (const string& target : opt.rtuTargets)
+	{
+		string device;
+		SerialPort::Settings settings = parse_serial(target, device);
+
+		/**
+		 * Serial line is half-duplex, so only one master per line.
+		 **/
+		factories.push_back([device, settings, timeout]()
+		{
+			unique_ptr<RtuMaster> m(new RtuMaster(device, settings));
+			m->SetTimeout(timeout);
+			return unique_ptr<Master>(move(m));
+		});
+	}
+
+	for (const string& target : opt.asciiTargets)
+	{
+		string device;
+		SerialPort::Settings settings = parse_serial(target, device);
+
+		factories.push_back([device, settings, timeout]()
+		{
+			unique_ptr<AsciiMaster> m(new AsciiMaster(device, settings));
+			m->SetTimeout(timeout);
+			return unique_ptr<Master>(move(m));
+		});
+	}
+
+	if (opt.simulated)
+	{
+		Slave* s = &slave;
+		const unsigned latency = opt.simulatedLatency;
+
+		for (unsigned c = 0; c < opt.connections; c++)
+		{
+			factories.push_back([s, latency]()
+			{
+				return unique_ptr<Master>(new LoopbackMaster(*s, latency));
+			});
+		}
+	}
+
+	return factories;
+}
+
+/**
+ * Execute one request of mix.
+ **/
+static void execute(Master& master, const Options& opt, const MixEntry& e)
+{
+	switch (e.funcCode)
+	{
+	case 1:
+		master.ReadCoils(opt.unit, opt.address, e.quantity);
+		break;
+	case 2:
+		master.ReadDiscreteInputs(opt.unit, opt.address, e.quantity);
+		break;
+	case 3:
+		master.ReadHoldingRegisters(opt.unit, opt.address, e.quantity);
+		break;
+	case 4:
+		master.ReadInputRegisters(opt.unit, opt.address, e.quantity);
+		break;
+	case 5:
+		master.WriteSingleCoil(opt.unit, opt.address, true);
+		break;
+	case 6:
+		master.WriteSingleRegister(opt.unit, opt.address, 0x1234);
+		break;
+	case 15:
+		master.WriteMultipleCoils(opt.unit, opt.address, vector<bool>(e.quantity, true));
+		break;
+	case 16:
+		master.WriteMultipleRegisters(opt.unit, opt.address, vector<uint16_t>(e.quantity, 0x1234));
+		break;
+	}
+}
+
+/**
+ * Worker loop. With target rate requests are sent by fixed schedule and
+ * latency is counted from scheduled time, so queueing delay of slow
+ * responces is not hidden(coordinated omission). Without target rate
+ * next request is sent immediately after responce.
+ **/
+static void worker(MasterFactory factory, const Options& opt, double rate,
+	steady_clock::time_point start, steady_clock::time_point stop, unsigned seed,
+	WorkerStat& stat)
+{
+	unique_ptr<Master> master;
+
+	try
+	{
+		master = factory();
+	}
+	catch (const exception& e)
+	{
+		cerr << "Can not open target: " << e.what() << endl;
+		stat.errors++;
+		return;
+	}
+
+	mt19937 rng(seed);
+	vector<unsigned> weights;
+	for (const MixEntry& e : opt.mix)
+		weights.push_back(e.weight);
+	discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+	const nanoseconds interval = rate > 0 ? nanoseconds((int64_t)(1e9 / rate)) : nanoseconds(0);
+	steady_clock::time_point scheduled = start;
+
+	stat.latencies.reserve(rate > 0 ? (size_t)(rate * opt.duration) + 16 : 1 << 20);
+
+	this_thread::sleep_until(start);
+
+	for (;;)
+	{
+		steady_clock::time_point now = steady_clock::now();
+		if (now >= stop)
+			break;
+
+		if (rate > 0)
+		{
+			if (scheduled > now)
+			{
+				this_thread::sleep_until(scheduled);
+			}
+		}
+		else
+		{
+			scheduled = now;
+		}
+
+		try
+		{
+			execute(*master, opt, opt.mix[pick(rng)]);
+
+			const uint64_t us = duration_cast<microseconds>(steady_clock::now() - scheduled).count();
+			stat.latencies.push_back((uint32_t)min<uint64_t>(us, UINT32_MAX));
+		}
+		catch (const ETimeout&)
+		{
+			stat.timeouts++;
+		}
+		catch (const EException&)
+		{
+			stat.exceptions++;
+		}
+		catch (const exception&)
+		{
+			stat.errors++;
+		}
+
+		scheduled += interval;
+	}
+}
+
+/**
+ * Return percentile of sorted samples.
+ **/
+static uint32_t percentile(const vector<uint32_t>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+
+	size_t index = (size_t)(p * sorted.size());
+	if (index >= sorted.size())
+		index = sorted.size() - 1;
+
+	return sorted[index];
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+
+	try
+	{
+		opt = parse_options(argc, argv);
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		usage();
+		return 1;
+	}
+
+	Slave slave;
+	vector<MasterFactory> factories = make_factories(opt, slave);
+
+	if (factories.empty())
+	{
+		usage();
+		return 1;
+	}
+
+	const double ratePerWorker = opt.rate / factories.size();
+
+	/**
+	 * Give workers time to connect before start.
+	 **/
+	const steady_clock::time_point start = steady_clock::now() + milliseconds(500);
+	const steady_clock::time_point stop = start + microseconds((int64_t)(opt.duration * 1e6));
+
+	vector<WorkerStat> stats(factories.size());
+	vector<thread> threads;
+
+	for (size_t i = 0; i < factories.size(); i++)
+	{
+		threads.push_back(thread(worker, factories[i], cref(opt), ratePerWorker,
+			start, stop, (unsigned)i + 1, ref(stats[i])));
+	}
+
+	for (thread& t : threads)
+		t.join();
+
+	const double elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+	WorkerStat total;
+	for (const WorkerStat& s : stats)
+	{
+		total.latencies.insert(total.latencies.end(), s.latencies.cbegin(), s.latencies.cend());
+		total.timeouts += s.timeouts;
+		total.exceptions += s.exceptions;
+		total.errors += s.errors;
+	}
+
+	sort(total.latencies.begin(), total.latencies.end());
+
+	printf("workers:        %u\n", (unsigned)factories.size());
+	printf("duration:       %.2f s\n", elapsed);
+	printf("transactions:   %llu\n", (unsigned long long)total.latencies.size());
+	printf("throughput:     %.1f tx/s\n", total.latencies.size() / elapsed);
+	printf("timeouts:       %llu\n", (unsigned long long)total.timeouts);
+	printf("exceptions:     %llu\n", (unsigned long long)total.exceptions);
+	printf("errors:         %llu\n", (unsigned long long)total.errors);
+	printf("latency p50:    %u us\n", percentile(total.latencies, 0.50));
+	printf("latency p99:    %u us\n", percentile(total.latencies, 0.99));
+	printf("latency p999:   %u us\n", percentile(total.latencies, 0.999));
+	printf("latency max:    %u us\n", total.latencies.empty() ? 0 : total.latencies.back());
+
+	return 0;
+}
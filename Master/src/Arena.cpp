@@ -0,0 +1,111 @@
+/**
+* Arena for results of poll cycle
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <new>
+#include <stdexcept>
+#include "Arena.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	const size_t Arena::DefaultSize;
+	const size_t Arena::DefaultAlignment;
+
+	Arena::Arena(size_t size) : position(nullptr), end(nullptr), used(0)
+	{
+		addChunk(size == 0 ? DefaultSize : size);
+	}
+
+	Arena::~Arena()
+	{
+		for (vector<Chunk>::const_iterator i = chunks.cbegin(); i != chunks.cend(); i++)
+			delete[] i->data;
+	}
+
+	void* Arena::Allocate(size_t size, size_t alignment)
+	{
+		if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+		{
+			throw invalid_argument("Alignment must be power of 2.");
+		}
+
+		/**
+		 * Zero size allocation still gets unique address.
+		 **/
+		if (size == 0)
+			size = 1;
+
+		uintptr_t p = ((uintptr_t)position + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+		if (p + size > (uintptr_t)end)
+		{
+			size_t next = chunks.back().size * 2;
+			while (next < size + alignment)
+				next *= 2;
+
+			addChunk(next);
+			p = ((uintptr_t)position + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		}
+
+		used += size;
+		position = (uint8_t*)(p + size);
+		return (void*)p;
+	}
+
+	void Arena::Reset()
+	{
+		if (chunks.size() > 1)
+		{
+			Chunk chunk;
+			chunk.size = Capacity();
+			chunk.data = new uint8_t[chunk.size];
+
+			for (vector<Chunk>::const_iterator i = chunks.cbegin(); i != chunks.cend(); i++)
+				delete[] i->data;
+
+			chunks.assign(1, chunk);
+			end = chunk.data + chunk.size;
+		}
+
+		position = chunks.back().data;
+		used = 0;
+	}
+
+	size_t Arena::Used() const
+	{
+		return used;
+	}
+
+	size_t Arena::Capacity() const
+	{
+		size_t capacity = 0;
+
+		for (vector<Chunk>::const_iterator i = chunks.cbegin(); i != chunks.cend(); i++)
+			capacity += i->size;
+
+		return capacity;
+	}
+
+	void Arena::addChunk(size_t size)
+	{
+		Chunk chunk;
+		chunk.data = new uint8_t[size];
+		chunk.size = size;
+
+		try
+		{
+			chunks.push_back(chunk);
+		}
+		catch (...)
+		{
+			delete[] chunk.data;
+			throw;
+		}
+
+		position = chunk.data;
+		end = chunk.data + size;
+	}
+}
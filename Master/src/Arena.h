@@ -0,0 +1,193 @@
+/**
+ * Description: Arena for results of poll cycle. Poller reads many units
+ *				each cycle, and every result vector(registers, file
+ *				records, server ID, event log) is allocated on heap and
+ *				freed again. Arena hands out memory from chunks by moving
+ *				pointer, frees nothing, and is reset once per cycle, so
+ *				after first cycle results of whole cycle need no heap.
+ *				ArenaAllocator is STL allocator over arena for Master
+ *				result overloads. When built as C++17, ArenaResource is
+ *				std::pmr::memory_resource over arena, and pmr result types
+ *				are defined.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "Master.h"
+
+#if (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)) && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define MODBUS_HAS_PMR 1
+#endif
+#endif
+
+namespace Modbus
+{
+	/**
+	 * Arena is not thread safe: each poller thread uses its own.
+	 **/
+	class Arena
+	{
+	public:
+		static const size_t DefaultSize = 16384;
+		static const size_t DefaultAlignment = 16;
+
+		/**
+		 * size:	size of first chunk. When it is full, chunks of double
+		 *			size are added.
+		 **/
+		explicit Arena(size_t size = DefaultSize);
+		~Arena();
+
+		/**
+		 * Allocate memory. It is freed only by Reset or destructor.
+		 * alignment:	power of 2
+		 * Exceptions:	invalid_argument if alignment is not power of 2,
+		 *				bad_alloc if no memory.
+		 **/
+		void* Allocate(size_t size, size_t alignment = DefaultAlignment);
+
+		/**
+		 * Free all allocations at once. Memory is kept; if cycle needed
+		 * several chunks, they are replaced with one chunk of their total
+		 * size, so next cycles fit in it. Containers allocated from arena
+		 * must not be used after reset.
+		 **/
+		void Reset();
+
+		/**
+		 * Bytes allocated since reset, and memory of arena.
+		 **/
+		size_t Used() const;
+		size_t Capacity() const;
+
+	private:
+		struct Chunk
+		{
+			uint8_t* data;
+			size_t size;
+		};
+
+		Arena(const Arena&);
+		Arena& operator=(const Arena&);
+
+		void addChunk(size_t size);
+
+		std::vector<Chunk> chunks;
+
+		/**
+		 * Free space of last chunk: [position, end)
+		 **/
+		uint8_t* position;
+		uint8_t* end;
+		size_t used;
+	};
+
+	/**
+	 * STL allocator over arena. deallocate does nothing, memory is
+	 * returned by Arena::Reset.
+	 **/
+	template <class T>
+	class ArenaAllocator
+	{
+	public:
+		typedef T value_type;
+
+		template <class U>
+		struct rebind
+		{
+			typedef ArenaAllocator<U> other;
+		};
+
+		explicit ArenaAllocator(Arena& arena) : arena(&arena)
+		{
+		}
+
+		template <class U>
+		ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena)
+		{
+		}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(arena->Allocate(n * sizeof(T), std::alignment_of<T>::value));
+		}
+
+		void deallocate(T*, size_t)
+		{
+		}
+
+		Arena* arena;
+	};
+
+	template <class T, class U>
+	inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+	{
+		return a.arena == b.arena;
+	}
+
+	template <class T, class U>
+	inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+	{
+		return a.arena != b.arena;
+	}
+
+	/**
+	 * Result types of Master functions in arena. Container is created
+	 * with allocator, for example ArenaRegisters values(ArenaAllocator<uint16_t>(arena)).
+	 **/
+	typedef std::vector<bool, ArenaAllocator<bool>> ArenaBits;
+	typedef std::vector<uint16_t, ArenaAllocator<uint16_t>> ArenaRegisters;
+	typedef std::vector<uint8_t, ArenaAllocator<uint8_t>> ArenaBytes;
+	typedef std::vector<ArenaBytes, ArenaAllocator<ArenaBytes>> ArenaFileRecords;
+	typedef Master::BasicServerID<ArenaAllocator<uint8_t>> ArenaServerID;
+	typedef Master::BasicCommEventLog<ArenaAllocator<Master::CommEvent>> ArenaCommEventLog;
+
+#ifdef MODBUS_HAS_PMR
+	/**
+	 * memory_resource over arena, and result types of Master functions
+	 * with polymorphic allocator.
+	 **/
+	class ArenaResource : public std::pmr::memory_resource
+	{
+	public:
+		explicit ArenaResource(Arena& arena) : arena(arena)
+		{
+		}
+
+	protected:
+		virtual void* do_allocate(size_t bytes, size_t alignment)
+		{
+			return arena.Allocate(bytes, alignment);
+		}
+
+		virtual void do_deallocate(void*, size_t, size_t)
+		{
+		}
+
+		virtual bool do_is_equal(const std::pmr::memory_resource& other) const noexcept
+		{
+			return this == &other;
+		}
+
+	private:
+		Arena& arena;
+	};
+
+	typedef std::pmr::vector<bool> PmrBits;
+	typedef std::pmr::vector<uint16_t> PmrRegisters;
+	typedef std::pmr::vector<std::pmr::vector<uint8_t>> PmrFileRecords;
+	typedef Master::BasicServerID<std::pmr::polymorphic_allocator<uint8_t>> PmrServerID;
+	typedef Master::BasicCommEventLog<std::pmr::polymorphic_allocator<Master::CommEvent>> PmrCommEventLog;
+#endif
+}
+
+#endif	/* _ARENA_H_ */
@@ -0,0 +1,374 @@
+/**
+* MODBUS ASCII master
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include "AsciiFdu.h"
+#include "mb_exceptions.h"
+
+/**
+ * Hex codec and LRC use SSE2 kernels where available. Every x86-64
+ * CPU has SSE2, on 32-bit MSVC it is enabled by /arch:SSE2(default
+ * since VS2012).
+ **/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MODBUS_ASCII_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+
+	/**
+	 * Return value of hex digit or -1 if character is not hex digit.
+	 **/
+	static int hex_value(char c)
+	{
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		if (c >= 'A' && c <= 'F')
+			return c - 'A' + 10;
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		return -1;
+	}
+
+#ifdef MODBUS_ASCII_SSE2
+	/**
+	 * Convert 16 nibbles(0-15) to hex characters.
+	 **/
+	static inline __m128i nibbles_to_hex(__m128i n)
+	{
+		const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10));
+		return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letters);
+	}
+
+	/**
+	 * Convert 16 hex characters to nibbles.
+	 * valid:	0xFF in each lane with valid hex digit
+	 **/
+	static inline __m128i hex_to_nibbles(__m128i c, __m128i& valid)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		/**
+		 * Unsigned x <= k is checked as saturated x - k == 0.
+		 **/
+		const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+		const __m128i isDigit = _mm_cmpeq_epi8(_mm_subs_epu8(digit, _mm_set1_epi8(9)), zero);
+
+		const __m128i letter = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		const __m128i isLetter = _mm_cmpeq_epi8(_mm_subs_epu8(letter, _mm_set1_epi8(5)), zero);
+
+		valid = _mm_or_si128(isDigit, isLetter);
+
+		return _mm_or_si128(
+			_mm_and_si128(isDigit, digit),
+			_mm_and_si128(isLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+	}
+
+	/**
+	 * Combine pairs of nibbles(high first) into bytes in 16-bit lanes.
+	 **/
+	static inline __m128i combine_nibbles(__m128i n)
+	{
+		const __m128i high = _mm_and_si128(n, _mm_set1_epi16(0x00FF));
+		const __m128i low = _mm_srli_epi16(n, 8);
+		return _mm_or_si128(_mm_slli_epi16(high, 4), low);
+	}
+#endif
+
+	/**
+	* Encode bytes to upper case hex characters.
+	**/
+	void AsciiMaster::EncodeHex(const uint8_t* in, size_t size, char* out)
+	{
+		size_t i = 0;
+
+#ifdef MODBUS_ASCII_SSE2
+		const __m128i mask = _mm_set1_epi8(0x0F);
+
+		for (; i + 16 <= size; i += 16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+			const __m128i high = nibbles_to_hex(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+			const __m128i low = nibbles_to_hex(_mm_and_si128(v, mask));
+
+			_mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi8(high, low));
+			_mm_storeu_si128((__m128i*)(out + i * 2 + 16), _mm_unpackhi_epi8(high, low));
+		}
+#endif
+
+		for (; i < size; i++)
+		{
+			out[i * 2] = hex_digits[in[i] >> 4];
+			out[i * 2 + 1] = hex_digits[in[i] & 0x0F];
+		}
+	}
+
+	/**
+	* Decode hex characters to bytes.
+	**/
+	bool AsciiMaster::DecodeHex(const char* in, size_t size, uint8_t* out)
+	{
+		if (size % 2 != 0)
+			return false;
+
+		size_t i = 0;
+
+#ifdef MODBUS_ASCII_SSE2
+		__m128i allValid = _mm_set1_epi8((char)0xFF);
+
+		for (; i + 32 <= size; i += 32)
+		{
+			__m128i validA, validB;
+			const __m128i a = hex_to_nibbles(_mm_loadu_si128((const __m128i*)(in + i)), validA);
+			const __m128i b = hex_to_nibbles(_mm_loadu_si128((const __m128i*)(in + i + 16)), validB);
+
+			allValid = _mm_and_si128(allValid, _mm_and_si128(validA, validB));
+
+			_mm_storeu_si128((__m128i*)(out + i / 2), _mm_packus_epi16(combine_nibbles(a), combine_nibbles(b)));
+		}
+
+		if (_mm_movemask_epi8(allValid) != 0xFFFF)
+			return false;
+#endif
+
+		for (; i < size; i += 2)
+		{
+			const int high = hex_value(in[i]);
+			const int low = hex_value(in[i + 1]);
+
+			if (high < 0 || low < 0)
+				return false;
+
+			out[i / 2] = (uint8_t)((high << 4) | low);
+		}
+
+		return true;
+	}
+
+	/**
+	* Compute MODBUS LRC.
+	**/
+	uint8_t AsciiMaster::LRC(const uint8_t* data, size_t size)
+	{
+		size_t i = 0;
+		uint32_t sum = 0;
+
+#ifdef MODBUS_ASCII_SSE2
+		/**
+		 * Sum of absolute differences with zero is horizontal sum
+		 * of 8 bytes in each 64-bit lane.
+		 **/
+		__m128i acc = _mm_setzero_si128();
+
+		for (; i + 16 <= size; i += 16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+		}
+
+		sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+
+		for (; i < size; i++)
+		{
+			sum += data[i];
+		}
+
+		return (uint8_t)(0 - sum);
+	}
+
+	AsciiMaster::AsciiMaster(const string& device, const SerialPort::Settings& settings)
+		: port(device, settings), timeout(DefaultTimeout),
+		turnaroundDelay(DefaultTurnaroundDelay), delimiter(DefaultDelimiter)
+	{
+	}
+
+	AsciiMaster::~AsciiMaster()
+	{
+	}
+
+	void AsciiMaster::SetTimeout(unsigned timeout)
+	{
+		this->timeout = timeout;
+	}
+
+	unsigned AsciiMaster::GetTimeout() const
+	{
+		return timeout;
+	}
+
+	void AsciiMaster::SetTurnaroundDelay(unsigned delay)
+	{
+		turnaroundDelay = delay;
+	}
+
+	void AsciiMaster::SetDelimiter(char delim)
+	{
+		delimiter = delim;
+	}
+
+	SerialPort& AsciiMaster::Port()
+	{
+		return port;
+	}
+
+	void AsciiMaster::SetLowLatency(const LowLatency::Settings& settings)
+	{
+		lowLatency.SetSettings(settings);
+		port.SetSpin(settings.spin);
+	}
+
+	/**
+	* Send PDU and wait responce.
+	**/
+	vector<uint8_t> AsciiMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		lowLatency.Enter();
+		sendADU(id, request);
+
+		vector<uint8_t> frame = receiveADU(request);
+
+		/**
+		 * Frame is address, PDU and LRC. LRC of whole frame including
+		 * LRC byte is zero.
+		 **/
+		if (frame.size() < 3 ||
+			frame[0] != id ||
+			LRC(frame.data(), frame.size() - 1) != frame.back())
+		{
+			throw EPDUFrameError(request, frame);
+		}
+
+		return vector<uint8_t>(frame.cbegin() + 1, frame.cend() - 1);
+	}
+
+	/**
+	* Send broadcast PDU and wait turnaround delay.
+	**/
+	void AsciiMaster::SendPDU(vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		lowLatency.Enter();
+		sendADU(0, request);
+		this_thread::sleep_for(milliseconds(turnaroundDelay));
+	}
+
+	/**
+	* Encode and send ADU.
+	**/
+	void AsciiMaster::sendADU(uint8_t id, const vector<uint8_t>& pdu)
+	{
+		uint8_t binary[PDU_MAX_SIZE + 2];
+		char adu[ADU_MAX_SIZE];
+
+		binary[0] = id;
+		memcpy(binary + 1, pdu.data(), pdu.size());
+		binary[pdu.size() + 1] = LRC(binary, pdu.size() + 1);
+
+		const size_t binarySize = pdu.size() + 2;
+
+		adu[0] = FrameStart;
+		EncodeHex(binary, binarySize, adu + 1);
+		adu[1 + binarySize * 2] = '\r';
+		adu[2 + binarySize * 2] = delimiter;
+
+		port.FlushInput();
+		port.Write((const uint8_t*)adu, 3 + binarySize * 2);
+	}
+
+	/**
+	* Receive frame. Data is read by chunks, and start and end of frame
+	* are searched only in new part of buffer.
+	**/
+	vector<uint8_t> AsciiMaster::receiveADU(const vector<uint8_t>& request)
+	{
+		char buffer[ADU_MAX_SIZE];
+		size_t length = 0;
+		size_t start = 0;
+		bool started = false;
+		unsigned wait = timeout;
+		const char* end = NULL;
+
+		while (end == NULL)
+		{
+			if (length == sizeof(buffer))
+			{
+				throw EPDUFrameError(request, vector<uint8_t>(buffer, buffer + length));
+			}
+
+			const size_t n = port.Read((uint8_t*)buffer + length, sizeof(buffer) - length, wait);
+			if (n == 0)
+			{
+				throw ETimeout();
+			}
+
+			size_t scan = length;
+			length += n;
+
+			if (!started)
+			{
+				const char* colon = (const char*)memchr(buffer + scan, FrameStart, length - scan);
+				if (colon == NULL)
+				{
+					/**
+					 * Garbage before start of frame is dropped.
+					 **/
+					length = 0;
+					continue;
+				}
+
+				started = true;
+				start = colon - buffer + 1;
+				scan = start;
+			}
+
+			end = (const char*)memchr(buffer + scan, delimiter, length - scan);
+
+			/**
+			 * Characters of frame may be separated by up to 1 s.
+			 **/
+			wait = InterCharTimeout;
+		}
+
+		/**
+		 * Frame body is hex characters followed by CR.
+		 **/
+		const char* body = buffer + start;
+		size_t bodySize = end - body;
+
+		if (bodySize < 1 || body[bodySize - 1] != '\r')
+		{
+			throw EPDUFrameError(request, vector<uint8_t>(body, end));
+		}
+
+		bodySize--;
+
+		vector<uint8_t> frame(bodySize / 2);
+		if (!DecodeHex(body, bodySize, frame.data()))
+		{
+			throw EPDUFrameError(request, vector<uint8_t>(body, end));
+		}
+
+		return frame;
+	}
+}
@@ -0,0 +1,97 @@
+/**
+ * Description: MODBUS ASCII master. Frame is ':', hex encoded address,
+ *				PDU and LRC, CR and LF(or delimiter set by Change ASCII
+ *				Input Delimiter diagnostic).
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _ASCII_FDU_H_
+#define _ASCII_FDU_H_
+
+#include <cstddef>
+#include <string>
+#include "Master.h"
+#include "Serial.h"
+
+namespace Modbus
+{
+	class AsciiMaster : public Master
+	{
+	public:
+		/**
+		 * Constants
+		 **/
+		static const char FrameStart = ':';
+		static const char DefaultDelimiter = '\n';
+		static const int ADU_MAX_SIZE = 513;
+		static const unsigned DefaultTimeout = 1000;
+		static const unsigned InterCharTimeout = 1000;
+		static const unsigned DefaultTurnaroundDelay = 100;
+
+		AsciiMaster(const std::string& device, const SerialPort::Settings& settings);
+		virtual ~AsciiMaster();
+
+		/**
+		 * Set responce timeout, ms.
+		 **/
+		void SetTimeout(unsigned timeout);
+		unsigned GetTimeout() const;
+
+		/**
+		 * Set delay after broadcast request, ms.
+		 **/
+		void SetTurnaroundDelay(unsigned delay);
+
+		/**
+		 * Set end of frame character. It must be changed together
+		 * with Change ASCII Input Delimiter(08/03) request to device.
+		 **/
+		void SetDelimiter(char delim);
+
+		SerialPort& Port();
+
+		/**
+		 * Low-latency mode. Thread options are applied to thread which
+		 * makes transactions.
+		 **/
+		void SetLowLatency(const LowLatency::Settings& settings);
+
+		/**
+		 * Encode bytes to upper case hex characters.
+		 * out must have room for 2 * size characters.
+		 **/
+		static void EncodeHex(const uint8_t* in, size_t size, char* out);
+
+		/**
+		 * Decode hex characters to bytes. Both upper and lower
+		 * case digits are accepted.
+		 * size:	number of characters, must be even
+		 * Return:	false if input contain non-hex character
+		 **/
+		static bool DecodeHex(const char* in, size_t size, uint8_t* out);
+
+		/**
+		 * Compute MODBUS LRC(two's complement of sum of bytes).
+		 **/
+		static uint8_t LRC(const uint8_t* data, size_t size);
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+		void sendADU(uint8_t id, const std::vector<uint8_t>& pdu);
+
+		/**
+		 * Receive frame. Return decoded address, PDU and LRC.
+		 **/
+		std::vector<uint8_t> receiveADU(const std::vector<uint8_t>& request);
+
+		SerialPort port;
+		unsigned timeout;
+		unsigned turnaroundDelay;
+		char delimiter;
+		LowLatency lowLatency;
+	};
+}
+
+#endif	/* _ASCII_FDU_H_ */
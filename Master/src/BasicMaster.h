@@ -0,0 +1,201 @@
+/**
+ * Description: MODBUS master with transport as compile-time policy. Calls
+ *				to transport are not virtual, so encode, send and decode
+ *				are inlined into one function body, and PDUs are kept in
+ *				member buffers without allocations.
+ *
+ *				Transport must provide:
+ *				size_t Transact(uint8_t id, const uint8_t* request, size_t size, uint8_t* responce);
+ *					send request PDU and write responce PDU(up to
+ *					PDU_MAX_SIZE bytes) to responce. Return responce size.
+ *				void Broadcast(const uint8_t* request, size_t size);
+ *					send request PDU without waiting responce.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _BASIC_MASTER_H_
+#define _BASIC_MASTER_H_
+
+#include <cstdint>
+#include <vector>
+#include "Master.h"
+#include "Pdu.h"
+
+namespace Modbus
+{
+	template <class Transport>
+	class BasicMaster
+	{
+	public:
+		BasicMaster()
+		{
+		}
+
+		explicit BasicMaster(const Transport& transport) : transport(transport)
+		{
+		}
+
+		Transport& GetTransport()
+		{
+			return transport;
+		}
+
+		/**
+		 * Same functions as in Master. Functions with values pointer
+		 * store result there instead of vector.
+		 **/
+		void ReadCoils(uint8_t id, uint16_t addr, unsigned quantity, uint8_t* values)
+		{
+			readBits(id, Master::FunctionCodes::ReadCoils, addr, quantity, values);
+		}
+
+		std::vector<bool> ReadCoils(uint8_t id, uint16_t addr, unsigned quantity)
+		{
+			std::vector<bool> values(quantity);
+			readBits(id, Master::FunctionCodes::ReadCoils, addr, quantity, values.begin());
+			return values;
+		}
+
+		void ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity, uint8_t* values)
+		{
+			readBits(id, Master::FunctionCodes::ReadDiscreteInputs, addr, quantity, values);
+		}
+
+		std::vector<bool> ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity)
+		{
+			std::vector<bool> values(quantity);
+			readBits(id, Master::FunctionCodes::ReadDiscreteInputs, addr, quantity, values.begin());
+			return values;
+		}
+
+		void ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity, uint16_t* values)
+		{
+			readRegisters(id, Master::FunctionCodes::ReadHoldingRegisters, addr, quantity, values);
+		}
+
+		std::vector<uint16_t> ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity)
+		{
+			std::vector<uint16_t> values(quantity);
+			readRegisters(id, Master::FunctionCodes::ReadHoldingRegisters, addr, quantity, values.data());
+			return values;
+		}
+
+		void ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity, uint16_t* values)
+		{
+			readRegisters(id, Master::FunctionCodes::ReadInputRegisters, addr, quantity, values);
+		}
+
+		std::vector<uint16_t> ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity)
+		{
+			std::vector<uint16_t> values(quantity);
+			readRegisters(id, Master::FunctionCodes::ReadInputRegisters, addr, quantity, values.data());
+			return values;
+		}
+
+		void WriteSingleCoil(uint8_t id, uint16_t addr, bool value)
+		{
+			write(id, Pdu::EncodeWriteSingleCoil(request, addr, value));
+		}
+
+		void WriteSingleRegister(uint8_t id, uint16_t addr, uint16_t value)
+		{
+			write(id, Pdu::EncodeWriteSingleRegister(request, addr, value));
+		}
+
+		void WriteMultipleCoils(uint8_t id, uint16_t addr, const std::vector<bool>& coils)
+		{
+			write(id, Pdu::EncodeWriteMultipleCoils(request, addr, coils.begin(), (unsigned)coils.size()));
+		}
+
+		void WriteMultipleCoils(uint8_t id, uint16_t addr, const uint8_t* coils, unsigned quantity)
+		{
+			write(id, Pdu::EncodeWriteMultipleCoils(request, addr, coils, quantity));
+		}
+
+		void WriteMultipleRegisters(uint8_t id, uint16_t addr, const std::vector<uint16_t>& regs)
+		{
+			write(id, Pdu::EncodeWriteMultipleRegisters(request, addr, regs.data(), (unsigned)regs.size()));
+		}
+
+		void WriteMultipleRegisters(uint8_t id, uint16_t addr, const uint16_t* regs, unsigned quantity)
+		{
+			write(id, Pdu::EncodeWriteMultipleRegisters(request, addr, regs, quantity));
+		}
+
+	private:
+		template <class Output>
+		void readBits(uint8_t id, Master::FunctionCodes funcCode, uint16_t addr, unsigned quantity, Output values)
+		{
+			Pdu::CheckNotBroadcast(id);
+
+			const size_t size = Pdu::EncodeRead(request, funcCode, addr, quantity);
+			const size_t responceSize = transport.Transact(id, request, size, responce);
+
+			Pdu::DecodeBits(request, size, responce, responceSize, quantity, values);
+		}
+
+		void readRegisters(uint8_t id, Master::FunctionCodes funcCode, uint16_t addr, unsigned quantity, uint16_t* values)
+		{
+			Pdu::CheckNotBroadcast(id);
+
+			const size_t size = Pdu::EncodeRead(request, funcCode, addr, quantity);
+			const size_t responceSize = transport.Transact(id, request, size, responce);
+
+			Pdu::DecodeRegisters(request, size, responce, responceSize, quantity, values);
+		}
+
+		/**
+		 * Send write request and check responce by its descriptor.
+		 **/
+		void write(uint8_t id, size_t size)
+		{
+			if (id == Master::IDBroadcast)
+			{
+				transport.Broadcast(request, size);
+				return;
+			}
+
+			const size_t responceSize = transport.Transact(id, request, size, responce);
+
+			Pdu::CheckResponce(request, size, responce, responceSize);
+		}
+
+		Transport transport;
+		uint8_t request[Master::PDU_MAX_SIZE];
+		uint8_t responce[Master::PDU_MAX_SIZE];
+	};
+
+	/**
+	 * Transport over any Master, for example TcpMaster or RtuMaster.
+	 **/
+	class MasterTransport
+	{
+	public:
+		explicit MasterTransport(Master& master) : master(&master)
+		{
+		}
+
+		size_t Transact(uint8_t id, const uint8_t* request, size_t size, uint8_t* responce)
+		{
+			std::vector<uint8_t> pdu = master->Transact(id, std::vector<uint8_t>(request, request + size));
+
+			if (pdu.size() > Master::PDU_MAX_SIZE)
+			{
+				Pdu::FrameError(request, size, pdu.data(), pdu.size());
+			}
+
+			std::copy(pdu.cbegin(), pdu.cend(), responce);
+			return pdu.size();
+		}
+
+		void Broadcast(const uint8_t* request, size_t size)
+		{
+			master->Broadcast(std::vector<uint8_t>(request, request + size));
+		}
+
+	private:
+		Master* master;
+	};
+}
+
+#endif	/* _BASIC_MASTER_H_ */
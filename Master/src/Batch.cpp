@@ -0,0 +1,498 @@
+/**
+* Batch of MODBUS operations
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include "Batch.h"
+#include "Pdu.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	/**
+	 * Maximum quantity of read function
+	 **/
+	static unsigned max_quantity(uint8_t read)
+	{
+		return read <= (uint8_t)Master::FunctionCodes::ReadDiscreteInputs ? 2000 : 125;
+	}
+
+	static bool is_bits(uint8_t read)
+	{
+		return read <= (uint8_t)Master::FunctionCodes::ReadDiscreteInputs;
+	}
+
+	Batch::Batch() : mergeGap(0), sent(0)
+	{
+	}
+
+	void Batch::SetMergeGap(unsigned gap)
+	{
+		mergeGap = gap;
+	}
+
+	void Batch::SetProfile(uint8_t id, const DeviceProfile& profile)
+	{
+		profiles[id] = profile;
+	}
+
+	Batch::Handle Batch::add(uint8_t id, uint8_t read, uint16_t addr, unsigned quantity, const Encoder& encode)
+	{
+		Operation operation;
+		operation.id = id;
+		operation.read = read;
+		operation.addr = addr;
+		operation.quantity = quantity;
+
+		try
+		{
+			encode(operation.request);
+		}
+		catch (...)
+		{
+			operation.request.clear();
+			operation.error = current_exception();
+		}
+
+		operations.push_back(move(operation));
+		return operations.size() - 1;
+	}
+
+	Batch::Handle Batch::addRead(uint8_t id, Master::FunctionCodes read, uint16_t addr, unsigned quantity)
+	{
+		return add(id, (uint8_t)read, addr, quantity, [=](vector<uint8_t>& request)
+		{
+			uint8_t pdu[Master::PDU_MAX_SIZE];
+
+			Modbus::Pdu::CheckNotBroadcast(id);
+			request.assign(pdu, pdu + Modbus::Pdu::EncodeRead(pdu, read, addr, quantity));
+		});
+	}
+
+	Batch::Handle Batch::ReadCoils(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return addRead(id, Master::FunctionCodes::ReadCoils, addr, quantity);
+	}
+
+	Batch::Handle Batch::ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return addRead(id, Master::FunctionCodes::ReadDiscreteInputs, addr, quantity);
+	}
+
+	Batch::Handle Batch::ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return addRead(id, Master::FunctionCodes::ReadHoldingRegisters, addr, quantity);
+	}
+
+	Batch::Handle Batch::ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return addRead(id, Master::FunctionCodes::ReadInputRegisters, addr, quantity);
+	}
+
+	Batch::Handle Batch::WriteSingleCoil(uint8_t id, uint16_t addr, bool value)
+	{
+		return add(id, 0, addr, 1, [=](vector<uint8_t>& request)
+		{
+			uint8_t pdu[Master::PDU_MAX_SIZE];
+			request.assign(pdu, pdu + Modbus::Pdu::EncodeWriteSingleCoil(pdu, addr, value));
+		});
+	}
+
+	Batch::Handle Batch::WriteSingleRegister(uint8_t id, uint16_t addr, uint16_t value)
+	{
+		return add(id, 0, addr, 1, [=](vector<uint8_t>& request)
+		{
+			uint8_t pdu[Master::PDU_MAX_SIZE];
+			request.assign(pdu, pdu + Modbus::Pdu::EncodeWriteSingleRegister(pdu, addr, value));
+		});
+	}
+
+	Batch::Handle Batch::WriteMultipleCoils(uint8_t id, uint16_t addr, const vector<bool>& coils)
+	{
+		return add(id, 0, addr, (unsigned)coils.size(), [&](vector<uint8_t>& request)
+		{
+			uint8_t pdu[Master::PDU_MAX_SIZE];
+			request.assign(pdu, pdu + Modbus::Pdu::EncodeWriteMultipleCoils(pdu, addr, coils.begin(), (unsigned)coils.size()));
+		});
+	}
+
+	Batch::Handle Batch::WriteMultipleRegisters(uint8_t id, uint16_t addr, const vector<uint16_t>& regs)
+	{
+		return add(id, 0, addr, (unsigned)regs.size(), [&](vector<uint8_t>& request)
+		{
+			uint8_t pdu[Master::PDU_MAX_SIZE];
+			request.assign(pdu, pdu + Modbus::Pdu::EncodeWriteMultipleRegisters(pdu, addr, regs.data(), (unsigned)regs.size()));
+		});
+	}
+
+	Batch::Handle Batch::MaskWriteRegister(uint8_t id, uint16_t addr, uint16_t orMask, uint16_t andMask)
+	{
+		return add(id, 0, addr, 1, [=](vector<uint8_t>& request)
+		{
+			uint8_t pdu[Master::PDU_MAX_SIZE];
+			request.assign(pdu, pdu + Modbus::Pdu::EncodeMaskWriteRegister(pdu, addr, orMask, andMask));
+		});
+	}
+
+	Batch::Handle Batch::ReadFileRecord(uint8_t id, const vector<Master::FileReadSubRequest>& requests)
+	{
+		return add(id, 0, 0, 0, [&](vector<uint8_t>& request)
+		{
+			if (id == Master::IDBroadcast)
+			{
+				throw invalid_argument("Read File Record with broadcast ID.");
+			}
+
+			Modbus::Pdu::EncodeReadFileRecord(request, requests);
+		});
+	}
+
+	Batch::Handle Batch::WriteFileRecord(uint8_t id, const vector<Master::FileWriteSubRequest>& requests)
+	{
+		return add(id, 0, 0, 0, [&](vector<uint8_t>& request)
+		{
+			Modbus::Pdu::EncodeWriteFileRecord(request, requests);
+		});
+	}
+
+	size_t Batch::Size() const
+	{
+		return operations.size();
+	}
+
+	void Batch::Clear()
+	{
+		operations.clear();
+		results.clear();
+		sent = 0;
+	}
+
+	const Batch::Result& Batch::GetResult(Handle handle) const
+	{
+		if (handle >= results.size())
+		{
+			throw out_of_range("Invalid batch handle.");
+		}
+
+		return results[handle];
+	}
+
+	void Batch::Check(Handle handle) const
+	{
+		const Result& result = GetResult(handle);
+
+		if (result.error)
+			rethrow_exception(result.error);
+	}
+
+	const vector<bool>& Batch::Bits(Handle handle) const
+	{
+		Check(handle);
+		return results[handle].bits;
+	}
+
+	const vector<uint16_t>& Batch::Registers(Handle handle) const
+	{
+		Check(handle);
+		return results[handle].registers;
+	}
+
+	const Master::FileRecords& Batch::Records(Handle handle) const
+	{
+		Check(handle);
+		return results[handle].records;
+	}
+
+	size_t Batch::SentPDUs() const
+	{
+		return sent;
+	}
+
+	/**
+	 * Read is merged into earlier read PDU of the same unit and function,
+	 * if merged range fits into one request. Any other operation on unit
+	 * closes its PDUs for merging, so reads never move before write they
+	 * follow. Broadcast closes PDUs of all units. Unit with profile gets
+	 * merged reads within its maximum block and out of its holes.
+	 **/
+	vector<Batch::Pdu> Batch::plan() const
+	{
+		vector<Pdu> pdus;
+		map<uint8_t, vector<size_t>> open;
+
+		for (size_t i = 0; i < operations.size(); i++)
+		{
+			const Operation& op = operations[i];
+			const bool mergeable = op.read != 0 && op.id != Master::IDBroadcast &&
+				op.quantity >= 1 && op.quantity <= max_quantity(op.read) && op.addr + op.quantity <= 0x10000;
+
+			if (mergeable)
+			{
+				vector<size_t>& candidates = open[op.id];
+				map<uint8_t, DeviceProfile>::const_iterator profile = profiles.find(op.id);
+				const unsigned block = profile == profiles.end() ? max_quantity(op.read) :
+					min(max_quantity(op.read), profile->second.MaxBlock((Master::FunctionCodes)op.read));
+				bool merged = false;
+
+				for (vector<size_t>::const_iterator p = candidates.cbegin(); p != candidates.cend() && !merged; p++)
+				{
+					Pdu& pdu = pdus[*p];
+					const unsigned first = min<unsigned>(pdu.addr, op.addr);
+					const unsigned last = max(pdu.addr + pdu.quantity, op.addr + op.quantity);
+
+					if (pdu.read != op.read ||
+						op.addr > pdu.addr + pdu.quantity + mergeGap ||
+						pdu.addr > op.addr + op.quantity + mergeGap ||
+						last - first > block)
+					{
+						continue;
+					}
+
+					if (profile != profiles.end() &&
+						!profile->second.IsReadable((Master::FunctionCodes)op.read, (uint16_t)first, last - first))
+					{
+						continue;
+					}
+
+					for (vector<Part>::iterator part = pdu.parts.begin(); part != pdu.parts.end(); part++)
+						part->offset += pdu.addr - first;
+
+					Part part = { i, op.addr - first };
+					pdu.parts.push_back(part);
+					pdu.addr = (uint16_t)first;
+					pdu.quantity = last - first;
+					merged = true;
+				}
+
+				if (merged)
+					continue;
+
+				candidates.push_back(pdus.size());
+			}
+			else if (op.read != 0)
+			{
+				/**
+				 * Invalid read fails on encoding and is not sent, so it
+				 * does not close PDUs for merging.
+				 **/
+			}
+			else if (op.id == Master::IDBroadcast)
+			{
+				open.clear();
+			}
+			else
+			{
+				open.erase(op.id);
+			}
+
+			Pdu pdu;
+			pdu.id = op.id;
+			pdu.read = mergeable ? op.read : 0;
+			pdu.addr = op.addr;
+			pdu.quantity = op.quantity;
+			pdu.request = op.request;
+			pdu.error = op.error;
+			pdu.broadcast = op.id == Master::IDBroadcast && !op.error;
+
+			Part part = { i, 0 };
+			pdu.parts.push_back(part);
+			pdus.push_back(pdu);
+		}
+
+		/**
+		 * Merged reads get request for whole range.
+		 **/
+		for (vector<Pdu>::iterator pdu = pdus.begin(); pdu != pdus.end(); pdu++)
+		{
+			if (pdu->parts.size() < 2)
+				continue;
+
+			uint8_t request[Master::PDU_MAX_SIZE];
+			const size_t size = Modbus::Pdu::EncodeRead(request, (Master::FunctionCodes)pdu->read, pdu->addr, pdu->quantity);
+			pdu->request.assign(request, request + size);
+		}
+
+		return pdus;
+	}
+
+	void Batch::distribute(const Pdu& pdu, const Result& result)
+	{
+		if (result.error || pdu.read == 0 || pdu.parts.size() == 1)
+		{
+			for (vector<Part>::const_iterator part = pdu.parts.cbegin(); part != pdu.parts.cend(); part++)
+				results[part->operation] = result;
+
+			return;
+		}
+
+		for (vector<Part>::const_iterator part = pdu.parts.cbegin(); part != pdu.parts.cend(); part++)
+		{
+			const unsigned quantity = operations[part->operation].quantity;
+			Result& r = results[part->operation];
+
+			if (is_bits(pdu.read))
+			{
+				if (result.bits.size() < part->offset + quantity)
+				{
+					r.error = make_exception_ptr(EPDUFrameError(pdu.request, vector<uint8_t>()));
+					continue;
+				}
+
+				r.bits.assign(result.bits.cbegin() + part->offset, result.bits.cbegin() + part->offset + quantity);
+			}
+			else
+			{
+				r.registers.assign(result.registers.cbegin() + part->offset,
+					result.registers.cbegin() + part->offset + quantity);
+			}
+		}
+	}
+
+	void Batch::decode(const Pdu& pdu, const vector<uint8_t>& responce, Result& result)
+	{
+		const vector<uint8_t>& request = pdu.request;
+
+		switch ((Master::FunctionCodes)request[0])
+		{
+		case Master::FunctionCodes::ReadCoils:
+		case Master::FunctionCodes::ReadDiscreteInputs:
+			result.bits.resize(pdu.quantity);
+			Modbus::Pdu::DecodeBits(request.data(), request.size(), responce.data(), responce.size(),
+				pdu.quantity, result.bits.begin());
+			break;
+
+		case Master::FunctionCodes::ReadHoldingRegisters:
+		case Master::FunctionCodes::ReadInputRegisters:
+			result.registers.resize(pdu.quantity);
+			Modbus::Pdu::DecodeRegisters(request.data(), request.size(), responce.data(), responce.size(),
+				pdu.quantity, result.registers.data());
+			break;
+
+		case Master::FunctionCodes::ReadFileRecord:
+			Modbus::Pdu::DecodeReadFileRecord(request, responce, result.records);
+			break;
+
+		default:
+			Modbus::Pdu::CheckResponce(request, responce);
+			break;
+		}
+	}
+
+	/**
+	* Requests are encoded when operations are added, and responces are
+	* decoded by PDU codec, so no Master function is called per operation.
+	**/
+	size_t Batch::Execute(Master& master)
+	{
+		vector<Pdu> pdus = plan();
+
+		results.assign(operations.size(), Result());
+		sent = 0;
+
+		/**
+		 * Send. Broadcasts have no responce, so they are sent between
+		 * runs of TransactMany in their place.
+		 **/
+		vector<Master::Transaction> transactions;
+		vector<size_t> index;
+
+		auto flush = [&]()
+		{
+			if (transactions.empty())
+				return;
+
+			try
+			{
+				master.TransactMany(transactions);
+			}
+			catch (...)
+			{
+				for (size_t t = 0; t < transactions.size(); t++)
+					transactions[t].error = current_exception();
+			}
+
+			sent += transactions.size();
+
+			for (size_t t = 0; t < transactions.size(); t++)
+			{
+				Pdu& pdu = pdus[index[t]];
+				Result result;
+
+				if (transactions[t].error)
+				{
+					result.error = transactions[t].error;
+				}
+				else
+				{
+					try
+					{
+						decode(pdu, transactions[t].responce, result);
+					}
+					catch (...)
+					{
+						result = Result();
+						result.error = current_exception();
+					}
+				}
+
+				distribute(pdu, result);
+			}
+
+			transactions.clear();
+			index.clear();
+		};
+
+		for (size_t p = 0; p < pdus.size(); p++)
+		{
+			Pdu& pdu = pdus[p];
+
+			if (pdu.error)
+			{
+				Result result;
+				result.error = pdu.error;
+				distribute(pdu, result);
+			}
+			else if (pdu.broadcast)
+			{
+				flush();
+
+				Result result;
+				try
+				{
+					master.Broadcast(pdu.request);
+					sent++;
+				}
+				catch (...)
+				{
+					result.error = current_exception();
+				}
+
+				distribute(pdu, result);
+			}
+			else
+			{
+				Master::Transaction transaction;
+				transaction.id = pdu.id;
+				transaction.request = pdu.request;
+				transactions.push_back(transaction);
+				index.push_back(p);
+			}
+		}
+
+		flush();
+
+		size_t failed = 0;
+		for (vector<Result>::const_iterator r = results.cbegin(); r != results.cend(); r++)
+		{
+			if (r->error)
+				failed++;
+		}
+
+		return failed;
+	}
+}
@@ -0,0 +1,175 @@
+/**
+ * Description: Batch of MODBUS operations executed at once. Reads of
+ *				one unit and table are merged when ranges overlap or
+ *				adjoin and no write to that unit stands between them, and
+ *				all PDUs are sent through TransactMany, so they are
+ *				pipelined where transport supports it.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <vector>
+#include "DeviceProfile.h"
+#include "Master.h"
+
+namespace Modbus
+{
+	class Batch
+	{
+	public:
+		/**
+		 * Operation index in batch
+		 **/
+		typedef size_t Handle;
+
+		/**
+		 * Result of operation. Only field of operation type is filled.
+		 **/
+		struct Result
+		{
+			std::exception_ptr error;
+			std::vector<bool> bits;
+			std::vector<uint16_t> registers;
+			Master::FileRecords records;
+		};
+
+		Batch();
+
+		/**
+		 * Maximum number of unrequested registers or bits between two
+		 * reads which are still merged. Default is 0: only overlapping
+		 * and adjoining ranges are merged, because reading addresses out
+		 * of device map fails whole request.
+		 **/
+		void SetMergeGap(unsigned gap);
+
+		/**
+		 * Learned profile of unit. Merged reads of unit are not larger
+		 * than its maximum block and don't cover its holes. Profiles are
+		 * kept by Clear.
+		 **/
+		void SetProfile(uint8_t id, const DeviceProfile& profile);
+
+		/**
+		 * Add operation. Arguments are the same as of Master functions.
+		 * Request is encoded here, and error of invalid arguments is
+		 * result of operation in Execute.
+		 **/
+		Handle ReadCoils(uint8_t id, uint16_t addr, unsigned quantity);
+		Handle ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity);
+		Handle ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity);
+		Handle ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity);
+		Handle WriteSingleCoil(uint8_t id, uint16_t addr, bool value);
+		Handle WriteSingleRegister(uint8_t id, uint16_t addr, uint16_t value);
+		Handle WriteMultipleCoils(uint8_t id, uint16_t addr, const std::vector<bool>& coils);
+		Handle WriteMultipleRegisters(uint8_t id, uint16_t addr, const std::vector<uint16_t>& regs);
+		Handle MaskWriteRegister(uint8_t id, uint16_t addr, uint16_t orMask, uint16_t andMask);
+		Handle ReadFileRecord(uint8_t id, const std::vector<Master::FileReadSubRequest>& requests);
+		Handle WriteFileRecord(uint8_t id, const std::vector<Master::FileWriteSubRequest>& requests);
+
+		/**
+		 * Execute all operations. Error of operation(invalid argument,
+		 * exception responce, timeout) is stored in its result.
+		 * Return:	number of failed operations.
+		 **/
+		size_t Execute(Master& master);
+
+		size_t Size() const;
+
+		/**
+		 * Remove all operations and results.
+		 **/
+		void Clear();
+
+		/**
+		 * Results of last Execute. Typed accessors rethrow operation error.
+		 * Exception:	out_of_range if handle is invalid.
+		 **/
+		const Result& GetResult(Handle handle) const;
+		void Check(Handle handle) const;
+		const std::vector<bool>& Bits(Handle handle) const;
+		const std::vector<uint16_t>& Registers(Handle handle) const;
+		const Master::FileRecords& Records(Handle handle) const;
+
+		/**
+		 * Number of PDUs sent by last Execute.
+		 **/
+		size_t SentPDUs() const;
+
+	private:
+		typedef std::function<void(std::vector<uint8_t>&)> Encoder;
+
+		struct Operation
+		{
+			uint8_t id;
+
+			/**
+			 * Function code for reads 01-04, 0 for operations which are
+			 * never merged.
+			 **/
+			uint8_t read;
+			uint16_t addr;
+			unsigned quantity;
+
+			/**
+			 * Request PDU, or error of encoding.
+			 **/
+			std::vector<uint8_t> request;
+			std::exception_ptr error;
+		};
+
+		/**
+		 * Part of PDU result which belongs to operation.
+		 **/
+		struct Part
+		{
+			size_t operation;
+			unsigned offset;
+		};
+
+		struct Pdu
+		{
+			uint8_t id;
+			uint8_t read;
+			uint16_t addr;
+			unsigned quantity;
+			std::vector<Part> parts;
+
+			std::vector<uint8_t> request;
+			bool broadcast;
+			std::exception_ptr error;
+		};
+
+		Handle add(uint8_t id, uint8_t read, uint16_t addr, unsigned quantity, const Encoder& encode);
+		Handle addRead(uint8_t id, Master::FunctionCodes read, uint16_t addr, unsigned quantity);
+
+		/**
+		 * Merge reads and build list of PDUs in send order.
+		 **/
+		std::vector<Pdu> plan() const;
+
+		/**
+		 * Store PDU result or error into results of its operations.
+		 **/
+		void distribute(const Pdu& pdu, const Result& result);
+
+		/**
+		 * Decode responce of PDU by its function.
+		 **/
+		static void decode(const Pdu& pdu, const std::vector<uint8_t>& responce, Result& result);
+
+		std::vector<Operation> operations;
+		std::vector<Result> results;
+		std::map<uint8_t, DeviceProfile> profiles;
+		unsigned mergeGap;
+		size_t sent;
+	};
+}
+
+#endif	/* _BATCH_H_ */
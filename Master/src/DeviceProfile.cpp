@@ -0,0 +1,619 @@
+/**
+* Learned limits of MODBUS devices
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "DeviceProfile.h"
+#include "MappedFile.h"
+#include "Pdu.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	const unsigned DeviceProfile::Tables;
+
+	/**
+	 * Cache file: magic, version, number of profiles, then profiles.
+	 * Profile: key(8), supported(32), unsupported(32), and for each
+	 * table accepted(2), rejected(2), number of holes(2), holes(4 each).
+	 * Numbers are little endian.
+	 **/
+	static const char CacheMagic[4] = { 'M', 'B', 'P', 'F' };
+	static const uint8_t CacheVersion = 1;
+
+	static unsigned protocol_max(unsigned table)
+	{
+		return table < 2 ? Pdu::MaxReadBits : Pdu::MaxReadRegisters;
+	}
+
+	DeviceProfile::DeviceProfile()
+	{
+		memset(supported, 0, sizeof(supported));
+		memset(unsupported, 0, sizeof(unsupported));
+
+		for (unsigned i = 0; i < Tables; i++)
+		{
+			accepted[i] = 0;
+			rejected[i] = 0;
+		}
+	}
+
+	unsigned DeviceProfile::TableOf(Master::FunctionCodes read)
+	{
+		if (read < Master::FunctionCodes::ReadCoils || read > Master::FunctionCodes::ReadInputRegisters)
+		{
+			throw invalid_argument("Function is not read of table.");
+		}
+
+		return (unsigned)read - 1;
+	}
+
+	bool DeviceProfile::IsSupported(Master::FunctionCodes code) const
+	{
+		return (supported[(uint8_t)code / 8] & (1 << ((uint8_t)code % 8))) != 0;
+	}
+
+	bool DeviceProfile::IsUnsupported(Master::FunctionCodes code) const
+	{
+		return (unsupported[(uint8_t)code / 8] & (1 << ((uint8_t)code % 8))) != 0;
+	}
+
+	void DeviceProfile::SetSupported(Master::FunctionCodes code, bool isSupported)
+	{
+		const uint8_t bit = (uint8_t)(1 << ((uint8_t)code % 8));
+
+		if (isSupported)
+		{
+			supported[(uint8_t)code / 8] |= bit;
+			unsupported[(uint8_t)code / 8] &= ~bit;
+		}
+		else
+		{
+			unsupported[(uint8_t)code / 8] |= bit;
+			supported[(uint8_t)code / 8] &= ~bit;
+		}
+	}
+
+	unsigned DeviceProfile::MaxBlock(Master::FunctionCodes read) const
+	{
+		const unsigned table = TableOf(read);
+
+		if (rejected[table] == 0)
+			return protocol_max(table);
+
+		return max<unsigned>(accepted[table], 1);
+	}
+
+	bool DeviceProfile::IsReadable(Master::FunctionCodes read, uint16_t addr, unsigned quantity) const
+	{
+		const vector<Range>& ranges = holes[TableOf(read)];
+		const unsigned end = addr + quantity;
+
+		for (vector<Range>::const_iterator i = ranges.cbegin(); i != ranges.cend() && i->addr < end; i++)
+		{
+			if ((unsigned)i->addr + i->quantity > addr)
+				return false;
+		}
+
+		return true;
+	}
+
+	void DeviceProfile::AddHole(Master::FunctionCodes read, uint16_t addr, unsigned quantity)
+	{
+		vector<Range>& ranges = holes[TableOf(read)];
+		unsigned first = addr;
+		unsigned end = min<unsigned>(addr + quantity, 0x10000);
+
+		if (end <= first)
+			return;
+
+		/**
+		 * Merge with overlapping and adjoining holes.
+		 **/
+		vector<Range> merged;
+		for (vector<Range>::const_iterator i = ranges.cbegin(); i != ranges.cend(); i++)
+		{
+			const unsigned holeEnd = (unsigned)i->addr + i->quantity;
+
+			if (holeEnd < first || i->addr > end)
+			{
+				merged.push_back(*i);
+				continue;
+			}
+
+			first = min<unsigned>(first, i->addr);
+			end = max(end, holeEnd);
+		}
+
+		/**
+		 * Quantity of hole is 16 bit, so whole table is two holes.
+		 **/
+		while (first < end)
+		{
+			Range range = { (uint16_t)first, (uint16_t)min<unsigned>(end - first, 0xFFFF) };
+			merged.push_back(range);
+			first += range.quantity;
+		}
+
+		sort(merged.begin(), merged.end(), [](const Range& a, const Range& b) { return a.addr < b.addr; });
+		ranges.swap(merged);
+	}
+
+	void DeviceProfile::RemoveHoles(Master::FunctionCodes read, uint16_t addr, unsigned quantity)
+	{
+		vector<Range>& ranges = holes[TableOf(read)];
+		const unsigned end = addr + quantity;
+		vector<Range> rest;
+
+		for (vector<Range>::const_iterator i = ranges.cbegin(); i != ranges.cend(); i++)
+		{
+			const unsigned holeEnd = (unsigned)i->addr + i->quantity;
+
+			if (holeEnd <= addr || i->addr >= end)
+			{
+				rest.push_back(*i);
+				continue;
+			}
+
+			if (i->addr < addr)
+			{
+				Range range = { i->addr, (uint16_t)(addr - i->addr) };
+				rest.push_back(range);
+			}
+
+			if (holeEnd > end)
+			{
+				Range range = { (uint16_t)end, (uint16_t)(holeEnd - end) };
+				rest.push_back(range);
+			}
+		}
+
+		ranges.swap(rest);
+	}
+
+	uint64_t ProfileCache::Key(uint64_t device, uint8_t id)
+	{
+		return (device << 8) | id;
+	}
+
+	ProfileCache::ProfileCache()
+	{
+	}
+
+	bool ProfileCache::Find(uint64_t key, DeviceProfile& profile) const
+	{
+		lock_guard<std::mutex> lock(mutex);
+
+		map<uint64_t, DeviceProfile>::const_iterator i = profiles.find(key);
+		if (i == profiles.end())
+			return false;
+
+		profile = i->second;
+		return true;
+	}
+
+	void ProfileCache::Set(uint64_t key, const DeviceProfile& profile)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		profiles[key] = profile;
+	}
+
+	void ProfileCache::Update(uint64_t key, const function<void(DeviceProfile&)>& update)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		update(profiles[key]);
+	}
+
+	void ProfileCache::Erase(uint64_t key)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		profiles.erase(key);
+	}
+
+	size_t ProfileCache::Size() const
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return profiles.size();
+	}
+
+	static void put(vector<uint8_t>& data, uint64_t value, unsigned size)
+	{
+		for (unsigned i = 0; i < size; i++)
+			data.push_back((uint8_t)(value >> (8 * i)));
+	}
+
+	void ProfileCache::Save(const string& path) const
+	{
+		vector<uint8_t> data(CacheMagic, CacheMagic + sizeof(CacheMagic));
+
+		{
+			lock_guard<std::mutex> lock(mutex);
+
+			data.push_back(CacheVersion);
+			put(data, profiles.size(), 4);
+
+			for (map<uint64_t, DeviceProfile>::const_iterator i = profiles.cbegin(); i != profiles.cend(); i++)
+			{
+				const DeviceProfile& profile = i->second;
+
+				put(data, i->first, 8);
+				data.insert(data.end(), profile.supported, profile.supported + sizeof(profile.supported));
+				data.insert(data.end(), profile.unsupported, profile.unsupported + sizeof(profile.unsupported));
+
+				for (unsigned table = 0; table < DeviceProfile::Tables; table++)
+				{
+					put(data, profile.accepted[table], 2);
+					put(data, profile.rejected[table], 2);
+					put(data, profile.holes[table].size(), 2);
+
+					for (vector<DeviceProfile::Range>::const_iterator hole = profile.holes[table].cbegin();
+						hole != profile.holes[table].cend(); hole++)
+					{
+						put(data, hole->addr, 2);
+						put(data, hole->quantity, 2);
+					}
+				}
+			}
+		}
+
+		const string temporary = path + ".tmp";
+
+		{
+			ofstream file(temporary.c_str(), ios::binary | ios::trunc);
+			file.write((const char*)data.data(), data.size());
+			file.close();
+
+			if (!file)
+			{
+				remove(temporary.c_str());
+				throw runtime_error("Can not write profile cache " + temporary);
+			}
+		}
+
+#ifdef _WIN32
+		remove(path.c_str());
+#endif
+
+		if (rename(temporary.c_str(), path.c_str()) != 0)
+		{
+			remove(temporary.c_str());
+			throw runtime_error("Can not write profile cache " + path);
+		}
+	}
+
+	/**
+	 * Reader of cache file which checks size of each field.
+	 **/
+	class CacheReader
+	{
+	public:
+		CacheReader(const uint8_t* data, size_t size) : data(data), size(size), offset(0)
+		{
+		}
+
+		uint64_t Get(unsigned bytes)
+		{
+			const uint8_t* p = Take(bytes);
+			uint64_t value = 0;
+
+			for (unsigned i = 0; i < bytes; i++)
+				value |= (uint64_t)p[i] << (8 * i);
+
+			return value;
+		}
+
+		const uint8_t* Take(size_t bytes)
+		{
+			if (size - offset < bytes)
+			{
+				throw runtime_error("Invalid profile cache file.");
+			}
+
+			const uint8_t* p = data + offset;
+			offset += bytes;
+			return p;
+		}
+
+	private:
+		const uint8_t* data;
+		size_t size;
+		size_t offset;
+	};
+
+	void ProfileCache::Load(const string& path)
+	{
+		MappedFile file(path, MappedFile::Mode::Read);
+		CacheReader reader(file.Data(), file.Size());
+		map<uint64_t, DeviceProfile> loaded;
+
+		if (memcmp(reader.Take(sizeof(CacheMagic)), CacheMagic, sizeof(CacheMagic)) != 0 ||
+			reader.Get(1) != CacheVersion)
+		{
+			throw runtime_error("Invalid profile cache file.");
+		}
+
+		const uint64_t count = reader.Get(4);
+
+		for (uint64_t n = 0; n < count; n++)
+		{
+			DeviceProfile& profile = loaded[reader.Get(8)];
+
+			memcpy(profile.supported, reader.Take(sizeof(profile.supported)), sizeof(profile.supported));
+			memcpy(profile.unsupported, reader.Take(sizeof(profile.unsupported)), sizeof(profile.unsupported));
+
+			for (unsigned table = 0; table < DeviceProfile::Tables; table++)
+			{
+				profile.accepted[table] = (uint16_t)reader.Get(2);
+				profile.rejected[table] = (uint16_t)reader.Get(2);
+
+				const unsigned holes = (unsigned)reader.Get(2);
+				profile.holes[table].resize(holes);
+
+				/**
+				 * Holes are sorted and do not overlap, IsReadable relies
+				 * on it.
+				 **/
+				unsigned end = 0;
+				for (unsigned i = 0; i < holes; i++)
+				{
+					DeviceProfile::Range& hole = profile.holes[table][i];
+					hole.addr = (uint16_t)reader.Get(2);
+					hole.quantity = (uint16_t)reader.Get(2);
+
+					if (hole.quantity == 0 || hole.addr < end)
+					{
+						throw runtime_error("Invalid profile cache file.");
+					}
+
+					end = (unsigned)hole.addr + hole.quantity;
+				}
+			}
+		}
+
+		lock_guard<std::mutex> lock(mutex);
+		profiles.swap(loaded);
+	}
+
+	ProfilingMaster::ProfilingMaster(Master& master, ProfileCache& cache, uint64_t device)
+		: master(master), cache(cache), device(device)
+	{
+	}
+
+	DeviceProfile ProfilingMaster::GetProfile(uint8_t id) const
+	{
+		DeviceProfile profile;
+		cache.Find(ProfileCache::Key(device, id), profile);
+		return profile;
+	}
+
+	vector<uint8_t> ProfilingMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		vector<uint8_t> responce = master.Transact(id, request);
+		observe(id, request, responce);
+		return responce;
+	}
+
+	void ProfilingMaster::SendPDU(vector<uint8_t> request)
+	{
+		master.Broadcast(request);
+	}
+
+	void ProfilingMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		master.TransactMany(transactions);
+
+		for (vector<Transaction>::const_iterator i = transactions.cbegin(); i != transactions.cend(); i++)
+		{
+			if (!i->error)
+				observe(i->id, i->request, i->responce);
+		}
+	}
+
+	/**
+	* Only well formed responces are learned. Normal responce of read
+	* must have byte count of requested quantity.
+	**/
+	void ProfilingMaster::observe(uint8_t id, const vector<uint8_t>& request, const vector<uint8_t>& responce)
+	{
+		if (request.empty() || responce.empty() || (responce[0] & 0x7F) != request[0])
+			return;
+
+		const FunctionCodes code = (FunctionCodes)request[0];
+		const bool read = code >= FunctionCodes::ReadCoils && code <= FunctionCodes::ReadInputRegisters;
+		uint16_t addr = 0;
+		unsigned quantity = 0;
+
+		if (read)
+		{
+			if (request.size() != 5)
+				return;
+
+			addr = Pdu::GetWord(&request[1]);
+			quantity = Pdu::GetWord(&request[3]);
+		}
+
+		if (responce[0] & 0x80)
+		{
+			if (responce.size() != 2)
+				return;
+
+			const uint8_t exception = responce[1];
+
+			cache.Update(ProfileCache::Key(device, id), [&](DeviceProfile& profile)
+			{
+				if (exception == EException::ILLEGAL_FUNCTION)
+				{
+					profile.SetSupported(code, false);
+					return;
+				}
+
+				if (!read)
+					return;
+
+				const unsigned table = DeviceProfile::TableOf(code);
+
+				if (exception == EException::ILLEGAL_DATA_VALUE && quantity > profile.accepted[table] &&
+					(profile.rejected[table] == 0 || quantity < profile.rejected[table]))
+				{
+					profile.rejected[table] = (uint16_t)quantity;
+				}
+				else if (exception == EException::ILLEGAL_DATA_ADDRESS && quantity == 1)
+				{
+					profile.AddHole(code, addr, 1);
+				}
+			});
+
+			return;
+		}
+
+		if (read)
+		{
+			const bool bits = code <= FunctionCodes::ReadDiscreteInputs;
+			const size_t count = bits ? (quantity + 7) / 8 : 2 * quantity;
+
+			if (quantity == 0 || responce.size() != 2 + count || responce[1] != count)
+				return;
+		}
+
+		cache.Update(ProfileCache::Key(device, id), [&](DeviceProfile& profile)
+		{
+			profile.SetSupported(code, true);
+
+			if (!read)
+				return;
+
+			const unsigned table = DeviceProfile::TableOf(code);
+
+			if (quantity > profile.accepted[table])
+				profile.accepted[table] = (uint16_t)quantity;
+
+			/**
+			 * Device accepted what it rejected before: it was changed.
+			 **/
+			if (profile.rejected[table] != 0 && profile.rejected[table] <= profile.accepted[table])
+				profile.rejected[table] = 0;
+
+			profile.RemoveHoles(code, addr, quantity);
+		});
+	}
+
+	uint8_t ProfilingMaster::probeRead(uint8_t id, FunctionCodes read, uint16_t addr, unsigned quantity)
+	{
+		uint8_t pdu[5];
+		const size_t size = Pdu::EncodeRead(pdu, read, addr, quantity);
+		const vector<uint8_t> responce = Transact(id, vector<uint8_t>(pdu, pdu + size));
+
+		if (responce.size() == 2 && (responce[0] & 0x80) != 0)
+			return responce[1];
+
+		Pdu::CheckException(pdu, size, responce.data(), responce.size());
+		return 0;
+	}
+
+	void ProfilingMaster::probeHoles(uint8_t id, FunctionCodes read, uint16_t addr, unsigned quantity)
+	{
+		if (quantity == 1)
+			return;
+
+		const unsigned half = quantity / 2;
+
+		if (probeRead(id, read, addr, half) != 0)
+			probeHoles(id, read, addr, half);
+
+		if (probeRead(id, read, (uint16_t)(addr + half), quantity - half) != 0)
+			probeHoles(id, read, (uint16_t)(addr + half), quantity - half);
+	}
+
+	void ProfilingMaster::Probe(uint8_t id, FunctionCodes read, uint16_t addr, unsigned quantity)
+	{
+		const unsigned table = DeviceProfile::TableOf(read);
+
+		if (id == IDBroadcast || quantity == 0 || addr + quantity > 0x10000)
+		{
+			throw invalid_argument("Invalid probe range.");
+		}
+
+		/**
+		 * Binary search of block size between largest accepted and
+		 * smallest rejected quantity.
+		 **/
+		const unsigned limit = min(quantity, protocol_max(table));
+		unsigned good = 0;
+		unsigned bad = limit + 1;
+		uint8_t badCode = 0;
+		uint8_t code = probeRead(id, read, addr, limit);
+
+		if (code == EException::ILLEGAL_FUNCTION)
+			return;
+
+		if (code == 0)
+			good = limit;
+		else
+		{
+			bad = limit;
+			badCode = code;
+		}
+
+		while (bad - good > 1)
+		{
+			const unsigned middle = (good + bad) / 2;
+			code = probeRead(id, read, addr, middle);
+
+			if (code == EException::ILLEGAL_FUNCTION)
+				return;
+
+			if (code == 0)
+				good = middle;
+			else
+			{
+				bad = middle;
+				badCode = code;
+			}
+		}
+
+		/**
+		 * Block of good + 1 is rejected either because it is too large
+		 * or because address addr + good is hole. ILLEGAL_DATA_VALUE is
+		 * size limit; devices also reject too large block with
+		 * ILLEGAL_DATA_ADDRESS, so then limit is learned only if that one
+		 * address is readable.
+		 **/
+		bool limited = false;
+
+		if (good > 0 && bad <= limit)
+		{
+			limited = badCode == EException::ILLEGAL_DATA_VALUE ||
+				probeRead(id, read, (uint16_t)(addr + good), 1) == 0;
+		}
+
+		if (limited)
+		{
+			cache.Update(ProfileCache::Key(device, id), [&](DeviceProfile& profile)
+			{
+				profile.accepted[table] = max<uint16_t>(profile.accepted[table], (uint16_t)good);
+				profile.rejected[table] = (uint16_t)max<unsigned>(bad, profile.accepted[table] + 1);
+			});
+		}
+
+		/**
+		 * Scan rest of range. Rejected blocks are split to find holes.
+		 **/
+		const unsigned block = limited ? good : limit;
+		const unsigned end = addr + quantity;
+
+		for (unsigned first = addr + good; first < end; first += block)
+		{
+			const unsigned size = min(block, end - first);
+
+			if (probeRead(id, read, (uint16_t)first, size) != 0)
+				probeHoles(id, read, (uint16_t)first, size);
+		}
+	}
+}
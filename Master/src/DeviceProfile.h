@@ -0,0 +1,206 @@
+/**
+ * Description: Learned limits of MODBUS devices. Many devices reject
+ *				reads of full 125 registers or 2000 bits, some function
+ *				codes, or addresses in holes of their map. Profile keeps
+ *				what device accepted and rejected: supported functions,
+ *				maximum read block and unreadable address ranges of each
+ *				table. ProfilingMaster learns profiles from responces and
+ *				by probing, ProfileCache keeps profiles of many devices and
+ *				saves them to compact binary file, and Batch plans requests
+ *				by profile, so after restart devices are not probed again.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _DEVICE_PROFILE_H_
+#define _DEVICE_PROFILE_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	struct DeviceProfile
+	{
+		/**
+		 * Tables of read functions 01-04. Table index is function code - 1.
+		 **/
+		static const unsigned Tables = 4;
+
+		struct Range
+		{
+			uint16_t addr;
+			uint16_t quantity;
+		};
+
+		/**
+		 * Function codes answered with normal responce and with
+		 * ILLEGAL_FUNCTION, bit per code.
+		 **/
+		uint8_t supported[32];
+		uint8_t unsupported[32];
+
+		/**
+		 * Largest read quantity accepted and smallest quantity rejected
+		 * with ILLEGAL_DATA_VALUE, by table. 0 if unknown.
+		 **/
+		uint16_t accepted[Tables];
+		uint16_t rejected[Tables];
+
+		/**
+		 * Sorted ranges which were rejected with ILLEGAL_DATA_ADDRESS, by
+		 * table.
+		 **/
+		std::vector<Range> holes[Tables];
+
+		DeviceProfile();
+
+		bool IsSupported(Master::FunctionCodes code) const;
+		bool IsUnsupported(Master::FunctionCodes code) const;
+		void SetSupported(Master::FunctionCodes code, bool supported);
+
+		/**
+		 * Largest read which is known to be accepted. If nothing was
+		 * rejected, it is maximum of protocol.
+		 * Exceptions:	invalid_argument if read is not function 01-04.
+		 **/
+		unsigned MaxBlock(Master::FunctionCodes read) const;
+
+		/**
+		 * Range doesn't overlap holes.
+		 **/
+		bool IsReadable(Master::FunctionCodes read, uint16_t addr, unsigned quantity) const;
+
+		void AddHole(Master::FunctionCodes read, uint16_t addr, unsigned quantity);
+		void RemoveHoles(Master::FunctionCodes read, uint16_t addr, unsigned quantity);
+
+		/**
+		 * Table index of read function.
+		 * Exceptions:	invalid_argument if read is not function 01-04.
+		 **/
+		static unsigned TableOf(Master::FunctionCodes read);
+	};
+
+	/**
+	 * Profiles of many devices. Functions are thread safe.
+	 **/
+	class ProfileCache
+	{
+	public:
+		/**
+		 * Key of unit: device is any number which identifies line or
+		 * gateway, for example IPv4 address and port.
+		 **/
+		static uint64_t Key(uint64_t device, uint8_t id);
+
+		ProfileCache();
+
+		/**
+		 * Get profile of unit.
+		 * Return:	false if there is no profile.
+		 **/
+		bool Find(uint64_t key, DeviceProfile& profile) const;
+
+		void Set(uint64_t key, const DeviceProfile& profile);
+
+		/**
+		 * Change profile of unit under lock. Profile is created if there
+		 * is no one.
+		 **/
+		void Update(uint64_t key, const std::function<void(DeviceProfile&)>& update);
+
+		void Erase(uint64_t key);
+		size_t Size() const;
+
+		/**
+		 * Save all profiles. File is written to temporary file first and
+		 * then renamed, so crash doesn't leave broken cache.
+		 * Exceptions:	runtime_error if file can not be written.
+		 **/
+		void Save(const std::string& path) const;
+
+		/**
+		 * Replace profiles with profiles of file.
+		 * Exceptions:	runtime_error if file can not be read or is not
+		 *				profile cache.
+		 **/
+		void Load(const std::string& path);
+
+	private:
+		ProfileCache(const ProfileCache&);
+		ProfileCache& operator=(const ProfileCache&);
+
+		mutable std::mutex mutex;
+		std::map<uint64_t, DeviceProfile> profiles;
+	};
+
+	/**
+	 * Master which learns profiles of units of another master from all
+	 * responces: normal responce marks function supported and read
+	 * quantity accepted, ILLEGAL_FUNCTION marks function unsupported,
+	 * ILLEGAL_DATA_VALUE of read rejects its quantity, ILLEGAL_DATA_ADDRESS
+	 * of single register or bit read marks hole.
+	 **/
+	class ProfilingMaster : public Master
+	{
+	public:
+		/**
+		 * master:	master used for all transactions
+		 * cache:	cache where profiles are learned
+		 * device:	device part of cache keys of units of this master
+		 **/
+		ProfilingMaster(Master& master, ProfileCache& cache, uint64_t device);
+
+		/**
+		 * Learned profile of unit, empty profile if unit is unknown.
+		 **/
+		DeviceProfile GetProfile(uint8_t id) const;
+
+		/**
+		 * Probe read function on range of addresses: find maximum read
+		 * block at start of range, then read whole range by blocks and
+		 * split rejected blocks in halves down to single addresses, so
+		 * holes are found with few requests. Block size is probed at addr,
+		 * so range should start with readable addresses. Probing stops if
+		 * function is unsupported.
+		 * Exceptions:	invalid_argument if read is not function 01-04 or
+		 *				range is invalid; timeout and other errors of master.
+		 **/
+		void Probe(uint8_t id, FunctionCodes read, uint16_t addr, unsigned quantity);
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+	private:
+		ProfilingMaster(const ProfilingMaster&);
+		ProfilingMaster& operator=(const ProfilingMaster&);
+
+		/**
+		 * Learn from responce of transaction.
+		 **/
+		void observe(uint8_t id, const std::vector<uint8_t>& request, const std::vector<uint8_t>& responce);
+
+		/**
+		 * Read range for probing.
+		 * Return:	0 if read is accepted, exception code otherwise.
+		 **/
+		uint8_t probeRead(uint8_t id, FunctionCodes read, uint16_t addr, unsigned quantity);
+
+		/**
+		 * Split rejected range until holes are found.
+		 **/
+		void probeHoles(uint8_t id, FunctionCodes read, uint16_t addr, unsigned quantity);
+
+		Master& master;
+		ProfileCache& cache;
+		uint64_t device;
+	};
+}
+
+#endif	/* _DEVICE_PROFILE_H_ */
@@ -0,0 +1,258 @@
+/**
+* Device discovery
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include "Discovery.h"
+#include "Tcp.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	/**
+	 * Gateway exceptions: gateway answers instead of absent device.
+	 **/
+	static const uint8_t GatewayPathUnavailable = 0x0A;
+	static const uint8_t GatewayTargetFailedToRespond = 0x0B;
+
+	Discovery::Timeout::Timeout(const Settings& settings)
+		: settings(settings), measured(false), srtt(0), rttvar(0)
+	{
+	}
+
+	unsigned Discovery::Timeout::Get() const
+	{
+		if (!measured)
+			return settings.initialTimeout;
+
+		const unsigned timeout = (unsigned)ceil((srtt + 4 * rttvar) / 1000);
+		return min(max(timeout, settings.minTimeout), settings.maxTimeout);
+	}
+
+	void Discovery::Timeout::Update(unsigned latency)
+	{
+		if (!measured)
+		{
+			srtt = latency;
+			rttvar = latency / 2.0;
+			measured = true;
+			return;
+		}
+
+		rttvar = 0.75 * rttvar + 0.25 * fabs(srtt - latency);
+		srtt = 0.875 * srtt + 0.125 * latency;
+	}
+
+	Discovery::Discovery(const Settings& settings) : settings(settings)
+	{
+		if (settings.firstID > settings.lastID || settings.minTimeout > settings.maxTimeout)
+		{
+			throw invalid_argument("Invalid discovery settings.");
+		}
+	}
+
+	Discovery::Inventory Discovery::ScanSerial(const vector<Line>& lines)
+	{
+		vector<Inventory> found(lines.size());
+		vector<thread> threads;
+
+		for (size_t i = 0; i < lines.size(); i++)
+		{
+			threads.push_back(thread([this, &lines, &found, i]()
+			{
+				scan(lines[i].name, *lines[i].master, lines[i].setTimeout, false, found[i]);
+			}));
+		}
+
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+
+		Inventory inventory;
+		for (size_t i = 0; i < found.size(); i++)
+			inventory.insert(inventory.end(), found[i].begin(), found[i].end());
+
+		return inventory;
+	}
+
+	Discovery::Inventory Discovery::ScanTcp(const vector<string>& hosts)
+	{
+		vector<Inventory> found(hosts.size());
+		vector<thread> threads;
+		atomic<size_t> next(0);
+
+		const size_t count = min<size_t>(max(settings.threads, 1u), hosts.size());
+
+		for (size_t t = 0; t < count; t++)
+		{
+			threads.push_back(thread([this, &hosts, &found, &next]()
+			{
+				for (size_t i = next++; i < hosts.size(); i = next++)
+				{
+					unique_ptr<TcpMaster> master;
+
+					try
+					{
+						master.reset(new TcpMaster(hosts[i], settings.port, settings.connectTimeout));
+					}
+					catch (...)
+					{
+						continue;
+					}
+
+					TcpMaster* tcp = master.get();
+					scan(hosts[i], *tcp, [tcp](unsigned timeout) { tcp->SetTimeout(timeout); }, true, found[i]);
+				}
+			}));
+		}
+
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+
+		Inventory inventory;
+		for (size_t i = 0; i < found.size(); i++)
+			inventory.insert(inventory.end(), found[i].begin(), found[i].end());
+
+		return inventory;
+	}
+
+	vector<string> Discovery::IPv4Range(const string& first, const string& last)
+	{
+		uint32_t range[2];
+		const string* addresses[2] = { &first, &last };
+
+		for (int i = 0; i < 2; i++)
+		{
+			unsigned a, b, c, d;
+			char tail;
+
+			if (sscanf(addresses[i]->c_str(), "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 ||
+				a > 255 || b > 255 || c > 255 || d > 255)
+			{
+				throw invalid_argument("Invalid IPv4 address " + *addresses[i]);
+			}
+
+			range[i] = (a << 24) | (b << 16) | (c << 8) | d;
+		}
+
+		if (range[1] < range[0])
+		{
+			throw invalid_argument("Last address is less than first.");
+		}
+
+		vector<string> hosts;
+		char buffer[16];
+
+		for (uint64_t address = range[0]; address <= range[1]; address++)
+		{
+			sprintf(buffer, "%u.%u.%u.%u", (unsigned)(address >> 24) & 0xFF, (unsigned)(address >> 16) & 0xFF,
+				(unsigned)(address >> 8) & 0xFF, (unsigned)address & 0xFF);
+			hosts.push_back(buffer);
+		}
+
+		return hosts;
+	}
+
+	/**
+	 * Probe is Read Exception Status: it has shortest request and responce.
+	 * Devices which do not support it answer with exception, which is
+	 * enough to know they are present.
+	 **/
+	void Discovery::scan(const string& endpoint, Master& master, const function<void(unsigned)>& setTimeout,
+		bool stopOnError, Inventory& inventory)
+	{
+		const vector<uint8_t> probe(1, (uint8_t)Master::FunctionCodes::ReadExceptionStatus);
+		Timeout timeout(settings);
+
+		for (unsigned id = settings.firstID; id <= settings.lastID; id++)
+		{
+			if (setTimeout)
+				setTimeout(timeout.Get());
+
+			const steady_clock::time_point start = steady_clock::now();
+			vector<uint8_t> responce;
+
+			try
+			{
+				responce = master.Transact((uint8_t)id, probe);
+			}
+			catch (const ETimeout&)
+			{
+				continue;
+			}
+			catch (const EPDUFrameError&)
+			{
+				continue;
+			}
+			catch (...)
+			{
+				if (stopOnError)
+					return;
+
+				continue;
+			}
+
+			const unsigned latency = (unsigned)duration_cast<microseconds>(steady_clock::now() - start).count();
+
+			if (responce.size() == Master::ExceptionResponcePDUSize && (responce[0] & 0x80) != 0 &&
+				(responce[1] == GatewayPathUnavailable || responce[1] == GatewayTargetFailedToRespond))
+			{
+				continue;
+			}
+
+			timeout.Update(latency);
+
+			Device device;
+			device.endpoint = endpoint;
+			device.id = (uint8_t)id;
+			device.latency = latency;
+			device.hasServerID = false;
+			device.hasIdentification = false;
+
+			if (settings.identify)
+			{
+				if (setTimeout)
+					setTimeout(settings.maxTimeout);
+
+				identify(master, device);
+			}
+
+			inventory.push_back(device);
+		}
+	}
+
+	/**
+	 * Identification functions are optional, so errors only mean that
+	 * device does not support them.
+	 **/
+	void Discovery::identify(Master& master, Device& device)
+	{
+		try
+		{
+			device.identification = master.ReadDeviceIdentification(device.id);
+			device.hasIdentification = true;
+		}
+		catch (...)
+		{
+		}
+
+		try
+		{
+			device.serverID = master.ReportServerID(device.id);
+			device.hasServerID = true;
+		}
+		catch (...)
+		{
+		}
+	}
+}
@@ -0,0 +1,167 @@
+/**
+ * Description: Device discovery. Probe unit IDs on serial lines and
+ *				hosts x unit IDs over MODBUS/TCP concurrently, and collect
+ *				inventory of responsive devices with their identification.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _DISCOVERY_H_
+#define _DISCOVERY_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	class Discovery
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Probed unit IDs
+			 **/
+			uint8_t firstID;
+			uint8_t lastID;
+
+			/**
+			 * Probe timeout, ms. It starts from initialTimeout and follows
+			 * responce time of found devices within minTimeout-maxTimeout.
+			 * Identification requests use maxTimeout.
+			 **/
+			unsigned initialTimeout;
+			unsigned minTimeout;
+			unsigned maxTimeout;
+
+			/**
+			 * TCP port, connect timeout(ms) and number of hosts scanned
+			 * at the same time.
+			 **/
+			uint16_t port;
+			unsigned connectTimeout;
+			unsigned threads;
+
+			/**
+			 * Read server ID and device identification of found devices.
+			 **/
+			bool identify;
+
+			Settings() : firstID(1), lastID(247), initialTimeout(100), minTimeout(20), maxTimeout(1000),
+				port(502), connectTimeout(300), threads(64), identify(true)
+			{
+			}
+		};
+
+		/**
+		 * Serial line to scan. setTimeout sets responce timeout of master,
+		 * ms. If it is empty, timeout is not adapted.
+		 **/
+		struct Line
+		{
+			std::string name;
+			Master* master;
+			std::function<void(unsigned)> setTimeout;
+		};
+
+		/**
+		 * Make line from master with SetTimeout(RtuMaster, AsciiMaster).
+		 **/
+		template <class T>
+		static Line MakeLine(const std::string& name, T& master)
+		{
+			Line line;
+			line.name = name;
+			line.master = &master;
+			line.setTimeout = [&master](unsigned timeout) { master.SetTimeout(timeout); };
+			return line;
+		}
+
+		struct Device
+		{
+			/**
+			 * Line name or host
+			 **/
+			std::string endpoint;
+			uint8_t id;
+
+			/**
+			 * Probe responce time, us
+			 **/
+			unsigned latency;
+
+			bool hasServerID;
+			Master::ServerID serverID;
+
+			bool hasIdentification;
+			Master::DeviceIdentification identification;
+		};
+
+		typedef std::vector<Device> Inventory;
+
+		explicit Discovery(const Settings& settings = Settings());
+
+		/**
+		 * Scan serial lines, each line in its own thread. Devices on one
+		 * line are probed one by one, because line is half-duplex.
+		 * Return:	devices in order of lines and IDs.
+		 **/
+		Inventory ScanSerial(const std::vector<Line>& lines);
+
+		/**
+		 * Scan hosts concurrently. Hosts which do not accept connection
+		 * are skipped.
+		 * Return:	devices in order of hosts and IDs.
+		 **/
+		Inventory ScanTcp(const std::vector<std::string>& hosts);
+
+		/**
+		 * Return IPv4 addresses from first to last inclusive.
+		 * Exception:	invalid_argument if address is invalid or last < first.
+		 **/
+		static std::vector<std::string> IPv4Range(const std::string& first, const std::string& last);
+
+	private:
+		/**
+		 * Adaptive probe timeout from smoothed responce time and its
+		 * deviation, like TCP retransmission timeout.
+		 **/
+		class Timeout
+		{
+		public:
+			explicit Timeout(const Settings& settings);
+
+			/**
+			 * Return:	timeout, ms
+			 **/
+			unsigned Get() const;
+
+			/**
+			 * latency:	responce time, us
+			 **/
+			void Update(unsigned latency);
+
+		private:
+			const Settings& settings;
+			bool measured;
+			double srtt;
+			double rttvar;
+		};
+
+		/**
+		 * Probe IDs through master and add found devices to inventory.
+		 * Scan stops on transport error other than timeout, when
+		 * stopOnError is set.
+		 **/
+		void scan(const std::string& endpoint, Master& master, const std::function<void(unsigned)>& setTimeout,
+			bool stopOnError, Inventory& inventory);
+
+		void identify(Master& master, Device& device);
+
+		Settings settings;
+	};
+}
+
+#endif	/* _DISCOVERY_H_ */
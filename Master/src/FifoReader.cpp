@@ -0,0 +1,159 @@
+/**
+* Continuous FIFO drain over Read FIFO Queue
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include "FifoReader.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	/**
+	 * Interval is tuned to read this many values per poll.
+	 **/
+	static const unsigned TargetFill = Master::FIFOCountMax / 2;
+
+	FifoReader::FifoReader(Master& master, const Settings& settings)
+		: master(master), settings(settings), ring(settings.capacity), running(false)
+	{
+		if (settings.minInterval > settings.maxInterval)
+		{
+			throw invalid_argument("Minimum interval is more than maximum.");
+		}
+
+		statistic = Statistic();
+		statistic.interval = settings.minInterval;
+	}
+
+	FifoReader::~FifoReader()
+	{
+		Stop();
+	}
+
+	void FifoReader::Start()
+	{
+		if (running)
+			return;
+
+		running = true;
+		pollThread = thread(&FifoReader::pollLoop, this);
+	}
+
+	void FifoReader::Stop()
+	{
+		if (!running)
+			return;
+
+		{
+			lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		stopped.notify_all();
+
+		pollThread.join();
+	}
+
+	bool FifoReader::Pop(uint16_t& value)
+	{
+		return ring.Pop(value);
+	}
+
+	size_t FifoReader::Pop(uint16_t* values, size_t count)
+	{
+		return ring.Pop(values, count);
+	}
+
+	FifoReader::Statistic FifoReader::GetStatistic()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return statistic;
+	}
+
+	/**
+	 * FIFO fills at about count/elapsed values per us, so interval is
+	 * scaled to get TargetFill values next time. Full FIFO only gives
+	 * lower bound of rate, so interval is halved. Empty FIFO gives no
+	 * rate, so interval is doubled, except read right after full one,
+	 * which only drains rest of FIFO.
+	 **/
+	unsigned FifoReader::nextInterval(unsigned interval, unsigned elapsed, size_t count, bool drain) const
+	{
+		unsigned long long next;
+
+		if (count == Master::FIFOCountMax)
+			next = interval / 2;
+		else if (count == 0)
+			next = drain ? interval : (unsigned long long)interval * 2;
+		else
+			next = (unsigned long long)max(elapsed, 1u) * TargetFill / count;
+
+		next = max<unsigned long long>(next, settings.minInterval);
+		next = min<unsigned long long>(next, settings.maxInterval);
+
+		return (unsigned)next;
+	}
+
+	void FifoReader::pollLoop()
+	{
+		unsigned interval = settings.minInterval;
+		steady_clock::time_point last = steady_clock::now();
+		bool full = false;
+
+		while (running)
+		{
+			const bool drain = full;
+			full = false;
+
+			try
+			{
+				vector<uint16_t> values = master.ReadFIFOQueue(settings.id, settings.address);
+				const size_t pushed = values.empty() ? 0 : ring.Push(values.data(), values.size());
+
+				/**
+				 * Values are counted from previous read, so elapsed time
+				 * includes transaction time.
+				 **/
+				const steady_clock::time_point now = steady_clock::now();
+				const unsigned elapsed = (unsigned)duration_cast<microseconds>(now - last).count();
+				last = now;
+
+				full = values.size() == Master::FIFOCountMax;
+				interval = nextInterval(interval, elapsed, values.size(), drain);
+
+				lock_guard<std::mutex> lock(mutex);
+				statistic.reads++;
+				statistic.fullReads += full ? 1 : 0;
+				statistic.values += values.size();
+				statistic.dropped += values.size() - pushed;
+				statistic.interval = interval;
+			}
+			catch (...)
+			{
+				/**
+				 * Device does not answer or FIFO is not accessible: back
+				 * off as for empty FIFO.
+				 **/
+				interval = settings.maxInterval;
+
+				lock_guard<std::mutex> lock(mutex);
+				statistic.errors++;
+				statistic.interval = interval;
+			}
+
+			/**
+			 * Full FIFO may have more values waiting, so it is read again
+			 * back-to-back.
+			 **/
+			if (full)
+				continue;
+
+			unique_lock<std::mutex> lock(mutex);
+			stopped.wait_for(lock, microseconds(interval), [this]() { return !running; });
+		}
+	}
+}
@@ -0,0 +1,115 @@
+/**
+ * Description: Continuous FIFO drain over Read FIFO Queue. Poll interval
+ *				adapts to FIFO fill level: full FIFO is read again at once,
+ *				empty FIFO backs off. Values are passed to consumer through
+ *				lock-free SPSC ring.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _FIFO_READER_H_
+#define _FIFO_READER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "Master.h"
+#include "SpscRing.h"
+
+namespace Modbus
+{
+	class FifoReader
+	{
+	public:
+		struct Settings
+		{
+			uint8_t id;
+
+			/**
+			 * FIFO pointer address
+			 **/
+			uint16_t address;
+
+			/**
+			 * Poll interval limits, us. Interval is chosen to read FIFO
+			 * about half full; full FIFO is read without delay.
+			 **/
+			unsigned minInterval;
+			unsigned maxInterval;
+
+			/**
+			 * Ring capacity, values.
+			 **/
+			size_t capacity;
+
+			Settings() : id(1), address(0), minInterval(1000), maxInterval(100000), capacity(4096)
+			{
+			}
+		};
+
+		struct Statistic
+		{
+			uint64_t reads;
+			uint64_t fullReads;
+			uint64_t values;
+
+			/**
+			 * Values lost because consumer did not empty ring.
+			 **/
+			uint64_t dropped;
+			uint64_t errors;
+
+			/**
+			 * Current poll interval, us.
+			 **/
+			unsigned interval;
+		};
+
+		/**
+		 * master:	master used for polling. It must be used only by
+		 *			reader while reader is running.
+		 **/
+		FifoReader(Master& master, const Settings& settings);
+		~FifoReader();
+
+		void Start();
+		void Stop();
+
+		/**
+		 * Consumer side. Must be called from one thread.
+		 * Return:	false or 0 if no values.
+		 **/
+		bool Pop(uint16_t& value);
+		size_t Pop(uint16_t* values, size_t count);
+
+		Statistic GetStatistic();
+
+	private:
+		FifoReader(const FifoReader&);
+		FifoReader& operator=(const FifoReader&);
+
+		void pollLoop();
+
+		/**
+		 * Return next poll interval.
+		 * elapsed:	time since previous read, us
+		 * count:	number of read values
+		 * drain:	previous read returned full FIFO
+		 **/
+		unsigned nextInterval(unsigned interval, unsigned elapsed, size_t count, bool drain) const;
+
+		Master& master;
+		Settings settings;
+		SpscRing<uint16_t> ring;
+
+		std::mutex mutex;
+		std::condition_variable stopped;
+		Statistic statistic;
+
+		std::atomic<bool> running;
+		std::thread pollThread;
+	};
+}
+
+#endif	/* _FIFO_READER_H_ */
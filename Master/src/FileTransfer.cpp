@@ -0,0 +1,301 @@
+/**
+* Bulk file transfer over File Record functions
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "FileTransfer.h"
+#include "Pdu.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	static const unsigned SubRequestSize = 7;
+	static const unsigned SubResponceHeaderSize = 2;
+
+	static void push_word(vector<uint8_t>& pdu, uint16_t word)
+	{
+		pdu.push_back((uint8_t)(word >> 8));
+		pdu.push_back((uint8_t)word);
+	}
+
+	/**
+	 * Check that range is not empty and does not pass last record.
+	 **/
+	static void check_range(const FileTransfer::Range& range)
+	{
+		if (range.Count == 0 || range.StartingRecord > Master::FileRecordMax ||
+			range.Count - 1 > (unsigned)(Master::FileRecordMax - range.StartingRecord))
+		{
+			throw invalid_argument("Record number out of range.");
+		}
+	}
+
+	const unsigned FileTransfer::DefaultWindow;
+	const unsigned FileTransfer::MaxReadRecords;
+	const unsigned FileTransfer::MaxReadSubRequests;
+	const unsigned FileTransfer::MaxWriteRecords;
+
+	FileTransfer::FileTransfer(Master& master) : master(master), window(DefaultWindow)
+	{
+	}
+
+	void FileTransfer::SetWindow(unsigned window)
+	{
+		if (window == 0)
+		{
+			throw invalid_argument("Window must be more than 0.");
+		}
+
+		this->window = window;
+	}
+
+	unsigned FileTransfer::GetWindow() const
+	{
+		return window;
+	}
+
+	/**
+	 * Greedy packing. Responce limit is reached first: 2 bytes of PDU
+	 * header, then 2 bytes of header and 2 bytes per record for each
+	 * sub-request. Request limit(35 sub-requests) matters only for many
+	 * short ranges.
+	 **/
+	FileTransfer::ReadPlan FileTransfer::PlanRead(const vector<Range>& ranges)
+	{
+		ReadPlan plan;
+		vector<Master::FileReadSubRequest> pdu;
+		unsigned budget = Master::PDU_MAX_SIZE - 2;
+
+		for (vector<Range>::const_iterator i = ranges.cbegin(); i != ranges.cend(); i++)
+		{
+			check_range(*i);
+
+			unsigned record = i->StartingRecord;
+			unsigned left = i->Count;
+
+			while (left > 0)
+			{
+				if (pdu.size() == MaxReadSubRequests || budget < SubResponceHeaderSize + 2)
+				{
+					plan.push_back(pdu);
+					pdu.clear();
+					budget = Master::PDU_MAX_SIZE - 2;
+				}
+
+				unsigned n = min(left, (budget - SubResponceHeaderSize) / 2);
+				Master::FileReadSubRequest sub = { i->FileNumber, (uint16_t)record, (uint16_t)n };
+				pdu.push_back(sub);
+
+				budget -= SubResponceHeaderSize + n * 2;
+				record += n;
+				left -= n;
+			}
+		}
+
+		if (!pdu.empty())
+			plan.push_back(pdu);
+
+		return plan;
+	}
+
+	void FileTransfer::Download(uint8_t id, const vector<Range>& ranges, const Sink& sink)
+	{
+		if (id == Master::IDBroadcast)
+		{
+			throw invalid_argument("Read File Record with broadcast ID.");
+		}
+
+		ReadPlan plan = PlanRead(ranges);
+		vector<Master::Transaction> transactions;
+
+		for (size_t first = 0; first < plan.size(); first += window)
+		{
+			const size_t last = min(plan.size(), first + window);
+
+			/**
+			 * Transactions are reused between windows, so request and
+			 * responce buffers keep their capacity.
+			 **/
+			transactions.resize(last - first);
+
+			for (size_t p = first; p < last; p++)
+			{
+				Master::Transaction& t = transactions[p - first];
+
+				t.id = id;
+				Pdu::EncodeReadFileRecord(t.request, plan[p]);
+			}
+
+			master.TransactMany(transactions);
+
+			for (size_t p = first; p < last; p++)
+			{
+				const Master::Transaction& t = transactions[p - first];
+				const vector<Master::FileReadSubRequest>& subs = plan[p];
+
+				if (t.error)
+				{
+					rethrow_exception(t.error);
+				}
+
+				/**
+				 * Whole responce is checked before sink gets any data of
+				 * this PDU.
+				 **/
+				Pdu::CheckReadFileRecord(t.request, t.responce);
+
+				unsigned pos = 2;
+				for (vector<Master::FileReadSubRequest>::const_iterator s = subs.cbegin(); s != subs.cend(); s++)
+				{
+					sink(s->FileNumber, s->StartingRecord, t.responce.data() + pos + SubResponceHeaderSize, s->Length);
+					pos += SubResponceHeaderSize + s->Length * 2;
+				}
+			}
+		}
+	}
+
+	void FileTransfer::Download(uint8_t id, uint16_t fileNumber, uint16_t startingRecord, unsigned count,
+		ostream& out)
+	{
+		vector<Range> ranges(1);
+		ranges[0].FileNumber = fileNumber;
+		ranges[0].StartingRecord = startingRecord;
+		ranges[0].Count = count;
+
+		Download(id, ranges, [&out](uint16_t, uint16_t, const uint8_t* data, unsigned records)
+		{
+			out.write((const char*)data, records * 2);
+		});
+	}
+
+	void FileTransfer::Download(uint8_t id, uint16_t fileNumber, uint16_t startingRecord, unsigned count,
+		MappedFile& file, size_t offset)
+	{
+		if (offset > file.Size() || (file.Size() - offset) / 2 < count)
+		{
+			throw out_of_range("Records do not fit into file.");
+		}
+
+		vector<Range> ranges(1);
+		ranges[0].FileNumber = fileNumber;
+		ranges[0].StartingRecord = startingRecord;
+		ranges[0].Count = count;
+
+		uint8_t* base = file.Data() + offset;
+
+		Download(id, ranges, [base, startingRecord](uint16_t, uint16_t record, const uint8_t* data, unsigned records)
+		{
+			copy(data, data + records * 2, base + (record - startingRecord) * 2);
+		});
+	}
+
+	/**
+	 * Upload is one continuous range, so one sub-request per PDU is the
+	 * tightest packing: second sub-request would cost 7 bytes of header.
+	 **/
+	void FileTransfer::Upload(uint8_t id, uint16_t fileNumber, uint16_t startingRecord,
+		const uint8_t* data, size_t size, bool verify)
+	{
+		const uint8_t funcCode = (uint8_t)Master::FunctionCodes::WriteFileRecord;
+
+		if (size == 0)
+		{
+			throw invalid_argument("No data.");
+		}
+
+		if ((size + 1) / 2 > Master::FileRecordMax + 1u)
+		{
+			throw invalid_argument("Record number out of range.");
+		}
+
+		Range range = { fileNumber, startingRecord, (unsigned)((size + 1) / 2) };
+		check_range(range);
+
+		if (verify && id == Master::IDBroadcast)
+		{
+			throw invalid_argument("Broadcast upload can not be verified.");
+		}
+
+		vector<Master::Transaction> transactions;
+		unsigned record = 0;
+
+		while (record < range.Count)
+		{
+			transactions.resize(min((range.Count - record + MaxWriteRecords - 1) / MaxWriteRecords, window));
+
+			for (vector<Master::Transaction>::iterator t = transactions.begin(); t != transactions.end(); t++)
+			{
+				const unsigned n = min(range.Count - record, MaxWriteRecords);
+				const size_t offset = record * 2;
+				const size_t bytes = min(size - offset, (size_t)n * 2);
+
+				t->id = id;
+				t->request.clear();
+				t->request.push_back(funcCode);
+				t->request.push_back((uint8_t)(SubRequestSize + n * 2));
+				t->request.push_back(Master::FileReferenceType);
+				push_word(t->request, fileNumber);
+				push_word(t->request, (uint16_t)(startingRecord + record));
+				push_word(t->request, (uint16_t)n);
+				t->request.insert(t->request.end(), data + offset, data + offset + bytes);
+
+				if (bytes < n * 2)
+					t->request.push_back(0);
+
+				record += n;
+			}
+
+			if (id == Master::IDBroadcast)
+			{
+				for (vector<Master::Transaction>::const_iterator t = transactions.cbegin(); t != transactions.cend(); t++)
+					master.Broadcast(t->request);
+
+				continue;
+			}
+
+			master.TransactMany(transactions);
+
+			for (vector<Master::Transaction>::const_iterator t = transactions.cbegin(); t != transactions.cend(); t++)
+			{
+				if (t->error)
+				{
+					rethrow_exception(t->error);
+				}
+
+				Pdu::CheckResponce(t->request, t->responce);
+			}
+		}
+
+		if (!verify)
+			return;
+
+		Download(id, vector<Range>(1, range), [data, size, startingRecord](uint16_t, uint16_t record, const uint8_t* readData, unsigned records)
+		{
+			const size_t offset = (size_t)(record - startingRecord) * 2;
+			const size_t bytes = min(size - offset, (size_t)records * 2);
+
+			if (memcmp(data + offset, readData, bytes) != 0)
+			{
+				throw runtime_error("Read back records differ from uploaded data.");
+			}
+		});
+	}
+
+	void FileTransfer::Upload(uint8_t id, uint16_t fileNumber, uint16_t startingRecord,
+		const MappedFile& file, bool verify)
+	{
+		Upload(id, fileNumber, startingRecord, file.Data(), file.Size(), verify);
+	}
+
+	void FileTransfer::Upload(uint8_t id, uint16_t fileNumber, uint16_t startingRecord,
+		const string& path, bool verify)
+	{
+		MappedFile file(path, MappedFile::Mode::Read);
+		Upload(id, fileNumber, startingRecord, file, verify);
+	}
+}
@@ -0,0 +1,134 @@
+/**
+ * Description: Bulk file transfer over File Record functions. Record
+ *				ranges are split into sub-requests packed as tight as
+ *				PDU_MAX_SIZE allows, and PDUs are sent through TransactMany,
+ *				so they are pipelined where transport supports it.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _FILE_TRANSFER_H_
+#define _FILE_TRANSFER_H_
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Master.h"
+#include "MappedFile.h"
+
+namespace Modbus
+{
+	class FileTransfer
+	{
+	public:
+		/**
+		 * Constants
+		 **/
+		static const unsigned DefaultWindow = 8;
+
+		/**
+		 * Maximum records in one sub-request and sub-requests in one
+		 * Read File Record PDU.
+		 **/
+		static const unsigned MaxReadRecords = 124;
+		static const unsigned MaxReadSubRequests = 35;
+
+		/**
+		 * Maximum records in one Write File Record sub-request.
+		 **/
+		static const unsigned MaxWriteRecords = 122;
+
+		/**
+		 * Continuous range of records in one file.
+		 **/
+		struct Range
+		{
+			uint16_t FileNumber;
+			uint16_t StartingRecord;
+			unsigned Count;
+		};
+
+		/**
+		 * Receiver of downloaded records. Data points to records in
+		 * responce PDU(big-endian, 2 bytes per record) and is valid only
+		 * during the call. Records are delivered in order.
+		 **/
+		typedef std::function<void(uint16_t fileNumber, uint16_t record,
+			const uint8_t* data, unsigned records)> Sink;
+
+		typedef std::vector<std::vector<Master::FileReadSubRequest>> ReadPlan;
+
+		explicit FileTransfer(Master& master);
+
+		/**
+		 * Set number of PDUs passed to TransactMany at once.
+		 * Exception:	invalid_argument if window is 0.
+		 **/
+		void SetWindow(unsigned window);
+		unsigned GetWindow() const;
+
+		/**
+		 * Download record ranges.
+		 * Exceptions:	invalid_argument if range is empty or out of record numbers,
+		 *				EException, EPDUFrameError, ETimeout and transport errors
+		 *				of the first failed PDU. Records before it are
+		 *				already delivered to sink.
+		 **/
+		void Download(uint8_t id, const std::vector<Range>& ranges, const Sink& sink);
+
+		/**
+		 * Download records of one file and write them to stream.
+		 **/
+		void Download(uint8_t id, uint16_t fileNumber, uint16_t startingRecord, unsigned count,
+			std::ostream& out);
+
+		/**
+		 * Download records of one file into mapped file at offset.
+		 * Exception:	out_of_range if records do not fit into file.
+		 **/
+		void Download(uint8_t id, uint16_t fileNumber, uint16_t startingRecord, unsigned count,
+			MappedFile& file, size_t offset = 0);
+
+		/**
+		 * Upload data to file records starting from startingRecord, 2 bytes
+		 * per record. Odd last byte is padded with zero. Records are copied
+		 * from data straight into request PDUs.
+		 * verify:		read records back and compare them with data.
+		 * Exceptions:	invalid_argument if data is empty, does not fit into
+		 *				record numbers or broadcast upload is verified.
+		 *				runtime_error if verification fails.
+		 *				EException, EPDUFrameError, ETimeout and transport errors
+		 *				of the first failed PDU.
+		 **/
+		void Upload(uint8_t id, uint16_t fileNumber, uint16_t startingRecord,
+			const uint8_t* data, size_t size, bool verify = false);
+
+		/**
+		 * Upload mapped file.
+		 **/
+		void Upload(uint8_t id, uint16_t fileNumber, uint16_t startingRecord,
+			const MappedFile& file, bool verify = false);
+
+		/**
+		 * Map local file and upload it.
+		 **/
+		void Upload(uint8_t id, uint16_t fileNumber, uint16_t startingRecord,
+			const std::string& path, bool verify = false);
+
+		/**
+		 * Split ranges into Read File Record PDUs. Each PDU gets as many
+		 * records as request and responce size limits allow.
+		 **/
+		static ReadPlan PlanRead(const std::vector<Range>& ranges);
+
+	private:
+		FileTransfer(const FileTransfer&);
+		FileTransfer& operator=(const FileTransfer&);
+
+		Master& master;
+		unsigned window;
+	};
+}
+
+#endif	/* _FILE_TRANSFER_H_ */
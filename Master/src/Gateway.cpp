@@ -0,0 +1,409 @@
+/**
+* MODBUS/TCP to serial line gateway
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <stdexcept>
+#include "Gateway.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	/**
+	 * Constants
+	 **/
+	static const int MBAPHeaderSize = 7;
+	static const unsigned PollInterval = 100;
+	static const uint8_t BroadcastUnit = 0;
+
+	Gateway::Gateway(Master& master, const Settings& settings)
+		: master(master), settings(settings), nextClientID(1), lastServedID(0),
+		pending(0), running(false)
+	{
+		statistic = Statistic();
+	}
+
+	Gateway::~Gateway()
+	{
+		Stop();
+	}
+
+	/**
+	* Start listening and forwarding.
+	**/
+	void Gateway::Start()
+	{
+		if (running)
+			return;
+
+		listener.Listen(settings.address, settings.port);
+		listener.SetNonBlocking(true);
+
+		running = true;
+		networkThread = thread(&Gateway::networkLoop, this);
+		dispatchThread = thread(&Gateway::dispatchLoop, this);
+	}
+
+	/**
+	* Stop gateway and close all connections.
+	**/
+	void Gateway::Stop()
+	{
+		if (!running)
+			return;
+
+		{
+			lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		queued.notify_all();
+
+		networkThread.join();
+		dispatchThread.join();
+
+		listener.Close();
+
+		lock_guard<std::mutex> lock(mutex);
+		clients.clear();
+		pending = 0;
+	}
+
+	Gateway::Statistic Gateway::GetStatistic()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		Statistic s = statistic;
+		s.clients = clients.size();
+		return s;
+	}
+
+	/**
+	* Accept clients and read requests.
+	**/
+	void Gateway::networkLoop()
+	{
+		while (running)
+		{
+			vector<Socket::PollEntry> entries;
+			vector<ClientPtr> polled;
+
+			Socket::PollEntry listenEntry = { listener.Handle(), false };
+			entries.push_back(listenEntry);
+
+			{
+				lock_guard<std::mutex> lock(mutex);
+				for (auto i = clients.cbegin(); i != clients.cend(); i++)
+				{
+					Socket::PollEntry e = { i->second->socket.Handle(), false };
+					entries.push_back(e);
+					polled.push_back(i->second);
+				}
+			}
+
+			if (Socket::Poll(entries, PollInterval) == 0)
+				continue;
+
+			if (entries[0].readable)
+			{
+				for (;;)
+				{
+					Socket s = listener.Accept();
+					if (!s.IsValid())
+						break;
+
+					lock_guard<std::mutex> lock(mutex);
+					if (clients.size() >= settings.maxClients)
+						continue;
+
+					s.SetNonBlocking(true);
+
+					ClientPtr client = make_shared<Client>();
+					client->id = nextClientID++;
+					client->socket = move(s);
+					client->closed = false;
+					clients[client->id] = client;
+				}
+			}
+
+			for (size_t i = 0; i < polled.size(); i++)
+			{
+				if (!entries[i + 1].readable || readClient(polled[i]))
+					continue;
+
+				/**
+				 * Disconnect client. Its queued requests are dropped.
+				 **/
+				const ClientPtr& client = polled[i];
+				{
+					lock_guard<std::mutex> lock(mutex);
+					pending -= client->queue.size();
+					client->queue.clear();
+					clients.erase(client->id);
+				}
+
+				lock_guard<std::mutex> lock(client->sendMutex);
+				client->closed = true;
+				client->socket.Close();
+			}
+		}
+	}
+
+	/**
+	* Read data from client and queue complete requests.
+	**/
+	bool Gateway::readClient(const ClientPtr& client)
+	{
+		uint8_t buffer[1024];
+		size_t n;
+
+		try
+		{
+			n = client->socket.Receive(buffer, sizeof(buffer), 0);
+		}
+		catch (const ETimeout&)
+		{
+			return true;
+		}
+		catch (const exception&)
+		{
+			return false;
+		}
+
+		vector<uint8_t>& rx = client->rxBuffer;
+		rx.insert(rx.end(), buffer, buffer + n);
+
+		size_t offset = 0;
+		while (rx.size() - offset >= MBAPHeaderSize)
+		{
+			const uint8_t* h = rx.data() + offset;
+			const uint16_t protocol = ((uint16_t)h[2] << 8) | h[3];
+			const uint16_t length = ((uint16_t)h[4] << 8) | h[5];
+
+			if (protocol != 0 || length < 2 || length > Master::PDU_MAX_SIZE + 1)
+			{
+				return false;
+			}
+
+			if (rx.size() - offset < 6u + length)
+				break;
+
+			Request request;
+			request.transaction = ((uint16_t)h[0] << 8) | h[1];
+			request.unit = h[6];
+			request.pdu.assign(h + MBAPHeaderSize, h + 6 + length);
+			request.deadline = steady_clock::now() + milliseconds(settings.requestTimeout);
+
+			offset += 6 + length;
+
+			bool rejected = false;
+			{
+				lock_guard<std::mutex> lock(mutex);
+
+				/**
+				 * Client dropped by dispatch thread.
+				 **/
+				if (clients.find(client->id) == clients.end())
+					return false;
+
+				statistic.requests++;
+
+				if (client->queue.size() >= settings.maxQueuedPerClient)
+				{
+					statistic.rejected++;
+					rejected = true;
+				}
+				else
+				{
+					client->queue.push_back(request);
+					pending++;
+				}
+			}
+
+			if (rejected)
+				sendException(client, request, EException::SERVER_DEVICE_BUSY);
+			else
+				queued.notify_one();
+		}
+
+		rx.erase(rx.begin(), rx.begin() + offset);
+
+		return true;
+	}
+
+	/**
+	* Pick next request by round robin between clients. Each client
+	* get one request per round, so client with long queue can not
+	* starve others. Mutex must be locked.
+	**/
+	bool Gateway::nextRequest(ClientPtr& client, Request& request)
+	{
+		if (pending == 0)
+			return false;
+
+		auto i = clients.upper_bound(lastServedID);
+
+		for (size_t n = 0; n <= clients.size(); n++)
+		{
+			if (i == clients.end())
+				i = clients.begin();
+
+			if (!i->second->queue.empty())
+			{
+				client = i->second;
+				request = client->queue.front();
+				client->queue.pop_front();
+				pending--;
+				lastServedID = client->id;
+				return true;
+			}
+
+			i++;
+		}
+
+		return false;
+	}
+
+	/**
+	* Forward queued requests to master.
+	**/
+	void Gateway::dispatchLoop()
+	{
+		for (;;)
+		{
+			ClientPtr client;
+			Request request;
+
+			{
+				unique_lock<std::mutex> lock(mutex);
+				queued.wait(lock, [this]() { return !running || pending > 0; });
+
+				if (!running)
+					break;
+
+				if (!nextRequest(client, request))
+					continue;
+			}
+
+			if (steady_clock::now() > request.deadline)
+			{
+				{
+					lock_guard<std::mutex> lock(mutex);
+					statistic.expired++;
+				}
+
+				sendException(client, request, EException::TARGET_DEVICE_FAILED_TO_RESPONCE);
+				continue;
+			}
+
+			try
+			{
+				if (request.unit == BroadcastUnit)
+				{
+					master.Broadcast(request.pdu);
+					continue;
+				}
+
+				vector<uint8_t> responce = master.Transact(request.unit, request.pdu);
+				sendResponce(client, request, responce);
+			}
+			catch (const ETimeout&)
+			{
+				{
+					lock_guard<std::mutex> lock(mutex);
+					statistic.timeouts++;
+				}
+
+				sendException(client, request, EException::TARGET_DEVICE_FAILED_TO_RESPONCE);
+			}
+			catch (const EPDUFrameError&)
+			{
+				sendException(client, request, EException::TARGET_DEVICE_FAILED_TO_RESPONCE);
+			}
+			catch (const exception&)
+			{
+				sendException(client, request, EException::GATEWAY_PATH_UNAVIABLE);
+			}
+		}
+	}
+
+	/**
+	* Send responce with transaction and unit of request.
+	**/
+	void Gateway::sendResponce(const ClientPtr& client, const Request& request, const vector<uint8_t>& pdu)
+	{
+		const uint16_t length = (uint16_t)(pdu.size() + 1);
+		vector<uint8_t> adu;
+
+		adu.reserve(MBAPHeaderSize + pdu.size());
+		adu.push_back((uint8_t)(request.transaction >> 8));
+		adu.push_back((uint8_t)request.transaction);
+		adu.push_back(0);
+		adu.push_back(0);
+		adu.push_back((uint8_t)(length >> 8));
+		adu.push_back((uint8_t)length);
+		adu.push_back(request.unit);
+		adu.insert(adu.end(), pdu.cbegin(), pdu.cend());
+
+		bool timedOut = false;
+		{
+			lock_guard<std::mutex> lock(client->sendMutex);
+
+			if (client->closed)
+				return;
+
+			try
+			{
+				client->socket.SendAll(adu.data(), adu.size(), settings.sendTimeout);
+			}
+			catch (const ETimeout&)
+			{
+				client->closed = true;
+				timedOut = true;
+			}
+			catch (const exception&)
+			{
+				/**
+				 * Network thread will find connection closed.
+				 **/
+				return;
+			}
+		}
+
+		if (timedOut)
+		{
+			dropClient(client);
+			return;
+		}
+
+		lock_guard<std::mutex> statLock(mutex);
+		statistic.responces++;
+	}
+
+	/**
+	* Client is removed from clients and its queue is dropped. Socket is
+	* closed by destructor of client when network thread releases it too,
+	* so network thread never uses closed handle.
+	**/
+	void Gateway::dropClient(const ClientPtr& client)
+	{
+		lock_guard<std::mutex> lock(mutex);
+
+		if (clients.erase(client->id) == 0)
+			return;
+
+		pending -= client->queue.size();
+		client->queue.clear();
+		statistic.dropped++;
+	}
+
+	void Gateway::sendException(const ClientPtr& client, const Request& request, uint8_t ecode)
+	{
+		vector<uint8_t> pdu(2);
+		pdu[0] = request.pdu[0] | 0x80;
+		pdu[1] = ecode;
+
+		sendResponce(client, request, pdu);
+	}
+}
@@ -0,0 +1,168 @@
+/**
+ * Description: MODBUS/TCP to serial line gateway. Accept many MODBUS/TCP
+ *				clients and forward their requests through one Master
+ *				(usually RtuMaster or AsciiMaster) with fair queuing
+ *				between clients.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _GATEWAY_H_
+#define _GATEWAY_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Master.h"
+#include "Socket.h"
+
+namespace Modbus
+{
+	class Gateway
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Listen address and port
+			 **/
+			std::string address;
+			uint16_t port;
+
+			/**
+			 * Maximum time request may stay in gateway, ms. Requests that
+			 * can not be started in time are answered with exception
+			 * TARGET_DEVICE_FAILED_TO_RESPONCE, because client gives up anyway.
+			 **/
+			unsigned requestTimeout;
+
+			/**
+			 * Maximum number of queued requests of one client. Extra
+			 * requests are answered with SERVER_DEVICE_BUSY.
+			 **/
+			size_t maxQueuedPerClient;
+
+			/**
+			 * Maximum number of connected clients.
+			 **/
+			size_t maxClients;
+
+			/**
+			 * Maximum time of sending responce to client, ms. Client
+			 * which does not read responces in time is disconnected, so
+			 * it does not stall requests of other clients.
+			 **/
+			unsigned sendTimeout;
+
+			Settings() : port(502), requestTimeout(5000), maxQueuedPerClient(16), maxClients(64), sendTimeout(1000)
+			{
+			}
+		};
+
+		struct Statistic
+		{
+			uint64_t requests;
+			uint64_t responces;
+			uint64_t timeouts;
+			uint64_t expired;
+			uint64_t rejected;
+
+			/**
+			 * Clients disconnected because responce was not sent in time
+			 **/
+			uint64_t dropped;
+			size_t clients;
+		};
+
+		/**
+		 * master:	master used to forward requests. It must be used
+		 *			only by gateway while gateway is running.
+		 **/
+		Gateway(Master& master, const Settings& settings);
+		~Gateway();
+
+		/**
+		 * Start listening and forwarding.
+		 * Exceptions:	runtime_error if port can not be bound.
+		 **/
+		void Start();
+
+		/**
+		 * Stop gateway and close all connections.
+		 **/
+		void Stop();
+
+		Statistic GetStatistic();
+
+	private:
+		Gateway(const Gateway&);
+		Gateway& operator=(const Gateway&);
+
+		struct Request
+		{
+			uint16_t transaction;
+			uint8_t unit;
+			std::vector<uint8_t> pdu;
+			std::chrono::steady_clock::time_point deadline;
+		};
+
+		struct Client
+		{
+			uint64_t id;
+			Socket socket;
+			std::vector<uint8_t> rxBuffer;
+			std::deque<Request> queue;
+			std::mutex sendMutex;
+			bool closed;
+		};
+
+		typedef std::shared_ptr<Client> ClientPtr;
+
+		void networkLoop();
+		void dispatchLoop();
+
+		/**
+		 * Read data from client and queue complete requests.
+		 * Return:	false if client must be disconnected.
+		 **/
+		bool readClient(const ClientPtr& client);
+
+		/**
+		 * Pick next request by round robin between clients.
+		 **/
+		bool nextRequest(ClientPtr& client, Request& request);
+
+		void sendResponce(const ClientPtr& client, const Request& request, const std::vector<uint8_t>& pdu);
+		void sendException(const ClientPtr& client, const Request& request, uint8_t ecode);
+
+		/**
+		 * Disconnect client from dispatch thread.
+		 **/
+		void dropClient(const ClientPtr& client);
+
+		Master& master;
+		Settings settings;
+		Socket listener;
+
+		std::mutex mutex;
+		std::condition_variable queued;
+		std::map<uint64_t, ClientPtr> clients;
+		uint64_t nextClientID;
+		uint64_t lastServedID;
+		size_t pending;
+		Statistic statistic;
+
+		std::atomic<bool> running;
+		std::thread networkThread;
+		std::thread dispatchThread;
+	};
+}
+
+#endif	/* _GATEWAY_H_ */
@@ -0,0 +1,219 @@
+/**
+* Sweep of diagnostic counters
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include "HealthSweep.h"
+#include "Pdu.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	/**
+	 * Request of counter: Diagnostic sub-functions 0B-12 with zero data
+	 * and Get Comm Event Counter. Both responces have counter at byte 3.
+	 **/
+	static vector<uint8_t> counter_request(unsigned counter)
+	{
+		vector<uint8_t> request;
+
+		if (counter == HealthSweep::CommEvents)
+		{
+			request.push_back((uint8_t)Master::FunctionCodes::GetCommEventCounter);
+			return request;
+		}
+
+		request.push_back((uint8_t)Master::FunctionCodes::Diagnostic);
+		request.push_back(0);
+		request.push_back((uint8_t)((unsigned)Master::DiagnosticSubFunctions::ReturnBusMessageCount + counter));
+		request.push_back(0);
+		request.push_back(0);
+
+		return request;
+	}
+
+	HealthSweep::HealthSweep(const Settings& settings) : settings(settings)
+	{
+	}
+
+	void HealthSweep::Add(Master& master, uint8_t id)
+	{
+		Pdu::CheckNotBroadcast(id);
+
+		Row row;
+		row.master = &master;
+		row.id = id;
+		row.available = 0;
+		row.changed = 0;
+
+		for (unsigned i = 0; i < Counters; i++)
+		{
+			row.values[i] = 0;
+			row.deltas[i] = 0;
+		}
+
+		rows.push_back(row);
+	}
+
+	const vector<HealthSweep::Row>& HealthSweep::Rows() const
+	{
+		return rows;
+	}
+
+	/**
+	* One thread for each transport.
+	**/
+	size_t HealthSweep::Sweep()
+	{
+		map<Master*, vector<size_t>> transports;
+
+		for (size_t i = 0; i < rows.size(); i++)
+			transports[rows[i].master].push_back(i);
+
+		vector<thread> threads;
+
+		for (map<Master*, vector<size_t>>::const_iterator i = transports.cbegin(); i != transports.cend(); i++)
+		{
+			const vector<size_t>* units = &i->second;
+			threads.push_back(thread([this, units]() { sweep(*units); }));
+		}
+
+		for (vector<thread>::iterator i = threads.begin(); i != threads.end(); i++)
+			i->join();
+
+		size_t failed = 0;
+		for (vector<Row>::const_iterator i = rows.cbegin(); i != rows.cend(); i++)
+		{
+			if (i->error)
+				failed++;
+		}
+
+		return failed;
+	}
+
+	/**
+	* First counter of all units is read by first TransactMany, and other
+	* counters only of units which answered it, so dead unit on serial
+	* line costs one timeout instead of one per counter.
+	**/
+	void HealthSweep::sweep(const vector<size_t>& units)
+	{
+		Master& master = *rows[units.front()].master;
+		vector<unsigned> counters;
+
+		for (unsigned i = 0; i < Counters; i++)
+		{
+			if (settings.counters & (1 << i))
+				counters.push_back(i);
+		}
+
+		vector<uint16_t> previous(units.size());
+
+		for (size_t i = 0; i < units.size(); i++)
+		{
+			Row& row = rows[units[i]];
+			previous[i] = row.available;
+			row.available = 0;
+			row.changed = 0;
+			row.error = nullptr;
+
+			for (unsigned c = 0; c < Counters; c++)
+				row.deltas[c] = 0;
+		}
+
+		if (counters.empty())
+			return;
+
+		for (unsigned round = 0; round < 2; round++)
+		{
+			vector<Master::Transaction> transactions;
+			vector<pair<size_t, unsigned>> owners;
+
+			for (size_t i = 0; i < units.size(); i++)
+			{
+				if (rows[units[i]].error)
+					continue;
+
+				for (size_t c = round == 0 ? 0 : 1; c < (round == 0 ? 1 : counters.size()); c++)
+				{
+					Master::Transaction transaction;
+					transaction.id = rows[units[i]].id;
+					transaction.request = counter_request(counters[c]);
+
+					transactions.push_back(transaction);
+					owners.push_back(make_pair(i, counters[c]));
+				}
+			}
+
+			if (transactions.empty())
+				break;
+
+			exception_ptr error;
+
+			try
+			{
+				master.TransactMany(transactions);
+			}
+			catch (...)
+			{
+				error = current_exception();
+			}
+
+			for (size_t t = 0; t < transactions.size(); t++)
+			{
+				if (error)
+					transactions[t].error = error;
+
+				const size_t i = owners[t].first;
+				const unsigned counter = owners[t].second;
+				Row& row = rows[units[i]];
+
+				store(row, counter, transactions[t]);
+
+				if ((row.available & previous[i] & (1 << counter)) != 0)
+					row.changed |= 1 << counter;
+				else
+					row.deltas[counter] = 0;
+			}
+		}
+	}
+
+	void HealthSweep::store(Row& row, unsigned counter, const Master::Transaction& transaction)
+	{
+		try
+		{
+			if (transaction.error)
+				rethrow_exception(transaction.error);
+
+			const vector<uint8_t>& responce = transaction.responce;
+			Pdu::CheckResponce(transaction.request, responce);
+
+			if (responce.size() != 5)
+			{
+				throw EPDUFrameError(transaction.request, responce);
+			}
+
+			const uint16_t value = Pdu::GetWord(responce.data() + 3);
+
+			row.deltas[counter] = (uint16_t)(value - row.values[counter]);
+			row.values[counter] = value;
+			row.available |= 1 << counter;
+		}
+		catch (const EException&)
+		{
+			/**
+			 * Counter is not supported by unit.
+			 **/
+		}
+		catch (...)
+		{
+			if (!row.error)
+				row.error = current_exception();
+		}
+	}
+}
@@ -0,0 +1,117 @@
+/**
+ * Description: Sweep of diagnostic counters of all units on all lines.
+ *				Counters of Diagnostic(08) and Get Comm Event Counter(0B)
+ *				are read from units of each transport(master) by its own
+ *				thread with one TransactMany, so lines are swept in
+ *				parallel and requests are pipelined where transport
+ *				supports it. Result is table with row per unit, values and
+ *				deltas since previous sweep.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _HEALTH_SWEEP_H_
+#define _HEALTH_SWEEP_H_
+
+#include <cstdint>
+#include <exception>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	class HealthSweep
+	{
+	public:
+		/**
+		 * Counters of row. First eight are Diagnostic sub-functions
+		 * 0B-12, last one is event count of Get Comm Event Counter.
+		 **/
+		enum Counter
+		{
+			BusMessages,
+			BusCommunicationErrors,
+			BusExceptionErrors,
+			ServerMessages,
+			ServerNoResponces,
+			ServerNAKs,
+			ServerBusy,
+			BusCharacterOverruns,
+			CommEvents,
+			Counters
+		};
+
+		struct Settings
+		{
+			/**
+			 * Bit mask of counters to read(1 << Counter).
+			 **/
+			uint16_t counters;
+
+			Settings() : counters((1 << Counters) - 1)
+			{
+			}
+		};
+
+		struct Row
+		{
+			Master* master;
+			uint8_t id;
+
+			/**
+			 * Counters of last sweep and their increments since previous
+			 * one, modulo 2^16 as counters wrap. Counter of device which
+			 * was restarted between sweeps gives wrong delta.
+			 **/
+			uint16_t values[Counters];
+			uint16_t deltas[Counters];
+
+			/**
+			 * Bit masks of counters read by last sweep and counters which
+			 * have delta(read by last two sweeps). Counter which unit
+			 * answers by exception is not available.
+			 **/
+			uint16_t available;
+			uint16_t changed;
+
+			/**
+			 * First error other than exception responce, for example
+			 * timeout. Unit which doesn't answer first counter is not
+			 * asked for others.
+			 **/
+			std::exception_ptr error;
+		};
+
+		explicit HealthSweep(const Settings& settings = Settings());
+
+		/**
+		 * Add unit. Master must live while sweep is used, and is used by
+		 * one thread of sweep, so it needs not be thread safe.
+		 * Exceptions:	invalid_argument if id is broadcast.
+		 **/
+		void Add(Master& master, uint8_t id);
+
+		/**
+		 * Read counters of all units.
+		 * Return:	number of units with error.
+		 **/
+		size_t Sweep();
+
+		const std::vector<Row>& Rows() const;
+
+	private:
+		/**
+		 * Sweep units of one transport.
+		 **/
+		void sweep(const std::vector<size_t>& units);
+
+		/**
+		 * Store result of one counter to row.
+		 **/
+		void store(Row& row, unsigned counter, const Master::Transaction& transaction);
+
+		Settings settings;
+		std::vector<Row> rows;
+	};
+}
+
+#endif	/* _HEALTH_SWEEP_H_ */
@@ -0,0 +1,139 @@
+/**
+* Low-latency mode of transport
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include "LowLatency.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	/**
+	 * Stack prefaulted by ConfigureThread, bytes
+	 **/
+	static const size_t PrefaultStackSize = 64 * 1024;
+
+	/**
+	 * Touch stack pages, so they are mapped before first transaction.
+	 **/
+	static void prefault_stack()
+	{
+		uint8_t stack[PrefaultStackSize];
+		volatile uint8_t* page = stack;
+
+		for (size_t i = 0; i < PrefaultStackSize; i += 4096)
+			page[i] = 0;
+	}
+
+	LowLatency::LowLatency()
+	{
+	}
+
+	void LowLatency::SetSettings(const Settings& settings)
+	{
+		this->settings = settings;
+		thread = std::thread::id();
+	}
+
+	const LowLatency::Settings& LowLatency::GetSettings() const
+	{
+		return settings;
+	}
+
+	/**
+	* Apply thread options to calling thread once.
+	**/
+	void LowLatency::Enter()
+	{
+		if (settings.cpu < 0 && settings.priority == 0 && !settings.lockMemory)
+			return;
+
+		const std::thread::id current = this_thread::get_id();
+		if (thread == current)
+			return;
+
+		thread = current;
+		ConfigureThread(settings);
+	}
+
+	/**
+	* Pause for us microseconds.
+	**/
+	void LowLatency::Pause(unsigned us) const
+	{
+		if (settings.spin == 0)
+		{
+			this_thread::sleep_for(microseconds(us));
+			return;
+		}
+
+		const steady_clock::time_point end = steady_clock::now() + microseconds(us);
+		while (steady_clock::now() < end)
+		{
+		}
+	}
+
+	/**
+	* Apply cpu, priority and lockMemory to calling thread.
+	**/
+	bool LowLatency::ConfigureThread(const Settings& settings)
+	{
+		bool applied = true;
+
+#ifdef _WIN32
+		if (settings.cpu >= 0)
+		{
+			applied &= SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << settings.cpu) != 0;
+		}
+
+		if (settings.priority > 0)
+		{
+			applied &= SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+		}
+#else
+		if (settings.cpu >= 0)
+		{
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(settings.cpu, &set);
+			applied &= pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+			applied = false;
+#endif
+		}
+
+		if (settings.priority > 0)
+		{
+			sched_param param;
+			memset(&param, 0, sizeof(param));
+			param.sched_priority = settings.priority;
+			applied &= pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+		}
+
+		if (settings.lockMemory)
+		{
+			applied &= mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+		}
+#endif
+
+		if (settings.lockMemory)
+		{
+			prefault_stack();
+		}
+
+		return applied;
+	}
+}
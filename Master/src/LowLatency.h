@@ -0,0 +1,113 @@
+/**
+ * Description: Low-latency mode of transport. Thread which makes
+ *				transactions is pinned to core, switched to real-time
+ *				scheduling and its memory is locked, and waits for
+ *				responce are spin-waits instead of sleeps, so responce
+ *				is handled without scheduler wakeup delay.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _LOW_LATENCY_H_
+#define _LOW_LATENCY_H_
+
+#include <chrono>
+#include <thread>
+
+namespace Modbus
+{
+	class LowLatency
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Core to pin I/O thread to, -1 to not pin.
+			 **/
+			int cpu;
+
+			/**
+			 * SCHED_FIFO priority(1-99) of I/O thread, 0 to keep
+			 * scheduler. On Windows any priority means time critical
+			 * thread priority.
+			 **/
+			int priority;
+
+			/**
+			 * Time of busy wait for data before blocking wait, us. Also
+			 * RTU inter-frame silence is spin-waited instead of sleep.
+			 **/
+			unsigned spin;
+
+			/**
+			 * SO_BUSY_POLL of TCP socket, us. Linux only.
+			 **/
+			unsigned busyPoll;
+
+			/**
+			 * Lock process memory(mlockall) and prefault stack of I/O
+			 * thread, so no page faults happen during transaction.
+			 **/
+			bool lockMemory;
+
+			Settings() : cpu(-1), priority(0), spin(0), busyPoll(0), lockMemory(false)
+			{
+			}
+		};
+
+		LowLatency();
+
+		/**
+		 * Set settings. Thread options are applied again on next Enter.
+		 **/
+		void SetSettings(const Settings& settings);
+		const Settings& GetSettings() const;
+
+		/**
+		 * Called by transport before transaction. Apply thread options
+		 * to calling thread, once for each new thread.
+		 **/
+		void Enter();
+
+		/**
+		 * Pause for us microseconds: spin if spin-wait is on, sleep
+		 * otherwise.
+		 **/
+		void Pause(unsigned us) const;
+
+		/**
+		 * Call ready until it returns true, but not longer than spin time.
+		 * Return:	last result of ready.
+		 **/
+		template <class Ready>
+		bool Spin(Ready ready) const
+		{
+			if (settings.spin == 0)
+				return false;
+
+			const std::chrono::steady_clock::time_point end =
+				std::chrono::steady_clock::now() + std::chrono::microseconds(settings.spin);
+
+			do
+			{
+				if (ready())
+					return true;
+			} while (std::chrono::steady_clock::now() < end);
+
+			return false;
+		}
+
+		/**
+		 * Apply cpu, priority and lockMemory to calling thread. Options
+		 * which are not permitted(no CAP_SYS_NICE, RLIMIT_MEMLOCK) or not
+		 * supported by system are skipped.
+		 * Return:	true if all requested options are applied.
+		 **/
+		static bool ConfigureThread(const Settings& settings);
+
+	private:
+		Settings settings;
+		std::thread::id thread;
+	};
+}
+
+#endif	/* _LOW_LATENCY_H_ */
@@ -0,0 +1,154 @@
+/**
+* Memory-mapped file
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdexcept>
+#include "MappedFile.h"
+
+using namespace std;
+
+namespace Modbus
+{
+#ifdef _WIN32
+	MappedFile::MappedFile(const string& path, Mode mode, size_t size)
+		: data(NULL), size(size), file(INVALID_HANDLE_VALUE), mapping(NULL)
+	{
+		const bool write = mode == Mode::Create;
+
+		file = CreateFileA(path.c_str(),
+			write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+			FILE_SHARE_READ, NULL,
+			write ? CREATE_ALWAYS : OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			throw runtime_error("Can not open file " + path);
+		}
+
+		if (!write)
+		{
+			LARGE_INTEGER fileSize;
+			GetFileSizeEx(file, &fileSize);
+			this->size = (size_t)fileSize.QuadPart;
+		}
+
+		/**
+		 * Empty file can not be mapped.
+		 **/
+		if (this->size == 0)
+			return;
+
+		const unsigned long long mapSize = this->size;
+		mapping = CreateFileMappingA(file, NULL, write ? PAGE_READWRITE : PAGE_READONLY,
+			(DWORD)(mapSize >> 32), (DWORD)mapSize, NULL);
+		if (mapping == NULL)
+		{
+			CloseHandle(file);
+			throw runtime_error("Can not map file " + path);
+		}
+
+		data = (uint8_t*)MapViewOfFile(mapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, this->size);
+		if (data == NULL)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			throw runtime_error("Can not map file " + path);
+		}
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (data != NULL)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		CloseHandle(file);
+	}
+
+	void MappedFile::Flush()
+	{
+		if (data != NULL)
+			FlushViewOfFile(data, size);
+	}
+#else
+	MappedFile::MappedFile(const string& path, Mode mode, size_t size)
+		: data(NULL), size(size), file(-1)
+	{
+		const bool write = mode == Mode::Create;
+
+		file = write ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			throw runtime_error("Can not open file " + path);
+		}
+
+		if (write)
+		{
+			if (ftruncate(file, size) != 0)
+			{
+				close(file);
+				throw runtime_error("Can not resize file " + path);
+			}
+		}
+		else
+		{
+			struct stat st;
+			fstat(file, &st);
+			this->size = st.st_size;
+		}
+
+		/**
+		 * Empty file can not be mapped.
+		 **/
+		if (this->size == 0)
+			return;
+
+		void* p = mmap(NULL, this->size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+		if (p == MAP_FAILED)
+		{
+			close(file);
+			throw runtime_error("Can not map file " + path);
+		}
+
+		data = (uint8_t*)p;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (data != NULL)
+			munmap(data, size);
+		close(file);
+	}
+
+	void MappedFile::Flush()
+	{
+		if (data != NULL)
+			msync(data, size, MS_SYNC);
+	}
+#endif
+
+	uint8_t* MappedFile::Data()
+	{
+		return data;
+	}
+
+	const uint8_t* MappedFile::Data() const
+	{
+		return data;
+	}
+
+	size_t MappedFile::Size() const
+	{
+		return size;
+	}
+}
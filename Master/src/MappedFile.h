@@ -0,0 +1,64 @@
+/**
+ * Description: Memory-mapped file. It is used by file transfers to read
+ *				and write file records without intermediate copies.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Modbus
+{
+	class MappedFile
+	{
+	public:
+		enum class Mode
+		{
+			/**
+			 * Map existing file for reading.
+			 **/
+			Read,
+
+			/**
+			 * Create or truncate file to size and map it for writing.
+			 **/
+			Create
+		};
+
+		/**
+		 * path:		file path
+		 * size:		file size for Create mode, ignored in Read mode
+		 * Exceptions:	runtime_error if file can not be opened or mapped.
+		 **/
+		MappedFile(const std::string& path, Mode mode, size_t size = 0);
+		~MappedFile();
+
+		uint8_t* Data();
+		const uint8_t* Data() const;
+		size_t Size() const;
+
+		/**
+		 * Write modified pages to disk.
+		 **/
+		void Flush();
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		uint8_t* data;
+		size_t size;
+#ifdef _WIN32
+		void* file;
+		void* mapping;
+#else
+		int file;
+#endif
+	};
+}
+
+#endif	/* _MAPPED_FILE_H_ */
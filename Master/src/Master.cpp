@@ -3,9 +3,12 @@
 * Author	Oleg Gavrilchenko
 * E-mail	reffum@bk.ru
 **/
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 #include "Master.h"
+#include "BasicMaster.h"
+#include "Pdu.h"
 #include "mb_exceptions.h"
 
 using namespace std;
@@ -34,12 +37,26 @@ namespace Modbus
 		return ((uint16_t)h << 8) | l;
 	}
 
+	const uint8_t Master::FileReferenceType;
+	const uint16_t Master::FileRecordMax;
+	const unsigned Master::ReadBitsMax;
+	const unsigned Master::ReadRegistersMax;
+
+	Master::Master()
+	{
+	}
+
+	Master::~Master()
+	{
+	}
+
 	/**
-	 * Return Exception Function code for MODBUS function code
+	 * Send PDU and no wait responce.
+	 * Protocols that support broadcast requests must override this function.
 	 **/
-	uint8_t Master::exceptionCodeFor(FunctionCodes code)
+	void Master::SendPDU(vector<uint8_t>)
 	{
-		return ((uint8_t)code & 0x80);
+		throw logic_error("Broadcast requests are not supported by protocol");
 	}
 
 	/**
@@ -52,62 +69,7 @@ namespace Modbus
 	**/
 	vector<bool> Master::ReadCoils(const uint8_t id, const uint16_t addr, const unsigned quantity)
 	{
-		vector<uint8_t> request, responce;
-
-		if ((quantity > 2000) || (quantity < 1))
-		{
-			throw invalid_argument("Quantity of coils out of range");
-		}
-
-		if (id == IDBroadcast)
-		{
-			throw invalid_argument("Read Coils with broadcast ID");
-		}
-
-		/**
-		 * Send request PDU
-		 **/
-		request.push_back((uint8_t)FunctionCodes::ReadCoils);
-		request.push_back(high_byte(addr));
-		request.push_back(low_byte(addr));
-		request.push_back(high_byte(quantity));
-		request.push_back(low_byte(quantity));
-
-		responce = SendPDU(id, request);
-
-		checkForException(request, responce);
-
-		/**
-		 * Compute expected PDU size
-		 **/
-		int N = ((quantity % 8) == 0) ? quantity / 8 : (quantity / 8) + 1;
-		int pduSize = N + 2;
-
-		if ((responce.size() != pduSize) ||
-			(responce[0] != request[0]) ||
-			(responce[1] != N))
-		{
-			throw EPDUFrameError(request, responce);
-		}
-
-		/**
-		 * Parse and form coils status
-		 **/
-		vector<bool> coils;
-
-		for (vector<uint8_t>::const_iterator i = responce.cbegin() + 2;
-			i != responce.cend();
-			i++)
-		{
-			uint8_t byte = *i;
-			for (int j = 0; j < 7; j++)
-			{
-				bool b = 0x01 & (byte >> j);
-				coils.push_back(b);
-			}
-		}
-
-		return coils;
+		return BasicMaster<MasterTransport>(MasterTransport(*this)).ReadCoils(id, addr, quantity);
 	}
 
 	/**
@@ -120,62 +82,7 @@ namespace Modbus
 	* */
 	vector<bool> Master::ReadDiscreteInputs(const uint8_t id, const uint16_t addr, const unsigned quantity)
 	{
-		vector<uint8_t> request, responce;
-
-		if ((quantity > 2000) || (quantity < 1))
-		{
-			throw invalid_argument("Quantity of coils out of range");
-		}
-
-		if (id == IDBroadcast)
-		{
-			throw invalid_argument("Read Coils with broadcast ID");
-		}
-
-		/**
-		* Send request PDU
-		**/
-		request.push_back((uint8_t)FunctionCodes::ReadDiscreteInputs);
-		request.push_back(high_byte(addr));
-		request.push_back(low_byte(addr));
-		request.push_back(high_byte(quantity));
-		request.push_back(low_byte(quantity));
-
-		responce = SendPDU(id, request);
-
-		checkForException(request, responce);
-
-		/**
-		* Compute expected PDU size
-		**/
-		int N = ((quantity % 8) == 0) ? quantity / 8 : (quantity / 8) + 1;
-		int pduSize = N + 2;
-
-		if ((responce.size() != pduSize) ||
-			(responce[0] != request[0]) ||
-			(responce[1] != N))
-		{
-			throw EPDUFrameError(request, responce);
-		}
-
-		/**
-		* Parse and form coils status
-		**/
-		vector<bool> coils;
-
-		for (vector<uint8_t>::const_iterator i = responce.cbegin() + 2;
-			i != responce.cend();
-			i++)
-		{
-			uint8_t byte = *i;
-			for (int j = 0; j < 7; j++)
-			{
-				bool b = 0x01 & (byte >> j);
-				coils.push_back(b);
-			}
-		}
-
-		return coils;
+		return BasicMaster<MasterTransport>(MasterTransport(*this)).ReadDiscreteInputs(id, addr, quantity);
 	}
 
 	/**
@@ -188,59 +95,7 @@ namespace Modbus
 	**/
 	vector<uint16_t> Master::ReadHoldingRegisters(const uint8_t id, const uint16_t addr, const unsigned quantity)
 	{
-		vector<uint8_t> request, responce;
-		const uint8_t funcCode = (uint8_t)FunctionCodes::ReadHoldingRegisters;
-		vector<uint16_t> registers;
-
-		/**
-		 * Check parameters
-		 **/
-		if (quantity < 1 || quantity > 125)
-		{
-			throw invalid_argument("Quantaty out of range.");
-		}
-
-		if (id == IDBroadcast)
-		{
-			throw invalid_argument("Read Hold with broadcast ID.");
-		}
-
-		/**
-		 * Request PDU
-		 **/
-		request.push_back(funcCode);
-		request.push_back(high_byte(addr));
-		request.push_back(low_byte(addr));
-		request.push_back(high_byte(quantity));
-		request.push_back(low_byte(quantity));
-
-		responce = SendPDU(id, request);
-
-		checkForException(request, responce);
-
-		/**
-		 * Check responce PDU.
-		 **/
-		const int expectedSize = 2 + quantity * 2;
-		if (responce.size() != expectedSize ||
-			responce[0] != funcCode ||
-			responce[1] != quantity * 2)
-		{
-			throw EPDUFrameError(request, responce);
-		}
-
-		/**
-		 * Parse responce and return registers value.
-		 **/
-		for (unsigned i = 2; i < responce.size(); i += 2)
-		{
-			uint8_t hbyte = responce[i];
-			uint8_t lbyte = responce[i + 1];
-
-			registers.push_back(get_word(hbyte, lbyte));
-		}
-
-		return registers;
+		return BasicMaster<MasterTransport>(MasterTransport(*this)).ReadHoldingRegisters(id, addr, quantity);
 	}
 
 	/**
@@ -253,59 +108,7 @@ namespace Modbus
 	**/
 	vector<uint16_t> Master::ReadInputRegisters(const uint8_t id, const uint16_t addr, const unsigned quantity)
 	{
-		vector<uint8_t> request, responce;
-		const uint8_t funcCode = (uint8_t)FunctionCodes::ReadInputRegisters;
-		vector<uint16_t> registers;
-
-		/**
-		* Check parameters
-		**/
-		if (quantity < 1 || quantity > 125)
-		{
-			throw invalid_argument("Quantaty out of range.");
-		}
-
-		if (id == IDBroadcast)
-		{
-			throw invalid_argument("Read Hold with broadcast ID.");
-		}
-
-		/**
-		* Request PDU
-		**/
-		request.push_back(funcCode);
-		request.push_back(high_byte(addr));
-		request.push_back(low_byte(addr));
-		request.push_back(high_byte(quantity));
-		request.push_back(low_byte(quantity));
-
-		responce = SendPDU(id, request);
-
-		checkForException(request, responce);
-
-		/**
-		* Check responce PDU.
-		**/
-		const int expectedSize = 2 + quantity * 2;
-		if (responce.size() != expectedSize ||
-			responce[0] != funcCode ||
-			responce[1] != quantity * 2)
-		{
-			throw EPDUFrameError(request, responce);
-		}
-
-		/**
-		* Parse responce and return registers value.
-		**/
-		for (unsigned i = 2; i < responce.size(); i += 2)
-		{
-			uint8_t hbyte = responce[i];
-			uint8_t lbyte = responce[i + 1];
-
-			registers.push_back(get_word(hbyte, lbyte));
-		}
-
-		return registers;
+		return BasicMaster<MasterTransport>(MasterTransport(*this)).ReadInputRegisters(id, addr, quantity);
 	}
 
 	/**
@@ -315,28 +118,7 @@ namespace Modbus
 	**/
 	void Master::WriteSingleCoil(const uint8_t id, const uint16_t addr, const bool value)
 	{
-		uint8_t funcCode = (uint8_t)FunctionCodes::WriteSingleCoil;
-		vector<uint8_t> request, responce;
-
-		request.push_back(funcCode);
-		request.push_back(high_byte(addr));
-		request.push_back(low_byte(addr));
-		request.push_back(value ? 0xFF : 0x00);
-		request.push_back(0);
-
-		if (id == IDBroadcast)
-		{
-			SendPDU(request);
-		}
-		else
-		{
-			responce = SendPDU(id, request);
-
-			checkForException(request, responce);
-
-			if (responce != request)
-				throw EPDUFrameError(request, responce);
-		}
+		BasicMaster<MasterTransport>(MasterTransport(*this)).WriteSingleCoil(id, addr, value);
 	}
 
 	/**
@@ -346,28 +128,7 @@ namespace Modbus
 	**/
 	void Master::WriteSingleRegister(const uint8_t id, const uint16_t addr, const uint16_t value)
 	{
-		uint8_t funcCode = (uint8_t)FunctionCodes::WriteSingleRegister;
-		vector<uint8_t> request, responce;
-
-		request.push_back(funcCode);
-		request.push_back(high_byte(addr));
-		request.push_back(low_byte(addr));
-		request.push_back(high_byte(value));
-		request.push_back(low_byte(value));
-
-		if (id == IDBroadcast)
-		{
-			SendPDU(request);
-		}
-		else
-		{
-			responce = SendPDU(id, request);
-
-			checkForException(request, responce);
-
-			if (responce != request)
-				throw EPDUFrameError(request, responce);
-		}
+		BasicMaster<MasterTransport>(MasterTransport(*this)).WriteSingleRegister(id, addr, value);
 	}
 
 	/**
@@ -388,17 +149,7 @@ namespace Modbus
 
 		responce = SendPDU(id, request);
 
-		checkForException(request, responce);
-
-		/**
-		 * Check responce correction.
-		 **/
-		const int expectedSize = 2;
-		if (responce[0] != request[0] ||
-			responce.size() != expectedSize)
-		{
-			throw EPDUFrameError(request, responce);
-		}
+		Pdu::CheckResponce(request, responce);
 
 		return responce[1];
 	}
@@ -418,7 +169,7 @@ namespace Modbus
 		/**
 		 * Check parameters
 		 **/
-		const int requestPDUSize = 3 + data.size() * 2;
+		const size_t requestPDUSize = 3 + data.size();
 		if (requestPDUSize > PDU_MAX_SIZE)
 		{
 			throw invalid_argument("PDU size is more than maximum size.");
@@ -450,12 +201,12 @@ namespace Modbus
 		{
 			responce = SendPDU(id, request);
 
-			checkForException(request, responce);
+			Pdu::CheckResponce(request, responce);
 			
 			/**
-			 * Return responce data
+			 * Return responce data after echo of sub-function
 			 **/
-			return vector<uint8_t>(responce.cbegin() + 2, responce.cend());
+			return vector<uint8_t>(responce.cbegin() + 3, responce.cend());
 		}
 	}
 
@@ -681,8 +432,8 @@ namespace Modbus
 	**/
 	void Master::ClearOverrunCounterAndFlag(const uint8_t id)
 	{
-		vector<uint8_t> requestData = { 0, 0 }, responceData;
-		Diagnostic(id, (uint16_t)DiagnosticSubFunctions::ClearOverrunCounterAndFlag, requestData);
+		vector<uint8_t> requestData = { 0, 0 };
+		vector<uint8_t> responceData = Diagnostic(id, (uint16_t)DiagnosticSubFunctions::ClearOverrunCounterAndFlag, requestData);
 
 		if (requestData != responceData)
 		{
@@ -705,16 +456,7 @@ namespace Modbus
 
 		vector<uint8_t> responcePDU = SendPDU(id, requestPDU);
 
-		checkForException(requestPDU, responcePDU);
-
-		/**
-		 * Check responce PDU correction
-		 **/
-		const int responcePDUSize = 5;
-		if (responcePDU.size() != responcePDUSize)
-		{
-			EPDUFrameError(requestPDU, responcePDU);
-		}
+		Pdu::CheckResponce(requestPDU, responcePDU);
 
 		uint16_t statusWord;
 		uint16_t counter;
@@ -744,34 +486,266 @@ namespace Modbus
 	**/
 	Master::CommEventLog Master::GetCommEventLog(const uint8_t id)
 	{
+		CommEventLog commEventLog;
+		GetCommEventLog(id, commEventLog);
+		return commEventLog;
+	}
+
+	/**
+	* Write Multiple Coils(0F)
+	* addr:			Start address
+	* coils:		coils output state and quantity
+	* Exception:	invalid_argument if quantity of coils out of range(1-1968)
+	**/
+	void Master::WriteMultipleCoils(uint8_t id, uint16_t addr, vector<bool> coils)
+	{
+		BasicMaster<MasterTransport>(MasterTransport(*this)).WriteMultipleCoils(id, addr, coils);
+	}
+
+	/**
+	* Write Muliple Registers(10)
+	* addr:			Start address
+	* regs:			registers value(and quatity)
+	* Exception:	logic_error if quantity of registers out of range(1-123)
+	**/
+	void Master::WriteMultipleRegisters(uint8_t id, uint16_t addr, vector<uint16_t> regs)
+	{
+		BasicMaster<MasterTransport>(MasterTransport(*this)).WriteMultipleRegisters(id, addr, regs);
+	}
+
+	/**
+	* Report Server ID(11)(Serial Line Only)
+	**/
+	Master::ServerID Master::ReportServerID(uint8_t id)
+	{
+		ServerID serverID;
+		ReportServerID(id, serverID);
+		return serverID;
+	}
+
+	/**
+	* Read File Record(14)
+	* Exception:	logic_error if PDU size more than PDU_MAX_SIZE.
+	**/
+	Master::FileRecords Master::ReadFileRecord(uint8_t id, vector<FileReadSubRequest> requests)
+	{
+		FileRecords records;
+		ReadFileRecord(id, requests, records);
+		return records;
+	}
+
+	/**
+	* Write File Record(15)
+	* Exception:	logic_error if PDU size more than PDU_MAX_SIZE.
+	**/
+	void Master::WriteFileRecord(uint8_t id, vector<FileWriteSubRequest> requests)
+	{
+		vector<uint8_t> request, responce;
+
+		Pdu::EncodeWriteFileRecord(request, requests);
+
 		if (id == IDBroadcast)
 		{
-			throw invalid_argument("Read request with broadcast ID.");
+			SendPDU(request);
+			return;
 		}
 
-		const vector<uint8_t> requestPDU = { (uint8_t)FunctionCodes::GetCommEventLog };
+		responce = SendPDU(id, request);
 
-		vector<uint8_t> responcePDU = SendPDU(id, requestPDU);
+		Pdu::CheckResponce(request, responce);
+	}
+
+	/**
+	* Mask Write Register(16)
+	* Register = (Register AND AndMask) OR (OrMask AND (NOT AndMask))
+	**/
+	void Master::MaskWriteResister(uint8_t id, uint16_t addr, uint16_t OrMask, uint16_t AndMask)
+	{
+		uint8_t pdu[PDU_MAX_SIZE];
+		const vector<uint8_t> request(pdu, pdu + Pdu::EncodeMaskWriteRegister(pdu, addr, OrMask, AndMask));
+		vector<uint8_t> responce;
+
+		if (id == IDBroadcast)
+		{
+			SendPDU(request);
+			return;
+		}
+
+		responce = SendPDU(id, request);
+
+		Pdu::CheckResponce(request, responce);
+	}
+
+	/**
+	* Read FIFO Queue(18)
+	**/
+	vector<uint16_t> Master::ReadFIFOQueue(uint8_t id, uint16_t FIFOPointerAddress)
+	{
+		vector<uint16_t> values;
+		ReadFIFOQueue(id, FIFOPointerAddress, values);
+		return values;
+	}
+
+	/**
+	* Encapsulated interface Transport(2B)
+	**/
+	vector<uint8_t> Master::EncaplulatedInterfaceTransport(uint8_t id, uint16_t MEIType, vector<uint8_t> data)
+	{
+		const uint8_t funcCode = (uint8_t)FunctionCodes::EncapsulatedInterfaceTransport;
+		vector<uint8_t> request, responce;
+
+		if (MEIType > 0xFF)
+		{
+			throw invalid_argument("MEI type out of range.");
+		}
+
+		if (2 + data.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
 
-		checkForException(requestPDU, responcePDU);
+		request.push_back(funcCode);
+		request.push_back((uint8_t)MEIType);
+		request.insert(request.end(), data.cbegin(), data.cend());
+
+		if (id == IDBroadcast)
+		{
+			SendPDU(request);
+			return vector<uint8_t>();
+		}
+
+		responce = SendPDU(id, request);
+
+		Pdu::CheckResponce(request, responce);
+
+		return vector<uint8_t>(responce.cbegin() + 2, responce.cend());
+	}
+
+	/**
+	* Read Device identification(2B/0E)
+	**/
+	Master::DeviceIdentification Master::ReadDeviceIdentification(uint8_t id, ReadDeviceIDCode code, uint8_t objectID)
+	{
+		DeviceIdentification identification;
+		identification.conformityLevel = 0;
+
+		if (id == IDBroadcast)
+		{
+			throw invalid_argument("Read Device Identification with broadcast ID.");
+		}
 
 		/**
-		 * Check responce PDU correction.
+		 * Each object is read at most once, so number of requests is
+		 * limited even if device repeats next object ID.
 		 **/
-		const int MinResponcePDUSize = 6;
-		if (responcePDU.size() < MinResponcePDUSize)
-			throw EPDUFrameError(requestPDU, responcePDU);
+		for (unsigned requests = 0; requests < 256; requests++)
+		{
+			vector<uint8_t> data;
+			data.push_back((uint8_t)code);
+			data.push_back(objectID);
 
-		uint8_t N = responcePDU[1];
+			vector<uint8_t> responce = EncaplulatedInterfaceTransport(id, MEIReadDeviceIdentification, data);
 
-		if (responcePDU.size() != N)
-			throw EPDUFrameError(requestPDU, responcePDU);
+			/**
+			 * Responce data: read device ID code, conformity level, more
+			 * follows, next object ID, number of objects and objects list
+			 * of ID, length and value.
+			 **/
+			if (responce.size() < 5 || responce[0] != (uint8_t)code)
+			{
+				throw EPDUFrameError(data, responce);
+			}
 
-		CommEventLog commEventLog;
+			identification.conformityLevel = responce[1];
+			const bool moreFollows = responce[2] == 0xFF;
+			const uint8_t nextObjectID = responce[3];
+			const unsigned count = responce[4];
+
+			size_t pos = 5;
+			for (unsigned i = 0; i < count; i++)
+			{
+				if (pos + 2 > responce.size() || pos + 2 + responce[pos + 1] > responce.size())
+				{
+					throw EPDUFrameError(data, responce);
+				}
+
+				identification.objects[responce[pos]] =
+					string(responce.cbegin() + pos + 2, responce.cbegin() + pos + 2 + responce[pos + 1]);
+				pos += 2 + responce[pos + 1];
+			}
+
+			if (!moreFollows || code == ReadDeviceIDCode::Specific ||
+				identification.objects.count(nextObjectID) != 0)
+			{
+				break;
+			}
+
+			objectID = nextObjectID;
+		}
+
+		return identification;
+	}
+
+	/**
+	* Send raw request PDU and return raw responce PDU.
+	**/
+	vector<uint8_t> Master::Transact(uint8_t id, const vector<uint8_t>& request)
+	{
+		if (request.empty() || request.size() > PDU_MAX_SIZE)
+		{
+			throw invalid_argument("Invalid request PDU size.");
+		}
 
+		return SendPDU(id, request);
+	}
+
+	/**
+	* Send raw broadcast request PDU.
+	**/
+	void Master::Broadcast(const vector<uint8_t>& request)
+	{
+		if (request.empty() || request.size() > PDU_MAX_SIZE)
+		{
+			throw invalid_argument("Invalid request PDU size.");
+		}
 
+		SendPDU(request);
 	}
 
+	/**
+	* Execute several raw transactions.
+	**/
+	void Master::TransactMany(vector<Transaction>& transactions)
+	{
+		for (vector<Transaction>::const_iterator i = transactions.cbegin(); i != transactions.cend(); i++)
+		{
+			if (i->request.empty() || i->request.size() > PDU_MAX_SIZE)
+			{
+				throw invalid_argument("Invalid request PDU size.");
+			}
+		}
+
+		SendPDUs(transactions);
+	}
+
+	/**
+	* Send several PDU one by one.
+	**/
+	void Master::SendPDUs(vector<Transaction>& transactions)
+	{
+		for (vector<Transaction>::iterator i = transactions.begin(); i != transactions.end(); i++)
+		{
+			try
+			{
+				i->responce = SendPDU(i->id, i->request);
+				i->error = nullptr;
+			}
+			catch (...)
+			{
+				i->error = current_exception();
+			}
+		}
+	}
 
 	/**
 	 * Private functions
@@ -799,39 +773,197 @@ namespace Modbus
 
 		if (responceData.size() == 0)
 		{
-			EDiagnostic(requestData, responceData);
+			throw EDiagnostic(requestData, responceData);
 		}
 
 		/**
-		* Responce data contain message count, and it size is variable.
-		* It can contain more than 8 bytes. In this case, the function return low 8 byte
-		* only .
+		* Responce data contain counter word, high byte first. Longer data
+		* is read as big-endian number of its last 8 bytes.
 		**/
 		uint64_t counter = 0;
-		for (unsigned i = 0; i < responceData.size() && i < 8; i++)
+		for (vector<uint8_t>::const_iterator i = responceData.cbegin(); i != responceData.cend(); i++)
 		{
-			counter += ((uint64_t)responceData[i] << i * 8);
+			counter = (counter << 8) | *i;
 		}
 
 		return counter;
 	}
 
 	/**
-	* Check responce PDU for exceptions
-	* Raise EException if PDU is MODBUS exception.
-	* funcCode		Function code in request PDU.
+	* Read bits into buffer of result template, one byte per bit.
 	**/
-	void Master::checkForException(const vector<uint8_t> request, const vector<uint8_t> responce)
+	void Master::readBits(uint8_t id, FunctionCodes funcCode, uint16_t addr, unsigned quantity, uint8_t* values)
 	{
-		if (responce.size() == ExceptionResponcePDUSize)
+		BasicMaster<MasterTransport> master((MasterTransport(*this)));
+
+		if (funcCode == FunctionCodes::ReadCoils)
+			master.ReadCoils(id, addr, quantity, values);
+		else
+			master.ReadDiscreteInputs(id, addr, quantity, values);
+	}
+
+	/**
+	* Read registers into buffer of result template.
+	**/
+	void Master::readRegisters(uint8_t id, FunctionCodes funcCode, uint16_t addr, unsigned quantity, uint16_t* values)
+	{
+		BasicMaster<MasterTransport> master((MasterTransport(*this)));
+
+		if (funcCode == FunctionCodes::ReadHoldingRegisters)
+			master.ReadHoldingRegisters(id, addr, quantity, values);
+		else
+			master.ReadInputRegisters(id, addr, quantity, values);
+	}
+
+	/**
+	* Request of Get Comm Event Log(0C).
+	* Responce: function code, byte count, status(2), event count(2),
+	* message count(2) and events, newest first.
+	**/
+	vector<uint8_t> Master::getCommEventLog(uint8_t id)
+	{
+		if (id == IDBroadcast)
+		{
+			throw invalid_argument("Read request with broadcast ID.");
+		}
+
+		const vector<uint8_t> requestPDU = { (uint8_t)FunctionCodes::GetCommEventLog };
+
+		vector<uint8_t> responcePDU = SendPDU(id, requestPDU);
+
+		Pdu::CheckResponce(requestPDU, responcePDU);
+
+		const uint16_t statusWord = get_word(responcePDU[2], responcePDU[3]);
+
+		if (statusWord != 0xFFFF && statusWord != 0x0000)
+		{
+			throw EPDUFrameError(requestPDU, responcePDU);
+		}
+
+		CommEvent event;
+		for (vector<uint8_t>::const_iterator i = responcePDU.cbegin() + 8; i != responcePDU.cend(); i++)
 		{
-			uint8_t functionCode = responce[0];
-			if (functionCode == exceptionCodeFor(FunctionCodes::ReadDiscreteInputs))
+			if (!decodeCommEvent(*i, event))
 			{
-				throw EException(responce[1]);
+				throw EPDUFrameError(requestPDU, responcePDU);
 			}
+		}
+
+		return responcePDU;
+	}
+
+	bool Master::decodeCommEvent(uint8_t byte, CommEvent& event)
+	{
+		if (byte & 0x80)
+		{
+			event.type = CommLogEventType::ReceiveEvent;
+			event.receive.CommunicationError = (byte & 0x02) != 0;
+			event.receive.CharacterOverrun = (byte & 0x10) != 0;
+			event.receive.CurrentlyInListenOnlyMode = (byte & 0x20) != 0;
+			event.receive.BroadcastReceived = (byte & 0x40) != 0;
+		}
+		else if (byte & 0x40)
+		{
+			event.type = CommLogEventType::SendEvent;
+			event.send.ReadExceptionSend = (byte & 0x01) != 0;
+			event.send.ServerAbortExceptionSend = (byte & 0x02) != 0;
+			event.send.ServerBusyExceptionSend = (byte & 0x04) != 0;
+			event.send.ServerProgramNAKExceptionSend = (byte & 0x08) != 0;
+			event.send.WriteTimeoutErrorOccurred = (byte & 0x10) != 0;
+			event.send.CurrentlyInListenOnlyMode = (byte & 0x20) != 0;
+		}
+		else if (byte == 0x04)
+		{
+			event.type = CommLogEventType::ListenOnlyMode;
+		}
+		else if (byte == 0x00)
+		{
+			event.type = CommLogEventType::CommRestart;
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
 
+	/**
+	* Request of Report Server ID(11).
+	**/
+	vector<uint8_t> Master::reportServerID(uint8_t id)
+	{
+		const uint8_t funcCode = (uint8_t)FunctionCodes::ReportServerID;
+		vector<uint8_t> request, responce;
+
+		if (id == IDBroadcast)
+		{
+			throw invalid_argument("Report Server ID with broadcast ID.");
+		}
+
+		request.push_back(funcCode);
+
+		responce = SendPDU(id, request);
+
+		Pdu::CheckResponce(request, responce);
+
+		return responce;
+	}
+
+	/**
+	* Request of Read File Record(14). Sub-responces are checked, so
+	* template only copies records.
+	**/
+	vector<uint8_t> Master::readFileRecord(uint8_t id, const vector<FileReadSubRequest>& requests)
+	{
+		vector<uint8_t> request, responce;
+
+		if (id == IDBroadcast)
+		{
+			throw invalid_argument("Read File Record with broadcast ID.");
+		}
+
+		Pdu::EncodeReadFileRecord(request, requests);
+
+		responce = SendPDU(id, request);
+
+		Pdu::CheckReadFileRecord(request, responce);
+
+		return responce;
+	}
+
+	/**
+	* Request of Read FIFO Queue(18).
+	**/
+	vector<uint8_t> Master::readFIFOQueue(uint8_t id, uint16_t FIFOPointerAddress)
+	{
+		const uint8_t funcCode = (uint8_t)FunctionCodes::ReadFIFOQueue;
+		vector<uint8_t> request, responce;
+
+		if (id == IDBroadcast)
+		{
+			throw invalid_argument("Read FIFO Queue with broadcast ID.");
+		}
+
+		request.push_back(funcCode);
+		request.push_back(high_byte(FIFOPointerAddress));
+		request.push_back(low_byte(FIFOPointerAddress));
+
+		responce = SendPDU(id, request);
+
+		Pdu::CheckResponce(request, responce);
+
+		/**
+		 * Responce: function code, byte count(2), FIFO count(2), values.
+		 **/
+		const unsigned byteCount = get_word(responce[1], responce[2]);
+		const unsigned count = get_word(responce[3], responce[4]);
+
+		if (count > FIFOCountMax || byteCount != 2 + count * 2)
+		{
 			throw EPDUFrameError(request, responce);
 		}
+
+		return responce;
 	}
-}
\ No newline at end of file
+}
@@ -10,6 +10,10 @@
 #include <cstdint>
 #include <vector>
 #include <bitset>
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
 
 namespace Modbus
 {
@@ -43,7 +47,15 @@ namespace Modbus
 			ReadExceptionStatus = 0x07,
 			Diagnostic = 0x08,
 			GetCommEventCounter = 0x0B,
-			GetCommEventLog = 0x0C
+			GetCommEventLog = 0x0C,
+			WriteMultipleCoils = 0x0F,
+			WriteMultipleRegisters = 0x10,
+			ReportServerID = 0x11,
+			ReadFileRecord = 0x14,
+			WriteFileRecord = 0x15,
+			MaskWriteRegister = 0x16,
+			ReadFIFOQueue = 0x18,
+			EncapsulatedInterfaceTransport = 0x2B
 		};
 
 		/**
@@ -68,6 +80,17 @@ namespace Modbus
 			ClearOverrunCounterAndFlag = 0x14
 		};
 
+		/**
+		 * Read Device ID codes
+		 **/
+		enum class ReadDeviceIDCode : uint8_t
+		{
+			Basic = 0x01,
+			Regular = 0x02,
+			Extended = 0x03,
+			Specific = 0x04
+		};
+
 		enum class CommStatus
 		{
 			LastCommandStillProcessed,
@@ -93,44 +116,79 @@ namespace Modbus
 
 		struct CommEvent
 		{
+			struct ReceiveEvent
+			{
+				bool CommunicationError;
+				bool CharacterOverrun;
+				bool CurrentlyInListenOnlyMode;
+				bool BroadcastReceived;
+			};
+
+			struct SendEvent
+			{
+				bool ReadExceptionSend;
+				bool ServerAbortExceptionSend;
+				bool ServerBusyExceptionSend;
+				bool ServerProgramNAKExceptionSend;
+				bool WriteTimeoutErrorOccurred;
+				bool CurrentlyInListenOnlyMode;
+			};
+
 			CommLogEventType type;
 			union
 			{
-				struct ReceiveEvent
-				{
-					bool CommunicationError;
-					bool CharacterOverrun;
-					bool CurrentlyInListenOnlyMode;
-					bool BroadcastReceived;
-				};
-
-				struct SendEvent
-				{
-					bool ReadExceptionSend;
-					bool ServerAbortExceptionSend;
-					bool ServerBusyExceptionSend;
-					bool ServerProgramNAKExceptionSend;
-					bool WriteTimeoutErrorOccurred;
-					bool CurrentlyInListenOnlyMode;
-				};
+				ReceiveEvent receive;
+				SendEvent send;
 			};
 		};
 
-		struct CommEventLog
+		/**
+		 * Result structures with vectors are templates of allocator, so
+		 * they can be allocated from arena or memory_resource(see
+		 * Arena.h). Allocator is passed to constructor.
+		 **/
+		template <class Allocator>
+		struct BasicCommEventLog
 		{
 			CommStatus status;
 
 			uint16_t eventCount;
 			uint16_t messageCount;
 
-			std::vector<CommEvent> eventLog;
+			std::vector<CommEvent, Allocator> eventLog;
+
+			explicit BasicCommEventLog(const Allocator& allocator = Allocator()) :
+				status(CommStatus::LastCommandComplete), eventCount(0), messageCount(0), eventLog(allocator)
+			{
+			}
 		};
 
-		struct ServerID
+		typedef BasicCommEventLog<std::allocator<CommEvent>> CommEventLog;
+
+		template <class Allocator>
+		struct BasicServerID
 		{
-			std::vector<uint8_t> serverID;
+			std::vector<uint8_t, Allocator> serverID;
 			bool RunIndicatorStatus;
-			std::vector<uint8_t> additionData;
+			std::vector<uint8_t, Allocator> additionData;
+
+			explicit BasicServerID(const Allocator& allocator = Allocator()) :
+				serverID(allocator), RunIndicatorStatus(false), additionData(allocator)
+			{
+			}
+		};
+
+		typedef BasicServerID<std::allocator<uint8_t>> ServerID;
+
+		struct DeviceIdentification
+		{
+			uint8_t conformityLevel;
+
+			/**
+			 * Objects by object ID: 00 VendorName, 01 ProductCode,
+			 * 02 MajorMinorRevision etc.
+			 **/
+			std::map<uint8_t, std::string> objects;
 		};
 
 		struct FileReadSubRequest
@@ -149,6 +207,41 @@ namespace Modbus
 
 		typedef std::vector<std::vector<uint8_t>> FileRecords;
 
+		/**
+		 * Raw transaction for TransactMany. Responce or error is
+		 * filled for each transaction.
+		 **/
+		struct Transaction
+		{
+			uint8_t id;
+			std::vector<uint8_t> request;
+			std::vector<uint8_t> responce;
+			std::exception_ptr error;
+		};
+
+		/**
+		 * Constants of File Record functions
+		 **/
+		static const uint8_t FileReferenceType = 6;
+		static const uint16_t FileRecordMax = 0x270F;
+
+		/**
+		 * Maximum FIFO count in Read FIFO Queue responce
+		 **/
+		static const unsigned FIFOCountMax = 31;
+
+		/**
+		 * Maximum quantity of Read Coils/Discrete Inputs and Read
+		 * Holding/Input Registers
+		 **/
+		static const unsigned ReadBitsMax = 2000;
+		static const unsigned ReadRegistersMax = 125;
+
+		/**
+		 * MEI type of Read Device Identification
+		 **/
+		static const uint8_t MEIReadDeviceIdentification = 0x0E;
+
 		Master();
 		virtual ~Master();
 
@@ -171,6 +264,14 @@ namespace Modbus
 		 **/
 		std::vector<bool> ReadCoils(const uint8_t id, const uint16_t addr, const unsigned quantity);
 
+		/**
+		 * Functions with result parameter store result to container of
+		 * any allocator, for example in arena of poll cycle. Container
+		 * keeps its allocator.
+		 **/
+		template <class Allocator>
+		void ReadCoils(uint8_t id, uint16_t addr, unsigned quantity, std::vector<bool, Allocator>& values);
+
 		/**
 		 * Read Discrete Inputs(02)
 		 * addr:		Starting address
@@ -181,6 +282,9 @@ namespace Modbus
 		 * */
 		std::vector<bool> ReadDiscreteInputs(const uint8_t id, const uint16_t addr, const unsigned quantity);
 
+		template <class Allocator>
+		void ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity, std::vector<bool, Allocator>& values);
+
 		/**
 		 * Read Holding Registers(03)
 		 * addr:		start address
@@ -191,6 +295,9 @@ namespace Modbus
 		 **/
 		std::vector<uint16_t> ReadHoldingRegisters(const uint8_t id, const uint16_t addr, const unsigned quantity);
 
+		template <class Allocator>
+		void ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity, std::vector<uint16_t, Allocator>& values);
+
 		/**
 		 * Read Input Registers(04)
 		 * addr:		starting address
@@ -201,6 +308,9 @@ namespace Modbus
 		 **/
 		std::vector<uint16_t> ReadInputRegisters(const uint8_t id, const uint16_t addr, const unsigned quantity);
 
+		template <class Allocator>
+		void ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity, std::vector<uint16_t, Allocator>& values);
+
 		/**
 		 * Write Single Coil(05)
 		 * addr:		Coil address
@@ -327,6 +437,9 @@ namespace Modbus
 		 **/
 		CommEventLog GetCommEventLog(const uint8_t id);
 
+		template <class Allocator>
+		void GetCommEventLog(uint8_t id, BasicCommEventLog<Allocator>& commEventLog);
+
 		/**
 		 * Write Multiple Coils(0F)
 		 * addr:		Start address
@@ -345,22 +458,40 @@ namespace Modbus
 
 		/**
 		 * Report Server ID(11)(Serial Line Only)
+		 * Server ID length is device specific, so first byte is returned as
+		 * server ID, second as run indicator and the rest as additional data.
+		 * Exceptions:	invalid_argument if id is broadcast
 		 **/
 		ServerID ReportServerID(uint8_t id);
 
+		template <class Allocator>
+		void ReportServerID(uint8_t id, BasicServerID<Allocator>& serverID);
+
 		/**
 		 * Read File Record(14)
 		 * Exception:	logic_error if PDU size more than PDU_MAX_SIZE.
 		 **/
 		FileRecords ReadFileRecord(uint8_t id, std::vector<FileReadSubRequest> requests);
 
+		/**
+		 * records:	vector of byte vectors; records are allocated by
+		 *			its allocator.
+		 **/
+		template <class Records>
+		void ReadFileRecord(uint8_t id, const std::vector<FileReadSubRequest>& requests, Records& records);
+
 		/**
 		 * Write File Record(15)
+		 * Each sub-request data is records data, 2 bytes per record.
+		 * Exceptions:	invalid_argument if sub-request data is empty, has odd size
+		 *				or records are out of range.
+		 *				logic_error if PDU size more than PDU_MAX_SIZE.
 		 **/
 		void WriteFileRecord(uint8_t id, std::vector<FileWriteSubRequest> requests);
 
 		/**
 		 * Mask Write Register(16)
+		 * Register = (Register AND AndMask) OR (OrMask AND (NOT AndMask))
 		 **/
 		void MaskWriteResister(uint8_t id, uint16_t addr, uint16_t OrMask, uint16_t AndMask);
 
@@ -375,12 +506,18 @@ namespace Modbus
 
 		/**
 		 * Read FIFO Queue(18)
+		 * FIFOPointerAddress:	address of FIFO count register
+		 * Return:				FIFO values(0-31), oldest first
+		 * Exceptions:			invalid_argument if id is broadcast
 		 **/
 		std::vector<uint16_t> ReadFIFOQueue(uint8_t id, uint16_t FIFOPointerAddress);
 
+		template <class Allocator>
+		void ReadFIFOQueue(uint8_t id, uint16_t FIFOPointerAddress, std::vector<uint16_t, Allocator>& values);
+
 		/**
 		 * Encapsulated interface Transport(2B)
-		 * MEIType:		MEI Type
+		 * MEIType:		MEI Type(0-255)
 		 * data:		protocol specific data
 		 * Return:		protocol specific data
 		 **/
@@ -392,7 +529,37 @@ namespace Modbus
 
 		/**
 		 * Read Device identification(2B/0E)
+		 * code:		read device ID code
+		 * objectID:	first object to read(or the only one for Specific)
+		 * Return:		all objects of category. Responces with "more follows"
+		 *				are continued with next requests.
+		 * Exceptions:	invalid_argument if id is broadcast
+		 **/
+		DeviceIdentification ReadDeviceIdentification(uint8_t id,
+			ReadDeviceIDCode code = ReadDeviceIDCode::Basic,
+			uint8_t objectID = 0);
+
+		/**
+		 * Send raw request PDU and return raw responce PDU. Responce is
+		 * not checked, so exception responce is returned as is. It is used
+		 * by components which route PDU without decoding, like gateways.
+		 * Exceptions:	invalid_argument if request is empty or more than PDU_MAX_SIZE.
+		 **/
+		std::vector<uint8_t> Transact(uint8_t id, const std::vector<uint8_t>& request);
+
+		/**
+		 * Send raw broadcast request PDU.
 		 **/
+		void Broadcast(const std::vector<uint8_t>& request);
+
+		/**
+		 * Execute several raw transactions. Protocols which support it
+		 * pipeline requests, others execute them one by one. Error of one
+		 * transaction(timeout, connection failure) is stored in its error
+		 * field and does not abort others.
+		 * Exceptions:	invalid_argument if any request is empty or more than PDU_MAX_SIZE.
+		 **/
+		void TransactMany(std::vector<Transaction>& transactions);
 
 	protected:
 		/**
@@ -407,6 +574,12 @@ namespace Modbus
 		 **/
 		virtual void SendPDU(std::vector<uint8_t> request);
 
+		/**
+		 * Send several PDU and receive responces. Default implementation
+		 * send them one by one with SendPDU.
+		 **/
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
 	private:
 		/**
 		 * Get counters function
@@ -414,17 +587,139 @@ namespace Modbus
 		uint64_t getCounter(const uint8_t id, const DiagnosticSubFunctions);
 
 		/**
-		 * Check responce PDU for exceptions
-		 * Raise EException if PDU is MODBUS exception. 
-		 * funcCode		Function code in request PDU.
+		 * Read bits(one byte per bit) and registers into buffers of
+		 * result templates.
 		 **/
-		void checkForException(const std::vector<uint8_t> request, const std::vector<uint8_t> responce);
+		void readBits(uint8_t id, FunctionCodes funcCode, uint16_t addr, unsigned quantity, uint8_t* values);
+		void readRegisters(uint8_t id, FunctionCodes funcCode, uint16_t addr, unsigned quantity, uint16_t* values);
 
 		/**
-		* Return Exception Function code for MODBUS function code
-		**/
-		uint8_t exceptionCodeFor(FunctionCodes code);
+		 * Send request and return checked responce PDU, which result
+		 * templates decode.
+		 **/
+		std::vector<uint8_t> getCommEventLog(uint8_t id);
+		std::vector<uint8_t> reportServerID(uint8_t id);
+		std::vector<uint8_t> readFileRecord(uint8_t id, const std::vector<FileReadSubRequest>& requests);
+		std::vector<uint8_t> readFIFOQueue(uint8_t id, uint16_t FIFOPointerAddress);
+
+		/**
+		 * Decode event of Get Comm Event Log.
+		 * Return:	false if byte is not valid event.
+		 **/
+		static bool decodeCommEvent(uint8_t byte, CommEvent& event);
+
+		static uint16_t getWord(const std::vector<uint8_t>& pdu, size_t pos)
+		{
+			return ((uint16_t)pdu[pos] << 8) | pdu[pos + 1];
+		}
 	};
+
+	template <class Allocator>
+	void Master::ReadCoils(uint8_t id, uint16_t addr, unsigned quantity, std::vector<bool, Allocator>& values)
+	{
+		uint8_t buffer[ReadBitsMax];
+		readBits(id, FunctionCodes::ReadCoils, addr, quantity, buffer);
+		values.assign(buffer, buffer + quantity);
+	}
+
+	template <class Allocator>
+	void Master::ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity, std::vector<bool, Allocator>& values)
+	{
+		uint8_t buffer[ReadBitsMax];
+		readBits(id, FunctionCodes::ReadDiscreteInputs, addr, quantity, buffer);
+		values.assign(buffer, buffer + quantity);
+	}
+
+	template <class Allocator>
+	void Master::ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity, std::vector<uint16_t, Allocator>& values)
+	{
+		uint16_t buffer[ReadRegistersMax];
+		readRegisters(id, FunctionCodes::ReadHoldingRegisters, addr, quantity, buffer);
+		values.assign(buffer, buffer + quantity);
+	}
+
+	template <class Allocator>
+	void Master::ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity, std::vector<uint16_t, Allocator>& values)
+	{
+		uint16_t buffer[ReadRegistersMax];
+		readRegisters(id, FunctionCodes::ReadInputRegisters, addr, quantity, buffer);
+		values.assign(buffer, buffer + quantity);
+	}
+
+	/**
+	 * Responce: function code, byte count, status(2), event count(2),
+	 * message count(2) and events, newest first.
+	 **/
+	template <class Allocator>
+	void Master::GetCommEventLog(uint8_t id, BasicCommEventLog<Allocator>& commEventLog)
+	{
+		const std::vector<uint8_t> responce = getCommEventLog(id);
+
+		commEventLog.status = getWord(responce, 2) == 0xFFFF ?
+			CommStatus::LastCommandStillProcessed : CommStatus::LastCommandComplete;
+		commEventLog.eventCount = getWord(responce, 4);
+		commEventLog.messageCount = getWord(responce, 6);
+
+		commEventLog.eventLog.resize(responce.size() - 8);
+		for (size_t i = 8; i < responce.size(); i++)
+		{
+			decodeCommEvent(responce[i], commEventLog.eventLog[i - 8]);
+		}
+	}
+
+	/**
+	 * Responce: function code, byte count, server ID, run indicator
+	 * status and additional data.
+	 **/
+	template <class Allocator>
+	void Master::ReportServerID(uint8_t id, BasicServerID<Allocator>& serverID)
+	{
+		const std::vector<uint8_t> responce = reportServerID(id);
+
+		serverID.serverID.assign(1, responce[2]);
+		serverID.RunIndicatorStatus = responce[3] == 0xFF;
+		serverID.additionData.assign(responce.cbegin() + 4, responce.cend());
+	}
+
+	/**
+	 * Sub-responces: length, reference type and records data.
+	 **/
+	template <class Records>
+	void Master::ReadFileRecord(uint8_t id, const std::vector<FileReadSubRequest>& requests, Records& records)
+	{
+		typedef typename Records::value_type Record;
+
+		const std::vector<uint8_t> responce = readFileRecord(id, requests);
+		size_t pos = 2;
+
+		records.clear();
+		records.reserve(requests.size());
+
+		for (std::vector<FileReadSubRequest>::const_iterator i = requests.cbegin(); i != requests.cend(); i++)
+		{
+			const size_t size = (size_t)i->Length * 2;
+
+			records.push_back(Record(responce.cbegin() + pos + 2, responce.cbegin() + pos + 2 + size,
+				typename Record::allocator_type(records.get_allocator())));
+			pos += 2 + size;
+		}
+	}
+
+	/**
+	 * Responce: function code, byte count(2), FIFO count(2), values.
+	 **/
+	template <class Allocator>
+	void Master::ReadFIFOQueue(uint8_t id, uint16_t FIFOPointerAddress, std::vector<uint16_t, Allocator>& values)
+	{
+		const std::vector<uint8_t> responce = readFIFOQueue(id, FIFOPointerAddress);
+		const unsigned count = getWord(responce, 3);
+
+		values.resize(count);
+		for (unsigned i = 0; i < count; i++)
+		{
+			values[i] = getWord(responce, 5 + i * 2);
+		}
+	}
 }
 
 #endif	/* _MASTER_H_ */
@@ -0,0 +1,543 @@
+/**
+ * Description: PDU codec helpers shared by Master and BasicMaster.
+ *				Functions work on raw buffers and are inline, so policy
+ *				masters can inline encode and decode into transaction.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _PDU_H_
+#define _PDU_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "Master.h"
+#include "mb_exceptions.h"
+
+namespace Modbus
+{
+	namespace Pdu
+	{
+		/**
+		 * Constants
+		 **/
+		static const uint8_t ExceptionFlag = 0x80;
+		static const unsigned MaxReadBits = Master::ReadBitsMax;
+		static const unsigned MaxReadRegisters = Master::ReadRegistersMax;
+		static const unsigned MaxWriteCoils = 1968;
+		static const unsigned MaxWriteRegisters = 123;
+
+		inline void PutWord(uint8_t* p, uint16_t word)
+		{
+			p[0] = (uint8_t)(word >> 8);
+			p[1] = (uint8_t)word;
+		}
+
+		inline uint16_t GetWord(const uint8_t* p)
+		{
+			return ((uint16_t)p[0] << 8) | p[1];
+		}
+
+		/**
+		 * Raise EPDUFrameError. Vectors are built only on error path.
+		 **/
+		inline void FrameError(const uint8_t* request, size_t requestSize, const uint8_t* responce, size_t size)
+		{
+			throw EPDUFrameError(std::vector<uint8_t>(request, request + requestSize),
+				std::vector<uint8_t>(responce, responce + size));
+		}
+
+		inline void CheckNotBroadcast(uint8_t id)
+		{
+			if (id == Master::IDBroadcast)
+			{
+				throw std::invalid_argument("Read request with broadcast ID.");
+			}
+		}
+
+		/**
+		 * Raise EException if responce is exception responce to request.
+		 **/
+		inline void CheckException(const uint8_t* request, size_t requestSize, const uint8_t* responce, size_t size)
+		{
+			if (size == Master::ExceptionResponcePDUSize && responce[0] == (request[0] | ExceptionFlag))
+			{
+				throw EException(responce[1]);
+			}
+
+			if (size == 0 || responce[0] != request[0])
+			{
+				FrameError(request, requestSize, responce, size);
+			}
+		}
+
+		/**
+		 * Layout of normal responce of function.
+		 **/
+		enum Layout
+		{
+			/**
+			 * Unknown function: only function code is checked.
+			 **/
+			Unchecked,
+
+			/**
+			 * Responce of fixed size.
+			 **/
+			Fixed,
+
+			/**
+			 * Responce is first size bytes of request, whole request if
+			 * size is 0.
+			 **/
+			Echo,
+
+			/**
+			 * Responce starts with first size bytes of request.
+			 **/
+			EchoPrefix,
+
+			/**
+			 * Byte count at [1](two bytes at [1] for WordByteCount) equals
+			 * to size of rest of responce and is at least size.
+			 **/
+			ByteCount,
+			WordByteCount,
+
+			/**
+			 * ByteCount of bits or registers of quantity of read request.
+			 **/
+			BitData,
+			RegisterData,
+
+			/**
+			 * RegisterData of read quantity of Read/Write Multiple
+			 * Registers request, which is followed by write part.
+			 **/
+			ReadWriteRegisterData
+		};
+
+		struct Descriptor
+		{
+			uint8_t layout;
+			uint8_t size;
+		};
+
+		/**
+		 * Descriptors of responces by function code. Codes above table
+		 * are Unchecked.
+		 **/
+		static const uint8_t DescriptorCount = 0x2C;
+		static const Descriptor Descriptors[DescriptorCount] =
+		{
+			{ Unchecked, 0 },		// 00
+			{ BitData, 0 },			// 01 Read Coils
+			{ BitData, 0 },			// 02 Read Discrete Inputs
+			{ RegisterData, 0 },	// 03 Read Holding Registers
+			{ RegisterData, 0 },	// 04 Read Input Registers
+			{ Echo, 0 },			// 05 Write Single Coil
+			{ Echo, 0 },			// 06 Write Single Register
+			{ Fixed, 2 },			// 07 Read Exception Status
+			{ EchoPrefix, 3 },		// 08 Diagnostic
+			{ Unchecked, 0 },		// 09
+			{ Unchecked, 0 },		// 0A
+			{ Fixed, 5 },			// 0B Get Comm Event Counter
+			{ ByteCount, 6 },		// 0C Get Comm Event Log
+			{ Unchecked, 0 },		// 0D
+			{ Unchecked, 0 },		// 0E
+			{ Echo, 5 },			// 0F Write Multiple Coils
+			{ Echo, 5 },			// 10 Write Multiple Registers
+			{ ByteCount, 2 },		// 11 Report Server ID
+			{ Unchecked, 0 },		// 12
+			{ Unchecked, 0 },		// 13
+			{ ByteCount, 2 },		// 14 Read File Record
+			{ Echo, 0 },			// 15 Write File Record
+			{ Echo, 0 },			// 16 Mask Write Register
+			{ ReadWriteRegisterData, 0 },	// 17 Read/Write Multiple Registers
+			{ WordByteCount, 2 },	// 18 Read FIFO Queue
+			{ Unchecked, 0 },		// 19
+			{ Unchecked, 0 },		// 1A
+			{ Unchecked, 0 },		// 1B
+			{ Unchecked, 0 },		// 1C
+			{ Unchecked, 0 },		// 1D
+			{ Unchecked, 0 },		// 1E
+			{ Unchecked, 0 },		// 1F
+			{ Unchecked, 0 },		// 20
+			{ Unchecked, 0 },		// 21
+			{ Unchecked, 0 },		// 22
+			{ Unchecked, 0 },		// 23
+			{ Unchecked, 0 },		// 24
+			{ Unchecked, 0 },		// 25
+			{ Unchecked, 0 },		// 26
+			{ Unchecked, 0 },		// 27
+			{ Unchecked, 0 },		// 28
+			{ Unchecked, 0 },		// 29
+			{ Unchecked, 0 },		// 2A
+			{ EchoPrefix, 2 }		// 2B Encapsulated Interface Transport
+		};
+
+		/**
+		 * Check responce to request by descriptor of function: raise
+		 * EException for exception responce and EPDUFrameError if
+		 * responce doesn't match layout.
+		 **/
+		inline void CheckResponce(const uint8_t* request, size_t requestSize, const uint8_t* responce, size_t size)
+		{
+			CheckException(request, requestSize, responce, size);
+
+			const Descriptor descriptor = request[0] < DescriptorCount ? Descriptors[request[0]] : Descriptors[0];
+			size_t expected = 0;
+			bool valid = true;
+
+			switch (descriptor.layout)
+			{
+			case Fixed:
+				valid = size == descriptor.size;
+				break;
+
+			case Echo:
+				expected = descriptor.size == 0 ? requestSize : descriptor.size;
+				valid = size == expected && expected <= requestSize && memcmp(request, responce, expected) == 0;
+				break;
+
+			case EchoPrefix:
+				valid = size >= descriptor.size && requestSize >= descriptor.size &&
+					memcmp(request, responce, descriptor.size) == 0;
+				break;
+
+			case ByteCount:
+				valid = size >= 2 && responce[1] >= descriptor.size && size == 2u + responce[1];
+				break;
+
+			case WordByteCount:
+				valid = size >= 3 && GetWord(responce + 1) >= descriptor.size && size == 3u + GetWord(responce + 1);
+				break;
+
+			case BitData:
+				valid = requestSize == 5;
+				if (!valid)
+					break;
+
+				expected = (GetWord(request + 3) + 7u) / 8;
+				valid = size == 2 + expected && responce[1] == expected;
+				break;
+
+			case RegisterData:
+				valid = requestSize == 5;
+				if (!valid)
+					break;
+
+				expected = GetWord(request + 3) * 2u;
+				valid = size == 2 + expected && responce[1] == expected;
+				break;
+
+			case ReadWriteRegisterData:
+				valid = requestSize >= 10;
+				if (!valid)
+					break;
+
+				expected = GetWord(request + 3) * 2u;
+				valid = size == 2 + expected && responce[1] == expected;
+				break;
+			}
+
+			if (!valid)
+			{
+				FrameError(request, requestSize, responce, size);
+			}
+		}
+
+		inline void CheckResponce(const std::vector<uint8_t>& request, const std::vector<uint8_t>& responce)
+		{
+			CheckResponce(request.data(), request.size(), responce.data(), responce.size());
+		}
+
+		/**
+		 * Read Coils(01), Read Discrete Inputs(02), Read Holding Registers(03)
+		 * and Read Input Registers(04) request.
+		 * Return:		PDU size
+		 * Exception:	invalid_argument if quantity is out of range.
+		 **/
+		inline size_t EncodeRead(uint8_t* pdu, Master::FunctionCodes funcCode, uint16_t addr, unsigned quantity)
+		{
+			const unsigned max = funcCode <= Master::FunctionCodes::ReadDiscreteInputs ? MaxReadBits : MaxReadRegisters;
+
+			if (quantity < 1 || quantity > max)
+			{
+				throw std::invalid_argument("Quantity out of range.");
+			}
+
+			pdu[0] = (uint8_t)funcCode;
+			PutWord(pdu + 1, addr);
+			PutWord(pdu + 3, (uint16_t)quantity);
+			return 5;
+		}
+
+		/**
+		 * Decode bits of Read Coils/Read Discrete Inputs responce into
+		 * values[0]..values[quantity - 1].
+		 **/
+		template <class Output>
+		inline void DecodeBits(const uint8_t* request, size_t requestSize, const uint8_t* responce, size_t size,
+			unsigned quantity, Output values)
+		{
+			CheckResponce(request, requestSize, responce, size);
+
+			for (unsigned i = 0; i < quantity; i++)
+			{
+				values[i] = ((responce[2 + i / 8] >> (i % 8)) & 0x01) != 0;
+			}
+		}
+
+		inline void DecodeRegisters(const uint8_t* request, size_t requestSize, const uint8_t* responce, size_t size,
+			unsigned quantity, uint16_t* values)
+		{
+			CheckResponce(request, requestSize, responce, size);
+
+			for (unsigned i = 0; i < quantity; i++)
+			{
+				values[i] = GetWord(responce + 2 + i * 2);
+			}
+		}
+
+		/**
+		 * Write Single Coil(05) and Write Single Register(06) request.
+		 **/
+		inline size_t EncodeWriteSingleCoil(uint8_t* pdu, uint16_t addr, bool value)
+		{
+			pdu[0] = (uint8_t)Master::FunctionCodes::WriteSingleCoil;
+			PutWord(pdu + 1, addr);
+			PutWord(pdu + 3, value ? 0xFF00 : 0x0000);
+			return 5;
+		}
+
+		inline size_t EncodeWriteSingleRegister(uint8_t* pdu, uint16_t addr, uint16_t value)
+		{
+			pdu[0] = (uint8_t)Master::FunctionCodes::WriteSingleRegister;
+			PutWord(pdu + 1, addr);
+			PutWord(pdu + 3, value);
+			return 5;
+		}
+
+		/**
+		 * Write Multiple Coils(0F) request from values[0]..values[quantity - 1].
+		 * Exception:	invalid_argument if quantity is out of range(1-1968).
+		 **/
+		template <class Input>
+		inline size_t EncodeWriteMultipleCoils(uint8_t* pdu, uint16_t addr, Input values, unsigned quantity)
+		{
+			if (quantity < 1 || quantity > MaxWriteCoils)
+			{
+				throw std::invalid_argument("Quantity of coils out of range.");
+			}
+
+			const unsigned bytes = (quantity + 7) / 8;
+
+			pdu[0] = (uint8_t)Master::FunctionCodes::WriteMultipleCoils;
+			PutWord(pdu + 1, addr);
+			PutWord(pdu + 3, (uint16_t)quantity);
+			pdu[5] = (uint8_t)bytes;
+
+			for (unsigned i = 0; i < bytes; i++)
+				pdu[6 + i] = 0;
+
+			for (unsigned i = 0; i < quantity; i++)
+			{
+				if (values[i])
+					pdu[6 + i / 8] |= (uint8_t)(1 << (i % 8));
+			}
+
+			return 6 + bytes;
+		}
+
+		/**
+		 * Write Multiple Registers(10) request.
+		 * Exception:	invalid_argument if quantity is out of range(1-123).
+		 **/
+		inline size_t EncodeWriteMultipleRegisters(uint8_t* pdu, uint16_t addr, const uint16_t* values, unsigned quantity)
+		{
+			if (quantity < 1 || quantity > MaxWriteRegisters)
+			{
+				throw std::invalid_argument("Quantity of registers out of range.");
+			}
+
+			pdu[0] = (uint8_t)Master::FunctionCodes::WriteMultipleRegisters;
+			PutWord(pdu + 1, addr);
+			PutWord(pdu + 3, (uint16_t)quantity);
+			pdu[5] = (uint8_t)(quantity * 2);
+
+			for (unsigned i = 0; i < quantity; i++)
+				PutWord(pdu + 6 + i * 2, values[i]);
+
+			return 6 + quantity * 2;
+		}
+
+		/**
+		 * Mask Write Register(16) request.
+		 **/
+		inline size_t EncodeMaskWriteRegister(uint8_t* pdu, uint16_t addr, uint16_t orMask, uint16_t andMask)
+		{
+			pdu[0] = (uint8_t)Master::FunctionCodes::MaskWriteRegister;
+			PutWord(pdu + 1, addr);
+			PutWord(pdu + 3, andMask);
+			PutWord(pdu + 5, orMask);
+			return 7;
+		}
+
+		/**
+		 * Read File Record(14) request. Each sub-request is 7 bytes in
+		 * request and 2 bytes plus records in responce.
+		 * Exception:	invalid_argument if there are no sub-requests or records
+		 *				are out of range.
+		 *				logic_error if request or responce is more than PDU_MAX_SIZE.
+		 **/
+		inline void EncodeReadFileRecord(std::vector<uint8_t>& pdu, const std::vector<Master::FileReadSubRequest>& requests)
+		{
+			if (requests.empty())
+			{
+				throw std::invalid_argument("No sub-requests.");
+			}
+
+			unsigned responceSize = 2;
+			for (std::vector<Master::FileReadSubRequest>::const_iterator i = requests.cbegin(); i != requests.cend(); i++)
+			{
+				if (i->StartingRecord > Master::FileRecordMax || i->Length == 0 ||
+					i->StartingRecord + i->Length - 1 > Master::FileRecordMax)
+				{
+					throw std::invalid_argument("Record number out of range.");
+				}
+
+				responceSize += 2 + i->Length * 2;
+			}
+
+			if (2 + requests.size() * 7 > Master::PDU_MAX_SIZE || responceSize > Master::PDU_MAX_SIZE)
+			{
+				throw std::logic_error("PDU size is more than maximum size.");
+			}
+
+			pdu.resize(2 + requests.size() * 7);
+			pdu[0] = (uint8_t)Master::FunctionCodes::ReadFileRecord;
+			pdu[1] = (uint8_t)(requests.size() * 7);
+
+			uint8_t* p = pdu.data() + 2;
+			for (std::vector<Master::FileReadSubRequest>::const_iterator i = requests.cbegin(); i != requests.cend(); i++)
+			{
+				p[0] = Master::FileReferenceType;
+				PutWord(p + 1, i->FileNumber);
+				PutWord(p + 3, i->StartingRecord);
+				PutWord(p + 5, i->Length);
+				p += 7;
+			}
+		}
+
+		/**
+		 * Check Read File Record responce: sub-responces are length,
+		 * reference type and records data of each sub-request.
+		 **/
+		inline void CheckReadFileRecord(const std::vector<uint8_t>& request, const std::vector<uint8_t>& responce)
+		{
+			CheckResponce(request, responce);
+
+			size_t pos = 2;
+			for (size_t r = 2; r + 7 <= request.size(); r += 7)
+			{
+				const size_t size = GetWord(request.data() + r + 5) * 2u;
+
+				if (pos + 2 + size > responce.size() || responce[pos] != 1 + size ||
+					responce[pos + 1] != Master::FileReferenceType)
+				{
+					throw EPDUFrameError(request, responce);
+				}
+
+				pos += 2 + size;
+			}
+
+			if (pos != responce.size())
+			{
+				throw EPDUFrameError(request, responce);
+			}
+		}
+
+		/**
+		 * Decode Read File Record responce into vector of records.
+		 **/
+		template <class Records>
+		inline void DecodeReadFileRecord(const std::vector<uint8_t>& request, const std::vector<uint8_t>& responce,
+			Records& records)
+		{
+			typedef typename Records::value_type Record;
+
+			CheckReadFileRecord(request, responce);
+
+			records.clear();
+
+			size_t pos = 2;
+			while (pos < responce.size())
+			{
+				const size_t size = responce[pos] - 1u;
+
+				records.push_back(Record(responce.cbegin() + pos + 2, responce.cbegin() + pos + 2 + size,
+					typename Record::allocator_type(records.get_allocator())));
+				pos += 2 + size;
+			}
+		}
+
+		/**
+		 * Write File Record(15) request. Each sub-request data is records
+		 * data, 2 bytes per record.
+		 * Exceptions:	invalid_argument if there are no sub-requests, data is
+		 *				empty, has odd size or records are out of range.
+		 *				logic_error if request is more than PDU_MAX_SIZE.
+		 **/
+		inline void EncodeWriteFileRecord(std::vector<uint8_t>& pdu, const std::vector<Master::FileWriteSubRequest>& requests)
+		{
+			if (requests.empty())
+			{
+				throw std::invalid_argument("No sub-requests.");
+			}
+
+			unsigned requestSize = 2;
+			for (std::vector<Master::FileWriteSubRequest>::const_iterator i = requests.cbegin(); i != requests.cend(); i++)
+			{
+				const unsigned length = (unsigned)(i->data.size() / 2);
+
+				if (i->data.empty() || i->data.size() % 2 != 0)
+				{
+					throw std::invalid_argument("Record data must be not empty and even size.");
+				}
+
+				if (i->StartingRecord > Master::FileRecordMax || i->data.size() > Master::PDU_MAX_SIZE ||
+					i->StartingRecord + length - 1 > Master::FileRecordMax)
+				{
+					throw std::invalid_argument("Record number out of range.");
+				}
+
+				requestSize += 7 + (unsigned)i->data.size();
+			}
+
+			if (requestSize > Master::PDU_MAX_SIZE)
+			{
+				throw std::logic_error("PDU size is more than maximum size.");
+			}
+
+			pdu.resize(requestSize);
+			pdu[0] = (uint8_t)Master::FunctionCodes::WriteFileRecord;
+			pdu[1] = (uint8_t)(requestSize - 2);
+
+			uint8_t* p = pdu.data() + 2;
+			for (std::vector<Master::FileWriteSubRequest>::const_iterator i = requests.cbegin(); i != requests.cend(); i++)
+			{
+				p[0] = Master::FileReferenceType;
+				PutWord(p + 1, i->FileNumber);
+				PutWord(p + 3, i->StartingRecord);
+				PutWord(p + 5, (uint16_t)(i->data.size() / 2));
+				memcpy(p + 7, i->data.data(), i->data.size());
+				p += 7 + i->data.size();
+			}
+		}
+	}
+}
+
+#endif	/* _PDU_H_ */
@@ -0,0 +1,297 @@
+/**
+* Priority queue of transactions to one master
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <stdexcept>
+#include "QueuedMaster.h"
+
+/**
+ * v120 toolset has no thread_local; POD is kept in compiler thread
+ * storage.
+ **/
+#ifdef _MSC_VER
+#define MB_THREAD_LOCAL __declspec(thread)
+#else
+#define MB_THREAD_LOCAL __thread
+#endif
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	const unsigned QueuedMaster::Lanes;
+
+	/**
+	 * Priority of PriorityScope of thread, -1 if there is no scope.
+	 **/
+	static MB_THREAD_LOCAL int scopePriority = -1;
+
+	QueuedMaster::PriorityScope::PriorityScope(Priority priority) : previous(scopePriority)
+	{
+		scopePriority = (int)priority;
+	}
+
+	QueuedMaster::PriorityScope::~PriorityScope()
+	{
+		scopePriority = previous;
+	}
+
+	QueuedMaster::QueuedMaster(Master& master, const Settings& settings)
+		: master(master), settings(settings), stopping(false)
+	{
+		for (unsigned i = 0; i < 256; i++)
+			priorities[i] = Priority::Normal;
+
+		priorities[(uint8_t)FunctionCodes::WriteSingleCoil] = Priority::High;
+		priorities[(uint8_t)FunctionCodes::WriteSingleRegister] = Priority::High;
+		priorities[(uint8_t)FunctionCodes::WriteMultipleCoils] = Priority::High;
+		priorities[(uint8_t)FunctionCodes::WriteMultipleRegisters] = Priority::High;
+		priorities[(uint8_t)FunctionCodes::MaskWriteRegister] = Priority::High;
+
+		priorities[(uint8_t)FunctionCodes::Diagnostic] = Priority::Low;
+		priorities[(uint8_t)FunctionCodes::GetCommEventLog] = Priority::Low;
+		priorities[(uint8_t)FunctionCodes::ReportServerID] = Priority::Low;
+		priorities[(uint8_t)FunctionCodes::ReadFileRecord] = Priority::Low;
+		priorities[(uint8_t)FunctionCodes::WriteFileRecord] = Priority::Low;
+		priorities[(uint8_t)FunctionCodes::ReadFIFOQueue] = Priority::Low;
+		priorities[(uint8_t)FunctionCodes::EncapsulatedInterfaceTransport] = Priority::Low;
+
+		for (unsigned i = 0; i < Lanes; i++)
+		{
+			statistic.transactions[i] = 0;
+			statistic.maxWait[i] = 0;
+		}
+		statistic.aged = 0;
+
+		worker = thread(&QueuedMaster::workerLoop, this);
+	}
+
+	/**
+	* Stop worker. Queued transactions fail.
+	**/
+	QueuedMaster::~QueuedMaster()
+	{
+		{
+			lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		queued.notify_all();
+		worker.join();
+	}
+
+	void QueuedMaster::SetPriority(FunctionCodes code, Priority priority)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		priorities[(uint8_t)code] = priority;
+	}
+
+	QueuedMaster::Priority QueuedMaster::GetPriority(FunctionCodes code)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return priorities[(uint8_t)code];
+	}
+
+	QueuedMaster::Statistic QueuedMaster::GetStatistic()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return statistic;
+	}
+
+	vector<uint8_t> QueuedMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		vector<uint8_t> responce;
+		exception_ptr error;
+		vector<Item> items(1);
+
+		items[0].id = id;
+		items[0].request = &request;
+		items[0].responce = &responce;
+		items[0].error = &error;
+		items[0].broadcast = false;
+
+		execute(items);
+
+		if (error)
+			rethrow_exception(error);
+
+		return responce;
+	}
+
+	void QueuedMaster::SendPDU(vector<uint8_t> request)
+	{
+		exception_ptr error;
+		vector<Item> items(1);
+
+		items[0].id = IDBroadcast;
+		items[0].request = &request;
+		items[0].responce = nullptr;
+		items[0].error = &error;
+		items[0].broadcast = true;
+
+		execute(items);
+
+		if (error)
+			rethrow_exception(error);
+	}
+
+	void QueuedMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		vector<Item> items(transactions.size());
+
+		for (size_t i = 0; i < transactions.size(); i++)
+		{
+			items[i].id = transactions[i].id;
+			items[i].request = &transactions[i].request;
+			items[i].responce = &transactions[i].responce;
+			items[i].error = &transactions[i].error;
+			items[i].broadcast = false;
+		}
+
+		execute(items);
+	}
+
+	/**
+	* Queue items and wait until all are done.
+	**/
+	void QueuedMaster::execute(vector<Item>& items)
+	{
+		unique_lock<std::mutex> lock(mutex);
+
+		if (stopping)
+		{
+			throw logic_error("Queued master is destroyed.");
+		}
+
+		const Clock::time_point now = Clock::now();
+
+		for (vector<Item>::iterator i = items.begin(); i != items.end(); i++)
+		{
+			i->done = false;
+			i->queued = now;
+			*i->error = nullptr;
+			lanes[laneOf(*i->request)].push_back(&*i);
+		}
+
+		queued.notify_one();
+
+		for (vector<Item>::const_iterator i = items.cbegin(); i != items.cend(); i++)
+		{
+			completed.wait(lock, [&i]() { return i->done; });
+		}
+	}
+
+	unsigned QueuedMaster::laneOf(const vector<uint8_t>& request) const
+	{
+		if (scopePriority >= 0)
+			return (unsigned)scopePriority;
+
+		return request.empty() ? (unsigned)Priority::Normal : (unsigned)priorities[request[0]];
+	}
+
+	/**
+	* Take head of lane with highest priority raised by aging. Of equal
+	* priorities the oldest is taken.
+	**/
+	QueuedMaster::Item* QueuedMaster::next(Clock::time_point now)
+	{
+		const Clock::duration aging = milliseconds(settings.aging == 0 ? 1 : settings.aging);
+		unsigned best = Lanes;
+		unsigned bestLevel = Lanes;
+
+		for (unsigned lane = 0; lane < Lanes; lane++)
+		{
+			if (lanes[lane].empty())
+				continue;
+
+			const Item* item = lanes[lane].front();
+			const unsigned raised = (unsigned)min<Clock::rep>(lane, (now - item->queued) / aging);
+			const unsigned level = lane - raised;
+
+			if (level < bestLevel || (level == bestLevel && item->queued < lanes[best].front()->queued))
+			{
+				best = lane;
+				bestLevel = level;
+			}
+		}
+
+		Item* item = lanes[best].front();
+		lanes[best].pop_front();
+
+		/**
+		 * Aged item is taken before waiting item of higher lane.
+		 **/
+		for (unsigned lane = 0; lane < best; lane++)
+		{
+			if (!lanes[lane].empty())
+			{
+				statistic.aged++;
+				break;
+			}
+		}
+
+		const uint64_t wait = (uint64_t)duration_cast<microseconds>(now - item->queued).count();
+		statistic.transactions[best]++;
+		statistic.maxWait[best] = max(statistic.maxWait[best], wait);
+
+		return item;
+	}
+
+	/**
+	* Execute queued transactions one by one.
+	**/
+	void QueuedMaster::workerLoop()
+	{
+		unique_lock<std::mutex> lock(mutex);
+
+		for (;;)
+		{
+			queued.wait(lock, [this]()
+			{
+				return stopping || !lanes[0].empty() || !lanes[1].empty() || !lanes[2].empty();
+			});
+
+			if (stopping)
+				break;
+
+			Item* item = next(Clock::now());
+			lock.unlock();
+
+			try
+			{
+				if (item->broadcast)
+					master.Broadcast(*item->request);
+				else
+					*item->responce = master.Transact(item->id, *item->request);
+			}
+			catch (...)
+			{
+				*item->error = current_exception();
+			}
+
+			lock.lock();
+			item->done = true;
+			completed.notify_all();
+		}
+
+		/**
+		 * Fail transactions which are still queued.
+		 **/
+		exception_ptr error = make_exception_ptr(logic_error("Queued master is destroyed."));
+
+		for (unsigned lane = 0; lane < Lanes; lane++)
+		{
+			for (deque<Item*>::const_iterator i = lanes[lane].cbegin(); i != lanes[lane].cend(); i++)
+			{
+				*(*i)->error = error;
+				(*i)->done = true;
+			}
+
+			lanes[lane].clear();
+		}
+
+		completed.notify_all();
+	}
+}
@@ -0,0 +1,169 @@
+/**
+ * Description: Master which queues transactions of many threads to one
+ *				master(usually serial line) by priority. Each priority has
+ *				its own queue(lane); next transaction is taken from highest
+ *				priority lane, so control writes wait at most for one
+ *				transaction in progress instead of all queued polling.
+ *				Waiting transactions are raised one priority for each aging
+ *				interval, so low priority traffic is not starved.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _QUEUED_MASTER_H_
+#define _QUEUED_MASTER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	class QueuedMaster : public Master
+	{
+	public:
+		enum class Priority
+		{
+			High = 0,
+			Normal = 1,
+			Low = 2
+		};
+
+		static const unsigned Lanes = 3;
+
+		struct Settings
+		{
+			/**
+			 * Waiting time which raises transaction one priority, ms.
+			 * Low priority transaction waits at most two intervals
+			 * plus transactions of higher lanes queued before it.
+			 **/
+			unsigned aging;
+
+			Settings() : aging(500)
+			{
+			}
+		};
+
+		struct Statistic
+		{
+			/**
+			 * Transactions and maximum queue waiting time(us) by lane
+			 **/
+			uint64_t transactions[Lanes];
+			uint64_t maxWait[Lanes];
+
+			/**
+			 * Transactions sent before fresher transactions of higher
+			 * lanes because of aging
+			 **/
+			uint64_t aged;
+		};
+
+		/**
+		 * Priority of transactions made by calling thread while scope
+		 * exists, instead of priority of function code.
+		 **/
+		class PriorityScope
+		{
+		public:
+			explicit PriorityScope(Priority priority);
+			~PriorityScope();
+
+		private:
+			PriorityScope(const PriorityScope&);
+			PriorityScope& operator=(const PriorityScope&);
+
+			int previous;
+		};
+
+		/**
+		 * master:	master used for all transactions. It is used only by
+		 *			worker thread of QueuedMaster.
+		 * Default priorities: writes(05, 06, 0F, 10, 16) are High; file
+		 * records, FIFO queue, diagnostics, event log, server ID and
+		 * device identification are Low; others are Normal.
+		 **/
+		explicit QueuedMaster(Master& master, const Settings& settings = Settings());
+		virtual ~QueuedMaster();
+
+		/**
+		 * Priority of requests with function code.
+		 **/
+		void SetPriority(FunctionCodes code, Priority priority);
+		Priority GetPriority(FunctionCodes code);
+
+		Statistic GetStatistic();
+
+	protected:
+		/**
+		 * Queue transaction and wait until worker executes it. Functions
+		 * are thread safe.
+		 **/
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+		/**
+		 * All transactions are queued at once, each with priority of its
+		 * function code, and executed one by one.
+		 **/
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		QueuedMaster(const QueuedMaster&);
+		QueuedMaster& operator=(const QueuedMaster&);
+
+		/**
+		 * Queued transaction. Item belongs to waiting caller.
+		 **/
+		struct Item
+		{
+			uint8_t id;
+			const std::vector<uint8_t>* request;
+			std::vector<uint8_t>* responce;
+			std::exception_ptr* error;
+			bool broadcast;
+			bool done;
+			Clock::time_point queued;
+		};
+
+		/**
+		 * Queue items and wait until all are done.
+		 **/
+		void execute(std::vector<Item>& items);
+
+		/**
+		 * Priority of request of calling thread.
+		 **/
+		unsigned laneOf(const std::vector<uint8_t>& request) const;
+
+		/**
+		 * Remove next item from lanes. Lanes must not be empty.
+		 **/
+		Item* next(Clock::time_point now);
+
+		void workerLoop();
+
+		Master& master;
+		Settings settings;
+		Priority priorities[256];
+
+		std::mutex mutex;
+		std::condition_variable queued;
+		std::condition_variable completed;
+		std::deque<Item*> lanes[Lanes];
+		bool stopping;
+		Statistic statistic;
+
+		std::thread worker;
+	};
+}
+
+#endif	/* _QUEUED_MASTER_H_ */
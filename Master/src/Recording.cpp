@@ -0,0 +1,418 @@
+/**
+* Record and replay of MODBUS traffic
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include "Recording.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	/**
+	 * File: magic and version, then records. Record: status(1), id(1),
+	 * time delta from previous record, latency, request size, request,
+	 * responce size, responce(or error message). Numbers are LEB128
+	 * varints, so common record is few bytes plus PDUs.
+	 **/
+	static const char RecordingMagic[4] = { 'M', 'B', 'R', 'R' };
+	static const uint8_t RecordingVersion = 1;
+
+	static void put_varint(vector<uint8_t>& data, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			data.push_back((uint8_t)(value | 0x80));
+			value >>= 7;
+		}
+
+		data.push_back((uint8_t)value);
+	}
+
+	static uint64_t get_varint(ifstream& file)
+	{
+		uint64_t value = 0;
+
+		for (unsigned shift = 0; shift < 64; shift += 7)
+		{
+			const int c = file.get();
+			if (c == EOF)
+			{
+				throw runtime_error("Invalid recording file.");
+			}
+
+			value |= (uint64_t)(c & 0x7F) << shift;
+			if ((c & 0x80) == 0)
+				return value;
+		}
+
+		throw runtime_error("Invalid recording file.");
+	}
+
+	static void get_bytes(ifstream& file, vector<uint8_t>& bytes)
+	{
+		const uint64_t size = get_varint(file);
+		if (size > 0x10000)
+		{
+			throw runtime_error("Invalid recording file.");
+		}
+
+		bytes.resize((size_t)size);
+		file.read((char*)bytes.data(), bytes.size());
+
+		if (!file)
+		{
+			throw runtime_error("Invalid recording file.");
+		}
+	}
+
+	vector<RecordedTransaction> LoadRecording(const string& path)
+	{
+		ifstream file(path.c_str(), ios::binary);
+		if (!file)
+		{
+			throw runtime_error("Can not open recording " + path);
+		}
+
+		char magic[sizeof(RecordingMagic)];
+		file.read(magic, sizeof(magic));
+
+		if (!file || memcmp(magic, RecordingMagic, sizeof(magic)) != 0 || file.get() != RecordingVersion)
+		{
+			throw runtime_error("Invalid recording file.");
+		}
+
+		vector<RecordedTransaction> recording;
+		int64_t time = 0;
+
+		for (;;)
+		{
+			const int status = file.get();
+			if (status == EOF)
+				break;
+
+			if (status > (int)RecordedTransaction::Status::Broadcast)
+			{
+				throw runtime_error("Invalid recording file.");
+			}
+
+			RecordedTransaction transaction;
+			transaction.status = (RecordedTransaction::Status)status;
+
+			const int id = file.get();
+			if (id == EOF)
+			{
+				throw runtime_error("Invalid recording file.");
+			}
+
+			transaction.id = (uint8_t)id;
+			time += (int64_t)get_varint(file);
+			transaction.time = time;
+			transaction.latency = (uint32_t)get_varint(file);
+			get_bytes(file, transaction.request);
+			get_bytes(file, transaction.responce);
+
+			if (transaction.status == RecordedTransaction::Status::Error)
+			{
+				transaction.message.assign(transaction.responce.begin(), transaction.responce.end());
+				transaction.responce.clear();
+			}
+
+			recording.push_back(move(transaction));
+		}
+
+		return recording;
+	}
+
+	RecordingMaster::RecordingMaster(Master& master, const string& path)
+		: master(master), previous(Clock::now()), file(path.c_str(), ios::binary | ios::trunc), recorded(0)
+	{
+		if (!file)
+		{
+			throw runtime_error("Can not create recording " + path);
+		}
+
+		file.write(RecordingMagic, sizeof(RecordingMagic));
+		file.put((char)RecordingVersion);
+
+		if (!file)
+		{
+			throw runtime_error("Can not write recording " + path);
+		}
+	}
+
+	RecordingMaster::~RecordingMaster()
+	{
+		file.close();
+	}
+
+	void RecordingMaster::Flush()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		file.flush();
+
+		if (!file)
+		{
+			throw runtime_error("Can not write recording.");
+		}
+	}
+
+	uint64_t RecordingMaster::Recorded()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return recorded;
+	}
+
+	/**
+	* Record times are deltas from previous record. Records of several
+	* threads may come out of order by start time, so delta is clamped to
+	* 0 and such record gets request time of previous record.
+	**/
+	void RecordingMaster::record(Clock::time_point requested, Clock::time_point done, uint8_t id,
+		const vector<uint8_t>& request, const vector<uint8_t>& responce, const exception_ptr& error, bool broadcast)
+	{
+		RecordedTransaction::Status status = broadcast ?
+			RecordedTransaction::Status::Broadcast : RecordedTransaction::Status::Responce;
+		string message;
+
+		if (error)
+		{
+			try
+			{
+				rethrow_exception(error);
+			}
+			catch (const ETimeout&)
+			{
+				status = RecordedTransaction::Status::Timeout;
+			}
+			catch (const exception& e)
+			{
+				status = RecordedTransaction::Status::Error;
+				message = e.what();
+			}
+			catch (...)
+			{
+				status = RecordedTransaction::Status::Error;
+			}
+		}
+
+		vector<uint8_t> data;
+		data.push_back((uint8_t)status);
+		data.push_back(id);
+
+		lock_guard<std::mutex> lock(mutex);
+
+		if (requested > previous)
+		{
+			put_varint(data, (uint64_t)duration_cast<microseconds>(requested - previous).count());
+			previous = requested;
+		}
+		else
+		{
+			put_varint(data, 0);
+		}
+
+		put_varint(data, (uint64_t)duration_cast<microseconds>(done - requested).count());
+		put_varint(data, request.size());
+		data.insert(data.end(), request.begin(), request.end());
+
+		if (status == RecordedTransaction::Status::Error)
+		{
+			put_varint(data, message.size());
+			data.insert(data.end(), message.begin(), message.end());
+		}
+		else
+		{
+			put_varint(data, responce.size());
+			data.insert(data.end(), responce.begin(), responce.end());
+		}
+
+		file.write((const char*)data.data(), data.size());
+
+		if (!file)
+		{
+			throw runtime_error("Can not write recording.");
+		}
+
+		recorded++;
+	}
+
+	vector<uint8_t> RecordingMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		const Clock::time_point requested = Clock::now();
+		vector<uint8_t> responce;
+
+		try
+		{
+			responce = master.Transact(id, request);
+		}
+		catch (...)
+		{
+			record(requested, Clock::now(), id, request, responce, current_exception(), false);
+			throw;
+		}
+
+		record(requested, Clock::now(), id, request, responce, exception_ptr(), false);
+		return responce;
+	}
+
+	void RecordingMaster::SendPDU(vector<uint8_t> request)
+	{
+		const Clock::time_point requested = Clock::now();
+
+		try
+		{
+			master.Broadcast(request);
+		}
+		catch (...)
+		{
+			record(requested, Clock::now(), IDBroadcast, request, vector<uint8_t>(), current_exception(), true);
+			throw;
+		}
+
+		record(requested, Clock::now(), IDBroadcast, request, vector<uint8_t>(), exception_ptr(), true);
+	}
+
+	void RecordingMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		const Clock::time_point requested = Clock::now();
+		master.TransactMany(transactions);
+		const Clock::time_point done = Clock::now();
+
+		for (vector<Transaction>::const_iterator i = transactions.cbegin(); i != transactions.cend(); i++)
+			record(requested, done, i->id, i->request, i->responce, i->error, false);
+	}
+
+	ReplayMaster::ReplayMaster(const vector<RecordedTransaction>& recording, const Settings& settings)
+		: recording(recording), settings(settings), unmatched(0)
+	{
+		for (vector<RecordedTransaction>::const_iterator i = this->recording.cbegin(); i != this->recording.cend(); i++)
+		{
+			if (i->status == RecordedTransaction::Status::Broadcast)
+				continue;
+
+			Answers& a = answers[Key(i->id, i->request)];
+			a.transactions.push_back(&*i);
+			a.next = 0;
+		}
+	}
+
+	uint64_t ReplayMaster::Unmatched()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return unmatched;
+	}
+
+	vector<uint8_t> ReplayMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		const RecordedTransaction* transaction = NULL;
+
+		{
+			lock_guard<std::mutex> lock(mutex);
+
+			map<Key, Answers>::iterator i = answers.find(Key(id, request));
+			if (i == answers.end())
+			{
+				unmatched++;
+			}
+			else
+			{
+				transaction = i->second.transactions[i->second.next];
+				i->second.next = (i->second.next + 1) % i->second.transactions.size();
+			}
+		}
+
+		if (transaction == NULL)
+			throw ETimeout();
+
+		if (settings.latencyScale > 0)
+			this_thread::sleep_for(duration<double, micro>(transaction->latency * settings.latencyScale));
+
+		switch (transaction->status)
+		{
+		case RecordedTransaction::Status::Timeout:
+			throw ETimeout();
+		case RecordedTransaction::Status::Error:
+			throw runtime_error(transaction->message);
+		default:
+			return transaction->responce;
+		}
+	}
+
+	void ReplayMaster::SendPDU(vector<uint8_t>)
+	{
+	}
+
+	Player::Player(const Settings& settings) : settings(settings)
+	{
+	}
+
+	Player::Result Player::Play(Master& master, const vector<RecordedTransaction>& recording) const
+	{
+		typedef steady_clock Clock;
+
+		Result result;
+		result.transactions = 0;
+		result.mismatches = 0;
+		result.errors = 0;
+		result.meanLatency = 0;
+		result.maxLatency = 0;
+
+		const Clock::time_point start = Clock::now();
+		const int64_t first = recording.empty() ? 0 : recording.front().time;
+		double latencies = 0;
+
+		for (vector<RecordedTransaction>::const_iterator i = recording.cbegin(); i != recording.cend(); i++)
+		{
+			if (settings.paced)
+			{
+				this_thread::sleep_until(start + duration_cast<Clock::duration>(
+					duration<double, micro>((i->time - first) * settings.timeScale)));
+			}
+
+			const Clock::time_point requested = Clock::now();
+			bool failed = false;
+			vector<uint8_t> responce;
+
+			try
+			{
+				if (i->status == RecordedTransaction::Status::Broadcast)
+					master.Broadcast(i->request);
+				else
+					responce = master.Transact(i->id, i->request);
+			}
+			catch (const exception&)
+			{
+				failed = true;
+			}
+
+			const double latency = duration<double, micro>(Clock::now() - requested).count();
+			latencies += latency;
+			result.maxLatency = max(result.maxLatency, latency);
+			result.transactions++;
+
+			if (failed)
+				result.errors++;
+
+			const bool recordedFailed = i->status == RecordedTransaction::Status::Timeout ||
+				i->status == RecordedTransaction::Status::Error;
+
+			if (failed != recordedFailed || (!failed && responce != i->responce))
+				result.mismatches++;
+		}
+
+		result.duration = duration<double, micro>(Clock::now() - start).count();
+
+		if (result.transactions > 0)
+			result.meanLatency = latencies / result.transactions;
+
+		result.throughput = result.duration > 0 ? result.transactions * 1e6 / result.duration : 0;
+		return result;
+	}
+}
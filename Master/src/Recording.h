@@ -0,0 +1,220 @@
+/**
+ * Description: Record and replay of MODBUS traffic. RecordingMaster writes
+ *				every transaction of another master with its time and
+ *				latency into compact binary file. ReplayMaster answers
+ *				requests with recorded responces and latencies, so it
+ *				stands in for real devices, and Player sends recorded
+ *				requests to any master with original pacing or as fast as
+ *				possible and measures throughput and latency. So transports
+ *				and schedulers are compared on real workload offline.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _RECORDING_H_
+#define _RECORDING_H_
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	/**
+	 * Transaction of recording.
+	 **/
+	struct RecordedTransaction
+	{
+		enum class Status : uint8_t
+		{
+			Responce = 0,
+			Timeout = 1,
+			Error = 2,
+			Broadcast = 3
+		};
+
+		/**
+		 * Time of request since start of recording and time till
+		 * responce, us.
+		 **/
+		int64_t time;
+		uint32_t latency;
+
+		uint8_t id;
+		Status status;
+		std::vector<uint8_t> request;
+		std::vector<uint8_t> responce;
+
+		/**
+		 * Message of error of Error status
+		 **/
+		std::string message;
+	};
+
+	/**
+	 * Read recording file.
+	 * Exceptions:	runtime_error if file can not be read or is not
+	 *				recording.
+	 **/
+	std::vector<RecordedTransaction> LoadRecording(const std::string& path);
+
+	class RecordingMaster : public Master
+	{
+	public:
+		/**
+		 * master:	master used for all transactions
+		 * path:	recording file, it is created or truncated
+		 * Exceptions:	runtime_error if file can not be created or
+		 *				written. Transactions and Flush throw
+		 *				runtime_error when record is not written.
+		 **/
+		RecordingMaster(Master& master, const std::string& path);
+		virtual ~RecordingMaster();
+
+		/**
+		 * Write buffered records to file.
+		 **/
+		void Flush();
+
+		uint64_t Recorded();
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+		/**
+		 * Transactions of TransactMany are recorded with common start
+		 * time and latency of whole call.
+		 **/
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		RecordingMaster(const RecordingMaster&);
+		RecordingMaster& operator=(const RecordingMaster&);
+
+		void record(Clock::time_point requested, Clock::time_point done, uint8_t id, const std::vector<uint8_t>& request,
+			const std::vector<uint8_t>& responce, const std::exception_ptr& error, bool broadcast);
+
+		Master& master;
+
+		/**
+		 * Request time of last record
+		 **/
+		Clock::time_point previous;
+
+		std::mutex mutex;
+		std::ofstream file;
+		uint64_t recorded;
+	};
+
+	/**
+	 * Master which answers from recording. Request is matched with
+	 * recorded transactions of the same unit and request in recorded
+	 * order; after last one matching starts from first again. Functions
+	 * are thread safe.
+	 **/
+	class ReplayMaster : public Master
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Recorded latency is multiplied by it. 0 answers at once.
+			 **/
+			double latencyScale;
+
+			Settings() : latencyScale(1)
+			{
+			}
+		};
+
+		explicit ReplayMaster(const std::vector<RecordedTransaction>& recording, const Settings& settings = Settings());
+
+		/**
+		 * Requests which are not in recording. They are answered with
+		 * timeout.
+		 **/
+		uint64_t Unmatched();
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+	private:
+		typedef std::pair<uint8_t, std::vector<uint8_t>> Key;
+
+		struct Answers
+		{
+			std::vector<const RecordedTransaction*> transactions;
+			size_t next;
+		};
+
+		std::vector<RecordedTransaction> recording;
+		Settings settings;
+
+		std::mutex mutex;
+		std::map<Key, Answers> answers;
+		uint64_t unmatched;
+	};
+
+	/**
+	 * Sends recorded workload to master.
+	 **/
+	class Player
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Send requests at recorded times multiplied by timeScale.
+			 * Otherwise each request is sent when previous is done.
+			 **/
+			bool paced;
+			double timeScale;
+
+			Settings() : paced(false), timeScale(1)
+			{
+			}
+		};
+
+		struct Result
+		{
+			uint64_t transactions;
+
+			/**
+			 * Responces different from recorded, and errors where
+			 * responce was recorded or vice versa.
+			 **/
+			uint64_t mismatches;
+			uint64_t errors;
+
+			/**
+			 * Time of whole replay, mean and maximum latency, us.
+			 **/
+			double duration;
+			double meanLatency;
+			double maxLatency;
+
+			/**
+			 * Transactions per second
+			 **/
+			double throughput;
+		};
+
+		explicit Player(const Settings& settings = Settings());
+
+		Result Play(Master& master, const std::vector<RecordedTransaction>& recording) const;
+
+	private:
+		Settings settings;
+	};
+}
+
+#endif	/* _RECORDING_H_ */
@@ -0,0 +1,625 @@
+/**
+* Serial line port and MODBUS RTU master
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include "Serial.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	/**
+	 * Serial port
+	 **/
+#ifdef _WIN32
+	SerialPort::SerialPort(const string& device, const Settings& settings)
+		: device(device), settings(settings), spin(0)
+	{
+		string name = "\\\\.\\" + device;
+		handle = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			throw runtime_error("Can not open serial port " + device);
+		}
+
+		DCB dcb;
+		memset(&dcb, 0, sizeof(dcb));
+		dcb.DCBlength = sizeof(dcb);
+		GetCommState(handle, &dcb);
+
+		dcb.BaudRate = settings.baudRate;
+		dcb.ByteSize = 8;
+		dcb.fBinary = TRUE;
+		dcb.fParity = settings.parity != Parity::None;
+		dcb.Parity = settings.parity == Parity::Even ? EVENPARITY :
+			settings.parity == Parity::Odd ? ODDPARITY : NOPARITY;
+		dcb.StopBits = settings.stopBits == 2 ? TWOSTOPBITS : ONESTOPBIT;
+		dcb.fOutxCtsFlow = FALSE;
+		dcb.fOutxDsrFlow = FALSE;
+		dcb.fDtrControl = DTR_CONTROL_ENABLE;
+		dcb.fRtsControl = RTS_CONTROL_ENABLE;
+		dcb.fOutX = FALSE;
+		dcb.fInX = FALSE;
+
+		if (!SetCommState(handle, &dcb))
+		{
+			CloseHandle(handle);
+			throw runtime_error("Can not configure serial port " + device);
+		}
+	}
+
+	SerialPort::~SerialPort()
+	{
+		CloseHandle(handle);
+	}
+
+	void SerialPort::Write(const uint8_t* data, size_t size)
+	{
+		DWORD written = 0;
+		if (!WriteFile(handle, data, (DWORD)size, &written, NULL) || written != size)
+		{
+			throw runtime_error("Serial port write failed");
+		}
+	}
+
+	size_t SerialPort::readWait(uint8_t* data, size_t size, unsigned timeout)
+	{
+		/**
+		 * Return as soon as any byte is received or timeout expired.
+		 **/
+		COMMTIMEOUTS timeouts;
+		timeouts.ReadIntervalTimeout = MAXDWORD;
+		timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+		timeouts.ReadTotalTimeoutConstant = timeout == 0 ? 1 : timeout;
+		timeouts.WriteTotalTimeoutMultiplier = 0;
+		timeouts.WriteTotalTimeoutConstant = 0;
+		SetCommTimeouts(handle, &timeouts);
+
+		DWORD read = 0;
+		if (!ReadFile(handle, data, (DWORD)size, &read, NULL))
+		{
+			throw runtime_error("Serial port read failed");
+		}
+
+		return read;
+	}
+
+	/**
+	* Read data without waiting.
+	**/
+	size_t SerialPort::readNow(uint8_t* data, size_t size)
+	{
+		COMMTIMEOUTS timeouts;
+		timeouts.ReadIntervalTimeout = MAXDWORD;
+		timeouts.ReadTotalTimeoutMultiplier = 0;
+		timeouts.ReadTotalTimeoutConstant = 0;
+		timeouts.WriteTotalTimeoutMultiplier = 0;
+		timeouts.WriteTotalTimeoutConstant = 0;
+		SetCommTimeouts(handle, &timeouts);
+
+		DWORD read = 0;
+		if (!ReadFile(handle, data, (DWORD)size, &read, NULL))
+		{
+			throw runtime_error("Serial port read failed");
+		}
+
+		return read;
+	}
+
+	void SerialPort::FlushInput()
+	{
+		PurgeComm(handle, PURGE_RXCLEAR);
+	}
+
+	void SerialPort::Drain()
+	{
+		FlushFileBuffers(handle);
+	}
+#else
+	/**
+	 * Convert baud rate to termios constant.
+	 **/
+	static speed_t baud_constant(unsigned baudRate)
+	{
+		switch (baudRate)
+		{
+		case 1200: return B1200;
+		case 2400: return B2400;
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B460800
+		case 460800: return B460800;
+#endif
+#ifdef B921600
+		case 921600: return B921600;
+#endif
+		default:
+			throw invalid_argument("Unsupported baud rate");
+		}
+	}
+
+	SerialPort::SerialPort(const string& device, const Settings& settings)
+		: device(device), settings(settings), spin(0)
+	{
+		/**
+		 * Baud rate is checked before port is opened, so its handle is
+		 * not lost by exception.
+		 **/
+		const speed_t speed = baud_constant(settings.baudRate);
+
+		handle = open(device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (handle < 0)
+		{
+			throw runtime_error("Can not open serial port " + device);
+		}
+
+		termios tio;
+		if (tcgetattr(handle, &tio) != 0)
+		{
+			close(handle);
+			throw runtime_error("Can not configure serial port " + device);
+		}
+
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+		tio.c_cflag |= CS8;
+
+		if (settings.parity != Parity::None)
+			tio.c_cflag |= PARENB;
+		if (settings.parity == Parity::Odd)
+			tio.c_cflag |= PARODD;
+		if (settings.stopBits == 2)
+			tio.c_cflag |= CSTOPB;
+
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+
+		if (tcsetattr(handle, TCSANOW, &tio) != 0)
+		{
+			close(handle);
+			throw runtime_error("Can not configure serial port " + device);
+		}
+	}
+
+	SerialPort::~SerialPort()
+	{
+		close(handle);
+	}
+
+	void SerialPort::Write(const uint8_t* data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t rc = write(handle, data, size);
+			if (rc < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				if (errno == EAGAIN)
+				{
+					pollfd pfd = { handle, POLLOUT, 0 };
+					poll(&pfd, 1, 100);
+					continue;
+				}
+
+				throw runtime_error("Serial port write failed");
+			}
+
+			data += rc;
+			size -= rc;
+		}
+	}
+
+	size_t SerialPort::readWait(uint8_t* data, size_t size, unsigned timeout)
+	{
+		pollfd pfd = { handle, POLLIN, 0 };
+
+		int rc;
+		do
+		{
+			rc = poll(&pfd, 1, (int)timeout);
+		} while (rc < 0 && errno == EINTR);
+
+		if (rc < 0)
+		{
+			throw runtime_error("Serial port read failed");
+		}
+
+		if (rc == 0)
+			return 0;
+
+		ssize_t n = read(handle, data, size);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+
+			throw runtime_error("Serial port read failed");
+		}
+
+		return n;
+	}
+
+	/**
+	* Read data without waiting. Port is opened non-blocking.
+	**/
+	size_t SerialPort::readNow(uint8_t* data, size_t size)
+	{
+		ssize_t n = read(handle, data, size);
+		if (n < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;
+
+			throw runtime_error("Serial port read failed");
+		}
+
+		return n;
+	}
+
+	void SerialPort::FlushInput()
+	{
+		tcflush(handle, TCIFLUSH);
+	}
+
+	void SerialPort::Drain()
+	{
+		tcdrain(handle);
+	}
+#endif
+
+	/**
+	* Read up to size bytes. With spin-wait data is polled without
+	* blocking first, so it is taken as soon as it is received.
+	**/
+	size_t SerialPort::Read(uint8_t* data, size_t size, unsigned timeout)
+	{
+		if (spin != 0)
+		{
+			const steady_clock::time_point end = steady_clock::now() + microseconds(spin);
+
+			do
+			{
+				const size_t n = readNow(data, size);
+				if (n != 0)
+					return n;
+			} while (steady_clock::now() < end);
+		}
+
+		return readWait(data, size, timeout);
+	}
+
+	size_t SerialPort::ReadAvailable(uint8_t* data, size_t size)
+	{
+		return readNow(data, size);
+	}
+
+	void SerialPort::SetSpin(unsigned us)
+	{
+		spin = us;
+	}
+
+	const SerialPort::Settings& SerialPort::GetSettings() const
+	{
+		return settings;
+	}
+
+	const string& SerialPort::GetDevice() const
+	{
+		return device;
+	}
+
+	SerialPort::NativeHandle SerialPort::Handle() const
+	{
+		return handle;
+	}
+
+	/**
+	* Time of one character transmission, us.
+	* Character is start bit, 8 data bits, parity bit and stop bits.
+	**/
+	unsigned SerialPort::CharTime() const
+	{
+		const unsigned bits = 1 + 8 + (settings.parity != Parity::None ? 1 : 0) + settings.stopBits;
+		return (bits * 1000000 + settings.baudRate - 1) / settings.baudRate;
+	}
+
+	/**
+	 * CRC16 lookup table(polynomial 0xA001)
+	 **/
+	static const uint16_t crc_table[256] =
+	{
+		0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+		0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+		0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+		0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+		0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+		0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+		0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+		0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+		0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+		0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+		0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+		0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+		0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+		0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+		0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+		0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+		0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+		0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+		0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+		0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+		0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+		0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+		0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+		0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+		0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+		0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+		0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+		0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+		0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+		0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+		0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+		0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+	};
+
+	/**
+	 * Expected RTU frame size by already received part of frame.
+	 **/
+	size_t RtuMaster::ExpectedFrameSize(const vector<uint8_t>& frame)
+	{
+		if (frame.size() < 2)
+			return 0;
+
+		const uint8_t funcCode = frame[1];
+
+		if (funcCode & 0x80)
+			return 5;
+
+		switch (funcCode)
+		{
+		case 0x07:
+			return 5;
+		case 0x05: case 0x06: case 0x0B: case 0x0F: case 0x10:
+			return 8;
+		case 0x08:
+			/**
+			 * Counter sub-functions(0A-14) answer with one word, others
+			 * echo data of any size(Return Query Data), so frame ends by
+			 * silence.
+			 **/
+			if (frame.size() < 4 || frame[2] != 0 || frame[3] < 0x0A || frame[3] > 0x14)
+				return 0;
+			return 8;
+		case 0x16:
+			return 10;
+		case 0x01: case 0x02: case 0x03: case 0x04:
+		case 0x0C: case 0x11: case 0x14: case 0x15: case 0x17:
+			return frame.size() < 3 ? 0 : 3 + frame[2] + 2;
+		case 0x18:
+			return frame.size() < 4 ? 0 : 4 + (((size_t)frame[2] << 8) | frame[3]) + 2;
+		default:
+			return 0;
+		}
+	}
+
+	/**
+	 * MODBUS RTU master
+	 **/
+	RtuMaster::RtuMaster(const string& device, const SerialPort::Settings& settings)
+		: port(device, settings), timeout(DefaultTimeout), turnaroundDelay(DefaultTurnaroundDelay)
+	{
+	}
+
+	RtuMaster::~RtuMaster()
+	{
+	}
+
+	void RtuMaster::SetTimeout(unsigned timeout)
+	{
+		this->timeout = timeout;
+	}
+
+	unsigned RtuMaster::GetTimeout() const
+	{
+		return timeout;
+	}
+
+	void RtuMaster::SetTurnaroundDelay(unsigned delay)
+	{
+		turnaroundDelay = delay;
+	}
+
+	SerialPort& RtuMaster::Port()
+	{
+		return port;
+	}
+
+	void RtuMaster::SetLowLatency(const LowLatency::Settings& settings)
+	{
+		lowLatency.SetSettings(settings);
+		port.SetSpin(settings.spin);
+	}
+
+	/**
+	* Compute MODBUS CRC16.
+	**/
+	uint16_t RtuMaster::CRC16(const uint8_t* data, size_t size)
+	{
+		uint16_t crc = 0xFFFF;
+
+		for (size_t i = 0; i < size; i++)
+		{
+			crc = (crc >> 8) ^ crc_table[(crc ^ data[i]) & 0xFF];
+		}
+
+		return crc;
+	}
+
+	/**
+	* Send PDU and wait responce.
+	**/
+	vector<uint8_t> RtuMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		lowLatency.Enter();
+		sendADU(id, request);
+
+		return DecodeADU(id, request, receiveADU());
+	}
+
+	vector<uint8_t> RtuMaster::EncodeADU(uint8_t id, const vector<uint8_t>& pdu)
+	{
+		vector<uint8_t> adu;
+		adu.reserve(pdu.size() + 3);
+		adu.push_back(id);
+		adu.insert(adu.end(), pdu.cbegin(), pdu.cend());
+
+		const uint16_t crc = CRC16(adu.data(), adu.size());
+		adu.push_back((uint8_t)(crc & 0xFF));
+		adu.push_back((uint8_t)(crc >> 8));
+
+		return adu;
+	}
+
+	/**
+	* Check address and CRC. Shortest frame is address, exception
+	* function code, exception code and CRC.
+	**/
+	vector<uint8_t> RtuMaster::DecodeADU(uint8_t id, const vector<uint8_t>& request, const vector<uint8_t>& frame)
+	{
+		if (frame.size() < 5)
+		{
+			throw EPDUFrameError(request, frame);
+		}
+
+		const uint16_t crc = (uint16_t)frame[frame.size() - 2] | ((uint16_t)frame[frame.size() - 1] << 8);
+		if (crc != CRC16(frame.data(), frame.size() - 2) || frame[0] != id)
+		{
+			throw EPDUFrameError(request, frame);
+		}
+
+		return vector<uint8_t>(frame.cbegin() + 1, frame.cend() - 2);
+	}
+
+	/**
+	* Send broadcast PDU. Slaves do not answer, so master just wait
+	* turnaround delay for slaves to process request.
+	**/
+	void RtuMaster::SendPDU(vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		lowLatency.Enter();
+		sendADU(0, request);
+		this_thread::sleep_for(milliseconds(turnaroundDelay));
+	}
+
+	/**
+	* Wait inter-frame silence(3.5 characters) and send ADU.
+	**/
+	void RtuMaster::sendADU(uint8_t id, const vector<uint8_t>& pdu)
+	{
+		const vector<uint8_t> adu = EncodeADU(id, pdu);
+
+		/**
+		 * Garbage of previous transactions must not be taken as responce.
+		 **/
+		port.FlushInput();
+		lowLatency.Pause(frameGap());
+
+		port.Write(adu.data(), adu.size());
+	}
+
+	/**
+	* Receive ADU. Frame is terminated by silence on line or by
+	* expected frame size, if it can be computed from frame header.
+	**/
+	vector<uint8_t> RtuMaster::receiveADU()
+	{
+		uint8_t buffer[ADU_MAX_SIZE];
+		vector<uint8_t> frame;
+
+		size_t n = port.Read(buffer, sizeof(buffer), timeout);
+		if (n == 0)
+		{
+			throw ETimeout();
+		}
+
+		frame.insert(frame.end(), buffer, buffer + n);
+
+		/**
+		 * Silence interval in ms, rounded up. Poll timer resolution is 1 ms.
+		 **/
+		const unsigned gap = (frameGap() + 999) / 1000 + 1;
+
+		for (;;)
+		{
+			const size_t expected = ExpectedFrameSize(frame);
+			if (expected != 0 && frame.size() >= expected)
+				break;
+
+			if (frame.size() >= ADU_MAX_SIZE)
+				break;
+
+			n = port.Read(buffer, ADU_MAX_SIZE - frame.size(), gap);
+			if (n == 0)
+				break;
+
+			frame.insert(frame.end(), buffer, buffer + n);
+		}
+
+		return frame;
+	}
+
+	/**
+	* Inter-frame silence interval(t3.5), us.
+	* For baud rates greater than 19200 fixed value 1750 us is used.
+	**/
+	unsigned RtuMaster::frameGap() const
+	{
+		return FrameGap(port);
+	}
+
+	unsigned RtuMaster::FrameGap(const SerialPort& port)
+	{
+		if (port.GetSettings().baudRate > 19200)
+			return 1750;
+
+		return port.CharTime() * 7 / 2;
+	}
+}
@@ -0,0 +1,211 @@
+/**
+ * Description: Serial line port and MODBUS RTU master.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SERIAL_H_
+#define _SERIAL_H_
+
+#include <cstddef>
+#include <string>
+#include "LowLatency.h"
+#include "Master.h"
+
+namespace Modbus
+{
+	/**
+	 * Serial port
+	 **/
+	class SerialPort
+	{
+	public:
+		/**
+		 * Types
+		 **/
+#ifdef _WIN32
+		typedef void* NativeHandle;
+#else
+		typedef int NativeHandle;
+#endif
+
+		enum class Parity
+		{
+			None,
+			Even,
+			Odd
+		};
+
+		struct Settings
+		{
+			unsigned baudRate;
+			Parity parity;
+			unsigned stopBits;
+
+			Settings() : baudRate(19200), parity(Parity::Even), stopBits(1)
+			{
+			}
+		};
+
+		/**
+		 * Open serial port.
+		 * device:		device name, for example "COM1" or "/dev/ttyS0"
+		 * Exceptions:	runtime_error if port can not be opened or configured.
+		 **/
+		SerialPort(const std::string& device, const Settings& settings);
+		~SerialPort();
+
+		/**
+		 * Write all data to port.
+		 **/
+		void Write(const uint8_t* data, size_t size);
+
+		/**
+		 * Read up to size bytes.
+		 * timeout:	maximum time to wait for first byte, ms
+		 * Return:	number of bytes read, 0 on timeout
+		 **/
+		size_t Read(uint8_t* data, size_t size, unsigned timeout);
+
+		/**
+		 * Read data which is already received, without waiting.
+		 * Return:	number of bytes read.
+		 **/
+		size_t ReadAvailable(uint8_t* data, size_t size);
+
+		/**
+		 * Busy wait for data before blocking wait in Read, us.
+		 **/
+		void SetSpin(unsigned us);
+
+		/**
+		 * Discard all received but not read data.
+		 **/
+		void FlushInput();
+
+		/**
+		 * Wait until all written data transmitted.
+		 **/
+		void Drain();
+
+		const Settings& GetSettings() const;
+		const std::string& GetDevice() const;
+		NativeHandle Handle() const;
+
+		/**
+		 * Time of one character transmission, us.
+		 **/
+		unsigned CharTime() const;
+
+	private:
+		SerialPort(const SerialPort&);
+		SerialPort& operator=(const SerialPort&);
+
+		/**
+		 * Read data without waiting. Return number of bytes read.
+		 **/
+		size_t readNow(uint8_t* data, size_t size);
+
+		/**
+		 * Wait up to timeout ms for data and read it.
+		 **/
+		size_t readWait(uint8_t* data, size_t size, unsigned timeout);
+
+		std::string device;
+		Settings settings;
+		NativeHandle handle;
+		unsigned spin;
+	};
+
+	/**
+	 * MODBUS RTU master
+	 **/
+	class RtuMaster : public Master
+	{
+	public:
+		/**
+		 * Constants
+		 **/
+		static const int ADU_MAX_SIZE = 256;
+		static const unsigned DefaultTimeout = 1000;
+		static const unsigned DefaultTurnaroundDelay = 100;
+
+		RtuMaster(const std::string& device, const SerialPort::Settings& settings);
+		virtual ~RtuMaster();
+
+		/**
+		 * Set responce timeout, ms.
+		 **/
+		void SetTimeout(unsigned timeout);
+		unsigned GetTimeout() const;
+
+		/**
+		 * Set delay after broadcast request, ms.
+		 **/
+		void SetTurnaroundDelay(unsigned delay);
+
+		SerialPort& Port();
+
+		/**
+		 * Low-latency mode. Thread options are applied to thread which
+		 * makes transactions.
+		 **/
+		void SetLowLatency(const LowLatency::Settings& settings);
+
+		/**
+		 * Compute MODBUS CRC16.
+		 **/
+		static uint16_t CRC16(const uint8_t* data, size_t size);
+
+		/**
+		 * RTU frame of PDU: address, PDU and CRC.
+		 **/
+		static std::vector<uint8_t> EncodeADU(uint8_t id, const std::vector<uint8_t>& pdu);
+
+		/**
+		 * Check size, address and CRC of received frame.
+		 * Return:		PDU of frame
+		 * Exceptions:	EPDUFrameError if frame is invalid.
+		 **/
+		static std::vector<uint8_t> DecodeADU(uint8_t id, const std::vector<uint8_t>& request,
+			const std::vector<uint8_t>& frame);
+
+		/**
+		 * Expected frame size by already received part of frame.
+		 * Return:	frame size including CRC, or 0 if it is unknown yet or
+		 *			frame size can not be computed(frame end by silence).
+		 **/
+		static size_t ExpectedFrameSize(const std::vector<uint8_t>& frame);
+
+		/**
+		 * Inter-frame silence interval(t3.5) of port, us.
+		 **/
+		static unsigned FrameGap(const SerialPort& port);
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+		/**
+		 * Wait inter-frame silence(3.5 characters) and send ADU.
+		 **/
+		void sendADU(uint8_t id, const std::vector<uint8_t>& pdu);
+
+		/**
+		 * Receive ADU. Frame is terminated by silence on line.
+		 * Return:	frame without CRC check.
+		 **/
+		std::vector<uint8_t> receiveADU();
+
+		/**
+		 * Inter-frame silence interval(t3.5), us.
+		 **/
+		unsigned frameGap() const;
+
+		SerialPort port;
+		unsigned timeout;
+		unsigned turnaroundDelay;
+		LowLatency lowLatency;
+	};
+}
+
+#endif	/* _SERIAL_H_ */
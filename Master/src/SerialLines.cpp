@@ -0,0 +1,483 @@
+/**
+* Many MODBUS RTU lines served by one thread
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include "SerialLines.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	SerialLines::SerialLines() : stopping(false)
+	{
+		if (::pipe(wakeup) != 0)
+		{
+			throw runtime_error("Can not create pipe of serial lines.");
+		}
+
+		fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+		fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+
+		worker = std::thread(&SerialLines::run, this);
+	}
+
+	SerialLines::~SerialLines()
+	{
+		{
+			lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wake();
+		worker.join();
+
+		close(wakeup[0]);
+		close(wakeup[1]);
+	}
+
+	SerialLines::Line SerialLines::Open(const string& device, const SerialPort::Settings& port, const Settings& settings)
+	{
+		unique_ptr<Port> line(new Port());
+		line->port.reset(new SerialPort(device, port));
+		line->settings = settings;
+		line->gap = RtuMaster::FrameGap(*line->port);
+
+		/**
+		 * End of frame is silence of t3.5 rounded up to ms of poll()
+		 * timer, plus 1 ms.
+		 **/
+		line->silence = ((line->gap + 999) / 1000 + 1) * 1000;
+		line->state = State::Idle;
+		line->activity = Clock::now();
+		line->reset = line->activity;
+		line->statistic = Statistic();
+
+		lock_guard<std::mutex> lock(mutex);
+		ports.push_back(move(line));
+		return (Line)(ports.size() - 1);
+	}
+
+	size_t SerialLines::Lines() const
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return ports.size();
+	}
+
+	void SerialLines::Execute(vector<Job>& jobs)
+	{
+		vector<pair<Line, Master::Transaction*>> transactions;
+		transactions.reserve(jobs.size());
+
+		for (vector<Job>::iterator i = jobs.begin(); i != jobs.end(); i++)
+			transactions.push_back(make_pair(i->line, &i->transaction));
+
+		execute(transactions);
+	}
+
+	void SerialLines::Execute(Line line, vector<Master::Transaction>& transactions)
+	{
+		vector<pair<Line, Master::Transaction*>> work;
+		work.reserve(transactions.size());
+
+		for (vector<Master::Transaction>::iterator i = transactions.begin(); i != transactions.end(); i++)
+			work.push_back(make_pair(line, &*i));
+
+		execute(work);
+	}
+
+	void SerialLines::execute(const vector<pair<Line, Master::Transaction*>>& transactions)
+	{
+		unique_lock<std::mutex> lock(mutex);
+
+		for (vector<pair<Line, Master::Transaction*>>::const_iterator i = transactions.cbegin(); i != transactions.cend(); i++)
+		{
+			if (i->first >= ports.size())
+			{
+				throw out_of_range("Invalid serial line.");
+			}
+
+			if (i->second->request.empty() || i->second->request.size() > Master::PDU_MAX_SIZE)
+			{
+				throw invalid_argument("Invalid request PDU size.");
+			}
+		}
+
+		if (transactions.empty())
+			return;
+
+		Batch batch;
+		batch.remaining = transactions.size();
+
+		for (vector<pair<Line, Master::Transaction*>>::const_iterator i = transactions.cbegin(); i != transactions.cend(); i++)
+		{
+			Work work;
+			work.transaction = i->second;
+			work.batch = &batch;
+
+			i->second->responce.clear();
+			i->second->error = nullptr;
+			ports[i->first]->queue.push_back(work);
+		}
+
+		wake();
+		done.wait(lock, [&]() { return batch.remaining == 0; });
+	}
+
+	SerialLines::Statistic SerialLines::GetStatistic(Line line) const
+	{
+		lock_guard<std::mutex> lock(mutex);
+
+		if (line >= ports.size())
+		{
+			throw out_of_range("Invalid serial line.");
+		}
+
+		const Port& port = *ports[line];
+		const Clock::time_point now = Clock::now();
+		Statistic statistic = port.statistic;
+
+		statistic.elapsed = (uint64_t)duration_cast<microseconds>(now - port.reset).count();
+
+		if (port.state != State::Idle)
+			statistic.busy += (uint64_t)duration_cast<microseconds>(now - max(port.started, port.reset)).count();
+
+		statistic.utilization = statistic.elapsed == 0 ? 0 : (double)statistic.busy / statistic.elapsed;
+		return statistic;
+	}
+
+	void SerialLines::ResetStatistic(Line line)
+	{
+		lock_guard<std::mutex> lock(mutex);
+
+		if (line >= ports.size())
+		{
+			throw out_of_range("Invalid serial line.");
+		}
+
+		ports[line]->statistic = Statistic();
+		ports[line]->reset = Clock::now();
+	}
+
+	void SerialLines::wake()
+	{
+		const char c = 1;
+		(void)write(wakeup[1], &c, 1);
+	}
+
+	/**
+	* Thread sleeps in poll() on ports which wait for responce and wake
+	* pipe, with timeout of nearest timer of all lines. State is under
+	* mutex, which is released only while poll() waits.
+	**/
+	void SerialLines::run()
+	{
+		vector<pollfd> fds;
+		vector<Port*> polled;
+		unique_lock<std::mutex> lock(mutex);
+
+		while (!stopping)
+		{
+			Clock::time_point now = Clock::now();
+			Clock::time_point next = Clock::time_point::max();
+
+			fds.clear();
+			polled.clear();
+
+			pollfd pipe = { wakeup[0], POLLIN, 0 };
+			fds.push_back(pipe);
+
+			for (vector<unique_ptr<Port>>::const_iterator i = ports.cbegin(); i != ports.cend(); i++)
+			{
+				Port& port = **i;
+				advance(port, now);
+
+				if (port.state == State::Idle)
+					continue;
+
+				next = min(next, port.timer);
+
+				if (port.state == State::Responce)
+				{
+					pollfd fd = { port.port->Handle(), POLLIN, 0 };
+					fds.push_back(fd);
+					polled.push_back(&port);
+				}
+			}
+
+			int wait = -1;
+			if (next != Clock::time_point::max())
+			{
+				wait = next <= now ? 0 : (int)((duration_cast<microseconds>(next - now).count() + 999) / 1000);
+			}
+
+			lock.unlock();
+			const int rc = poll(fds.data(), fds.size(), wait);
+			lock.lock();
+
+			/**
+			 * Failed poll() would fail again on next cycle, so pending
+			 * transactions get the error instead of the loop spinning.
+			 **/
+			if (rc < 0 && errno != EINTR)
+			{
+				failAll(Clock::now(), make_exception_ptr(runtime_error("Serial lines poll failed")));
+				continue;
+			}
+
+			if (rc <= 0)
+				continue;
+
+			if (fds[0].revents != 0)
+			{
+				char buffer[64];
+				while (read(wakeup[0], buffer, sizeof(buffer)) > 0)
+				{
+				}
+			}
+
+			now = Clock::now();
+
+			for (size_t i = 0; i < polled.size(); i++)
+			{
+				if (fds[i + 1].revents != 0)
+					receive(*polled[i], now);
+			}
+		}
+	}
+
+	void SerialLines::advance(Port& port, Clock::time_point now)
+	{
+		for (;;)
+		{
+			switch (port.state)
+			{
+			case State::Idle:
+				if (port.queue.empty())
+					return;
+
+				port.current = port.queue.front();
+				port.queue.pop_front();
+				port.started = now;
+				port.state = State::Gap;
+				port.timer = port.activity + microseconds(port.gap);
+				break;
+
+			case State::Gap:
+				if (now < port.timer)
+					return;
+
+				send(port, now);
+				break;
+
+			case State::Responce:
+				if (now < port.timer)
+					return;
+
+				/**
+				 * No responce, or frame ended by silence.
+				 **/
+				if (port.frame.empty())
+				{
+					complete(port, now, make_exception_ptr(ETimeout()));
+					break;
+				}
+
+				try
+				{
+					Master::Transaction& transaction = *port.current.transaction;
+					transaction.responce = RtuMaster::DecodeADU(transaction.id, transaction.request, port.frame);
+					complete(port, now, nullptr);
+				}
+				catch (...)
+				{
+					complete(port, now, current_exception());
+				}
+				break;
+
+			case State::Turnaround:
+				if (now < port.timer)
+					return;
+
+				complete(port, now, nullptr);
+				break;
+			}
+		}
+	}
+
+	void SerialLines::send(Port& port, Clock::time_point now)
+	{
+		const Master::Transaction& transaction = *port.current.transaction;
+		const vector<uint8_t> adu = RtuMaster::EncodeADU(transaction.id, transaction.request);
+
+		try
+		{
+			/**
+			 * Garbage of previous transactions must not be taken as responce.
+			 **/
+			port.port->FlushInput();
+			port.port->Write(adu.data(), adu.size());
+		}
+		catch (...)
+		{
+			complete(port, now, current_exception());
+			return;
+		}
+
+		/**
+		 * Write returns when frame is in driver buffer, so timeout starts
+		 * after its transmission time.
+		 **/
+		const unsigned transmission = (unsigned)adu.size() * port.port->CharTime();
+
+		port.statistic.sent += adu.size();
+		port.statistic.wire += transmission;
+		port.frame.clear();
+
+		if (transaction.id == 0)
+		{
+			port.state = State::Turnaround;
+			port.timer = now + microseconds(transmission) + milliseconds(port.settings.turnaroundDelay);
+		}
+		else
+		{
+			port.state = State::Responce;
+			port.timer = now + microseconds(transmission) + milliseconds(port.settings.timeout);
+		}
+	}
+
+	/**
+	* Frame is complete when its expected size is received, otherwise
+	* by silence timer.
+	**/
+	void SerialLines::receive(Port& port, Clock::time_point now)
+	{
+		uint8_t buffer[RtuMaster::ADU_MAX_SIZE];
+		size_t n;
+
+		try
+		{
+			n = port.port->ReadAvailable(buffer, RtuMaster::ADU_MAX_SIZE - port.frame.size());
+		}
+		catch (...)
+		{
+			complete(port, now, current_exception());
+			return;
+		}
+
+		if (n == 0)
+			return;
+
+		port.frame.insert(port.frame.end(), buffer, buffer + n);
+		port.statistic.received += n;
+		port.statistic.wire += n * port.port->CharTime();
+
+		const size_t expected = RtuMaster::ExpectedFrameSize(port.frame);
+
+		if ((expected != 0 && port.frame.size() >= expected) || port.frame.size() >= (size_t)RtuMaster::ADU_MAX_SIZE)
+			port.timer = now;
+		else
+			port.timer = now + microseconds(port.silence);
+
+		advance(port, now);
+	}
+
+	void SerialLines::complete(Port& port, Clock::time_point now, const exception_ptr& error)
+	{
+		Master::Transaction& transaction = *port.current.transaction;
+
+		port.statistic.transactions++;
+
+		if (error)
+		{
+			transaction.responce.clear();
+			transaction.error = error;
+
+			try
+			{
+				rethrow_exception(error);
+			}
+			catch (const ETimeout&)
+			{
+				port.statistic.timeouts++;
+			}
+			catch (...)
+			{
+				port.statistic.errors++;
+			}
+		}
+
+		port.statistic.busy += (uint64_t)duration_cast<microseconds>(now - max(port.started, port.reset)).count();
+		port.activity = now;
+		port.state = State::Idle;
+
+		if (--port.current.batch->remaining == 0)
+			done.notify_all();
+	}
+
+	void SerialLines::failAll(Clock::time_point now, const exception_ptr& error)
+	{
+		for (vector<unique_ptr<Port>>::const_iterator i = ports.cbegin(); i != ports.cend(); i++)
+		{
+			Port& port = **i;
+
+			if (port.state != State::Idle)
+				complete(port, now, error);
+
+			while (!port.queue.empty())
+			{
+				port.current = port.queue.front();
+				port.queue.pop_front();
+				port.started = now;
+				complete(port, now, error);
+			}
+		}
+	}
+
+	SerialLineMaster::SerialLineMaster(SerialLines& lines, SerialLines::Line line) : lines(lines), line(line)
+	{
+	}
+
+	vector<uint8_t> SerialLineMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		vector<Transaction> transactions(1);
+		transactions[0].id = id;
+		transactions[0].request = move(request);
+
+		lines.Execute(line, transactions);
+
+		if (transactions[0].error)
+			rethrow_exception(transactions[0].error);
+
+		return move(transactions[0].responce);
+	}
+
+	void SerialLineMaster::SendPDU(vector<uint8_t> request)
+	{
+		vector<Transaction> transactions(1);
+		transactions[0].id = 0;
+		transactions[0].request = move(request);
+
+		lines.Execute(line, transactions);
+
+		if (transactions[0].error)
+			rethrow_exception(transactions[0].error);
+	}
+
+	void SerialLineMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		lines.Execute(line, transactions);
+	}
+}
+
+#endif	/* _WIN32 */
@@ -0,0 +1,263 @@
+/**
+ * Description: Many MODBUS RTU lines served by one thread. Each line has
+ *				queue of transactions and state machine(inter-frame gap,
+ *				request, responce, turnaround) driven by one poll() loop
+ *				over all ports, so dozens of RS-485 buses run at full load
+ *				without thread per port. Transactions are submitted from any
+ *				thread; SerialLineMaster is Master over one line.
+ *				POSIX only.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SERIAL_LINES_H_
+#define _SERIAL_LINES_H_
+
+#ifndef _WIN32
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Master.h"
+#include "Serial.h"
+
+namespace Modbus
+{
+	class SerialLines
+	{
+	public:
+		/**
+		 * Line index
+		 **/
+		typedef unsigned Line;
+
+		struct Settings
+		{
+			/**
+			 * Responce timeout after request is transmitted, ms.
+			 **/
+			unsigned timeout;
+
+			/**
+			 * Delay after broadcast request, ms.
+			 **/
+			unsigned turnaroundDelay;
+
+			Settings() : timeout(RtuMaster::DefaultTimeout), turnaroundDelay(RtuMaster::DefaultTurnaroundDelay)
+			{
+			}
+		};
+
+		/**
+		 * Transaction with line it is sent to. Transaction to unit 0 is
+		 * broadcast: it has no responce and is completed after
+		 * turnaround delay.
+		 **/
+		struct Job
+		{
+			Line line;
+			Master::Transaction transaction;
+		};
+
+		struct Statistic
+		{
+			uint64_t transactions;
+			uint64_t timeouts;
+
+			/**
+			 * Frame errors and port failures
+			 **/
+			uint64_t errors;
+
+			/**
+			 * Bytes of requests and responces
+			 **/
+			uint64_t sent;
+			uint64_t received;
+
+			/**
+			 * Time since reset of statistic, time of line in transactions
+			 * (from start of inter-frame gap to end of responce) and time
+			 * of sent and received characters on wire, us.
+			 **/
+			uint64_t elapsed;
+			uint64_t busy;
+			uint64_t wire;
+
+			/**
+			 * busy / elapsed: 1 is line which is never idle.
+			 **/
+			double utilization;
+		};
+
+		/**
+		 * Start thread of lines.
+		 * Exceptions:	runtime_error if wake pipe can not be created.
+		 **/
+		SerialLines();
+
+		/**
+		 * Stop thread and close ports. No Execute must be in progress.
+		 **/
+		~SerialLines();
+
+		/**
+		 * Open serial port as new line. Thread safe.
+		 * Exceptions:	runtime_error if port can not be opened or configured.
+		 **/
+		Line Open(const std::string& device, const SerialPort::Settings& port, const Settings& settings = Settings());
+
+		size_t Lines() const;
+
+		/**
+		 * Execute transactions of any lines and wait until all are done.
+		 * Transactions of one line are sent in order, all lines work in
+		 * parallel. Error of transaction(timeout, frame error, port or
+		 * poll() failure) is stored in its error field. Thread safe: jobs of
+		 * several threads are queued on each line in order of calls.
+		 * Exceptions:	invalid_argument if request is empty or more than PDU_MAX_SIZE,
+		 *				out_of_range if line is invalid.
+		 **/
+		void Execute(std::vector<Job>& jobs);
+		void Execute(Line line, std::vector<Master::Transaction>& transactions);
+
+		/**
+		 * Statistic of line since previous reset.
+		 * Exceptions:	out_of_range if line is invalid.
+		 **/
+		Statistic GetStatistic(Line line) const;
+		void ResetStatistic(Line line);
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * Jobs of one Execute call
+		 **/
+		struct Batch
+		{
+			size_t remaining;
+		};
+
+		struct Work
+		{
+			Master::Transaction* transaction;
+			Batch* batch;
+		};
+
+		enum class State
+		{
+			Idle,
+
+			/**
+			 * Waiting for inter-frame gap before request
+			 **/
+			Gap,
+			Responce,
+			Turnaround
+		};
+
+		struct Port
+		{
+			std::unique_ptr<SerialPort> port;
+			Settings settings;
+
+			/**
+			 * Inter-frame gap and end of frame silence, us.
+			 **/
+			unsigned gap;
+			unsigned silence;
+
+			std::deque<Work> queue;
+			State state;
+			Work current;
+			std::vector<uint8_t> frame;
+
+			/**
+			 * End of current state: gap, responce timeout, silence after
+			 * last received byte or turnaround delay.
+			 **/
+			Clock::time_point timer;
+
+			/**
+			 * End of last frame on line, start of current transaction.
+			 **/
+			Clock::time_point activity;
+			Clock::time_point started;
+
+			Statistic statistic;
+			Clock::time_point reset;
+		};
+
+		SerialLines(const SerialLines&);
+		SerialLines& operator=(const SerialLines&);
+
+		/**
+		 * Thread of lines.
+		 **/
+		void run();
+
+		/**
+		 * Process timers and start next transaction of line.
+		 **/
+		void advance(Port& port, Clock::time_point now);
+		void send(Port& port, Clock::time_point now);
+		void receive(Port& port, Clock::time_point now);
+		void complete(Port& port, Clock::time_point now, const std::exception_ptr& error);
+
+		/**
+		 * Complete current and queued transactions of all lines with error.
+		 **/
+		void failAll(Clock::time_point now, const std::exception_ptr& error);
+
+		void wake();
+
+		/**
+		 * Queue transactions and wait until all are done.
+		 **/
+		void execute(const std::vector<std::pair<Line, Master::Transaction*>>& transactions);
+
+		mutable std::mutex mutex;
+		std::condition_variable done;
+		std::vector<std::unique_ptr<Port>> ports;
+		bool stopping;
+
+		/**
+		 * Pipe which wakes poll() of thread on new jobs.
+		 **/
+		int wakeup[2];
+		std::thread worker;
+	};
+
+	/**
+	 * Master over one line of SerialLines.
+	 **/
+	class SerialLineMaster : public Master
+	{
+	public:
+		SerialLineMaster(SerialLines& lines, SerialLines::Line line);
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+	private:
+		SerialLineMaster(const SerialLineMaster&);
+		SerialLineMaster& operator=(const SerialLineMaster&);
+
+		SerialLines& lines;
+		SerialLines::Line line;
+	};
+}
+
+#endif	/* _WIN32 */
+
+#endif	/* _SERIAL_LINES_H_ */
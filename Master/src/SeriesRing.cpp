@@ -0,0 +1,486 @@
+/**
+* Compressed in-memory ring of polled values
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "SeriesRing.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	static const char RingMagic[4] = { 'M', 'B', 'T', 'S' };
+	static const uint8_t RingVersion = 1;
+
+	/**
+	 * Append bits of value, most significant first.
+	 **/
+	static void put_bits(vector<uint8_t>& data, uint64_t& bits, uint64_t value, unsigned count)
+	{
+		while (count > 0)
+		{
+			if (bits % 8 == 0)
+				data.push_back(0);
+
+			const unsigned free = 8 - bits % 8;
+			const unsigned n = count < free ? count : free;
+			const uint8_t part = (uint8_t)((value >> (count - n)) & ((1u << n) - 1));
+
+			data.back() |= (uint8_t)(part << (free - n));
+			bits += n;
+			count -= n;
+		}
+	}
+
+	/**
+	 * Reader of chunk bit stream. Reading past bits of chunk raises
+	 * runtime_error, so corrupted chunk can not be read past its data.
+	 **/
+	class BitReader
+	{
+	public:
+		BitReader(const uint8_t* data, uint64_t bits) : data(data), bits(bits), offset(0)
+		{
+		}
+
+		uint64_t Get(unsigned count)
+		{
+			uint64_t value = 0;
+
+			if (count > bits - offset)
+			{
+				throw runtime_error("Invalid series ring chunk.");
+			}
+
+			while (count > 0)
+			{
+				const unsigned available = 8 - offset % 8;
+				const unsigned n = count < available ? count : available;
+				const uint8_t byte = data[offset / 8];
+
+				value = (value << n) | ((byte >> (available - n)) & ((1u << n) - 1));
+				offset += n;
+				count -= n;
+			}
+
+			return value;
+		}
+
+	private:
+		const uint8_t* data;
+		uint64_t bits;
+		uint64_t offset;
+	};
+
+	/**
+	 * Delta of delta of timestamps: 0 is one bit, small values have
+	 * prefix and field of 7, 9 or 12 bits, others are stored whole.
+	 **/
+	static void put_time(vector<uint8_t>& data, uint64_t& bits, int64_t dod)
+	{
+		if (dod == 0)
+			put_bits(data, bits, 0, 1);
+		else if (dod >= -63 && dod <= 64)
+		{
+			put_bits(data, bits, 0x2, 2);
+			put_bits(data, bits, (uint64_t)(dod + 63), 7);
+		}
+		else if (dod >= -255 && dod <= 256)
+		{
+			put_bits(data, bits, 0x6, 3);
+			put_bits(data, bits, (uint64_t)(dod + 255), 9);
+		}
+		else if (dod >= -2047 && dod <= 2048)
+		{
+			put_bits(data, bits, 0xE, 4);
+			put_bits(data, bits, (uint64_t)(dod + 2047), 12);
+		}
+		else
+		{
+			put_bits(data, bits, 0xF, 4);
+			put_bits(data, bits, (uint64_t)dod, 64);
+		}
+	}
+
+	static int64_t get_time(BitReader& reader)
+	{
+		if (reader.Get(1) == 0)
+			return 0;
+		if (reader.Get(1) == 0)
+			return (int64_t)reader.Get(7) - 63;
+		if (reader.Get(1) == 0)
+			return (int64_t)reader.Get(9) - 255;
+		if (reader.Get(1) == 0)
+			return (int64_t)reader.Get(12) - 2047;
+
+		return (int64_t)reader.Get(64);
+	}
+
+	/**
+	 * XOR with previous value: 0 is one bit, otherwise number of leading
+	 * zeros(4 bits), number of meaningful bits - 1(4 bits) and meaningful
+	 * bits.
+	 **/
+	static void put_value(vector<uint8_t>& data, uint64_t& bits, uint16_t x)
+	{
+		if (x == 0)
+		{
+			put_bits(data, bits, 0, 1);
+			return;
+		}
+
+		unsigned leading = 0;
+		while ((x & (0x8000 >> leading)) == 0)
+			leading++;
+
+		unsigned trailing = 0;
+		while ((x & (1 << trailing)) == 0)
+			trailing++;
+
+		const unsigned length = 16 - leading - trailing;
+
+		put_bits(data, bits, 1, 1);
+		put_bits(data, bits, leading, 4);
+		put_bits(data, bits, length - 1, 4);
+		put_bits(data, bits, x >> trailing, length);
+	}
+
+	static uint16_t get_value(BitReader& reader)
+	{
+		if (reader.Get(1) == 0)
+			return 0;
+
+		const unsigned leading = (unsigned)reader.Get(4);
+		const unsigned length = (unsigned)reader.Get(4) + 1;
+
+		if (leading + length > 16)
+		{
+			throw runtime_error("Invalid series ring chunk.");
+		}
+
+		return (uint16_t)(reader.Get(length) << (16 - leading - length));
+	}
+
+	SeriesRing::SeriesRing(const Settings& settings) : settings(settings)
+	{
+		if (settings.chunkSamples == 0 || settings.chunks == 0)
+		{
+			throw invalid_argument("Invalid series ring settings.");
+		}
+	}
+
+	uint32_t SeriesRing::tagOf(uint8_t id, uint16_t addr)
+	{
+		return ((uint32_t)id << 16) | addr;
+	}
+
+	void SeriesRing::append(Series& series, int64_t time, uint16_t value)
+	{
+		if (series.empty() || series.back().samples >= settings.chunkSamples)
+		{
+			if (series.size() == settings.chunks)
+				series.pop_front();
+
+			series.push_back(Chunk());
+			Chunk& chunk = series.back();
+
+			chunk.bits = 0;
+			chunk.samples = 1;
+			chunk.minTime = time;
+			chunk.maxTime = time;
+			chunk.lastTime = time;
+			chunk.lastDelta = 0;
+			chunk.lastValue = value;
+
+			put_bits(chunk.data, chunk.bits, (uint64_t)time, 64);
+			put_bits(chunk.data, chunk.bits, value, 16);
+			return;
+		}
+
+		Chunk& chunk = series.back();
+		const int64_t delta = time - chunk.lastTime;
+
+		put_time(chunk.data, chunk.bits, delta - chunk.lastDelta);
+		put_value(chunk.data, chunk.bits, value ^ chunk.lastValue);
+
+		chunk.samples++;
+		chunk.minTime = min(chunk.minTime, time);
+		chunk.maxTime = max(chunk.maxTime, time);
+		chunk.lastTime = time;
+		chunk.lastDelta = delta;
+		chunk.lastValue = value;
+
+		/**
+		 * Full chunk gives back unused capacity.
+		 **/
+		if (chunk.samples == settings.chunkSamples)
+			chunk.data.shrink_to_fit();
+	}
+
+	void SeriesRing::Append(int64_t time, uint8_t id, uint16_t addr, uint16_t value)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		append(tags[tagOf(id, addr)], time, value);
+	}
+
+	void SeriesRing::Append(int64_t time, uint8_t id, uint16_t addr, const vector<uint16_t>& registers)
+	{
+		lock_guard<std::mutex> lock(mutex);
+
+		for (size_t i = 0; i < registers.size(); i++)
+			append(tags[tagOf(id, (uint16_t)(addr + i))], time, registers[i]);
+	}
+
+	size_t SeriesRing::Query(uint8_t id, uint16_t addr, int64_t from, int64_t to, const Visitor& visit) const
+	{
+		lock_guard<std::mutex> lock(mutex);
+
+		unordered_map<uint32_t, Series>::const_iterator series = tags.find(tagOf(id, addr));
+		if (series == tags.end())
+			return 0;
+
+		size_t visited = 0;
+
+		for (Series::const_iterator chunk = series->second.cbegin(); chunk != series->second.cend(); chunk++)
+		{
+			if (chunk->maxTime < from || chunk->minTime > to)
+				continue;
+
+			BitReader reader(chunk->data.data(), chunk->bits);
+			int64_t time = (int64_t)reader.Get(64);
+			uint16_t value = (uint16_t)reader.Get(16);
+			int64_t delta = 0;
+
+			for (unsigned i = 0;; i++)
+			{
+				if (time >= from && time <= to)
+				{
+					visit(time, value);
+					visited++;
+				}
+
+				if (i + 1 == chunk->samples)
+					break;
+
+				delta += get_time(reader);
+				time += delta;
+				value ^= get_value(reader);
+			}
+		}
+
+		return visited;
+	}
+
+	SeriesRing::Statistic SeriesRing::GetStatistic() const
+	{
+		lock_guard<std::mutex> lock(mutex);
+		Statistic statistic;
+
+		statistic.tags = tags.size();
+		statistic.samples = 0;
+		statistic.bytes = 0;
+
+		for (unordered_map<uint32_t, Series>::const_iterator series = tags.cbegin(); series != tags.cend(); series++)
+		{
+			for (Series::const_iterator chunk = series->second.cbegin(); chunk != series->second.cend(); chunk++)
+			{
+				statistic.samples += chunk->samples;
+				statistic.bytes += chunk->data.size();
+			}
+		}
+
+		return statistic;
+	}
+
+	void SeriesRing::Clear()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		tags.clear();
+	}
+
+	static void put(ofstream& file, uint64_t value, unsigned size)
+	{
+		for (unsigned i = 0; i < size; i++)
+			file.put((char)(uint8_t)(value >> (8 * i)));
+	}
+
+	static uint64_t get(ifstream& file, unsigned size)
+	{
+		uint64_t value = 0;
+
+		for (unsigned i = 0; i < size; i++)
+			value |= (uint64_t)(uint8_t)file.get() << (8 * i);
+
+		if (!file)
+		{
+			throw runtime_error("Invalid series ring file.");
+		}
+
+		return value;
+	}
+
+	void SeriesRing::Export(const string& path) const
+	{
+		ofstream file(path.c_str(), ios::binary | ios::trunc);
+		lock_guard<std::mutex> lock(mutex);
+
+		file.write(RingMagic, sizeof(RingMagic));
+		put(file, RingVersion, 1);
+		put(file, tags.size(), 4);
+
+		for (unordered_map<uint32_t, Series>::const_iterator series = tags.cbegin(); series != tags.cend(); series++)
+		{
+			put(file, series->first, 4);
+			put(file, series->second.size(), 4);
+
+			for (Series::const_iterator chunk = series->second.cbegin(); chunk != series->second.cend(); chunk++)
+			{
+				put(file, chunk->samples, 4);
+				put(file, chunk->bits, 8);
+				put(file, (uint64_t)chunk->minTime, 8);
+				put(file, (uint64_t)chunk->maxTime, 8);
+				put(file, (uint64_t)chunk->lastTime, 8);
+				put(file, (uint64_t)chunk->lastDelta, 8);
+				put(file, chunk->lastValue, 2);
+				file.write((const char*)chunk->data.data(), chunk->data.size());
+			}
+		}
+
+		file.close();
+
+		if (!file)
+		{
+			throw runtime_error("Can not write series ring " + path);
+		}
+	}
+
+	/**
+	* Chunk read from file is decoded, so corrupted chunk is rejected here
+	* instead of in Query, and state of last sample is taken from data.
+	* Chunk of ring with more samples per chunk is split: its samples are
+	* appended again.
+	**/
+	void SeriesRing::load(Series& series, Chunk& chunk)
+	{
+		vector<pair<int64_t, uint16_t>> samples;
+		samples.reserve(chunk.samples);
+
+		try
+		{
+			BitReader reader(chunk.data.data(), chunk.bits);
+			int64_t time = (int64_t)reader.Get(64);
+			uint16_t value = (uint16_t)reader.Get(16);
+			int64_t delta = 0;
+
+			samples.push_back(make_pair(time, value));
+
+			for (unsigned i = 1; i < chunk.samples; i++)
+			{
+				delta += get_time(reader);
+				time += delta;
+				value ^= get_value(reader);
+				samples.push_back(make_pair(time, value));
+			}
+
+			chunk.lastDelta = delta;
+		}
+		catch (const runtime_error&)
+		{
+			throw runtime_error("Invalid series ring file.");
+		}
+
+		if (chunk.samples > settings.chunkSamples)
+		{
+			series.pop_back();
+
+			for (vector<pair<int64_t, uint16_t>>::const_iterator i = samples.cbegin(); i != samples.cend(); i++)
+				append(series, i->first, i->second);
+
+			return;
+		}
+
+		chunk.minTime = samples.front().first;
+		chunk.maxTime = samples.front().first;
+
+		for (vector<pair<int64_t, uint16_t>>::const_iterator i = samples.cbegin(); i != samples.cend(); i++)
+		{
+			chunk.minTime = min(chunk.minTime, i->first);
+			chunk.maxTime = max(chunk.maxTime, i->first);
+		}
+
+		chunk.lastTime = samples.back().first;
+		chunk.lastValue = samples.back().second;
+	}
+
+	void SeriesRing::Import(const string& path)
+	{
+		ifstream file(path.c_str(), ios::binary);
+		if (!file)
+		{
+			throw runtime_error("Can not open series ring " + path);
+		}
+
+		char magic[sizeof(RingMagic)];
+		file.read(magic, sizeof(magic));
+
+		if (!file || memcmp(magic, RingMagic, sizeof(magic)) != 0 || get(file, 1) != RingVersion)
+		{
+			throw runtime_error("Invalid series ring file.");
+		}
+
+		unordered_map<uint32_t, Series> loaded;
+		const uint64_t count = get(file, 4);
+
+		for (uint64_t n = 0; n < count; n++)
+		{
+			Series& series = loaded[(uint32_t)get(file, 4)];
+			const uint64_t chunks = get(file, 4);
+
+			for (uint64_t c = 0; c < chunks; c++)
+			{
+				series.push_back(Chunk());
+				Chunk& chunk = series.back();
+
+				chunk.samples = (unsigned)get(file, 4);
+				chunk.bits = get(file, 8);
+				chunk.minTime = (int64_t)get(file, 8);
+				chunk.maxTime = (int64_t)get(file, 8);
+				chunk.lastTime = (int64_t)get(file, 8);
+				chunk.lastDelta = (int64_t)get(file, 8);
+				chunk.lastValue = (uint16_t)get(file, 2);
+
+				/**
+				 * First sample is 80 bits, each next one at least 2.
+				 **/
+				if (chunk.samples == 0 || chunk.bits < 80 + (uint64_t)(chunk.samples - 1) * 2 ||
+					chunk.bits > (uint64_t)chunk.samples * 100)
+				{
+					throw runtime_error("Invalid series ring file.");
+				}
+
+				chunk.data.resize((size_t)((chunk.bits + 7) / 8));
+				file.read((char*)chunk.data.data(), chunk.data.size());
+
+				if (!file)
+				{
+					throw runtime_error("Invalid series ring file.");
+				}
+
+				load(series, chunk);
+			}
+
+			/**
+			 * Ring of other settings keeps last chunks.
+			 **/
+			while (series.size() > settings.chunks)
+				series.pop_front();
+		}
+
+		lock_guard<std::mutex> lock(mutex);
+		tags.swap(loaded);
+	}
+}
@@ -0,0 +1,144 @@
+/**
+ * Description: Compressed in-memory ring of polled values. Each tag(unit
+ *				and register address) has its own column of chunks.
+ *				Timestamps are stored as delta of delta and values as XOR
+ *				with previous value, so regular polling of slowly changing
+ *				registers takes few bits per sample instead of vector of
+ *				results. When tag has maximum number of chunks, its oldest
+ *				chunk is dropped.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SERIES_RING_H_
+#define _SERIES_RING_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Modbus
+{
+	class SeriesRing
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Samples in one chunk
+			 **/
+			unsigned chunkSamples;
+
+			/**
+			 * Chunks kept for each tag. Tag keeps at least
+			 * (chunks - 1) * chunkSamples last samples.
+			 **/
+			unsigned chunks;
+
+			Settings() : chunkSamples(1024), chunks(16)
+			{
+			}
+		};
+
+		struct Statistic
+		{
+			size_t tags;
+
+			/**
+			 * Kept samples
+			 **/
+			uint64_t samples;
+
+			/**
+			 * Compressed size of kept samples, bytes
+			 **/
+			size_t bytes;
+		};
+
+		/**
+		 * Visitor of query: time and value of sample.
+		 **/
+		typedef std::function<void(int64_t time, uint16_t value)> Visitor;
+
+		explicit SeriesRing(const Settings& settings = Settings());
+
+		/**
+		 * Append sample of tag. Time is in any unit(us of steady_clock
+		 * for example) and should not decrease for tag. Functions are
+		 * thread safe.
+		 **/
+		void Append(int64_t time, uint8_t id, uint16_t addr, uint16_t value);
+
+		/**
+		 * Append decoded read result: registers[i] is value of addr + i.
+		 **/
+		void Append(int64_t time, uint8_t id, uint16_t addr, const std::vector<uint16_t>& registers);
+
+		/**
+		 * Call visit for each kept sample of tag with time in [from, to],
+		 * in order of appending. Samples are decoded from chunks in place,
+		 * nothing is copied. Ring is locked while visit is called, so
+		 * visit must not append.
+		 * Return:	number of visited samples.
+		 **/
+		size_t Query(uint8_t id, uint16_t addr, int64_t from, int64_t to, const Visitor& visit) const;
+
+		Statistic GetStatistic() const;
+
+		/**
+		 * Remove all tags.
+		 **/
+		void Clear();
+
+		/**
+		 * Write compressed chunks of all tags to file, and replace tags
+		 * with tags of file. Format: "MBTS", version, number of tags, and
+		 * for each tag id, address and chunks as they are in memory.
+		 * Chunks with more samples than chunkSamples are split.
+		 * Exceptions:	runtime_error if file can not be written or read,
+		 *				or is not ring file.
+		 **/
+		void Export(const std::string& path) const;
+		void Import(const std::string& path);
+
+	private:
+		/**
+		 * Bit stream of chunk and state of last sample for encoding of
+		 * next one.
+		 **/
+		struct Chunk
+		{
+			std::vector<uint8_t> data;
+			uint64_t bits;
+			unsigned samples;
+			int64_t minTime;
+			int64_t maxTime;
+
+			int64_t lastTime;
+			int64_t lastDelta;
+			uint16_t lastValue;
+		};
+
+		typedef std::deque<Chunk> Series;
+
+		static uint32_t tagOf(uint8_t id, uint16_t addr);
+
+		void append(Series& series, int64_t time, uint16_t value);
+
+		/**
+		 * Check chunk just read from file, which is last in series.
+		 * Exceptions:	runtime_error if chunk is corrupted.
+		 **/
+		void load(Series& series, Chunk& chunk);
+
+		Settings settings;
+
+		mutable std::mutex mutex;
+		std::unordered_map<uint32_t, Series> tags;
+	};
+}
+
+#endif	/* _SERIES_RING_H_ */
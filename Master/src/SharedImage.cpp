@@ -0,0 +1,447 @@
+/**
+* Register and coil image in shared memory
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include "Pdu.h"
+#include "SharedImage.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	const uint32_t SharedImageHeader::Magic;
+	const uint32_t SharedImageHeader::Version;
+	const unsigned SharedImageBlock::DataSize;
+
+	static bool is_bits(uint8_t function)
+	{
+		return function <= (uint8_t)Master::FunctionCodes::ReadDiscreteInputs;
+	}
+
+#ifdef _WIN32
+	SharedSegment::SharedSegment(const string& name, size_t size)
+		: name(name), owner(true), data(NULL), size(size)
+	{
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD)((unsigned long long)size >> 32), (DWORD)size, name.c_str());
+		if (mapping == NULL)
+		{
+			throw runtime_error("Can not create shared memory " + name);
+		}
+
+		data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+		if (data == NULL)
+		{
+			CloseHandle(mapping);
+			throw runtime_error("Can not map shared memory " + name);
+		}
+
+		memset(data, 0, size);
+	}
+
+	SharedSegment::SharedSegment(const string& name)
+		: name(name), owner(false), data(NULL), size(0)
+	{
+		mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+		if (mapping == NULL)
+		{
+			throw runtime_error("Can not open shared memory " + name);
+		}
+
+		data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == NULL)
+		{
+			CloseHandle(mapping);
+			throw runtime_error("Can not map shared memory " + name);
+		}
+
+		MEMORY_BASIC_INFORMATION info;
+		VirtualQuery(data, &info, sizeof(info));
+		size = info.RegionSize;
+	}
+
+	SharedSegment::~SharedSegment()
+	{
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+	}
+#else
+	SharedSegment::SharedSegment(const string& name, size_t size)
+		: name(name), owner(true), data(NULL), size(size)
+	{
+		const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+		if (fd < 0)
+		{
+			throw runtime_error("Can not create shared memory " + name);
+		}
+
+		if (ftruncate(fd, (off_t)size) != 0)
+		{
+			close(fd);
+			shm_unlink(name.c_str());
+			throw runtime_error("Can not create shared memory " + name);
+		}
+
+		void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (p == MAP_FAILED)
+		{
+			shm_unlink(name.c_str());
+			throw runtime_error("Can not map shared memory " + name);
+		}
+
+		data = (uint8_t*)p;
+	}
+
+	SharedSegment::SharedSegment(const string& name)
+		: name(name), owner(false), data(NULL), size(0)
+	{
+		const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0)
+		{
+			throw runtime_error("Can not open shared memory " + name);
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			close(fd);
+			throw runtime_error("Can not open shared memory " + name);
+		}
+
+		size = (size_t)st.st_size;
+		void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (p == MAP_FAILED)
+		{
+			throw runtime_error("Can not map shared memory " + name);
+		}
+
+		data = (uint8_t*)p;
+	}
+
+	SharedSegment::~SharedSegment()
+	{
+		munmap(data, size);
+
+		if (owner)
+			shm_unlink(name.c_str());
+	}
+#endif
+
+	uint8_t* SharedSegment::Data() const
+	{
+		return data;
+	}
+
+	size_t SharedSegment::Size() const
+	{
+		return size;
+	}
+
+	static size_t segment_size(const vector<ImageBlock>& blocks)
+	{
+		for (vector<ImageBlock>::const_iterator i = blocks.cbegin(); i != blocks.cend(); i++)
+		{
+			const unsigned max = is_bits((uint8_t)i->function) ? Pdu::MaxReadBits : Pdu::MaxReadRegisters;
+
+			if (i->function < Master::FunctionCodes::ReadCoils || i->function > Master::FunctionCodes::ReadInputRegisters ||
+				i->quantity < 1 || i->quantity > max || i->addr + i->quantity > 0x10000)
+			{
+				throw invalid_argument("Invalid image block.");
+			}
+		}
+
+		return sizeof(SharedImageHeader) + blocks.size() * sizeof(SharedImageBlock);
+	}
+
+	ImagePublisher::ImagePublisher(const string& name, const vector<ImageBlock>& blocks)
+		: segment(name, segment_size(blocks)), count(blocks.size())
+	{
+		SharedImageHeader* header = (SharedImageHeader*)segment.Data();
+		this->blocks = (SharedImageBlock*)(segment.Data() + sizeof(SharedImageHeader));
+
+		for (size_t i = 0; i < count; i++)
+		{
+			SharedImageBlock& b = this->blocks[i];
+
+			b.sequence.store(0, memory_order_relaxed);
+			b.id = blocks[i].id;
+			b.function = (uint8_t)blocks[i].function;
+			b.addr = blocks[i].addr;
+			b.quantity = blocks[i].quantity;
+			b.time = 0;
+			b.updates = 0;
+
+			index[make_pair(b.id, b.function)].push_back(i);
+		}
+
+		header->version = SharedImageHeader::Version;
+		header->blocks = (uint32_t)count;
+		header->blockSize = sizeof(SharedImageBlock);
+		header->magic.store(SharedImageHeader::Magic, memory_order_release);
+	}
+
+	int ImagePublisher::Find(uint8_t id, Master::FunctionCodes function, uint16_t addr, unsigned quantity) const
+	{
+		map<pair<uint8_t, uint8_t>, vector<size_t>>::const_iterator i = index.find(make_pair(id, (uint8_t)function));
+		if (i == index.end())
+			return -1;
+
+		for (vector<size_t>::const_iterator h = i->second.cbegin(); h != i->second.cend(); h++)
+		{
+			const SharedImageBlock& b = blocks[*h];
+
+			if (b.addr <= addr && addr + quantity <= (unsigned)b.addr + b.quantity)
+				return (int)*h;
+		}
+
+		return -1;
+	}
+
+	SharedImageBlock& ImagePublisher::block(size_t handle, uint16_t addr, size_t quantity)
+	{
+		if (handle >= count)
+		{
+			throw out_of_range("Invalid image block handle.");
+		}
+
+		SharedImageBlock& b = blocks[handle];
+
+		if (addr < b.addr || addr + quantity > (size_t)b.addr + b.quantity)
+		{
+			throw out_of_range("Range is out of image block.");
+		}
+
+		return b;
+	}
+
+	void ImagePublisher::begin(SharedImageBlock& block)
+	{
+		block.sequence.store(block.sequence.load(memory_order_relaxed) + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+	}
+
+	void ImagePublisher::end(SharedImageBlock& block)
+	{
+		block.time = chrono::duration_cast<chrono::microseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+		block.updates++;
+		block.sequence.store(block.sequence.load(memory_order_relaxed) + 1, memory_order_release);
+	}
+
+	void ImagePublisher::Publish(size_t handle, uint16_t addr, const vector<uint16_t>& registers)
+	{
+		SharedImageBlock& b = block(handle, addr, registers.size());
+		uint8_t* p = b.data + 2 * (addr - b.addr);
+
+		begin(b);
+		for (size_t i = 0; i < registers.size(); i++)
+			memcpy(p + 2 * i, &registers[i], 2);
+		end(b);
+	}
+
+	void ImagePublisher::Publish(size_t handle, uint16_t addr, const vector<bool>& bits)
+	{
+		SharedImageBlock& b = block(handle, addr, bits.size());
+		const unsigned offset = addr - b.addr;
+
+		begin(b);
+		for (size_t i = 0; i < bits.size(); i++)
+		{
+			const unsigned bit = offset + (unsigned)i;
+
+			if (bits[i])
+				b.data[bit / 8] |= (uint8_t)(1 << (bit % 8));
+			else
+				b.data[bit / 8] &= (uint8_t)~(1 << (bit % 8));
+		}
+		end(b);
+	}
+
+	ImageReader::ImageReader(const string& name) : segment(name)
+	{
+		const SharedImageHeader* header = (const SharedImageHeader*)segment.Data();
+
+		if (segment.Size() < sizeof(SharedImageHeader) ||
+			header->magic.load(memory_order_acquire) != SharedImageHeader::Magic ||
+			header->version != SharedImageHeader::Version ||
+			header->blockSize != sizeof(SharedImageBlock) ||
+			segment.Size() < sizeof(SharedImageHeader) + (size_t)header->blocks * sizeof(SharedImageBlock))
+		{
+			throw runtime_error("Shared image " + name + " is not published.");
+		}
+
+		blocks = (const SharedImageBlock*)(segment.Data() + sizeof(SharedImageHeader));
+		count = header->blocks;
+	}
+
+	size_t ImageReader::Blocks() const
+	{
+		return count;
+	}
+
+	int ImageReader::Find(uint8_t id, Master::FunctionCodes function, uint16_t addr) const
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			if (blocks[i].id == id && blocks[i].function == (uint8_t)function && blocks[i].addr == addr)
+				return (int)i;
+		}
+
+		return -1;
+	}
+
+	/**
+	* Copy block while sequence is even and doesn't change.
+	**/
+	void ImageReader::copy(size_t handle, SharedImageBlock& copy) const
+	{
+		if (handle >= count)
+		{
+			throw out_of_range("Invalid image block handle.");
+		}
+
+		const SharedImageBlock& b = blocks[handle];
+
+		for (;;)
+		{
+			const uint32_t sequence = b.sequence.load(memory_order_acquire);
+
+			if (sequence & 1)
+				continue;
+
+			copy.id = b.id;
+			copy.function = b.function;
+			copy.addr = b.addr;
+			copy.quantity = b.quantity;
+			copy.time = b.time;
+			copy.updates = b.updates;
+			memcpy(copy.data, b.data, sizeof(copy.data));
+
+			atomic_thread_fence(memory_order_acquire);
+
+			if (b.sequence.load(memory_order_relaxed) == sequence)
+				return;
+		}
+	}
+
+	ImageBlock ImageReader::GetBlock(size_t handle) const
+	{
+		if (handle >= count)
+		{
+			throw out_of_range("Invalid image block handle.");
+		}
+
+		ImageBlock block = { blocks[handle].id, (Master::FunctionCodes)blocks[handle].function,
+			blocks[handle].addr, blocks[handle].quantity };
+		return block;
+	}
+
+	void ImageReader::Read(size_t handle, vector<uint16_t>& registers, int64_t& time) const
+	{
+		SharedImageBlock b;
+		copy(handle, b);
+
+		registers.resize(b.quantity);
+		for (size_t i = 0; i < registers.size(); i++)
+			memcpy(&registers[i], b.data + 2 * i, 2);
+
+		time = b.time;
+	}
+
+	void ImageReader::Read(size_t handle, vector<bool>& bits, int64_t& time) const
+	{
+		SharedImageBlock b;
+		copy(handle, b);
+
+		bits.resize(b.quantity);
+		for (size_t i = 0; i < bits.size(); i++)
+			bits[i] = (b.data[i / 8] & (1 << (i % 8))) != 0;
+
+		time = b.time;
+	}
+
+	PublishingMaster::PublishingMaster(Master& master, ImagePublisher& publisher)
+		: master(master), publisher(publisher)
+	{
+	}
+
+	vector<uint8_t> PublishingMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		vector<uint8_t> responce = master.Transact(id, request);
+		publish(id, request, responce);
+		return responce;
+	}
+
+	void PublishingMaster::SendPDU(vector<uint8_t> request)
+	{
+		master.Broadcast(request);
+	}
+
+	void PublishingMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		master.TransactMany(transactions);
+
+		for (vector<Transaction>::const_iterator i = transactions.cbegin(); i != transactions.cend(); i++)
+		{
+			if (!i->error)
+				publish(i->id, i->request, i->responce);
+		}
+	}
+
+	/**
+	* Decode normal responce of read and publish it, if it is in block.
+	* Invalid responces are left to caller.
+	**/
+	void PublishingMaster::publish(uint8_t id, const vector<uint8_t>& request, const vector<uint8_t>& responce)
+	{
+		if (request.size() != 5 || request[0] < (uint8_t)FunctionCodes::ReadCoils ||
+			request[0] > (uint8_t)FunctionCodes::ReadInputRegisters)
+		{
+			return;
+		}
+
+		const uint16_t addr = Pdu::GetWord(&request[1]);
+		const unsigned quantity = Pdu::GetWord(&request[3]);
+		const int handle = publisher.Find(id, (FunctionCodes)request[0], addr, quantity);
+
+		if (handle < 0)
+			return;
+
+		try
+		{
+			if (is_bits(request[0]))
+			{
+				vector<bool> bits(quantity);
+				Pdu::DecodeBits(request.data(), request.size(), responce.data(), responce.size(), quantity, bits.begin());
+				publisher.Publish(handle, addr, bits);
+			}
+			else
+			{
+				vector<uint16_t> registers(quantity);
+				Pdu::DecodeRegisters(request.data(), request.size(), responce.data(), responce.size(), quantity,
+					registers.data());
+				publisher.Publish(handle, addr, registers);
+			}
+		}
+		catch (const exception&)
+		{
+		}
+	}
+}
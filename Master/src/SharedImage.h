@@ -0,0 +1,221 @@
+/**
+ * Description: Register and coil image of units in shared memory. One
+ *				process polls devices and publishes latest values of each
+ *				block(unit, table and address range) into named shared
+ *				memory segment; other local processes map it and read
+ *				values without syscalls. Each block is protected by
+ *				seqlock: writer makes sequence odd while it writes, reader
+ *				copies block and retries if sequence was odd or changed.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SHARED_IMAGE_H_
+#define _SHARED_IMAGE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	/**
+	 * Layout of segment: header, then blocks. All fields are in native
+	 * byte order, segment is for processes of one host.
+	 **/
+	struct SharedImageHeader
+	{
+		static const uint32_t Magic = 0x4953424D;	// "MBSI"
+		static const uint32_t Version = 1;
+
+		/**
+		 * Magic is written last, when blocks are ready.
+		 **/
+		std::atomic<uint32_t> magic;
+		uint32_t version;
+		uint32_t blocks;
+		uint32_t blockSize;
+		uint8_t reserved[48];
+	};
+
+	struct SharedImageBlock
+	{
+		/**
+		 * Registers(2 bytes each) or bits(packed as in MODBUS responce)
+		 **/
+		static const unsigned DataSize = 256;
+
+		/**
+		 * Seqlock sequence: odd while block is written.
+		 **/
+		std::atomic<uint32_t> sequence;
+		uint8_t id;
+		uint8_t function;
+		uint16_t addr;
+		uint16_t quantity;
+		uint16_t reserved;
+
+		/**
+		 * Time of last publication, us of steady_clock, and number of
+		 * publications. 0 if block was not published.
+		 **/
+		int64_t time;
+		uint64_t updates;
+
+		uint8_t data[DataSize];
+		uint8_t padding[32];
+	};
+
+	/**
+	 * Block of image: unit, read function(table) and range.
+	 **/
+	struct ImageBlock
+	{
+		uint8_t id;
+		Master::FunctionCodes function;
+		uint16_t addr;
+		uint16_t quantity;
+	};
+
+	/**
+	 * Segment of shared memory.
+	 **/
+	class SharedSegment
+	{
+	public:
+		/**
+		 * Create segment of size, or open existing segment.
+		 * Exceptions:	runtime_error if segment can not be created or
+		 *				opened.
+		 **/
+		SharedSegment(const std::string& name, size_t size);
+		explicit SharedSegment(const std::string& name);
+		~SharedSegment();
+
+		uint8_t* Data() const;
+		size_t Size() const;
+
+	private:
+		SharedSegment(const SharedSegment&);
+		SharedSegment& operator=(const SharedSegment&);
+
+		std::string name;
+		bool owner;
+		uint8_t* data;
+		size_t size;
+#ifdef _WIN32
+		void* mapping;
+#endif
+	};
+
+	/**
+	 * Writer of image. Segment is removed by destructor; processes which
+	 * have mapped it keep last values.
+	 **/
+	class ImagePublisher
+	{
+	public:
+		/**
+		 * name:	segment name, "/name" on POSIX
+		 * blocks:	blocks of image, handle of block is its index
+		 * Exceptions:	invalid_argument if block is not read 01-04 or
+		 *				its quantity is out of range; runtime_error if
+		 *				segment can not be created.
+		 **/
+		ImagePublisher(const std::string& name, const std::vector<ImageBlock>& blocks);
+
+		/**
+		 * Write values of block part starting from addr. Part must be in
+		 * block. Only one thread may publish same block at once.
+		 * Exceptions:	out_of_range if handle or part is invalid.
+		 **/
+		void Publish(size_t handle, uint16_t addr, const std::vector<uint16_t>& registers);
+		void Publish(size_t handle, uint16_t addr, const std::vector<bool>& bits);
+
+		/**
+		 * Block which contains range, or -1.
+		 **/
+		int Find(uint8_t id, Master::FunctionCodes function, uint16_t addr, unsigned quantity) const;
+
+	private:
+		SharedImageBlock& block(size_t handle, uint16_t addr, size_t quantity);
+		void begin(SharedImageBlock& block);
+		void end(SharedImageBlock& block);
+
+		SharedSegment segment;
+		SharedImageBlock* blocks;
+		size_t count;
+
+		/**
+		 * Blocks by unit and function, for Find.
+		 **/
+		std::map<std::pair<uint8_t, uint8_t>, std::vector<size_t>> index;
+	};
+
+	/**
+	 * Reader of image.
+	 **/
+	class ImageReader
+	{
+	public:
+		/**
+		 * Exceptions:	runtime_error if segment doesn't exist or is not
+		 *				published yet.
+		 **/
+		explicit ImageReader(const std::string& name);
+
+		size_t Blocks() const;
+
+		/**
+		 * Handle of block with unit, function and start address, or -1.
+		 **/
+		int Find(uint8_t id, Master::FunctionCodes function, uint16_t addr) const;
+
+		/**
+		 * Consistent copy of block.
+		 * Exceptions:	out_of_range if handle is invalid.
+		 **/
+		ImageBlock GetBlock(size_t handle) const;
+		void Read(size_t handle, std::vector<uint16_t>& registers, int64_t& time) const;
+		void Read(size_t handle, std::vector<bool>& bits, int64_t& time) const;
+
+	private:
+		/**
+		 * Copy block under seqlock.
+		 **/
+		void copy(size_t handle, SharedImageBlock& copy) const;
+
+		SharedSegment segment;
+		const SharedImageBlock* blocks;
+		size_t count;
+	};
+
+	/**
+	 * Master which publishes responces of reads of another master: read
+	 * which is inside block of publisher updates that part of block.
+	 **/
+	class PublishingMaster : public Master
+	{
+	public:
+		PublishingMaster(Master& master, ImagePublisher& publisher);
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+	private:
+		PublishingMaster(const PublishingMaster&);
+		PublishingMaster& operator=(const PublishingMaster&);
+
+		void publish(uint8_t id, const std::vector<uint8_t>& request, const std::vector<uint8_t>& responce);
+
+		Master& master;
+		ImagePublisher& publisher;
+	};
+}
+
+#endif	/* _SHARED_IMAGE_H_ */
@@ -0,0 +1,127 @@
+/**
+* Single-flight deduplication of reads
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include "SingleFlight.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	bool SingleFlight::Key::operator<(const Key& other) const
+	{
+		if (id != other.id)
+			return id < other.id;
+		if (funcCode != other.funcCode)
+			return funcCode < other.funcCode;
+		if (addr != other.addr)
+			return addr < other.addr;
+		return quantity < other.quantity;
+	}
+
+	SingleFlight::SingleFlight(Master& master) : master(master)
+	{
+		statistic.requests = 0;
+		statistic.shared = 0;
+	}
+
+	vector<bool> SingleFlight::ReadCoils(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		Key key = { id, Master::FunctionCodes::ReadCoils, addr, quantity };
+		return execute(key)->bits;
+	}
+
+	vector<bool> SingleFlight::ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		Key key = { id, Master::FunctionCodes::ReadDiscreteInputs, addr, quantity };
+		return execute(key)->bits;
+	}
+
+	vector<uint16_t> SingleFlight::ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		Key key = { id, Master::FunctionCodes::ReadHoldingRegisters, addr, quantity };
+		return execute(key)->registers;
+	}
+
+	vector<uint16_t> SingleFlight::ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		Key key = { id, Master::FunctionCodes::ReadInputRegisters, addr, quantity };
+		return execute(key)->registers;
+	}
+
+	SingleFlight::Statistic SingleFlight::GetStatistic()
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return statistic;
+	}
+
+	/**
+	* Execute read as leader or wait result of leader. Call is removed
+	* from map before result is published, so request started after
+	* completion always read fresh data.
+	**/
+	SingleFlight::CallPtr SingleFlight::execute(const Key& key)
+	{
+		CallPtr call;
+
+		{
+			unique_lock<std::mutex> lock(mutex);
+			statistic.requests++;
+
+			auto i = calls.find(key);
+			if (i != calls.end())
+			{
+				statistic.shared++;
+
+				call = i->second;
+				call->finished.wait(lock, [&call]() { return call->done; });
+
+				if (call->error)
+					rethrow_exception(call->error);
+
+				return call;
+			}
+
+			call = make_shared<Call>();
+			calls[key] = call;
+		}
+
+		try
+		{
+			lock_guard<std::mutex> lock(masterMutex);
+
+			switch (key.funcCode)
+			{
+			case Master::FunctionCodes::ReadCoils:
+				call->bits = master.ReadCoils(key.id, key.addr, key.quantity);
+				break;
+			case Master::FunctionCodes::ReadDiscreteInputs:
+				call->bits = master.ReadDiscreteInputs(key.id, key.addr, key.quantity);
+				break;
+			case Master::FunctionCodes::ReadHoldingRegisters:
+				call->registers = master.ReadHoldingRegisters(key.id, key.addr, key.quantity);
+				break;
+			default:
+				call->registers = master.ReadInputRegisters(key.id, key.addr, key.quantity);
+				break;
+			}
+		}
+		catch (...)
+		{
+			call->error = current_exception();
+		}
+
+		{
+			lock_guard<std::mutex> lock(mutex);
+			calls.erase(key);
+			call->done = true;
+		}
+		call->finished.notify_all();
+
+		if (call->error)
+			rethrow_exception(call->error);
+
+		return call;
+	}
+}
@@ -0,0 +1,99 @@
+/**
+ * Description: Single-flight deduplication of reads. When several threads
+ *				request the same read(unit, function, address, quantity) at
+ *				the same time, only one request is sent and its result is
+ *				shared by all waiters.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SINGLE_FLIGHT_H_
+#define _SINGLE_FLIGHT_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	class SingleFlight
+	{
+	public:
+		struct Statistic
+		{
+			uint64_t requests;
+			uint64_t shared;
+		};
+
+		/**
+		 * master:	master used for all requests. Master itself is not thread
+		 *			safe, so access to it is serialized by SingleFlight.
+		 **/
+		explicit SingleFlight(Master& master);
+
+		/**
+		 * Same as Master functions. Function is thread safe. Identical
+		 * concurrent calls are merged into one request, and exceptions
+		 * are delivered to all waiters.
+		 **/
+		std::vector<bool> ReadCoils(uint8_t id, uint16_t addr, unsigned quantity);
+		std::vector<bool> ReadDiscreteInputs(uint8_t id, uint16_t addr, unsigned quantity);
+		std::vector<uint16_t> ReadHoldingRegisters(uint8_t id, uint16_t addr, unsigned quantity);
+		std::vector<uint16_t> ReadInputRegisters(uint8_t id, uint16_t addr, unsigned quantity);
+
+		Statistic GetStatistic();
+
+	private:
+		SingleFlight(const SingleFlight&);
+		SingleFlight& operator=(const SingleFlight&);
+
+		/**
+		 * Read key. Function code distinguish tables.
+		 **/
+		struct Key
+		{
+			uint8_t id;
+			Master::FunctionCodes funcCode;
+			uint16_t addr;
+			unsigned quantity;
+
+			bool operator<(const Key& other) const;
+		};
+
+		/**
+		 * Request in flight. Result is shared by leader with followers.
+		 **/
+		struct Call
+		{
+			bool done;
+			std::vector<bool> bits;
+			std::vector<uint16_t> registers;
+			std::exception_ptr error;
+			std::condition_variable finished;
+
+			Call() : done(false)
+			{
+			}
+		};
+
+		typedef std::shared_ptr<Call> CallPtr;
+
+		/**
+		 * Execute read as leader or wait result of leader.
+		 **/
+		CallPtr execute(const Key& key);
+
+		Master& master;
+		std::mutex masterMutex;
+
+		std::mutex mutex;
+		std::map<Key, CallPtr> calls;
+		Statistic statistic;
+	};
+}
+
+#endif	/* _SINGLE_FLIGHT_H_ */
@@ -0,0 +1,305 @@
+/**
+* Simulated MODBUS slave
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include "Slave.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	/**
+	 * Return word from high and low bytes
+	 **/
+	static uint16_t get_word(const uint8_t h, const uint8_t l)
+	{
+		return ((uint16_t)h << 8) | l;
+	}
+
+	Slave::Slave()
+		: coils(TableSize), discreteInputs(TableSize),
+		holdingRegisters(TableSize), inputRegisters(TableSize)
+	{
+	}
+
+	/**
+	* Process request PDU.
+	**/
+	vector<uint8_t> Slave::Process(const vector<uint8_t>& request)
+	{
+		if (request.empty())
+		{
+			return exception(0, EException::ILLEGAL_FUNCTION);
+		}
+
+		lock_guard<std::mutex> lock(mutex);
+
+		switch ((Master::FunctionCodes)request[0])
+		{
+		case Master::FunctionCodes::ReadCoils:
+			return readBits(request, coils);
+		case Master::FunctionCodes::ReadDiscreteInputs:
+			return readBits(request, discreteInputs);
+		case Master::FunctionCodes::ReadHoldingRegisters:
+			return readRegisters(request, holdingRegisters);
+		case Master::FunctionCodes::ReadInputRegisters:
+			return readRegisters(request, inputRegisters);
+		case Master::FunctionCodes::WriteSingleCoil:
+			return writeSingleCoil(request);
+		case Master::FunctionCodes::WriteSingleRegister:
+			return writeSingleRegister(request);
+		case Master::FunctionCodes::WriteMultipleCoils:
+			return writeMultipleCoils(request);
+		case Master::FunctionCodes::WriteMultipleRegisters:
+			return writeMultipleRegisters(request);
+		default:
+			return exception(request[0], EException::ILLEGAL_FUNCTION);
+		}
+	}
+
+	void Slave::SetCoil(uint16_t addr, bool value)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		coils[addr] = value;
+	}
+
+	void Slave::SetDiscreteInput(uint16_t addr, bool value)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		discreteInputs[addr] = value;
+	}
+
+	void Slave::SetHoldingRegister(uint16_t addr, uint16_t value)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		holdingRegisters[addr] = value;
+	}
+
+	void Slave::SetInputRegister(uint16_t addr, uint16_t value)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		inputRegisters[addr] = value;
+	}
+
+	bool Slave::GetCoil(uint16_t addr)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return coils[addr];
+	}
+
+	uint16_t Slave::GetHoldingRegister(uint16_t addr)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		return holdingRegisters[addr];
+	}
+
+	/**
+	 * Read Coils(01) and Read Discrete Inputs(02)
+	 **/
+	vector<uint8_t> Slave::readBits(const vector<uint8_t>& request, const vector<bool>& table)
+	{
+		if (request.size() != 5)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		const unsigned addr = get_word(request[1], request[2]);
+		const unsigned quantity = get_word(request[3], request[4]);
+
+		if (quantity < 1 || quantity > 2000)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		if (addr + quantity > TableSize)
+			return exception(request[0], EException::ILLEGAL_DATA_ADDRESS);
+
+		const unsigned N = (quantity + 7) / 8;
+		vector<uint8_t> responce(2 + N, 0);
+		responce[0] = request[0];
+		responce[1] = (uint8_t)N;
+
+		for (unsigned i = 0; i < quantity; i++)
+		{
+			if (table[addr + i])
+				responce[2 + i / 8] |= (uint8_t)(1 << (i % 8));
+		}
+
+		return responce;
+	}
+
+	/**
+	 * Read Holding Registers(03) and Read Input Registers(04)
+	 **/
+	vector<uint8_t> Slave::readRegisters(const vector<uint8_t>& request, const vector<uint16_t>& table)
+	{
+		if (request.size() != 5)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		const unsigned addr = get_word(request[1], request[2]);
+		const unsigned quantity = get_word(request[3], request[4]);
+
+		if (quantity < 1 || quantity > 125)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		if (addr + quantity > TableSize)
+			return exception(request[0], EException::ILLEGAL_DATA_ADDRESS);
+
+		vector<uint8_t> responce;
+		responce.reserve(2 + quantity * 2);
+		responce.push_back(request[0]);
+		responce.push_back((uint8_t)(quantity * 2));
+
+		for (unsigned i = 0; i < quantity; i++)
+		{
+			responce.push_back((uint8_t)(table[addr + i] >> 8));
+			responce.push_back((uint8_t)table[addr + i]);
+		}
+
+		return responce;
+	}
+
+	/**
+	 * Write Single Coil(05)
+	 **/
+	vector<uint8_t> Slave::writeSingleCoil(const vector<uint8_t>& request)
+	{
+		if (request.size() != 5)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		const uint16_t value = get_word(request[3], request[4]);
+		if (value != 0xFF00 && value != 0x0000)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		coils[get_word(request[1], request[2])] = value == 0xFF00;
+
+		return request;
+	}
+
+	/**
+	 * Write Single Register(06)
+	 **/
+	vector<uint8_t> Slave::writeSingleRegister(const vector<uint8_t>& request)
+	{
+		if (request.size() != 5)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		holdingRegisters[get_word(request[1], request[2])] = get_word(request[3], request[4]);
+
+		return request;
+	}
+
+	/**
+	 * Write Multiple Coils(0F)
+	 **/
+	vector<uint8_t> Slave::writeMultipleCoils(const vector<uint8_t>& request)
+	{
+		if (request.size() < 6)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		const unsigned addr = get_word(request[1], request[2]);
+		const unsigned quantity = get_word(request[3], request[4]);
+		const unsigned N = request[5];
+
+		if (quantity < 1 || quantity > 1968 || N != (quantity + 7) / 8 || request.size() != 6 + N)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		if (addr + quantity > TableSize)
+			return exception(request[0], EException::ILLEGAL_DATA_ADDRESS);
+
+		for (unsigned i = 0; i < quantity; i++)
+		{
+			coils[addr + i] = (request[6 + i / 8] >> (i % 8)) & 0x01;
+		}
+
+		return vector<uint8_t>(request.cbegin(), request.cbegin() + 5);
+	}
+
+	/**
+	 * Write Multiple Registers(10)
+	 **/
+	vector<uint8_t> Slave::writeMultipleRegisters(const vector<uint8_t>& request)
+	{
+		if (request.size() < 6)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		const unsigned addr = get_word(request[1], request[2]);
+		const unsigned quantity = get_word(request[3], request[4]);
+		const unsigned N = request[5];
+
+		if (quantity < 1 || quantity > 123 || N != quantity * 2 || request.size() != 6 + N)
+			return exception(request[0], EException::ILLEGAL_DATA_VALUE);
+
+		if (addr + quantity > TableSize)
+			return exception(request[0], EException::ILLEGAL_DATA_ADDRESS);
+
+		for (unsigned i = 0; i < quantity; i++)
+		{
+			holdingRegisters[addr + i] = get_word(request[6 + i * 2], request[7 + i * 2]);
+		}
+
+		return vector<uint8_t>(request.cbegin(), request.cbegin() + 5);
+	}
+
+	/**
+	 * Make exception responce PDU.
+	 **/
+	vector<uint8_t> Slave::exception(uint8_t funcCode, uint8_t ecode)
+	{
+		vector<uint8_t> responce(2);
+		responce[0] = funcCode | 0x80;
+		responce[1] = ecode;
+		return responce;
+	}
+
+	/**
+	 * Master connected directly to simulated slave
+	 **/
+	LoopbackMaster::LoopbackMaster(Slave& slave, unsigned latency)
+		: slave(slave), latency(latency)
+	{
+	}
+
+	LoopbackMaster::~LoopbackMaster()
+	{
+	}
+
+	vector<uint8_t> LoopbackMaster::SendPDU(uint8_t, vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		if (latency != 0)
+		{
+			this_thread::sleep_for(chrono::microseconds(latency));
+		}
+
+		return slave.Process(request);
+	}
+
+	void LoopbackMaster::SendPDU(vector<uint8_t> request)
+	{
+		slave.Process(request);
+	}
+
+	LoopbackTransport::LoopbackTransport(Slave& slave) : slave(&slave)
+	{
+	}
+
+	size_t LoopbackTransport::Transact(uint8_t, const uint8_t* request, size_t size, uint8_t* responce)
+	{
+		vector<uint8_t> pdu = slave->Process(vector<uint8_t>(request, request + size));
+
+		copy(pdu.cbegin(), pdu.cend(), responce);
+		return pdu.size();
+	}
+
+	void LoopbackTransport::Broadcast(const uint8_t* request, size_t size)
+	{
+		slave->Process(vector<uint8_t>(request, request + size));
+	}
+}
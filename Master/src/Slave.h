@@ -0,0 +1,101 @@
+/**
+ * Description: Simulated MODBUS slave. It process request PDU over
+ *				in-memory data tables and is used for testing and
+ *				benchmarking of masters without real devices.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SLAVE_H_
+#define _SLAVE_H_
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	class Slave
+	{
+	public:
+		/**
+		 * Constants
+		 **/
+		static const unsigned TableSize = 0x10000;
+
+		Slave();
+
+		/**
+		 * Process request PDU.
+		 * Return:	responce PDU. Exception responce is returned for
+		 *			unsupported functions and invalid requests.
+		 * Function is thread safe.
+		 **/
+		std::vector<uint8_t> Process(const std::vector<uint8_t>& request);
+
+		/**
+		 * Data tables access.
+		 **/
+		void SetCoil(uint16_t addr, bool value);
+		void SetDiscreteInput(uint16_t addr, bool value);
+		void SetHoldingRegister(uint16_t addr, uint16_t value);
+		void SetInputRegister(uint16_t addr, uint16_t value);
+
+		bool GetCoil(uint16_t addr);
+		uint16_t GetHoldingRegister(uint16_t addr);
+
+	private:
+		std::vector<uint8_t> readBits(const std::vector<uint8_t>& request, const std::vector<bool>& table);
+		std::vector<uint8_t> readRegisters(const std::vector<uint8_t>& request, const std::vector<uint16_t>& table);
+		std::vector<uint8_t> writeSingleCoil(const std::vector<uint8_t>& request);
+		std::vector<uint8_t> writeSingleRegister(const std::vector<uint8_t>& request);
+		std::vector<uint8_t> writeMultipleCoils(const std::vector<uint8_t>& request);
+		std::vector<uint8_t> writeMultipleRegisters(const std::vector<uint8_t>& request);
+
+		static std::vector<uint8_t> exception(uint8_t funcCode, uint8_t ecode);
+
+		std::mutex mutex;
+		std::vector<bool> coils;
+		std::vector<bool> discreteInputs;
+		std::vector<uint16_t> holdingRegisters;
+		std::vector<uint16_t> inputRegisters;
+	};
+
+	/**
+	 * Master connected directly to simulated slave. All unit IDs
+	 * are served by the same slave.
+	 **/
+	class LoopbackMaster : public Master
+	{
+	public:
+		/**
+		 * latency:		simulated responce latency, us
+		 **/
+		LoopbackMaster(Slave& slave, unsigned latency = 0);
+		virtual ~LoopbackMaster();
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+		Slave& slave;
+		unsigned latency;
+	};
+
+	/**
+	 * Transport of BasicMaster connected directly to simulated slave.
+	 **/
+	class LoopbackTransport
+	{
+	public:
+		explicit LoopbackTransport(Slave& slave);
+
+		size_t Transact(uint8_t id, const uint8_t* request, size_t size, uint8_t* responce);
+		void Broadcast(const uint8_t* request, size_t size);
+
+	private:
+		Slave* slave;
+	};
+}
+
+#endif	/* _SLAVE_H_ */
@@ -0,0 +1,270 @@
+/**
+* Time-aligned snapshot of many units
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "Pdu.h"
+#include "Snapshot.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	Snapshot::Snapshot(const Settings& settings) : settings(settings)
+	{
+	}
+
+	Snapshot::Handle Snapshot::add(Master& master, uint8_t id, Master::FunctionCodes read, uint16_t addr, unsigned quantity)
+	{
+		Read r;
+		r.master = &master;
+		r.id = id;
+		r.read = read;
+		r.addr = addr;
+		r.quantity = quantity;
+
+		reads.push_back(r);
+		return reads.size() - 1;
+	}
+
+	Snapshot::Handle Snapshot::ReadCoils(Master& master, uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return add(master, id, Master::FunctionCodes::ReadCoils, addr, quantity);
+	}
+
+	Snapshot::Handle Snapshot::ReadDiscreteInputs(Master& master, uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return add(master, id, Master::FunctionCodes::ReadDiscreteInputs, addr, quantity);
+	}
+
+	Snapshot::Handle Snapshot::ReadHoldingRegisters(Master& master, uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return add(master, id, Master::FunctionCodes::ReadHoldingRegisters, addr, quantity);
+	}
+
+	Snapshot::Handle Snapshot::ReadInputRegisters(Master& master, uint8_t id, uint16_t addr, unsigned quantity)
+	{
+		return add(master, id, Master::FunctionCodes::ReadInputRegisters, addr, quantity);
+	}
+
+	size_t Snapshot::Size() const
+	{
+		return reads.size();
+	}
+
+	void Snapshot::Clear()
+	{
+		reads.clear();
+		blocks.clear();
+		start = Clock::time_point();
+	}
+
+	const Snapshot::Block& Snapshot::GetBlock(Handle handle) const
+	{
+		if (handle >= blocks.size())
+		{
+			throw out_of_range("Invalid snapshot handle.");
+		}
+
+		return blocks[handle];
+	}
+
+	Snapshot::Clock::time_point Snapshot::Start() const
+	{
+		return start;
+	}
+
+	Snapshot::Clock::duration Snapshot::Spread() const
+	{
+		Clock::time_point first = Clock::time_point::max();
+		Clock::time_point last = Clock::time_point::min();
+
+		for (vector<Block>::const_iterator i = blocks.cbegin(); i != blocks.cend(); i++)
+		{
+			if (i->sent == Clock::time_point())
+				continue;
+
+			first = min(first, i->sent);
+			last = max(last, i->sent);
+		}
+
+		return first > last ? Clock::duration::zero() : last - first;
+	}
+
+	/**
+	* Encode all reads, then start one thread for each transport. Threads
+	* wait on barrier until all are started, so thread creation time does
+	* not spread first requests of transports.
+	**/
+	size_t Snapshot::Execute()
+	{
+		blocks.assign(reads.size(), Block());
+
+		map<Master*, vector<size_t>> transports;
+
+		for (size_t i = 0; i < reads.size(); i++)
+		{
+			Read& read = reads[i];
+
+			try
+			{
+				Pdu::CheckNotBroadcast(read.id);
+
+				if (read.addr + read.quantity > 0x10000)
+				{
+					throw invalid_argument("Address out of range.");
+				}
+
+				uint8_t pdu[5];
+				const size_t size = Pdu::EncodeRead(pdu, read.read, read.addr, read.quantity);
+				read.request.assign(pdu, pdu + size);
+				transports[read.master].push_back(i);
+			}
+			catch (...)
+			{
+				blocks[i].error = current_exception();
+			}
+		}
+
+		mutex barrier;
+		condition_variable changed;
+		size_t ready = 0;
+		bool released = false;
+		vector<thread> threads;
+
+		for (map<Master*, vector<size_t>>::const_iterator i = transports.cbegin(); i != transports.cend(); i++)
+		{
+			const vector<size_t>* transport = &i->second;
+
+			threads.push_back(thread([&, transport, this]()
+			{
+				{
+					unique_lock<mutex> lock(barrier);
+					ready++;
+					changed.notify_all();
+					changed.wait(lock, [&]() { return released; });
+				}
+
+				execute(*transport);
+			}));
+		}
+
+		{
+			unique_lock<mutex> lock(barrier);
+			changed.wait(lock, [&]() { return ready == threads.size(); });
+			start = Clock::now();
+			released = true;
+		}
+
+		changed.notify_all();
+
+		for (vector<thread>::iterator i = threads.begin(); i != threads.end(); i++)
+			i->join();
+
+		size_t failed = 0;
+		for (vector<Block>::const_iterator i = blocks.cbegin(); i != blocks.cend(); i++)
+		{
+			if (i->error)
+				failed++;
+		}
+
+		return failed;
+	}
+
+	void Snapshot::execute(const vector<size_t>& indexes)
+	{
+		Master& master = *reads[indexes.front()].master;
+
+		if (!settings.pipeline)
+		{
+			for (vector<size_t>::const_iterator i = indexes.cbegin(); i != indexes.cend(); i++)
+			{
+				const Read& read = reads[*i];
+				Block& block = blocks[*i];
+
+				try
+				{
+					block.sent = Clock::now();
+					const vector<uint8_t> responce = master.Transact(read.id, read.request);
+					block.received = Clock::now();
+
+					decode(read, responce, block);
+				}
+				catch (...)
+				{
+					if (block.received == Clock::time_point())
+						block.received = Clock::now();
+
+					block.error = current_exception();
+				}
+			}
+
+			return;
+		}
+
+		vector<Master::Transaction> transactions(indexes.size());
+		for (size_t i = 0; i < indexes.size(); i++)
+		{
+			transactions[i].id = reads[indexes[i]].id;
+			transactions[i].request = reads[indexes[i]].request;
+		}
+
+		const Clock::time_point sent = Clock::now();
+		exception_ptr error;
+
+		try
+		{
+			master.TransactMany(transactions);
+		}
+		catch (...)
+		{
+			error = current_exception();
+		}
+
+		const Clock::time_point received = Clock::now();
+
+		for (size_t i = 0; i < indexes.size(); i++)
+		{
+			Block& block = blocks[indexes[i]];
+			block.sent = sent;
+			block.received = received;
+
+			if (error || transactions[i].error)
+			{
+				block.error = error ? error : transactions[i].error;
+				continue;
+			}
+
+			try
+			{
+				decode(reads[indexes[i]], transactions[i].responce, block);
+			}
+			catch (...)
+			{
+				block.error = current_exception();
+			}
+		}
+	}
+
+	void Snapshot::decode(const Read& read, const vector<uint8_t>& responce, Block& block)
+	{
+		if (read.read <= Master::FunctionCodes::ReadDiscreteInputs)
+		{
+			block.bits.resize(read.quantity);
+			Pdu::DecodeBits(read.request.data(), read.request.size(), responce.data(), responce.size(),
+				read.quantity, block.bits.begin());
+		}
+		else
+		{
+			block.registers.resize(read.quantity);
+			Pdu::DecodeRegisters(read.request.data(), read.request.size(), responce.data(), responce.size(),
+				read.quantity, block.registers.data());
+		}
+	}
+}
@@ -0,0 +1,135 @@
+/**
+ * Description: Time-aligned snapshot of many units on many transports.
+ *				Reads of each transport(master) are made by its own thread,
+ *				and all threads start at once after barrier, so values of
+ *				different lines are sampled at nearly the same time instead
+ *				of one line after another. Each block is stamped with
+ *				monotonic(steady_clock) send and receive time.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	class Snapshot
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * Read index in snapshot
+		 **/
+		typedef size_t Handle;
+
+		struct Settings
+		{
+			/**
+			 * Send reads of each transport by one TransactMany, so they are
+			 * pipelined where transport supports it. All blocks of
+			 * transport get send time before and receive time after whole
+			 * TransactMany. Otherwise reads are sent one by one and each is
+			 * stamped exactly.
+			 **/
+			bool pipeline;
+
+			Settings() : pipeline(false)
+			{
+			}
+		};
+
+		/**
+		 * Result of read. Only field of read type is filled.
+		 **/
+		struct Block
+		{
+			std::exception_ptr error;
+			std::vector<bool> bits;
+			std::vector<uint16_t> registers;
+
+			/**
+			 * Time before request is sent and after responce is received.
+			 * Block which is not sent has both equal to epoch.
+			 **/
+			Clock::time_point sent;
+			Clock::time_point received;
+		};
+
+		explicit Snapshot(const Settings& settings = Settings());
+
+		/**
+		 * Add read. Master must live until Execute is done, and is used
+		 * by one thread of snapshot, so it needs not be thread safe.
+		 * Arguments are checked during Execute.
+		 **/
+		Handle ReadCoils(Master& master, uint8_t id, uint16_t addr, unsigned quantity);
+		Handle ReadDiscreteInputs(Master& master, uint8_t id, uint16_t addr, unsigned quantity);
+		Handle ReadHoldingRegisters(Master& master, uint8_t id, uint16_t addr, unsigned quantity);
+		Handle ReadInputRegisters(Master& master, uint8_t id, uint16_t addr, unsigned quantity);
+
+		/**
+		 * Make all reads. Error of read(invalid argument, exception
+		 * responce, timeout) is stored in its block.
+		 * Return:	number of failed reads.
+		 **/
+		size_t Execute();
+
+		size_t Size() const;
+
+		/**
+		 * Remove all reads and blocks.
+		 **/
+		void Clear();
+
+		/**
+		 * Block of last Execute.
+		 * Exception:	out_of_range if handle is invalid.
+		 **/
+		const Block& GetBlock(Handle handle) const;
+
+		/**
+		 * Time when barrier of last Execute was released.
+		 **/
+		Clock::time_point Start() const;
+
+		/**
+		 * Time between first and last send of last Execute. It is
+		 * sampling spread of snapshot.
+		 **/
+		Clock::duration Spread() const;
+
+	private:
+		struct Read
+		{
+			Master* master;
+			uint8_t id;
+			Master::FunctionCodes read;
+			uint16_t addr;
+			unsigned quantity;
+			std::vector<uint8_t> request;
+		};
+
+		Handle add(Master& master, uint8_t id, Master::FunctionCodes read, uint16_t addr, unsigned quantity);
+
+		/**
+		 * Send reads of one transport and decode responces.
+		 **/
+		void execute(const std::vector<size_t>& reads);
+
+		void decode(const Read& read, const std::vector<uint8_t>& responce, Block& block);
+
+		Settings settings;
+		std::vector<Read> reads;
+		std::vector<Block> blocks;
+		Clock::time_point start;
+	};
+}
+
+#endif	/* _SNAPSHOT_H_ */
@@ -0,0 +1,500 @@
+/**
+* Portable TCP socket wrapper
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "Socket.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+#ifdef _WIN32
+	const Socket::NativeHandle Socket::InvalidHandle = INVALID_SOCKET;
+
+	/**
+	 * WinSock must be initialized once per process.
+	 **/
+	static void startup()
+	{
+		static once_flag flag;
+		call_once(flag, []()
+		{
+			WSADATA wsaData;
+			if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+			{
+				throw runtime_error("WSAStartup failed");
+			}
+		});
+	}
+
+	static int last_error()
+	{
+		return WSAGetLastError();
+	}
+
+	static bool would_block(int error)
+	{
+		return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+	}
+
+	static void close_handle(Socket::NativeHandle handle)
+	{
+		closesocket(handle);
+	}
+#else
+	const Socket::NativeHandle Socket::InvalidHandle = -1;
+
+	static void startup()
+	{
+	}
+
+	static int last_error()
+	{
+		return errno;
+	}
+
+	static bool would_block(int error)
+	{
+		return error == EWOULDBLOCK || error == EAGAIN || error == EINPROGRESS;
+	}
+
+	static void close_handle(Socket::NativeHandle handle)
+	{
+		close(handle);
+	}
+#endif
+
+	/**
+	 * Wait for socket event.
+	 * write:	wait for writable instead of readable
+	 * Return:	true if event occurred, false on timeout
+	 **/
+	static bool wait_for(Socket::NativeHandle handle, bool write, unsigned timeout)
+	{
+#ifdef _WIN32
+		fd_set set;
+		FD_ZERO(&set);
+		FD_SET(handle, &set);
+
+		timeval tv;
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+
+		int rc = write ? select(0, NULL, &set, NULL, &tv) : select(0, &set, NULL, NULL, &tv);
+#else
+		pollfd pfd;
+		pfd.fd = handle;
+		pfd.events = write ? POLLOUT : POLLIN;
+		pfd.revents = 0;
+
+		int rc;
+		do
+		{
+			rc = poll(&pfd, 1, (int)timeout);
+		} while (rc < 0 && errno == EINTR);
+#endif
+		if (rc < 0)
+		{
+			throw runtime_error("Socket wait failed");
+		}
+
+		return rc > 0;
+	}
+
+	Socket::Socket() : handle(InvalidHandle)
+	{
+		startup();
+	}
+
+	Socket::Socket(NativeHandle handle) : handle(handle)
+	{
+	}
+
+	Socket::Socket(Socket&& other) : handle(other.handle)
+	{
+		other.handle = InvalidHandle;
+	}
+
+	Socket& Socket::operator=(Socket&& other)
+	{
+		if (this != &other)
+		{
+			Close();
+			handle = other.handle;
+			other.handle = InvalidHandle;
+		}
+
+		return *this;
+	}
+
+	Socket::~Socket()
+	{
+		Close();
+	}
+
+	/**
+	* Connect to remote host.
+	**/
+	void Socket::Connect(const string& host, uint16_t port, unsigned timeout)
+	{
+		Close();
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+
+		addrinfo* result = NULL;
+		if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0)
+		{
+			throw runtime_error("Can not resolve host " + host);
+		}
+
+		bool timedOut = false;
+
+		for (addrinfo* ai = result; ai != NULL; ai = ai->ai_next)
+		{
+			handle = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (handle == InvalidHandle)
+				continue;
+
+			/**
+			 * Non-blocking connect allows to limit connection time.
+			 **/
+			SetNonBlocking(true);
+
+			if (connect(handle, ai->ai_addr, (int)ai->ai_addrlen) == 0)
+			{
+				break;
+			}
+
+			if (would_block(last_error()))
+			{
+				if (wait_for(handle, true, timeout))
+				{
+					int error = 0;
+					socklen_t len = sizeof(error);
+					getsockopt(handle, SOL_SOCKET, SO_ERROR, (char*)&error, &len);
+					if (error == 0)
+						break;
+				}
+				else
+				{
+					timedOut = true;
+				}
+			}
+
+			Close();
+		}
+
+		freeaddrinfo(result);
+
+		if (handle == InvalidHandle)
+		{
+			if (timedOut)
+				throw ETimeout();
+
+			throw runtime_error("Can not connect to " + host);
+		}
+
+		SetNonBlocking(false);
+		SetNoDelay(true);
+	}
+
+	/**
+	* Start listening on local port.
+	**/
+	void Socket::Listen(const string& address, uint16_t port, int backlog)
+	{
+		Close();
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		addrinfo* result = NULL;
+		const char* node = address.empty() ? NULL : address.c_str();
+		if (getaddrinfo(node, to_string(port).c_str(), &hints, &result) != 0)
+		{
+			throw runtime_error("Can not resolve address " + address);
+		}
+
+		for (addrinfo* ai = result; ai != NULL; ai = ai->ai_next)
+		{
+			handle = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (handle == InvalidHandle)
+				continue;
+
+			int yes = 1;
+			setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+
+			if (::bind(handle, ai->ai_addr, (int)ai->ai_addrlen) == 0 &&
+				listen(handle, backlog) == 0)
+			{
+				break;
+			}
+
+			Close();
+		}
+
+		freeaddrinfo(result);
+
+		if (handle == InvalidHandle)
+		{
+			throw runtime_error("Can not listen on port " + to_string(port));
+		}
+	}
+
+	/**
+	* Accept incoming connection.
+	**/
+	Socket Socket::Accept()
+	{
+		NativeHandle client = accept(handle, NULL, NULL);
+		if (client == InvalidHandle)
+		{
+			if (would_block(last_error()))
+				return Socket(InvalidHandle);
+
+			throw runtime_error("Accept failed");
+		}
+
+		Socket s(client);
+		s.SetNoDelay(true);
+		return s;
+	}
+
+	/**
+	* Send all data.
+	**/
+	void Socket::SendAll(const uint8_t* data, size_t size)
+	{
+		while (size > 0)
+		{
+#ifdef MSG_NOSIGNAL
+			int rc = send(handle, (const char*)data, (int)size, MSG_NOSIGNAL);
+#else
+			int rc = send(handle, (const char*)data, (int)size, 0);
+#endif
+			if (rc < 0)
+			{
+				if (would_block(last_error()))
+				{
+					wait_for(handle, true, 1000);
+					continue;
+				}
+
+				throw runtime_error("Socket send failed");
+			}
+
+			data += rc;
+			size -= rc;
+		}
+	}
+
+	/**
+	* Send all data in time. Send buffer of peer which does not read is
+	* full, and waiting is limited by deadline.
+	**/
+	void Socket::SendAll(const uint8_t* data, size_t size, unsigned timeout)
+	{
+		const steady_clock::time_point deadline = steady_clock::now() + milliseconds(timeout);
+
+		while (size > 0)
+		{
+#ifdef MSG_NOSIGNAL
+			int rc = send(handle, (const char*)data, (int)size, MSG_NOSIGNAL);
+#else
+			int rc = send(handle, (const char*)data, (int)size, 0);
+#endif
+			if (rc < 0)
+			{
+				if (!would_block(last_error()))
+				{
+					throw runtime_error("Socket send failed");
+				}
+
+				steady_clock::time_point now = steady_clock::now();
+				if (now >= deadline)
+				{
+					throw ETimeout();
+				}
+
+				wait_for(handle, true, (unsigned)duration_cast<milliseconds>(deadline - now).count());
+				continue;
+			}
+
+			data += rc;
+			size -= rc;
+		}
+	}
+
+	/**
+	* Receive up to size bytes.
+	**/
+	size_t Socket::Receive(uint8_t* data, size_t size, unsigned timeout)
+	{
+		if (!wait_for(handle, false, timeout))
+		{
+			throw ETimeout();
+		}
+
+		int rc = recv(handle, (char*)data, (int)size, 0);
+		if (rc == 0)
+		{
+			throw runtime_error("Connection closed by remote side");
+		}
+
+		if (rc < 0)
+		{
+			if (would_block(last_error()))
+				throw ETimeout();
+
+			throw runtime_error("Socket receive failed");
+		}
+
+		return rc;
+	}
+
+	/**
+	* Receive exactly size bytes.
+	**/
+	void Socket::ReceiveAll(uint8_t* data, size_t size, unsigned timeout)
+	{
+		const steady_clock::time_point deadline = steady_clock::now() + milliseconds(timeout);
+
+		while (size > 0)
+		{
+			steady_clock::time_point now = steady_clock::now();
+			if (now >= deadline)
+			{
+				throw ETimeout();
+			}
+
+			unsigned left = (unsigned)duration_cast<milliseconds>(deadline - now).count();
+			size_t n = Receive(data, size, left);
+
+			data += n;
+			size -= n;
+		}
+	}
+
+	/**
+	* Wait until socket become readable.
+	**/
+	bool Socket::WaitReadable(unsigned timeout)
+	{
+		return wait_for(handle, false, timeout);
+	}
+
+	/**
+	* Wait until any of sockets become readable or closed.
+	**/
+	size_t Socket::Poll(vector<PollEntry>& entries, unsigned timeout)
+	{
+#ifdef _WIN32
+		vector<WSAPOLLFD> fds(entries.size());
+#else
+		vector<pollfd> fds(entries.size());
+#endif
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			fds[i].fd = entries[i].handle;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+
+		int rc;
+#ifdef _WIN32
+		rc = WSAPoll(fds.data(), (ULONG)fds.size(), (INT)timeout);
+#else
+		do
+		{
+			rc = poll(fds.data(), fds.size(), (int)timeout);
+		} while (rc < 0 && errno == EINTR);
+#endif
+		if (rc < 0)
+		{
+			throw runtime_error("Socket poll failed");
+		}
+
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			entries[i].readable = (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) != 0;
+		}
+
+		return rc;
+	}
+
+	void Socket::SetNonBlocking(bool nonBlocking)
+	{
+#ifdef _WIN32
+		u_long mode = nonBlocking ? 1 : 0;
+		ioctlsocket(handle, FIONBIO, &mode);
+#else
+		int flags = fcntl(handle, F_GETFL, 0);
+		flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+		fcntl(handle, F_SETFL, flags);
+#endif
+	}
+
+	void Socket::SetNoDelay(bool noDelay)
+	{
+		int flag = noDelay ? 1 : 0;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+	}
+
+	void Socket::SetBusyPoll(unsigned us)
+	{
+#ifdef SO_BUSY_POLL
+		int value = (int)us;
+		setsockopt(handle, SOL_SOCKET, SO_BUSY_POLL, (const char*)&value, sizeof(value));
+#endif
+	}
+
+	void Socket::Close()
+	{
+		if (handle != InvalidHandle)
+		{
+			close_handle(handle);
+			handle = InvalidHandle;
+		}
+	}
+
+	bool Socket::IsValid() const
+	{
+		return handle != InvalidHandle;
+	}
+
+	Socket::NativeHandle Socket::Handle() const
+	{
+		return handle;
+	}
+}
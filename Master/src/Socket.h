@@ -0,0 +1,127 @@
+/**
+ * Description: Portable TCP socket wrapper used by Modbus/TCP transports
+ *				and gateway. Hides differences between WinSock and BSD sockets.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SOCKET_H_
+#define _SOCKET_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Modbus
+{
+	class Socket
+	{
+	public:
+		/**
+		 * Types
+		 **/
+#ifdef _WIN32
+		typedef uintptr_t NativeHandle;
+#else
+		typedef int NativeHandle;
+#endif
+		static const NativeHandle InvalidHandle;
+
+		struct PollEntry
+		{
+			NativeHandle handle;
+			bool readable;
+		};
+
+		Socket();
+		explicit Socket(NativeHandle handle);
+		Socket(Socket&& other);
+		Socket& operator=(Socket&& other);
+		~Socket();
+
+		/**
+		 * Connect to remote host.
+		 * host:		host name or IP address
+		 * port:		TCP port
+		 * timeout:		connection timeout, ms
+		 * Exceptions:	ETimeout if connection is not established in time,
+		 *				runtime_error on other errors.
+		 **/
+		void Connect(const std::string& host, uint16_t port, unsigned timeout);
+
+		/**
+		 * Start listening on local port.
+		 * Exceptions:	runtime_error if port can not be bound.
+		 **/
+		void Listen(const std::string& address, uint16_t port, int backlog = 64);
+
+		/**
+		 * Accept incoming connection.
+		 * Return:	connected socket, or invalid socket if no connection is pending
+		 *			and socket is non-blocking.
+		 **/
+		Socket Accept();
+
+		/**
+		 * Send all data.
+		 * Exceptions:	runtime_error if connection is broken.
+		 **/
+		void SendAll(const uint8_t* data, size_t size);
+
+		/**
+		 * Send all data in time.
+		 * timeout:		timeout of whole operation, ms
+		 * Exceptions:	ETimeout if data is not sent in time,
+		 *				runtime_error if connection is broken.
+		 **/
+		void SendAll(const uint8_t* data, size_t size, unsigned timeout);
+
+		/**
+		 * Receive up to size bytes.
+		 * timeout:		receive timeout, ms
+		 * Return:		number of bytes received(greater than 0).
+		 * Exceptions:	ETimeout if no data received in time,
+		 *				runtime_error if connection closed by remote side.
+		 **/
+		size_t Receive(uint8_t* data, size_t size, unsigned timeout);
+
+		/**
+		 * Receive exactly size bytes.
+		 * timeout:		timeout of whole operation, ms
+		 **/
+		void ReceiveAll(uint8_t* data, size_t size, unsigned timeout);
+
+		/**
+		 * Wait until socket become readable.
+		 * Return:	true if data is available, false on timeout.
+		 **/
+		bool WaitReadable(unsigned timeout);
+
+		/**
+		 * Wait until any of sockets become readable or closed.
+		 * Return:	number of readable sockets, 0 on timeout.
+		 **/
+		static size_t Poll(std::vector<PollEntry>& entries, unsigned timeout);
+
+		void SetNonBlocking(bool nonBlocking);
+		void SetNoDelay(bool noDelay);
+
+		/**
+		 * Busy poll time of receive, us(SO_BUSY_POLL). Linux only,
+		 * ignored on other systems.
+		 **/
+		void SetBusyPoll(unsigned us);
+
+		void Close();
+		bool IsValid() const;
+		NativeHandle Handle() const;
+
+	private:
+		Socket(const Socket&);
+		Socket& operator=(const Socket&);
+
+		NativeHandle handle;
+	};
+}
+
+#endif	/* _SOCKET_H_ */
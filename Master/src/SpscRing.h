@@ -0,0 +1,147 @@
+/**
+ * Description: Lock-free single producer, single consumer ring buffer.
+ *				Push must be called from one thread and Pop from another
+ *				one thread.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace Modbus
+{
+	template <typename T>
+	class SpscRing
+	{
+	public:
+		static const size_t CacheLineSize = 64;
+
+		/**
+		 * capacity:	minimum number of elements. It is rounded up to
+		 *				power of two.
+		 * Exception:	invalid_argument if capacity is 0.
+		 **/
+		explicit SpscRing(size_t capacity) : head(0), tail(0)
+		{
+			if (capacity == 0)
+			{
+				throw std::invalid_argument("Ring capacity must be more than 0.");
+			}
+
+			size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+
+			buffer.resize(size);
+			mask = size - 1;
+		}
+
+		size_t Capacity() const
+		{
+			return mask + 1;
+		}
+
+		/**
+		 * Producer. Return:	false if ring is full.
+		 **/
+		bool Push(const T& value)
+		{
+			const size_t h = head.load(std::memory_order_relaxed);
+
+			if (h - tail.load(std::memory_order_acquire) > mask)
+				return false;
+
+			buffer[h & mask] = value;
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * Producer. Push up to count values.
+		 * Return:	number of pushed values.
+		 **/
+		size_t Push(const T* values, size_t count)
+		{
+			const size_t h = head.load(std::memory_order_relaxed);
+			const size_t free = Capacity() - (h - tail.load(std::memory_order_acquire));
+
+			if (count > free)
+				count = free;
+
+			for (size_t i = 0; i < count; i++)
+				buffer[(h + i) & mask] = values[i];
+
+			head.store(h + count, std::memory_order_release);
+			return count;
+		}
+
+		/**
+		 * Consumer. Return:	false if ring is empty.
+		 **/
+		bool Pop(T& value)
+		{
+			const size_t t = tail.load(std::memory_order_relaxed);
+
+			if (t == head.load(std::memory_order_acquire))
+				return false;
+
+			value = buffer[t & mask];
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * Consumer. Pop up to count values.
+		 * Return:	number of popped values.
+		 **/
+		size_t Pop(T* values, size_t count)
+		{
+			const size_t t = tail.load(std::memory_order_relaxed);
+			const size_t used = head.load(std::memory_order_acquire) - t;
+
+			if (count > used)
+				count = used;
+
+			for (size_t i = 0; i < count; i++)
+				values[i] = buffer[(t + i) & mask];
+
+			tail.store(t + count, std::memory_order_release);
+			return count;
+		}
+
+		/**
+		 * Number of values in ring. It is exact only when called from
+		 * producer or consumer while other side is idle.
+		 **/
+		size_t Size() const
+		{
+			return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+		}
+
+	private:
+		SpscRing(const SpscRing&);
+		SpscRing& operator=(const SpscRing&);
+
+		std::vector<T> buffer;
+		size_t mask;
+
+		/**
+		 * Producer and consumer indexes are on separate cache lines,
+		 * so sides do not invalidate each other caches on every access.
+		 * Lines are separated by padding: v120 has no alignas, and
+		 * padding does not depend on alignment of heap allocation.
+		 **/
+		char padding0[CacheLineSize];
+		std::atomic<size_t> head;
+		char padding1[CacheLineSize - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> tail;
+		char padding2[CacheLineSize - sizeof(std::atomic<size_t>)];
+	};
+}
+
+#endif	/* _SPSC_RING_H_ */
@@ -0,0 +1,578 @@
+/**
+* MODBUS/TCP master
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include "Tcp.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	/**
+	 * MODBUS protocol identifier in MBAP header
+	 **/
+	static const uint16_t ProtocolID = 0;
+
+	TcpMaster::TcpMaster(const string& host, uint16_t port, unsigned timeout)
+		: host(host), port(port), timeout(timeout), pipelineDepth(1), transactionID(0),
+		unitWindow(0), reading(false)
+	{
+		connect();
+	}
+
+	TcpMaster::~TcpMaster()
+	{
+	}
+
+	/**
+	* Set responce timeout, ms.
+	**/
+	void TcpMaster::SetTimeout(unsigned timeout)
+	{
+		this->timeout = timeout;
+	}
+
+	unsigned TcpMaster::GetTimeout() const
+	{
+		return timeout;
+	}
+
+	/**
+	* Close and open connection again.
+	**/
+	void TcpMaster::Reconnect()
+	{
+		socket.Close();
+		connect();
+	}
+
+	void TcpMaster::SetPipelineDepth(unsigned depth)
+	{
+		pipelineDepth = depth < 1 ? 1 : depth;
+	}
+
+	unsigned TcpMaster::GetPipelineDepth() const
+	{
+		return pipelineDepth;
+	}
+
+	void TcpMaster::SetUnitWindow(unsigned window)
+	{
+		unitWindow = window;
+	}
+
+	unsigned TcpMaster::GetUnitWindow() const
+	{
+		return unitWindow;
+	}
+
+	void TcpMaster::SetLowLatency(const LowLatency::Settings& settings)
+	{
+		lowLatency.SetSettings(settings);
+
+		if (socket.IsValid())
+		{
+			socket.SetBusyPoll(settings.busyPoll);
+		}
+	}
+
+	void TcpMaster::connect()
+	{
+		socket.Connect(host, port, timeout);
+
+		if (lowLatency.GetSettings().busyPoll != 0)
+		{
+			socket.SetBusyPoll(lowLatency.GetSettings().busyPoll);
+		}
+	}
+
+	/**
+	* Send PDU to remote device and wait responce.
+	**/
+	vector<uint8_t> TcpMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		if (unitWindow != 0)
+		{
+			return transactShared(id, request);
+		}
+
+		lowLatency.Enter();
+
+		if (!socket.IsValid())
+		{
+			Reconnect();
+		}
+
+		const uint16_t transaction = ++transactionID;
+		vector<uint8_t> adu = makeADU(transaction, id, request);
+
+		socket.SendAll(adu.data(), adu.size());
+
+		/**
+		 * Skip stale responces of timed out transactions.
+		 **/
+		for (;;)
+		{
+			uint16_t rxTransaction;
+			uint8_t rxID;
+			vector<uint8_t> responce = receiveADU(rxTransaction, rxID);
+
+			if (rxTransaction == transaction && rxID == id)
+				return responce;
+		}
+	}
+
+	/**
+	* Send broadcast PDU. MODBUS/TCP device shall not answer on
+	* unit ID 0, so responce is not waited.
+	**/
+	void TcpMaster::SendPDU(vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		unique_lock<std::mutex> lock(mutex, defer_lock);
+		if (unitWindow != 0)
+		{
+			lock.lock();
+		}
+		else
+		{
+			lowLatency.Enter();
+		}
+
+		if (!socket.IsValid())
+		{
+			Reconnect();
+		}
+
+		vector<uint8_t> adu = makeADU(++transactionID, 0, request);
+
+		try
+		{
+			socket.SendAll(adu.data(), adu.size());
+		}
+		catch (...)
+		{
+			/**
+			 * Same as failed request of unit window mode.
+			 **/
+			if (unitWindow != 0 && !reading)
+			{
+				socket.Close();
+				failAll(current_exception());
+			}
+
+			throw;
+		}
+	}
+
+	/**
+	* Pipeline requests. Window of pipeline depth requests is kept in
+	* flight, next request is sent as soon as any responce is received.
+	* Device may answer in any order.
+	**/
+	void TcpMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		if (unitWindow != 0)
+		{
+			transactManyShared(transactions);
+			return;
+		}
+
+		if (pipelineDepth <= 1)
+		{
+			Master::SendPDUs(transactions);
+			return;
+		}
+
+		lowLatency.Enter();
+
+		map<uint16_t, size_t> inflight;
+		size_t next = 0;
+
+		while (next < transactions.size() || !inflight.empty())
+		{
+			try
+			{
+				if (!socket.IsValid())
+				{
+					Reconnect();
+				}
+
+				while (next < transactions.size() && inflight.size() < pipelineDepth)
+				{
+					const Transaction& t = transactions[next];
+					const uint16_t transaction = ++transactionID;
+					vector<uint8_t> adu = makeADU(transaction, t.id, t.request);
+
+					socket.SendAll(adu.data(), adu.size());
+					inflight[transaction] = next++;
+				}
+
+				uint16_t rxTransaction;
+				uint8_t rxID;
+				vector<uint8_t> responce = receiveADU(rxTransaction, rxID);
+
+				map<uint16_t, size_t>::iterator i = inflight.find(rxTransaction);
+				if (i == inflight.end() || transactions[i->second].id != rxID)
+				{
+					/**
+					 * Stale responce of timed out transaction.
+					 **/
+					continue;
+				}
+
+				transactions[i->second].responce = move(responce);
+				transactions[i->second].error = nullptr;
+				inflight.erase(i);
+			}
+			catch (...)
+			{
+				/**
+				 * Timeout or connection failure fails all requests in flight.
+				 * If nothing is in flight, request could not be sent at all.
+				 **/
+				exception_ptr error = current_exception();
+
+				if (inflight.empty() && next < transactions.size())
+				{
+					transactions[next++].error = error;
+				}
+
+				for (map<uint16_t, size_t>::const_iterator i = inflight.cbegin(); i != inflight.cend(); i++)
+				{
+					transactions[i->second].error = error;
+				}
+
+				inflight.clear();
+			}
+		}
+	}
+
+	/**
+	* Build MBAP header + PDU frame.
+	**/
+	vector<uint8_t> TcpMaster::makeADU(uint16_t transaction, uint8_t id, const vector<uint8_t>& pdu) const
+	{
+		const uint16_t length = (uint16_t)(pdu.size() + 1);
+		vector<uint8_t> adu;
+
+		adu.reserve(MBAPHeaderSize + pdu.size());
+		adu.push_back((uint8_t)(transaction >> 8));
+		adu.push_back((uint8_t)transaction);
+		adu.push_back((uint8_t)(ProtocolID >> 8));
+		adu.push_back((uint8_t)ProtocolID);
+		adu.push_back((uint8_t)(length >> 8));
+		adu.push_back((uint8_t)length);
+		adu.push_back(id);
+		adu.insert(adu.end(), pdu.cbegin(), pdu.cend());
+
+		return adu;
+	}
+
+	/**
+	* Receive one ADU from socket.
+	**/
+	vector<uint8_t> TcpMaster::receiveADU(uint16_t& transaction, uint8_t& id)
+	{
+		if (!lowLatency.Spin([this]() { return socket.WaitReadable(0); }) && !socket.WaitReadable(timeout))
+		{
+			throw ETimeout();
+		}
+
+		/**
+		 * Frame started. Any failure from here leaves stream out of sync,
+		 * so connection is closed and will be opened on next request.
+		 **/
+		try
+		{
+			return readADU(transaction, id);
+		}
+		catch (...)
+		{
+			socket.Close();
+			throw;
+		}
+	}
+
+	vector<uint8_t> TcpMaster::readADU(uint16_t& transaction, uint8_t& id)
+	{
+		uint8_t header[MBAPHeaderSize];
+
+		socket.ReceiveAll(header, MBAPHeaderSize, timeout);
+
+		transaction = ((uint16_t)header[0] << 8) | header[1];
+		const uint16_t protocol = ((uint16_t)header[2] << 8) | header[3];
+		const uint16_t length = ((uint16_t)header[4] << 8) | header[5];
+		id = header[6];
+
+		if (protocol != ProtocolID || length < 2 || length > PDU_MAX_SIZE + 1)
+		{
+			throw EPDUFrameError(vector<uint8_t>(), vector<uint8_t>(header, header + MBAPHeaderSize));
+		}
+
+		vector<uint8_t> pdu(length - 1);
+		socket.ReceiveAll(pdu.data(), pdu.size(), timeout);
+
+		return pdu;
+	}
+
+	/**
+	* Unit window mode. All state is under mutex. Socket is written under
+	* mutex and read by one thread at a time(reading), which delivers
+	* responces to pendings of all threads. Connection is closed only under
+	* mutex when nobody reads, so it is reopened only when nothing is in
+	* flight.
+	**/
+	vector<uint8_t> TcpMaster::transactShared(uint8_t id, const vector<uint8_t>& request)
+	{
+		unique_lock<std::mutex> lock(mutex);
+		Unit& unit = units[id];
+		const uint64_t ticket = unit.tickets++;
+
+		condition.wait(lock, [&]() { return unit.serving == ticket && unit.inflight < unitWindow; });
+		unit.serving++;
+		condition.notify_all();
+
+		Pending pending;
+		send(id, request, pending);
+
+		const vector<Pending*> mine(1, &pending);
+		while (!pending.done)
+			await(lock, mine);
+
+		if (pending.error)
+			rethrow_exception(pending.error);
+
+		return move(pending.responce);
+	}
+
+	/**
+	* Requests are sent in order of transactions as soon as their unit
+	* window and pipeline depth allow it.
+	**/
+	void TcpMaster::transactManyShared(vector<Transaction>& transactions)
+	{
+		const size_t count = transactions.size();
+		vector<uint64_t> tickets(count);
+		vector<Pending> states(count);
+		vector<uint8_t> sent(count, 0);
+		size_t first = 0, done = 0;
+
+		unique_lock<std::mutex> lock(mutex);
+
+		for (size_t i = 0; i < count; i++)
+			tickets[i] = units[transactions[i].id].tickets++;
+
+		while (done < count)
+		{
+			vector<Pending*> mine;
+
+			for (size_t i = first; i < count; i++)
+			{
+				if (sent[i] == 1)
+				{
+					if (!states[i].done)
+					{
+						mine.push_back(&states[i]);
+						continue;
+					}
+
+					transactions[i].responce = move(states[i].responce);
+					transactions[i].error = states[i].error;
+					sent[i] = 2;
+					done++;
+				}
+			}
+
+			for (size_t i = first; i < count && mine.size() < max(pipelineDepth, 1u); i++)
+			{
+				Unit& unit = units[transactions[i].id];
+				if (sent[i] != 0 || unit.serving != tickets[i] || unit.inflight >= unitWindow)
+					continue;
+
+				unit.serving++;
+				condition.notify_all();
+				sent[i] = 1;
+
+				try
+				{
+					send(transactions[i].id, transactions[i].request, states[i]);
+					mine.push_back(&states[i]);
+				}
+				catch (...)
+				{
+					transactions[i].error = current_exception();
+					sent[i] = 2;
+					done++;
+				}
+			}
+
+			while (first < count && sent[first] == 2)
+				first++;
+
+			if (done == count)
+				break;
+
+			if (mine.empty())
+			{
+				/**
+				 * Next requests wait for transactions of other threads.
+				 **/
+				condition.wait(lock);
+			}
+			else
+			{
+				await(lock, mine);
+			}
+		}
+	}
+
+	void TcpMaster::send(uint8_t id, const vector<uint8_t>& request, Pending& pending)
+	{
+		if (!socket.IsValid())
+		{
+			Reconnect();
+		}
+
+		do
+		{
+			transactionID++;
+		} while (pendings.count(transactionID) != 0);
+
+		const vector<uint8_t> adu = makeADU(transactionID, id, request);
+
+		try
+		{
+			socket.SendAll(adu.data(), adu.size());
+		}
+		catch (...)
+		{
+			/**
+			 * Reader will see broken connection itself.
+			 **/
+			if (!reading)
+			{
+				socket.Close();
+				failAll(current_exception());
+			}
+
+			throw;
+		}
+
+		pending.id = id;
+		pending.transaction = transactionID;
+		pending.done = false;
+		pending.deadline = Clock::now() + milliseconds(timeout);
+		pendings[transactionID] = &pending;
+		units[id].inflight++;
+	}
+
+	void TcpMaster::await(unique_lock<std::mutex>& lock, const vector<Pending*>& mine)
+	{
+		Clock::time_point deadline = Clock::time_point::max();
+		for (vector<Pending*>::const_iterator i = mine.cbegin(); i != mine.cend(); i++)
+		{
+			if (!(*i)->done)
+				deadline = min(deadline, (*i)->deadline);
+		}
+
+		if (reading)
+		{
+			condition.wait_until(lock, deadline);
+		}
+		else
+		{
+			reading = true;
+			lock.unlock();
+
+			exception_ptr error;
+			bool received = false;
+			uint16_t transaction = 0;
+			uint8_t id = 0;
+			vector<uint8_t> responce;
+
+			try
+			{
+				const Clock::duration left = deadline - Clock::now();
+				const unsigned wait = left > Clock::duration::zero() ?
+					(unsigned)duration_cast<milliseconds>(left).count() + 1 : 0;
+
+				if (socket.WaitReadable(wait))
+				{
+					responce = readADU(transaction, id);
+					received = true;
+				}
+			}
+			catch (...)
+			{
+				error = current_exception();
+			}
+
+			lock.lock();
+			reading = false;
+
+			if (error)
+			{
+				socket.Close();
+				failAll(error);
+			}
+			else if (received)
+			{
+				/**
+				 * Responce of expired transaction is dropped.
+				 **/
+				map<uint16_t, Pending*>::iterator i = pendings.find(transaction);
+				if (i != pendings.end() && i->second->id == id)
+				{
+					i->second->responce = move(responce);
+					finish(*i->second);
+				}
+			}
+
+			condition.notify_all();
+		}
+
+		const Clock::time_point now = Clock::now();
+		for (vector<Pending*>::const_iterator i = mine.cbegin(); i != mine.cend(); i++)
+		{
+			if (!(*i)->done && (*i)->deadline <= now)
+			{
+				(*i)->error = make_exception_ptr(ETimeout());
+				finish(**i);
+			}
+		}
+	}
+
+	void TcpMaster::finish(Pending& pending)
+	{
+		pending.done = true;
+		pendings.erase(pending.transaction);
+		units[pending.id].inflight--;
+		condition.notify_all();
+	}
+
+	void TcpMaster::failAll(const exception_ptr& error)
+	{
+		while (!pendings.empty())
+		{
+			Pending& pending = *pendings.begin()->second;
+			pending.error = error;
+			finish(pending);
+		}
+	}
+}
@@ -0,0 +1,186 @@
+/**
+ * Description: MODBUS/TCP master. Implement MBAP framing of PDU over
+ *				TCP connection. With unit window transactions of several
+ *				threads to different units behind one gateway share the
+ *				connection concurrently.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _TCP_H_
+#define _TCP_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+#include "LowLatency.h"
+#include "Master.h"
+#include "Socket.h"
+
+namespace Modbus
+{
+	class TcpMaster : public Master
+	{
+	public:
+		/**
+		 * Constants
+		 **/
+		static const uint16_t DefaultPort = 502;
+		static const int MBAPHeaderSize = 7;
+		static const unsigned DefaultTimeout = 1000;
+
+		/**
+		 * host:		slave host name or IP address
+		 * port:		TCP port
+		 * timeout:		connect and responce timeout, ms
+		 * Exceptions:	ETimeout or runtime_error if connection fails.
+		 **/
+		TcpMaster(const std::string& host, uint16_t port = DefaultPort, unsigned timeout = DefaultTimeout);
+		virtual ~TcpMaster();
+
+		/**
+		 * Set responce timeout, ms.
+		 **/
+		void SetTimeout(unsigned timeout);
+		unsigned GetTimeout() const;
+
+		/**
+		 * Close and open connection again.
+		 **/
+		void Reconnect();
+
+		/**
+		 * Set maximum number of requests sent without waiting responce
+		 * by TransactMany. Default is 1, because many devices process only
+		 * one transaction at a time.
+		 **/
+		void SetPipelineDepth(unsigned depth);
+		unsigned GetPipelineDepth() const;
+
+		/**
+		 * Set maximum number of transactions in flight to one unit ID.
+		 * 0(default) is one transaction at a time for whole connection,
+		 * and master must be used by one thread. Otherwise functions are
+		 * thread safe: transactions of different threads are sent without
+		 * waiting for each other, at most window per unit, and requests to
+		 * each unit are sent in order of calls. Each transaction has its
+		 * own timeout. TransactMany keeps up to pipeline depth requests in
+		 * flight under the same per-unit window. Thread options of
+		 * low-latency mode(core, priority) are not applied to callers in
+		 * this mode, as they are many threads.
+		 * Window must not be changed while transactions are in progress.
+		 **/
+		void SetUnitWindow(unsigned window);
+		unsigned GetUnitWindow() const;
+
+		/**
+		 * Low-latency mode. Thread options are applied to thread which
+		 * makes transactions, socket options are kept on reconnect.
+		 **/
+		void SetLowLatency(const LowLatency::Settings& settings);
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+		/**
+		 * Pipeline requests: up to pipeline depth requests are sent ahead,
+		 * responces are matched by transaction identifier.
+		 **/
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+		/**
+		 * Build MBAP header + PDU frame.
+		 **/
+		std::vector<uint8_t> makeADU(uint16_t transaction, uint8_t id, const std::vector<uint8_t>& pdu) const;
+
+		/**
+		 * Connect socket and set its options.
+		 **/
+		void connect();
+
+		/**
+		 * Receive one ADU from socket.
+		 * Return:	PDU, transaction and unit id.
+		 **/
+		std::vector<uint8_t> receiveADU(uint16_t& transaction, uint8_t& id);
+
+		/**
+		 * Read ADU which is already arriving. Connection is not closed on
+		 * failure.
+		 **/
+		std::vector<uint8_t> readADU(uint16_t& transaction, uint8_t& id);
+
+		std::string host;
+		uint16_t port;
+		unsigned timeout;
+		unsigned pipelineDepth;
+		uint16_t transactionID;
+		Socket socket;
+		LowLatency lowLatency;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * Transaction in flight in unit window mode.
+		 **/
+		struct Pending
+		{
+			uint8_t id;
+			uint16_t transaction;
+			bool done;
+			Clock::time_point deadline;
+			std::vector<uint8_t> responce;
+			std::exception_ptr error;
+		};
+
+		/**
+		 * Window of unit: transactions in flight and tickets which keep
+		 * order of requests.
+		 **/
+		struct Unit
+		{
+			unsigned inflight;
+			uint64_t tickets;
+			uint64_t serving;
+
+			Unit() : inflight(0), tickets(0), serving(0)
+			{
+			}
+		};
+
+		TcpMaster(const TcpMaster&);
+		TcpMaster& operator=(const TcpMaster&);
+
+		std::vector<uint8_t> transactShared(uint8_t id, const std::vector<uint8_t>& request);
+		void transactManyShared(std::vector<Transaction>& transactions);
+
+		/**
+		 * Send request and register it as pending.
+		 **/
+		void send(uint8_t id, const std::vector<uint8_t>& request, Pending& pending);
+
+		/**
+		 * Wait until any of pendings is done or expired. Calling thread
+		 * reads connection and delivers responces of all threads if no
+		 * other thread does it.
+		 **/
+		void await(std::unique_lock<std::mutex>& lock, const std::vector<Pending*>& mine);
+
+		void finish(Pending& pending);
+		void failAll(const std::exception_ptr& error);
+
+		unsigned unitWindow;
+
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool reading;
+		std::map<uint16_t, Pending*> pendings;
+		std::map<uint8_t, Unit> units;
+	};
+}
+
+#endif	/* _TCP_H_ */
@@ -0,0 +1,346 @@
+/**
+* Rate limit and AIMD window of transactions to each unit
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "ThrottledMaster.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace Modbus
+{
+	static void check_settings(const ThrottledMaster::Settings& settings)
+	{
+		if (settings.rate < 0 || settings.burst == 0 || settings.minWindow == 0 ||
+			settings.minWindow > settings.maxWindow ||
+			settings.initialWindow < settings.minWindow || settings.initialWindow > settings.maxWindow)
+		{
+			throw invalid_argument("Invalid throttling settings.");
+		}
+	}
+
+	/**
+	* Result which means that unit is overloaded: Server Device Busy or
+	* Acknowledge exception, or no responce.
+	**/
+	static bool is_overload(const vector<uint8_t>& responce, const exception_ptr& error, bool& timeout)
+	{
+		timeout = false;
+
+		if (error)
+		{
+			try
+			{
+				rethrow_exception(error);
+			}
+			catch (const ETimeout&)
+			{
+				timeout = true;
+				return true;
+			}
+			catch (const EException& e)
+			{
+				return e.GetExceptionCode() == EException::SERVER_DEVICE_BUSY ||
+					e.GetExceptionCode() == EException::ACKNOWLEDGE;
+			}
+			catch (...)
+			{
+				return false;
+			}
+		}
+
+		return responce.size() == 2 && (responce[0] & 0x80) != 0 &&
+			(responce[1] == EException::SERVER_DEVICE_BUSY || responce[1] == EException::ACKNOWLEDGE);
+	}
+
+	ThrottledMaster::ThrottledMaster(Master& master, const Settings& settings)
+		: master(master), settings(settings)
+	{
+		check_settings(settings);
+	}
+
+	ThrottledMaster::~ThrottledMaster()
+	{
+	}
+
+	void ThrottledMaster::SetUnitSettings(uint8_t id, const Settings& settings)
+	{
+		check_settings(settings);
+
+		lock_guard<std::mutex> lock(mutex);
+		Unit& u = unit(id);
+
+		u.settings = settings;
+		u.tokens = settings.burst;
+		u.window = settings.initialWindow;
+		u.recovery = u.sequence;
+
+		released.notify_all();
+	}
+
+	ThrottledMaster::UnitStatistic ThrottledMaster::GetUnitStatistic(uint8_t id)
+	{
+		lock_guard<std::mutex> lock(mutex);
+		Unit& u = unit(id);
+
+		UnitStatistic statistic = u.statistic;
+		statistic.window = u.window;
+		statistic.inflight = u.inflight;
+		return statistic;
+	}
+
+	vector<uint8_t> ThrottledMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		unique_lock<std::mutex> lock(mutex);
+		Unit& u = unit(id);
+		uint64_t sequence;
+
+		if (!admit(u, Clock::now(), sequence))
+		{
+			u.statistic.delayed++;
+
+			do
+			{
+				if (u.inflight < (unsigned)u.window)
+					released.wait_until(lock, nextToken(u));
+				else
+					released.wait(lock);
+			} while (!admit(u, Clock::now(), sequence));
+		}
+
+		lock.unlock();
+
+		vector<uint8_t> responce;
+		exception_ptr error;
+
+		try
+		{
+			responce = master.Transact(id, request);
+		}
+		catch (...)
+		{
+			error = current_exception();
+		}
+
+		lock.lock();
+		complete(u, sequence, responce, error);
+		lock.unlock();
+
+		released.notify_all();
+
+		if (error)
+			rethrow_exception(error);
+
+		return responce;
+	}
+
+	void ThrottledMaster::SendPDU(vector<uint8_t> request)
+	{
+		master.Broadcast(request);
+	}
+
+	void ThrottledMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		vector<size_t> pending(transactions.size());
+		vector<bool> delayed(transactions.size(), false);
+
+		for (size_t i = 0; i < transactions.size(); i++)
+			pending[i] = i;
+
+		unique_lock<std::mutex> lock(mutex);
+
+		while (!pending.empty())
+		{
+			vector<size_t> admitted;
+			vector<uint64_t> sequences;
+			vector<size_t> waiting;
+			bool blocked[256] = { false };
+
+			/**
+			 * Take transactions in order. After first transaction of unit
+			 * which is not admitted, other transactions of the unit wait
+			 * too, so they are not sent before it.
+			 **/
+			const Clock::time_point now = Clock::now();
+			Clock::time_point wake = Clock::time_point::max();
+
+			for (vector<size_t>::const_iterator i = pending.cbegin(); i != pending.cend(); i++)
+			{
+				const uint8_t id = transactions[*i].id;
+				Unit& u = unit(id);
+				uint64_t sequence;
+
+				if (!blocked[id] && admit(u, now, sequence))
+				{
+					admitted.push_back(*i);
+					sequences.push_back(sequence);
+					continue;
+				}
+
+				if (!blocked[id])
+				{
+					blocked[id] = true;
+
+					if (u.inflight < (unsigned)u.window)
+						wake = min(wake, nextToken(u));
+				}
+
+				if (!delayed[*i])
+				{
+					delayed[*i] = true;
+					u.statistic.delayed++;
+				}
+
+				waiting.push_back(*i);
+			}
+
+			if (admitted.empty())
+			{
+				if (wake == Clock::time_point::max())
+					released.wait(lock);
+				else
+					released.wait_until(lock, wake);
+
+				continue;
+			}
+
+			lock.unlock();
+
+			vector<Transaction> round(admitted.size());
+			for (size_t i = 0; i < admitted.size(); i++)
+			{
+				round[i].id = transactions[admitted[i]].id;
+				round[i].request.swap(transactions[admitted[i]].request);
+			}
+
+			try
+			{
+				master.TransactMany(round);
+			}
+			catch (...)
+			{
+				exception_ptr error = current_exception();
+				for (size_t i = 0; i < round.size(); i++)
+				{
+					if (round[i].responce.empty() && !round[i].error)
+						round[i].error = error;
+				}
+			}
+
+			lock.lock();
+
+			for (size_t i = 0; i < admitted.size(); i++)
+			{
+				Transaction& transaction = transactions[admitted[i]];
+
+				transaction.request.swap(round[i].request);
+				transaction.responce.swap(round[i].responce);
+				transaction.error = round[i].error;
+
+				complete(unit(transaction.id), sequences[i], transaction.responce, transaction.error);
+			}
+
+			released.notify_all();
+			pending.swap(waiting);
+		}
+	}
+
+	ThrottledMaster::Unit& ThrottledMaster::unit(uint8_t id)
+	{
+		map<uint8_t, Unit>::iterator i = units.find(id);
+		if (i != units.end())
+			return i->second;
+
+		Unit& u = units[id];
+		u.settings = settings;
+		u.tokens = settings.burst;
+		u.refilled = Clock::now();
+		u.window = settings.initialWindow;
+		u.inflight = 0;
+		u.sequence = 0;
+		u.recovery = 0;
+
+		u.statistic.window = u.window;
+		u.statistic.inflight = 0;
+		u.statistic.transactions = 0;
+		u.statistic.busy = 0;
+		u.statistic.timeouts = 0;
+		u.statistic.delayed = 0;
+
+		return u;
+	}
+
+	/**
+	* Refill bucket, then take token and window slot.
+	**/
+	bool ThrottledMaster::admit(Unit& unit, Clock::time_point now, uint64_t& sequence)
+	{
+		if (unit.settings.rate > 0 && now > unit.refilled)
+		{
+			const double elapsed = duration<double>(now - unit.refilled).count();
+			unit.tokens = min<double>(unit.settings.burst, unit.tokens + elapsed * unit.settings.rate);
+			unit.refilled = now;
+		}
+
+		if (unit.inflight >= (unsigned)unit.window)
+			return false;
+
+		if (unit.settings.rate > 0)
+		{
+			if (unit.tokens < 1)
+				return false;
+
+			unit.tokens -= 1;
+		}
+
+		unit.inflight++;
+		unit.statistic.transactions++;
+		sequence = unit.sequence++;
+		return true;
+	}
+
+	ThrottledMaster::Clock::time_point ThrottledMaster::nextToken(const Unit& unit) const
+	{
+		if (unit.settings.rate <= 0 || unit.tokens >= 1)
+			return unit.refilled;
+
+		const duration<double> wait((1 - unit.tokens) / unit.settings.rate);
+		return unit.refilled + duration_cast<Clock::duration>(wait) + Clock::duration(1);
+	}
+
+	/**
+	* Overload halves window once for each window of transactions, clean
+	* responce grows it by one transaction for each window of clean
+	* responces. Window grows only while it is full, so window of unit
+	* with few callers doesn't grow far above load it was tested with.
+	**/
+	void ThrottledMaster::complete(Unit& unit, uint64_t sequence, const vector<uint8_t>& responce, const exception_ptr& error)
+	{
+		const bool full = unit.inflight >= (unsigned)unit.window;
+		unit.inflight--;
+
+		bool timeout;
+		if (is_overload(responce, error, timeout))
+		{
+			if (timeout)
+				unit.statistic.timeouts++;
+			else
+				unit.statistic.busy++;
+
+			if (sequence >= unit.recovery)
+			{
+				unit.window = max<double>(unit.settings.minWindow, floor(unit.window / 2));
+				unit.recovery = unit.sequence;
+			}
+		}
+		else if (full && !error && !responce.empty() && (responce[0] & 0x80) == 0)
+		{
+			unit.window = min<double>(unit.settings.maxWindow, unit.window + 1 / unit.window);
+		}
+	}
+}
@@ -0,0 +1,164 @@
+/**
+ * Description: Master which limits load of each unit behind another
+ *				master(usually gateway). Each unit has token bucket rate
+ *				limit and window of transactions in flight. Window is
+ *				adapted AIMD-style: clean responce grows it by 1/window,
+ *				Server Device Busy, Acknowledge or timeout halves it.
+ *				So fragile devices are not overloaded, and devices which
+ *				handle pipelining get deep pipeline.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _THROTTLED_MASTER_H_
+#define _THROTTLED_MASTER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "Master.h"
+
+namespace Modbus
+{
+	class ThrottledMaster : public Master
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Token rate, transactions per second. 0 means no rate limit.
+			 **/
+			double rate;
+
+			/**
+			 * Bucket size: transactions sent at once after idle time.
+			 **/
+			unsigned burst;
+
+			/**
+			 * Window of transactions in flight: initial and limits.
+			 **/
+			unsigned initialWindow;
+			unsigned minWindow;
+			unsigned maxWindow;
+
+			Settings() : rate(0), burst(1), initialWindow(1), minWindow(1), maxWindow(16)
+			{
+			}
+		};
+
+		struct UnitStatistic
+		{
+			double window;
+			unsigned inflight;
+			uint64_t transactions;
+
+			/**
+			 * Responces which shrank window: busy and acknowledge
+			 * exceptions, timeouts.
+			 **/
+			uint64_t busy;
+			uint64_t timeouts;
+
+			/**
+			 * Transactions delayed by rate limit or window
+			 **/
+			uint64_t delayed;
+		};
+
+		/**
+		 * master:		master used for all transactions. Single transactions
+		 *				of several threads are sent to it concurrently(up
+		 *				to window of unit), so it must be thread safe if
+		 *				ThrottledMaster is used by several threads.
+		 * settings:	settings of units without own settings
+		 * Throws invalid_argument if settings are invalid.
+		 **/
+		explicit ThrottledMaster(Master& master, const Settings& settings = Settings());
+		virtual ~ThrottledMaster();
+
+		/**
+		 * Settings of one unit. Window of unit is reset to initial.
+		 * Throws invalid_argument if settings are invalid.
+		 **/
+		void SetUnitSettings(uint8_t id, const Settings& settings);
+
+		/**
+		 * Statistic of unit. Unit which has not been used has initial
+		 * window and zero counters.
+		 **/
+		UnitStatistic GetUnitStatistic(uint8_t id);
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+
+		/**
+		 * Broadcast is not limited.
+		 **/
+		virtual void SendPDU(std::vector<uint8_t> request);
+
+		/**
+		 * Transactions are sent by rounds through TransactMany of
+		 * master. Round has transactions admitted by window and tokens of
+		 * their units; order of transactions of each unit is kept.
+		 **/
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		ThrottledMaster(const ThrottledMaster&);
+		ThrottledMaster& operator=(const ThrottledMaster&);
+
+		struct Unit
+		{
+			Settings settings;
+			double tokens;
+			Clock::time_point refilled;
+			double window;
+			unsigned inflight;
+
+			/**
+			 * Sequence number of next transaction and first transaction
+			 * sent after last window decrease. Only transactions sent
+			 * after decrease can decrease window again, so burst of busy
+			 * responces to one window halves it once.
+			 **/
+			uint64_t sequence;
+			uint64_t recovery;
+
+			UnitStatistic statistic;
+		};
+
+		Unit& unit(uint8_t id);
+
+		/**
+		 * Take token and window slot of unit if both are available and
+		 * set sequence number of transaction.
+		 * Return:	false if transaction must wait.
+		 **/
+		bool admit(Unit& unit, Clock::time_point now, uint64_t& sequence);
+
+		/**
+		 * Time when unit gets next token.
+		 **/
+		Clock::time_point nextToken(const Unit& unit) const;
+
+		/**
+		 * Release window slot and adapt window by result.
+		 **/
+		void complete(Unit& unit, uint64_t sequence, const std::vector<uint8_t>& responce, const std::exception_ptr& error);
+
+		Master& master;
+		Settings settings;
+
+		std::mutex mutex;
+		std::condition_variable released;
+		std::map<uint8_t, Unit> units;
+	};
+}
+
+#endif	/* _THROTTLED_MASTER_H_ */
@@ -0,0 +1,908 @@
+/**
+* MODBUS/TCP transport on io_uring
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "UringTcp.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	/**
+	 * MODBUS protocol identifier in MBAP header
+	 **/
+	static const uint16_t ProtocolID = 0;
+
+	/**
+	 * Maximum ADU size: MBAP header and PDU
+	 **/
+	static const size_t ADUMaxSize = TcpMaster::MBAPHeaderSize + Master::PDU_MAX_SIZE;
+
+	/**
+	 * Provided buffer group of receive buffers
+	 **/
+	static const uint16_t BufferGroup = 0;
+
+	static int io_uring_setup(unsigned entries, io_uring_params* params)
+	{
+		return (int)syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	static int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t size)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, size);
+	}
+
+	static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned args)
+	{
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, args);
+	}
+
+	UringTcp::UringTcp(const Settings& settings)
+		: settings(settings), ring(-1), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED), cqRingSize(0),
+		sqes((io_uring_sqe*)MAP_FAILED), sqesSize(0),
+		bufferRing((io_uring_buf_ring*)MAP_FAILED), bufferRingSize(0), bufferTail(0)
+	{
+		memset(&statistic, 0, sizeof(statistic));
+
+		if (this->settings.maxPipelineDepth < 1)
+			this->settings.maxPipelineDepth = 1;
+
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+		params.cq_entries = settings.entries * 4;
+
+		ring = io_uring_setup(settings.entries, &params);
+		if (ring < 0 && errno == EINVAL)
+		{
+			/**
+			 * Kernel before 5.19 does not know last flags.
+			 **/
+			params.flags = IORING_SETUP_CQSIZE;
+			ring = io_uring_setup(settings.entries, &params);
+		}
+
+		if (ring < 0)
+		{
+			throw runtime_error("io_uring setup failed");
+		}
+
+		try
+		{
+			const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+			if ((params.features & required) != required)
+			{
+				throw runtime_error("io_uring features are not supported by kernel");
+			}
+
+			/**
+			 * Map rings. Submission and completion rings share one mapping.
+			 **/
+			sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+			sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+			if (sqRing == MAP_FAILED)
+			{
+				throw runtime_error("io_uring mapping failed");
+			}
+			cqRing = sqRing;
+
+			sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+			if (sqes == MAP_FAILED)
+			{
+				throw runtime_error("io_uring mapping failed");
+			}
+
+			uint8_t* sq = (uint8_t*)sqRing;
+			sqHead = (unsigned*)(sq + params.sq_off.head);
+			sqTail = (unsigned*)(sq + params.sq_off.tail);
+			sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+			sqEntries = params.sq_entries;
+			sqArray = (unsigned*)(sq + params.sq_off.array);
+
+			/**
+			 * Submission queue entry i is always at index i.
+			 **/
+			for (unsigned i = 0; i < params.sq_entries; i++)
+				sqArray[i] = i;
+
+			uint8_t* cq = (uint8_t*)cqRing;
+			cqHead = (unsigned*)(cq + params.cq_off.head);
+			cqTail = (unsigned*)(cq + params.cq_off.tail);
+			cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+			cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+			/**
+			 * Send buffers of all connections
+			 **/
+			txArea.resize((size_t)settings.connections * this->settings.maxPipelineDepth * ADUMaxSize);
+
+			/**
+			 * Receive buffer ring
+			 **/
+			unsigned buffers = 1;
+			while (buffers < settings.buffers && buffers < 0x8000)
+				buffers <<= 1;
+
+			bufferMask = buffers - 1;
+			bufferRingSize = buffers * sizeof(io_uring_buf);
+			bufferRing = (io_uring_buf_ring*)mmap(nullptr, bufferRingSize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (bufferRing == MAP_FAILED)
+			{
+				throw runtime_error("io_uring mapping failed");
+			}
+
+			/**
+			 * Touch pages before registration, else kernel pins zero page.
+			 **/
+			memset(bufferRing, 0, bufferRingSize);
+
+			io_uring_buf_reg reg;
+			memset(&reg, 0, sizeof(reg));
+			reg.ring_addr = (uint64_t)(uintptr_t)bufferRing;
+			reg.ring_entries = buffers;
+			reg.bgid = BufferGroup;
+
+			if (io_uring_register(ring, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+			{
+				throw runtime_error("io_uring provided buffers are not supported by kernel");
+			}
+
+			rxArea.resize((size_t)buffers * settings.bufferSize);
+			for (unsigned i = 0; i < buffers; i++)
+				recycle((uint16_t)i);
+		}
+		catch (...)
+		{
+			release();
+			throw;
+		}
+
+		links.reserve(settings.connections);
+	}
+
+	UringTcp::~UringTcp()
+	{
+		/**
+		 * Complete receives of all sockets before buffers are freed.
+		 **/
+		for (vector<Link>::iterator i = links.begin(); i != links.end(); i++)
+		{
+			if (i->socket.IsValid())
+				shutdown(i->socket.Handle(), SHUT_RDWR);
+		}
+
+		release();
+	}
+
+	void UringTcp::release()
+	{
+		if (ring >= 0)
+			::close(ring);
+		if (bufferRing != MAP_FAILED)
+			munmap(bufferRing, bufferRingSize);
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqesSize);
+		if (sqRing != MAP_FAILED)
+			munmap(sqRing, sqRingSize);
+
+		ring = -1;
+		bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+		sqes = (io_uring_sqe*)MAP_FAILED;
+		sqRing = cqRing = MAP_FAILED;
+	}
+
+	/**
+	* Open connection.
+	**/
+	UringTcp::Connection UringTcp::Connect(const string& host, uint16_t port, unsigned timeout)
+	{
+		if (links.size() >= settings.connections)
+		{
+			throw runtime_error("Too many connections");
+		}
+
+		const Connection connection = (Connection)links.size();
+
+		Link link;
+		link.host = host;
+		link.port = port;
+		link.timeout = timeout;
+		link.depth = 1;
+		link.generation = 0;
+		link.transactionID = 0;
+		link.receiving = false;
+		link.writing = false;
+		link.tx = txArea.data() + (size_t)connection * settings.maxPipelineDepth * ADUMaxSize;
+		link.txSize = 0;
+		link.txSent = 0;
+
+		open(link);
+
+		links.push_back(move(link));
+		return connection;
+	}
+
+	/**
+	* Close connection and open it again.
+	**/
+	void UringTcp::Reconnect(Connection connection)
+	{
+		Link& link = links.at(connection);
+
+		close(link);
+		open(link);
+	}
+
+	void UringTcp::SetTimeout(Connection connection, unsigned timeout)
+	{
+		links.at(connection).timeout = timeout;
+	}
+
+	void UringTcp::SetPipelineDepth(Connection connection, unsigned depth)
+	{
+		links.at(connection).depth = max(1u, min(depth, settings.maxPipelineDepth));
+	}
+
+	UringTcp::Statistic UringTcp::GetStatistic() const
+	{
+		return statistic;
+	}
+
+	/**
+	* Execute transactions of any connections.
+	**/
+	void UringTcp::Execute(vector<Job>& jobs)
+	{
+		vector<Work> works(jobs.size());
+
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			Master::Transaction& t = jobs[i].transaction;
+
+			works[i].connection = jobs[i].connection;
+			works[i].id = t.id;
+			works[i].request = &t.request;
+			works[i].responce = &t.responce;
+			works[i].error = &t.error;
+		}
+
+		run(works);
+	}
+
+	void UringTcp::Execute(Connection connection, vector<Master::Transaction>& transactions)
+	{
+		vector<Work> works(transactions.size());
+
+		for (size_t i = 0; i < transactions.size(); i++)
+		{
+			Master::Transaction& t = transactions[i];
+
+			works[i].connection = connection;
+			works[i].id = t.id;
+			works[i].request = &t.request;
+			works[i].responce = &t.responce;
+			works[i].error = &t.error;
+		}
+
+		run(works);
+	}
+
+	/**
+	* Send broadcast PDU and wait until it is written.
+	**/
+	void UringTcp::Broadcast(Connection connection, const vector<uint8_t>& request)
+	{
+		exception_ptr error;
+		vector<Work> works(1);
+
+		works[0].connection = connection;
+		works[0].id = 0;
+		works[0].request = &request;
+		works[0].responce = nullptr;
+		works[0].error = &error;
+
+		run(works);
+
+		if (error)
+			rethrow_exception(error);
+	}
+
+	/**
+	* Queue works to their links and process completions until all works
+	* are done. Each io_uring_enter submits requests of all links and
+	* waits for first completion or nearest responce deadline.
+	**/
+	void UringTcp::run(vector<Work>& works)
+	{
+		vector<Connection> active;
+
+		for (size_t i = 0; i < works.size(); i++)
+		{
+			const Work& work = works[i];
+
+			if (work.connection >= links.size())
+			{
+				throw out_of_range("Invalid connection");
+			}
+
+			if (work.request->empty() || work.request->size() > Master::PDU_MAX_SIZE)
+			{
+				throw invalid_argument("Invalid request PDU size.");
+			}
+		}
+
+		for (size_t i = 0; i < works.size(); i++)
+		{
+			Link& link = links[works[i].connection];
+
+			if (link.queue.empty())
+				active.push_back(works[i].connection);
+
+			*works[i].error = nullptr;
+			link.queue.push_back(i);
+		}
+
+		size_t remaining = works.size();
+
+		try
+		{
+			loop(works, active, remaining);
+		}
+		catch (...)
+		{
+			/**
+			 * Ring failure: drop state of works, they are not valid after return.
+			 **/
+			for (vector<Connection>::const_iterator i = active.cbegin(); i != active.cend(); i++)
+			{
+				links[*i].queue.clear();
+				links[*i].inflight.clear();
+			}
+
+			throw;
+		}
+
+		statistic.transactions += works.size();
+	}
+
+	/**
+	* Process works until all are done.
+	**/
+	void UringTcp::loop(vector<Work>& works, const vector<Connection>& active, size_t remaining)
+	{
+		while (remaining != 0)
+		{
+			Clock::time_point deadline = Clock::time_point::max();
+
+			for (vector<Connection>::const_iterator i = active.cbegin(); i != active.cend(); i++)
+			{
+				remaining -= fill(*i, works);
+
+				const vector<Pending>& inflight = links[*i].inflight;
+				for (vector<Pending>::const_iterator p = inflight.cbegin(); p != inflight.cend(); p++)
+					deadline = min(deadline, p->deadline);
+			}
+
+			if (remaining == 0)
+				break;
+
+			enter(1, deadline == Clock::time_point::max() ? nullptr : &deadline);
+
+			/**
+			 * Process all completions
+			 **/
+			unsigned head = *cqHead;
+			const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+			for (; head != tail; head++)
+			{
+				remaining -= complete(cqes[head & cqMask], works);
+				statistic.completions++;
+			}
+
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+			const Clock::time_point now = Clock::now();
+			for (vector<Connection>::const_iterator i = active.cbegin(); i != active.cend(); i++)
+				remaining -= expire(*i, works, now);
+		}
+	}
+
+	/**
+	* Write queued requests of link to send buffer up to pipeline depth.
+	**/
+	size_t UringTcp::fill(Connection connection, vector<Work>& works)
+	{
+		Link& link = links[connection];
+
+		if (link.queue.empty() && link.inflight.empty())
+			return 0;
+
+		if (!link.socket.IsValid())
+		{
+			try
+			{
+				open(link);
+			}
+			catch (...)
+			{
+				/**
+				 * Connection can not be opened: fail all queued requests.
+				 **/
+				exception_ptr error = current_exception();
+				const size_t failed = link.queue.size();
+
+				for (deque<size_t>::const_iterator i = link.queue.cbegin(); i != link.queue.cend(); i++)
+					*works[*i].error = error;
+
+				link.queue.clear();
+				return failed;
+			}
+		}
+
+		if (!link.receiving)
+			prepareReceive(connection);
+
+		if (link.writing)
+			return 0;
+
+		link.txSize = 0;
+		link.txSent = 0;
+
+		const Clock::time_point deadline = Clock::now() + chrono::milliseconds(link.timeout);
+
+		while (!link.queue.empty() && link.inflight.size() < link.depth)
+		{
+			const size_t index = link.queue.front();
+			const Work& work = works[index];
+			const vector<uint8_t>& pdu = *work.request;
+			const uint16_t transaction = ++link.transactionID;
+			const uint16_t length = (uint16_t)(pdu.size() + 1);
+			uint8_t* adu = link.tx + link.txSize;
+
+			link.queue.pop_front();
+
+			adu[0] = (uint8_t)(transaction >> 8);
+			adu[1] = (uint8_t)transaction;
+			adu[2] = (uint8_t)(ProtocolID >> 8);
+			adu[3] = (uint8_t)ProtocolID;
+			adu[4] = (uint8_t)(length >> 8);
+			adu[5] = (uint8_t)length;
+			adu[6] = work.id;
+			memcpy(adu + TcpMaster::MBAPHeaderSize, pdu.data(), pdu.size());
+
+			link.txSize += TcpMaster::MBAPHeaderSize + pdu.size();
+
+			Pending pending;
+			pending.transaction = transaction;
+			pending.work = index;
+			pending.deadline = deadline;
+			link.inflight.push_back(pending);
+		}
+
+		if (link.txSize != 0)
+			prepareWrite(connection);
+
+		return 0;
+	}
+
+	/**
+	* Start multishot receive into provided buffers. It produces completion
+	* for each received chunk until connection is closed or buffers are
+	* exhausted.
+	**/
+	void UringTcp::prepareReceive(Connection connection)
+	{
+		Link& link = links[connection];
+		io_uring_sqe* sqe = getSQE();
+
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = link.socket.Handle();
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BufferGroup;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->user_data = userData(Operation::Receive, link.generation, connection);
+
+		link.receiving = true;
+	}
+
+	/**
+	* Send unsent part of send buffer.
+	**/
+	void UringTcp::prepareWrite(Connection connection)
+	{
+		Link& link = links[connection];
+		io_uring_sqe* sqe = getSQE();
+
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = link.socket.Handle();
+		sqe->addr = (uint64_t)(uintptr_t)(link.tx + link.txSent);
+		sqe->len = (uint32_t)(link.txSize - link.txSent);
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = userData(Operation::Write, link.generation, connection);
+
+
+		link.writing = true;
+	}
+
+	/**
+	* Process completion.
+	**/
+	size_t UringTcp::complete(const io_uring_cqe& cqe, vector<Work>& works)
+	{
+		const Operation operation = (Operation)(cqe.user_data >> 56);
+		const uint32_t generation = (uint32_t)(cqe.user_data >> 32) & 0xFFFFFF;
+		const Connection connection = (Connection)cqe.user_data;
+		Link& link = links[connection];
+
+		/**
+		 * Completion of request of closed socket
+		 **/
+		const bool current = generation == (link.generation & 0xFFFFFF);
+
+		if (operation == Operation::Receive)
+		{
+			if (cqe.flags & IORING_CQE_F_BUFFER)
+			{
+				const uint16_t buffer = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+				if (current && cqe.res > 0)
+				{
+					const uint8_t* data = rxArea.data() + (size_t)buffer * settings.bufferSize;
+					link.rx.insert(link.rx.end(), data, data + cqe.res);
+				}
+
+				recycle(buffer);
+			}
+
+			if (!current)
+				return 0;
+
+			if (!(cqe.flags & IORING_CQE_F_MORE))
+				link.receiving = false;
+
+			if (cqe.res > 0)
+				return parse(connection, works);
+
+			/**
+			 * Out of buffers: receive is started again by next fill.
+			 **/
+			if (cqe.res == -ENOBUFS)
+				return 0;
+
+			if (cqe.res == 0)
+				return fail(connection, works, make_exception_ptr(runtime_error("Connection closed by remote side")));
+
+			return fail(connection, works, make_exception_ptr(runtime_error("Socket receive failed")));
+		}
+
+		if (!current)
+			return 0;
+
+		if (cqe.res < 0)
+			return fail(connection, works, make_exception_ptr(runtime_error("Socket send failed")));
+
+		link.txSent += cqe.res;
+		if (link.txSent < link.txSize)
+		{
+			prepareWrite(connection);
+			return 0;
+		}
+
+		link.writing = false;
+
+		/**
+		 * Broadcasts are done when written.
+		 **/
+		size_t done = 0;
+		for (vector<Pending>::iterator i = link.inflight.begin(); i != link.inflight.end();)
+		{
+			if (works[i->work].responce == nullptr)
+			{
+				i = link.inflight.erase(i);
+				done++;
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		return done;
+	}
+
+	/**
+	* Parse received ADUs and complete matching requests.
+	**/
+	size_t UringTcp::parse(Connection connection, vector<Work>& works)
+	{
+		Link& link = links[connection];
+		size_t done = 0;
+		size_t pos = 0;
+
+		while (link.rx.size() - pos >= (size_t)TcpMaster::MBAPHeaderSize)
+		{
+			const uint8_t* adu = link.rx.data() + pos;
+			const uint16_t transaction = ((uint16_t)adu[0] << 8) | adu[1];
+			const uint16_t protocol = ((uint16_t)adu[2] << 8) | adu[3];
+			const uint16_t length = ((uint16_t)adu[4] << 8) | adu[5];
+			const uint8_t id = adu[6];
+
+			if (protocol != ProtocolID || length < 2 || length > Master::PDU_MAX_SIZE + 1)
+			{
+				/**
+				 * Stream is out of sync.
+				 **/
+				exception_ptr error = make_exception_ptr(EPDUFrameError(vector<uint8_t>(),
+					vector<uint8_t>(adu, adu + TcpMaster::MBAPHeaderSize)));
+
+				return done + fail(connection, works, error);
+			}
+
+			if (link.rx.size() - pos < 6 + (size_t)length)
+				break;
+
+			/**
+			 * Responces of timed out requests are skipped.
+			 **/
+			for (vector<Pending>::iterator i = link.inflight.begin(); i != link.inflight.end(); i++)
+			{
+				const Work& work = works[i->work];
+
+				if (i->transaction == transaction && work.responce != nullptr && work.id == id)
+				{
+					work.responce->assign(adu + TcpMaster::MBAPHeaderSize, adu + 6 + length);
+					link.inflight.erase(i);
+					done++;
+					break;
+				}
+			}
+
+			pos += 6 + length;
+		}
+
+		link.rx.erase(link.rx.begin(), link.rx.begin() + pos);
+		return done;
+	}
+
+	/**
+	* Close link socket and fail requests in flight. Queued requests stay
+	* and are sent after connection is opened again.
+	**/
+	size_t UringTcp::fail(Connection connection, vector<Work>& works, exception_ptr error)
+	{
+		Link& link = links[connection];
+		const size_t failed = link.inflight.size();
+
+		for (vector<Pending>::const_iterator i = link.inflight.cbegin(); i != link.inflight.cend(); i++)
+			*works[i->work].error = error;
+
+		link.inflight.clear();
+		close(link);
+
+		return failed;
+	}
+
+	/**
+	* Fail expired requests.
+	**/
+	size_t UringTcp::expire(Connection connection, vector<Work>& works, Clock::time_point now)
+	{
+		vector<Pending>& inflight = links[connection].inflight;
+		size_t expired = 0;
+
+		for (vector<Pending>::iterator i = inflight.begin(); i != inflight.end();)
+		{
+			if (i->deadline <= now)
+			{
+				*works[i->work].error = make_exception_ptr(ETimeout());
+				i = inflight.erase(i);
+				expired++;
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		return expired;
+	}
+
+	void UringTcp::open(Link& link)
+	{
+		link.socket.Connect(link.host, link.port, link.timeout);
+		link.socket.SetNoDelay(true);
+		link.socket.SetNonBlocking(true);
+	}
+
+	/**
+	* Close socket. Requests of ring still hold it until they complete,
+	* shutdown makes them complete at once.
+	**/
+	void UringTcp::close(Link& link)
+	{
+		if (link.socket.IsValid())
+		{
+			shutdown(link.socket.Handle(), SHUT_RDWR);
+			link.socket.Close();
+		}
+
+		link.generation++;
+		link.receiving = false;
+		link.writing = false;
+		link.rx.clear();
+	}
+
+	/**
+	* Get free submission queue entry. Kernel reads entries only in
+	* io_uring_enter of this thread, so entry is published before it is
+	* filled by caller.
+	**/
+	io_uring_sqe* UringTcp::getSQE()
+	{
+		while (*sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+		{
+			enter(0, nullptr);
+		}
+
+		const unsigned tail = *sqTail;
+		io_uring_sqe* sqe = &sqes[tail & sqMask];
+
+		memset(sqe, 0, sizeof(*sqe));
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+		return sqe;
+	}
+
+	/**
+	* Submit prepared entries and wait for minComplete completions or
+	* deadline.
+	**/
+	void UringTcp::enter(unsigned minComplete, const Clock::time_point* deadline)
+	{
+		const unsigned toSubmit = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+		unsigned flags = minComplete != 0 ? IORING_ENTER_GETEVENTS : 0;
+		io_uring_getevents_arg arg;
+		__kernel_timespec ts;
+		void* argp = nullptr;
+		size_t argSize = 0;
+
+		if (deadline != nullptr)
+		{
+			const int64_t ns = max<int64_t>(0,
+				chrono::duration_cast<chrono::nanoseconds>(*deadline - Clock::now()).count());
+
+			ts.tv_sec = ns / 1000000000;
+			ts.tv_nsec = ns % 1000000000;
+
+			memset(&arg, 0, sizeof(arg));
+			arg.sigmask_sz = _NSIG / 8;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+
+			flags |= IORING_ENTER_EXT_ARG;
+			argp = &arg;
+			argSize = sizeof(arg);
+		}
+
+		if (toSubmit == 0 && minComplete == 0)
+			return;
+
+		statistic.enters++;
+
+		if (io_uring_enter(ring, toSubmit, minComplete, flags, argp, argSize) < 0)
+		{
+			/**
+			 * Timeout, signal or full completion queue: caller processes
+			 * completions and checks deadlines.
+			 **/
+			if (errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				throw runtime_error("io_uring enter failed");
+			}
+		}
+	}
+
+	/**
+	* Return receive buffer to ring.
+	**/
+	void UringTcp::recycle(uint16_t buffer)
+	{
+		/**
+		 * Ring is array of io_uring_buf with tail in first entry. bufs
+		 * member is not used: in C++ it is placed after empty struct.
+		 **/
+		io_uring_buf& buf = ((io_uring_buf*)bufferRing)[bufferTail & bufferMask];
+
+		buf.addr = (uint64_t)(uintptr_t)(rxArea.data() + (size_t)buffer * settings.bufferSize);
+		buf.len = settings.bufferSize;
+		buf.bid = buffer;
+
+		bufferTail++;
+		__atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+	}
+
+	uint64_t UringTcp::userData(Operation operation, uint32_t generation, Connection connection)
+	{
+		return ((uint64_t)operation << 56) | ((uint64_t)(generation & 0xFFFFFF) << 32) | connection;
+	}
+
+	UringTcpMaster::UringTcpMaster(UringTcp& uring, const string& host, uint16_t port, unsigned timeout)
+		: uring(uring), connection(uring.Connect(host, port, timeout))
+	{
+	}
+
+	UringTcpMaster::~UringTcpMaster()
+	{
+	}
+
+	void UringTcpMaster::SetTimeout(unsigned timeout)
+	{
+		uring.SetTimeout(connection, timeout);
+	}
+
+	void UringTcpMaster::SetPipelineDepth(unsigned depth)
+	{
+		uring.SetPipelineDepth(connection, depth);
+	}
+
+	UringTcp::Connection UringTcpMaster::GetConnection() const
+	{
+		return connection;
+	}
+
+	vector<uint8_t> UringTcpMaster::SendPDU(uint8_t id, vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		vector<Transaction> transactions(1);
+		transactions[0].id = id;
+		transactions[0].request = move(request);
+
+		uring.Execute(connection, transactions);
+
+		if (transactions[0].error)
+			rethrow_exception(transactions[0].error);
+
+		return move(transactions[0].responce);
+	}
+
+	void UringTcpMaster::SendPDU(vector<uint8_t> request)
+	{
+		if (request.size() > PDU_MAX_SIZE)
+		{
+			throw logic_error("PDU size is more than maximum size.");
+		}
+
+		uring.Broadcast(connection, request);
+	}
+
+	void UringTcpMaster::SendPDUs(vector<Transaction>& transactions)
+	{
+		uring.Execute(connection, transactions);
+	}
+}
+
+#endif	/* __linux__ */
@@ -0,0 +1,326 @@
+/**
+ * Description: MODBUS/TCP transport on Linux io_uring for collectors with
+ *				many connections. Requests of all connections are written
+ *				to rings and submitted with one io_uring_enter, which also
+ *				waits for completions. Responces are received by one
+ *				multishot receive per connection into buffer ring registered
+ *				in kernel, so socket needs no syscalls of its own. Requires
+ *				Linux 6.0 or later.
+ *
+ *				Object is not thread safe: all calls must be done from one
+ *				thread, or serialized by caller.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _URING_TCP_H_
+#define _URING_TCP_H_
+
+#ifdef __linux__
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <string>
+#include <vector>
+#include "Master.h"
+#include "Socket.h"
+#include "Tcp.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace Modbus
+{
+	class UringTcp
+	{
+	public:
+		struct Settings
+		{
+			/**
+			 * Submission queue size. Completion queue is 4 times more.
+			 **/
+			unsigned entries;
+
+			/**
+			 * Maximum number of connections
+			 **/
+			unsigned connections;
+
+			/**
+			 * Maximum pipeline depth of connection. Send buffer of each
+			 * connection holds that number of ADUs.
+			 **/
+			unsigned maxPipelineDepth;
+
+			/**
+			 * Receive buffers shared by all connections. Number of buffers
+			 * is rounded up to power of two.
+			 **/
+			unsigned buffers;
+			unsigned bufferSize;
+
+			Settings() : entries(1024), connections(256), maxPipelineDepth(16),
+				buffers(1024), bufferSize(1024)
+			{
+			}
+		};
+
+		/**
+		 * Connection index
+		 **/
+		typedef unsigned Connection;
+
+		/**
+		 * Transaction with connection it is sent to.
+		 **/
+		struct Job
+		{
+			Connection connection;
+			Master::Transaction transaction;
+		};
+
+		struct Statistic
+		{
+			/**
+			 * Completed transactions(with responce or error)
+			 **/
+			uint64_t transactions;
+
+			/**
+			 * io_uring_enter calls
+			 **/
+			uint64_t enters;
+
+			/**
+			 * Completions processed
+			 **/
+			uint64_t completions;
+		};
+
+		/**
+		 * Exceptions:	runtime_error if io_uring can not be created or
+		 *				kernel does not support required features.
+		 **/
+		explicit UringTcp(const Settings& settings = Settings());
+		~UringTcp();
+
+		/**
+		 * Open connection. Connection is opened again on next request
+		 * after it is broken.
+		 * timeout:		connect and responce timeout, ms
+		 * Exceptions:	ETimeout or runtime_error if connection fails,
+		 *				runtime_error if there are too many connections.
+		 **/
+		Connection Connect(const std::string& host, uint16_t port = TcpMaster::DefaultPort,
+			unsigned timeout = TcpMaster::DefaultTimeout);
+
+		/**
+		 * Close connection and open it again.
+		 **/
+		void Reconnect(Connection connection);
+
+		/**
+		 * Responce timeout of connection, ms.
+		 **/
+		void SetTimeout(Connection connection, unsigned timeout);
+
+		/**
+		 * Number of requests of connection sent without waiting responce.
+		 * Default is 1. Limited by Settings::maxPipelineDepth.
+		 **/
+		void SetPipelineDepth(Connection connection, unsigned depth);
+
+		/**
+		 * Execute transactions of any connections. Requests of one
+		 * connection are sent in order within its pipeline depth, all
+		 * connections work in parallel. Error of transaction(timeout,
+		 * connection failure, frame error) is stored in its error field.
+		 * Exceptions:	invalid_argument if request is empty or more than PDU_MAX_SIZE,
+		 *				out_of_range if connection is invalid.
+		 **/
+		void Execute(std::vector<Job>& jobs);
+		void Execute(Connection connection, std::vector<Master::Transaction>& transactions);
+
+		/**
+		 * Send broadcast PDU(unit ID 0) and wait until it is written.
+		 **/
+		void Broadcast(Connection connection, const std::vector<uint8_t>& request);
+
+		Statistic GetStatistic() const;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * Transaction of Execute. Broadcast has no responce and is
+		 * completed when written.
+		 **/
+		struct Work
+		{
+			Connection connection;
+			uint8_t id;
+			const std::vector<uint8_t>* request;
+			std::vector<uint8_t>* responce;
+			std::exception_ptr* error;
+		};
+
+		struct Pending
+		{
+			uint16_t transaction;
+			size_t work;
+			Clock::time_point deadline;
+		};
+
+		struct Link
+		{
+			std::string host;
+			uint16_t port;
+			unsigned timeout;
+			unsigned depth;
+			Socket socket;
+
+			/**
+			 * Incremented when socket is closed, so completions of
+			 * requests of old socket are ignored.
+			 **/
+			uint32_t generation;
+			uint16_t transactionID;
+			bool receiving;
+			bool writing;
+
+			std::deque<size_t> queue;
+			std::vector<Pending> inflight;
+			std::vector<uint8_t> rx;
+
+			/**
+			 * Send buffer: ADUs of one write
+			 **/
+			uint8_t* tx;
+			size_t txSize;
+			size_t txSent;
+		};
+
+		enum class Operation : uint8_t
+		{
+			Receive = 1,
+			Write = 2
+		};
+
+		UringTcp(const UringTcp&);
+		UringTcp& operator=(const UringTcp&);
+
+		void run(std::vector<Work>& works);
+		void loop(std::vector<Work>& works, const std::vector<Connection>& active, size_t remaining);
+
+		/**
+		 * Send queued requests of link up to its pipeline depth and
+		 * start receive if it is not running. Return number of works
+		 * failed because connection can not be opened.
+		 **/
+		size_t fill(Connection connection, std::vector<Work>& works);
+
+		void prepareReceive(Connection connection);
+		void prepareWrite(Connection connection);
+
+		/**
+		 * Process completion. Return number of completed works.
+		 **/
+		size_t complete(const io_uring_cqe& cqe, std::vector<Work>& works);
+
+		/**
+		 * Parse received ADUs of link. Return number of completed works.
+		 **/
+		size_t parse(Connection connection, std::vector<Work>& works);
+
+		/**
+		 * Close link socket and fail all its requests in flight.
+		 * Return number of failed works.
+		 **/
+		size_t fail(Connection connection, std::vector<Work>& works, std::exception_ptr error);
+
+		/**
+		 * Fail expired requests. Return number of failed works.
+		 **/
+		size_t expire(Connection connection, std::vector<Work>& works, Clock::time_point now);
+
+		void open(Link& link);
+		void close(Link& link);
+		void release();
+		io_uring_sqe* getSQE();
+		void enter(unsigned minComplete, const Clock::time_point* deadline);
+		void recycle(uint16_t buffer);
+
+		static uint64_t userData(Operation operation, uint32_t generation, Connection connection);
+
+		Settings settings;
+		std::vector<Link> links;
+		Statistic statistic;
+
+		/**
+		 * io_uring file descriptor and mapped rings
+		 **/
+		int ring;
+		void* sqRing;
+		size_t sqRingSize;
+		void* cqRing;
+		size_t cqRingSize;
+		io_uring_sqe* sqes;
+		size_t sqesSize;
+
+		unsigned* sqHead;
+		unsigned* sqTail;
+		unsigned sqMask;
+		unsigned sqEntries;
+		unsigned* sqArray;
+		unsigned* cqHead;
+		unsigned* cqTail;
+		unsigned cqMask;
+		io_uring_cqe* cqes;
+
+		/**
+		 * Send buffers of all connections
+		 **/
+		std::vector<uint8_t> txArea;
+
+		/**
+		 * Provided receive buffer ring
+		 **/
+		io_uring_buf_ring* bufferRing;
+		size_t bufferRingSize;
+		unsigned bufferMask;
+		uint16_t bufferTail;
+		std::vector<uint8_t> rxArea;
+	};
+
+	/**
+	 * Master over connection of UringTcp.
+	 **/
+	class UringTcpMaster : public Master
+	{
+	public:
+		/**
+		 * Exceptions:	see UringTcp::Connect
+		 **/
+		UringTcpMaster(UringTcp& uring, const std::string& host, uint16_t port = TcpMaster::DefaultPort,
+			unsigned timeout = TcpMaster::DefaultTimeout);
+		virtual ~UringTcpMaster();
+
+		void SetTimeout(unsigned timeout);
+		void SetPipelineDepth(unsigned depth);
+		UringTcp::Connection GetConnection() const;
+
+	protected:
+		virtual std::vector<uint8_t> SendPDU(uint8_t id, std::vector<uint8_t> request);
+		virtual void SendPDU(std::vector<uint8_t> request);
+		virtual void SendPDUs(std::vector<Transaction>& transactions);
+
+		UringTcp& uring;
+		UringTcp::Connection connection;
+	};
+}
+
+#endif	/* __linux__ */
+
+#endif	/* _URING_TCP_H_ */
@@ -0,0 +1,94 @@
+/**
+* MODBUS master exceptions
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#include "mb_exceptions.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	/**
+	 * PDU frame error
+	 **/
+	EPDUFrameError::EPDUFrameError(vector<uint8_t> request, vector<uint8_t> responce)
+		: request(request), responce(responce)
+	{
+	}
+
+	const char* EPDUFrameError::what() const throw()
+	{
+		return "MODBUS PDU frame error";
+	}
+
+	const vector<uint8_t>& EPDUFrameError::GetRequest() const
+	{
+		return request;
+	}
+
+	const vector<uint8_t>& EPDUFrameError::GetResponce() const
+	{
+		return responce;
+	}
+
+	/**
+	 * Timeout exception
+	 **/
+	const char* ETimeout::what() const throw()
+	{
+		return "MODBUS responce timeout";
+	}
+
+	/**
+	 * Diagnostic exception
+	 **/
+	EDiagnostic::EDiagnostic(vector<uint8_t> requestData, vector<uint8_t> responceData)
+		: requestData(requestData), responceData(responceData)
+	{
+	}
+
+	const char* EDiagnostic::what() const throw()
+	{
+		return "MODBUS diagnostic error";
+	}
+
+	/**
+	 * MODBUS exception code
+	 **/
+	EException::EException(uint8_t ecode) : ecode(ecode)
+	{
+	}
+
+	uint8_t EException::GetExceptionCode() const
+	{
+		return ecode;
+	}
+
+	const char* EException::what() const throw()
+	{
+		switch (ecode)
+		{
+		case ILLEGAL_FUNCTION:
+			return "MODBUS exception: illegal function";
+		case ILLEGAL_DATA_ADDRESS:
+			return "MODBUS exception: illegal data address";
+		case ILLEGAL_DATA_VALUE:
+			return "MODBUS exception: illegal data value";
+		case SERVER_DEVICE_FAILURE:
+			return "MODBUS exception: server device failure";
+		case ACKNOWLEDGE:
+			return "MODBUS exception: acknowledge";
+		case SERVER_DEVICE_BUSY:
+			return "MODBUS exception: server device busy";
+		case MEMORY_PARITY_ERROR:
+			return "MODBUS exception: memory parity error";
+		case GATEWAY_PATH_UNAVIABLE:
+			return "MODBUS exception: gateway path unavailable";
+		case TARGET_DEVICE_FAILED_TO_RESPONCE:
+			return "MODBUS exception: gateway target device failed to respond";
+		default:
+			return "MODBUS exception";
+		}
+	}
+}
@@ -20,6 +20,15 @@ namespace Modbus
 	public:
 		EPDUFrameError(std::vector<uint8_t> request, 
 			std::vector<uint8_t> responce);
+
+		const char* what() const throw();
+
+		const std::vector<uint8_t>& GetRequest() const;
+		const std::vector<uint8_t>& GetResponce() const;
+
+	private:
+		std::vector<uint8_t> request;
+		std::vector<uint8_t> responce;
 	};
 
 	/**
@@ -27,7 +36,8 @@ namespace Modbus
 	 **/
 	class ETimeout : public std::exception
 	{
-
+	public:
+		const char* what() const throw();
 	};
 
 	/**
@@ -38,6 +48,12 @@ namespace Modbus
 	public:
 		EDiagnostic(std::vector<uint8_t> requestData,
 			std::vector<uint8_t> responceData);
+
+		const char* what() const throw();
+
+	private:
+		std::vector<uint8_t> requestData;
+		std::vector<uint8_t> responceData;
 	};
 
 	/**
@@ -49,7 +65,9 @@ namespace Modbus
 	public:
 		EException(uint8_t ecode);
 
-		uint8_t GetExceptionCode();
+		uint8_t GetExceptionCode() const;
+
+		const char* what() const throw();
 
 		/**
 		 * MODBUS standart exception codes.
@@ -63,6 +81,9 @@ namespace Modbus
 		static const uint8_t MEMORY_PARITY_ERROR = 0x08;
 		static const uint8_t GATEWAY_PATH_UNAVIABLE = 0x0A;
 		static const uint8_t TARGET_DEVICE_FAILED_TO_RESPONCE = 0x0B;
+
+	private:
+		uint8_t ecode;
 	};
 }
 
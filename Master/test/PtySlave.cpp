@@ -0,0 +1,130 @@
+/**
+* Simulated MODBUS RTU slave on pseudo terminal pair
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+**/
+#define _XOPEN_SOURCE 600
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cerrno>
+#include <stdexcept>
+#include "PtySlave.h"
+#include "Serial.h"
+
+using namespace std;
+
+namespace Modbus
+{
+	PtySlave::PtySlave(Slave& slave) : slave(slave), master(-1), terminal(-1), stopping(false), mute(false), requests(0)
+	{
+		master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master < 0)
+		{
+			throw runtime_error("Can not create pty.");
+		}
+
+		const char* name = nullptr;
+		if (grantpt(master) != 0 || unlockpt(master) != 0 || (name = ptsname(master)) == nullptr)
+		{
+			close(master);
+			throw runtime_error("Can not create pty.");
+		}
+
+		device = name;
+		terminal = open(name, O_RDWR | O_NOCTTY);
+		if (terminal < 0)
+		{
+			close(master);
+			throw runtime_error("Can not open pty " + device);
+		}
+
+		termios tio;
+		tcgetattr(terminal, &tio);
+		cfmakeraw(&tio);
+		tcsetattr(terminal, TCSANOW, &tio);
+
+		worker = std::thread(&PtySlave::run, this);
+	}
+
+	PtySlave::~PtySlave()
+	{
+		stopping = true;
+		worker.join();
+
+		close(terminal);
+		close(master);
+	}
+
+	const string& PtySlave::Device() const
+	{
+		return device;
+	}
+
+	void PtySlave::SetMute(bool mute)
+	{
+		this->mute = mute;
+	}
+
+	uint64_t PtySlave::Requests() const
+	{
+		return requests;
+	}
+
+	/**
+	* Bytes are collected until 5 ms of silence, then frame is processed.
+	* Poll timeout also lets thread see stopping flag.
+	**/
+	void PtySlave::run()
+	{
+		vector<uint8_t> frame;
+		uint8_t buffer[RtuMaster::ADU_MAX_SIZE];
+
+		while (!stopping)
+		{
+			pollfd pfd = { master, POLLIN, 0 };
+			const int rc = poll(&pfd, 1, 5);
+
+			if (rc > 0)
+			{
+				const ssize_t n = read(master, buffer, sizeof(buffer));
+				if (n > 0)
+				{
+					frame.insert(frame.end(), buffer, buffer + n);
+					continue;
+				}
+			}
+
+			if (rc < 0 && errno != EINTR)
+				break;
+
+			if (!frame.empty())
+			{
+				process(frame);
+				frame.clear();
+			}
+		}
+	}
+
+	void PtySlave::process(const vector<uint8_t>& frame)
+	{
+		if (frame.size() < 4)
+			return;
+
+		const vector<uint8_t> pdu(frame.begin() + 1, frame.end() - 2);
+		if (RtuMaster::EncodeADU(frame[0], pdu) != frame)
+			return;
+
+		requests++;
+		const vector<uint8_t> responce = slave.Process(pdu);
+
+		if (frame[0] == 0 || mute)
+			return;
+
+		const vector<uint8_t> adu = RtuMaster::EncodeADU(frame[0], responce);
+		(void)write(master, adu.data(), adu.size());
+	}
+}
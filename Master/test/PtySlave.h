@@ -0,0 +1,72 @@
+/**
+ * Description: Simulated MODBUS RTU slave on pseudo terminal pair. Slave
+ *				device of pair is opened by master as serial port, and
+ *				thread of PtySlave answers frames on master side of pair
+ *				with Slave, so serial masters are tested without serial
+ *				hardware. Frame ends by 5 ms silence. POSIX only.
+ * Author:		Oleg Gavrilchenko
+ * E-mail:		reffum@bk.ru
+ **/
+#ifndef _PTY_SLAVE_H_
+#define _PTY_SLAVE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Slave.h"
+
+namespace Modbus
+{
+	class PtySlave
+	{
+	public:
+		/**
+		 * Create pty pair and start thread. All unit IDs are served by
+		 * slave; requests to unit 0 are processed without responce.
+		 * Exceptions:	runtime_error if pty can not be created.
+		 **/
+		explicit PtySlave(Slave& slave);
+		~PtySlave();
+
+		/**
+		 * Device of pty to open as serial port.
+		 **/
+		const std::string& Device() const;
+
+		/**
+		 * Mute slave receives requests but does not answer.
+		 **/
+		void SetMute(bool mute);
+
+		/**
+		 * Received frames with valid CRC.
+		 **/
+		uint64_t Requests() const;
+
+	private:
+		PtySlave(const PtySlave&);
+		PtySlave& operator=(const PtySlave&);
+
+		void run();
+		void process(const std::vector<uint8_t>& frame);
+
+		Slave& slave;
+		int master;
+
+		/**
+		 * Slave side is kept open, otherwise master side reads fail
+		 * while port is closed.
+		 **/
+		int terminal;
+		std::string device;
+
+		std::atomic<bool> stopping;
+		std::atomic<bool> mute;
+		std::atomic<uint64_t> requests;
+		std::thread worker;
+	};
+}
+
+#endif	/* _PTY_SLAVE_H_ */
@@ -0,0 +1,194 @@
+/**
+* Test of SerialLines over pty pairs
+* Author	Oleg Gavrilchenko
+* E-mail	reffum@bk.ru
+*
+* POSIX only. Build from Master directory:
+*	g++ -std=c++11 -Isrc test/SerialLinesTest.cpp test/PtySlave.cpp
+*		src/SerialLines.cpp src/Serial.cpp src/Slave.cpp src/Master.cpp
+*		src/LowLatency.cpp src/mb_exceptions.cpp -pthread -o SerialLinesTest
+* Returns 0 if all checks pass.
+**/
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "PtySlave.h"
+#include "SerialLines.h"
+#include "mb_exceptions.h"
+
+using namespace std;
+using namespace Modbus;
+
+static int failures = 0;
+
+static void check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+/**
+* Error stored in transaction is of type E.
+**/
+template <class E>
+static bool is_error(const Master::Transaction& transaction)
+{
+	if (!transaction.error)
+		return false;
+
+	try
+	{
+		rethrow_exception(transaction.error);
+	}
+	catch (const E&)
+	{
+		return true;
+	}
+	catch (...)
+	{
+	}
+
+	return false;
+}
+
+static Master::Transaction read_registers(uint8_t id, uint16_t addr, uint16_t quantity)
+{
+	Master::Transaction transaction;
+	transaction.id = id;
+	transaction.request.push_back((uint8_t)Master::FunctionCodes::ReadHoldingRegisters);
+	transaction.request.push_back((uint8_t)(addr >> 8));
+	transaction.request.push_back((uint8_t)addr);
+	transaction.request.push_back((uint8_t)(quantity >> 8));
+	transaction.request.push_back((uint8_t)quantity);
+	return transaction;
+}
+
+int main()
+{
+	static const unsigned Lines = 3;
+	static const unsigned Transactions = 10;
+
+	vector<unique_ptr<Slave>> slaves;
+	vector<unique_ptr<PtySlave>> ptys;
+
+	SerialPort::Settings port;
+	port.baudRate = 115200;
+
+	SerialLines::Settings settings;
+	settings.timeout = 100;
+	settings.turnaroundDelay = 10;
+
+	SerialLines lines;
+
+	for (unsigned line = 0; line < Lines; line++)
+	{
+		slaves.push_back(unique_ptr<Slave>(new Slave()));
+		for (unsigned addr = 0; addr < 100; addr++)
+			slaves[line]->SetHoldingRegister((uint16_t)addr, (uint16_t)(line * 1000 + addr));
+
+		ptys.push_back(unique_ptr<PtySlave>(new PtySlave(*slaves[line])));
+		check(lines.Open(ptys[line]->Device(), port, settings) == line, "line index");
+	}
+
+	/**
+	 * Transactions of all lines in one call
+	 **/
+	vector<SerialLines::Job> jobs;
+	for (unsigned i = 0; i < Transactions; i++)
+	{
+		for (unsigned line = 0; line < Lines; line++)
+		{
+			SerialLines::Job job;
+			job.line = line;
+			job.transaction = read_registers(1, (uint16_t)i, 2);
+			jobs.push_back(job);
+		}
+	}
+
+	lines.Execute(jobs);
+
+	for (vector<SerialLines::Job>::const_iterator i = jobs.cbegin(); i != jobs.cend(); i++)
+	{
+		const vector<uint8_t>& responce = i->transaction.responce;
+		const uint16_t expected = (uint16_t)(i->line * 1000 + i->transaction.request[2]);
+
+		check(!i->transaction.error, "transaction error");
+		check(responce.size() == 6 && responce[1] == 4 && (responce[2] << 8 | responce[3]) == expected, "responce");
+	}
+
+	/**
+	 * Master over line, exception responce and broadcast
+	 **/
+	SerialLineMaster master(lines, 1);
+	check(master.ReadHoldingRegisters(1, 5, 1).at(0) == 1005, "master read");
+
+	try
+	{
+		master.ReadHoldingRegisters(1, 0xFFFF, 2);
+		check(false, "exception responce");
+	}
+	catch (const EException& e)
+	{
+		check(e.GetExceptionCode() == EException::ILLEGAL_DATA_ADDRESS, "exception code");
+	}
+
+	master.WriteSingleRegister(Master::IDBroadcast, 10, 0x1234);
+	check(slaves[1]->GetHoldingRegister(10) == 0x1234, "broadcast");
+
+	/**
+	 * Mute line times out, other lines are not delayed by it.
+	 **/
+	ptys[2]->SetMute(true);
+	jobs.clear();
+	for (unsigned line = 0; line < Lines; line++)
+	{
+		SerialLines::Job job;
+		job.line = line;
+		job.transaction = read_registers(1, 0, 1);
+		jobs.push_back(job);
+	}
+
+	lines.Execute(jobs);
+	check(!jobs[0].transaction.error && !jobs[1].transaction.error, "lines next to mute line");
+	check(is_error<ETimeout>(jobs[2].transaction), "timeout");
+	check(lines.GetStatistic(2).timeouts == 1, "timeout statistic");
+	ptys[2]->SetMute(false);
+
+	/**
+	 * poll() fails with EINVAL when it gets more descriptors than
+	 * RLIMIT_NOFILE. Pending transactions must fail instead of hang.
+	 **/
+	rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	rlimit low = limit;
+	low.rlim_cur = 1;
+	setrlimit(RLIMIT_NOFILE, &low);
+
+	for (vector<SerialLines::Job>::iterator i = jobs.begin(); i != jobs.end(); i++)
+		i->transaction = read_registers(1, 0, 1);
+
+	lines.Execute(jobs);
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	for (vector<SerialLines::Job>::const_iterator i = jobs.cbegin(); i != jobs.cend(); i++)
+		check(is_error<runtime_error>(i->transaction), "poll failure");
+
+	/**
+	 * Lines work again after failure. Slaves got the failed requests,
+	 * so next request waits until they answer, otherwise PtySlave takes
+	 * both requests as one frame.
+	 **/
+	this_thread::sleep_for(chrono::milliseconds(50));
+	check(master.ReadHoldingRegisters(1, 7, 1).at(0) == 1007, "read after poll failure");
+
+	printf(failures == 0 ? "SerialLines test passed\n" : "SerialLines test failed\n");
+	return failures == 0 ? 0 : 1;
+}